@@ -1,8 +1,12 @@
 #!/bin/sh
 
 mkdir -p bin
-gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/test_cholesky.c src/utils.c src/cholesky.c -o bin/test_cholesky
-gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/solver.c src/circuits.c src/utils.c src/cholesky.c -o bin/circuit_solver
-gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/meshgen.c -o bin/meshgen
-gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/meshsolve.c src/circuits.c src/utils.c src/cholesky.c -o bin/meshsolve
-gcc -O2 -Wall -Wextra -pedantic -std=c89 src/finite_difference.c -o bin/finite_difference
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/test_cholesky.c src/utils.c src/cholesky.c src/timer.c src/perf.c -o bin/test_cholesky -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/test_pcg.c src/resistance.c src/circuits.c src/outofcore.c src/schur.c src/lattice.c src/stencil.c src/utils.c src/cholesky.c src/sparse.c src/pcg.c src/operator.c src/multigrid.c src/timer.c src/perf.c -o bin/test_pcg -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/test_fdmultigrid.c src/fdgrid.c src/fdmultigrid.c src/utils.c src/timer.c src/perf.c -o bin/test_fdmultigrid -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/solver.c src/circuits.c src/outofcore.c src/schur.c src/utils.c src/cholesky.c src/sparse.c src/pcg.c src/operator.c src/multigrid.c src/timer.c src/perf.c -o bin/circuit_solver -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/meshgen.c src/lattice.c src/circuits.c src/outofcore.c src/schur.c src/utils.c src/cholesky.c src/sparse.c src/pcg.c src/operator.c src/multigrid.c src/timer.c src/perf.c -o bin/meshgen -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/meshsolve.c src/lattice.c src/stencil.c src/circuits.c src/outofcore.c src/schur.c src/utils.c src/cholesky.c src/sparse.c src/pcg.c src/operator.c src/multigrid.c src/timer.c src/perf.c -o bin/meshsolve -lm -pthread
+gcc -O3 -Wall -Wextra -pedantic -std=c89 -Iinclude src/finite_difference.c src/fdgrid.c src/fdmultigrid.c src/fdgeometry.c src/fdquadtree.c src/fdsweep.c src/fdcheckpoint.c src/perf.c src/timer.c src/utils.c -o bin/finite_difference -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/equivalent_resistance.c src/resistance.c src/circuits.c src/outofcore.c src/schur.c src/utils.c src/cholesky.c src/sparse.c src/pcg.c src/operator.c src/multigrid.c src/timer.c src/perf.c -o bin/equivalent_resistance -lm -pthread
+gcc -O2 -Wall -Wextra -pedantic -std=c89 -Iinclude src/benchmark.c src/lattice.c src/stencil.c src/circuits.c src/outofcore.c src/schur.c src/utils.c src/cholesky.c src/sparse.c src/pcg.c src/operator.c src/multigrid.c src/timer.c src/perf.c -o bin/benchmark -lm -pthread
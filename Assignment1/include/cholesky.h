@@ -29,4 +29,60 @@ int cholesky_solve_system(struct Vector **xp, const struct Matrix *A, const stru
 /* This is the same except it also include half bandwidth hb to speed up computations for question 2. */
 int cholesky_solve_system_banded(struct Vector **xp, const struct Matrix *A, const struct Vector *b, struct Matrix **Lp, size_t hb);
 
+/* Cholesky factor
+ *
+ * Factors a real symmetric positive-definite matrix into L*L^T in place,
+ * for when the factorization and the solves are done separately.
+ * Only the lower half of the result holds L.
+ *
+ * Parameters:
+ * A - n x n matrix, overwritten with L
+ * hb - half bandwidth of A, or 0 if A is not banded
+ *
+ * Returns:
+ * 0 if operation successful
+ * -1 if A is not symmetric positive-definite.
+ */
+int cholesky_factor(struct Matrix *A, size_t hb);
+
+/* Solve (LL^T)x = b in place with a factor from cholesky_factor. x holds b on entry. */
+void cholesky_solve_factored(const struct Matrix *L, double *x);
+
+/* Cholesky factor band
+ *
+ * Factors a symmetric positive-definite band matrix into L*L^T in place,
+ * row by row. L has the same half bandwidth as A, so the factorization
+ * needs no storage beyond the band itself. Once factored, the matrix can
+ * be used for any number of solves with cholesky_solve_band.
+ *
+ * Returns:
+ * 0 if operation successful
+ * -1 if A is not positive-definite (A is left partially factored).
+ */
+int cholesky_factor_band(struct BandMatrix *A);
+
+/* Solve (LL^T)x = b in place with a factor from cholesky_factor_band,
+ * by forward elimination and back substitution. x holds b on entry. */
+void cholesky_solve_band(const struct BandMatrix *L, double *x);
+
+/* Cholesky band row kernels
+ *
+ * The band factorization and substitutions above, on rows that need not
+ * be contiguous: rows[i - base] points to the hb entries of row i, laid
+ * out as one row of a BandMatrix. This lets the band be processed a panel
+ * of rows at a time, e.g. out of core.
+ *
+ * cholesky_factor_band_rows factors rows first ... last - 1; the hb - 1
+ * rows before first must already be factored and present. It returns 0,
+ * or -1 if the matrix is not positive-definite.
+ *
+ * cholesky_forward_band_rows solves Ly = b for rows first ... last - 1,
+ * given y for the rows before first. cholesky_backward_band_rows applies
+ * columns last - 1 down to first of (L^T)x = y. Both work in place on x,
+ * and only need the rows they process.
+ */
+int cholesky_factor_band_rows(double *const *rows, size_t base, size_t hb, size_t first, size_t last);
+void cholesky_forward_band_rows(const double *const *rows, size_t base, size_t hb, size_t first, size_t last, double *x);
+void cholesky_backward_band_rows(const double *const *rows, size_t base, size_t hb, size_t first, size_t last, double *x);
+
 #endif
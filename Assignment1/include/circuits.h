@@ -1,6 +1,12 @@
 #ifndef CIRCUITS_H
 #define CIRCUITS_H
 
+#include <stdio.h>
+
+#include "multigrid.h"
+#include "pcg.h"
+#include "schur.h"
+#include "sparse.h"
 #include "utils.h"
 
 /* Contains the description of a circuit in terms
@@ -14,13 +20,151 @@ struct CircuitDescription {
 	struct Vector *E;
 };
 
+/* A circuit as a list of branches. Nodes are numbered 0 to nnodes - 1,
+ * with node 0 the ground node; node k > 0 is row k - 1 of the reduced
+ * incidence matrix. Branch j leaves node from[j] and enters node to[j]
+ * (the +1 and -1 of its incidence column), and has current source J[j],
+ * resistance R[j] and voltage source E[j], as in the circuit files.
+ * Unlike CircuitDescription, the storage is O(nbranches). */
+struct BranchList {
+	size_t *from;
+	size_t *to;
+	double *J;
+	double *R;
+	double *E;
+	size_t nnodes;
+	size_t nbranches;
+};
+
+/* Linear solvers available for the nodal equations (AYA^T)V = A(J - YE). */
+enum CircuitSolverMethod {
+	CIRCUIT_SOLVER_AUTO = 0,	/* Pick one of the others from the size and sparsity of AYA^T */
+	CIRCUIT_SOLVER_DENSE,		/* Dense Cholesky */
+	CIRCUIT_SOLVER_BANDED,		/* Banded Cholesky in band storage, half bandwidth taken from the matrix */
+	CIRCUIT_SOLVER_PCG,		/* Preconditioned conjugate gradient on the sparse matrix */
+	CIRCUIT_SOLVER_MULTIGRID,	/* Multigrid V-cycles, for lattice circuits */
+	CIRCUIT_SOLVER_SCHUR		/* Schur complement domain decomposition, subdomains factored in parallel */
+};
+
+/* Above this many nodes the automatic policy prefers PCG, since the direct
+ * solvers need O(n hb) to O(n^2) storage for the factor of AYA^T. */
+#define CIRCUIT_AUTO_DIRECT_MAX_NODES	1000
+
+struct CircuitSolverOptions {
+	enum CircuitSolverMethod method;
+	struct PCGOptions pcg;		/* Used when method is CIRCUIT_SOLVER_PCG */
+	struct MultigridOptions multigrid;	/* Used by CIRCUIT_SOLVER_MULTIGRID and the multigrid preconditioner */
+	size_t band_memory;		/* Bytes the banded solver may hold in memory, 0 for no limit.
+					 * Larger bands are factored out of core, see outofcore.h */
+	struct SchurOptions schur;	/* Used when method is CIRCUIT_SOLVER_SCHUR */
+};
+
+struct CircuitSolverStats {
+	enum CircuitSolverMethod method;	/* Method actually used */
+	size_t nnodes;
+	size_t nnz;			/* Nonzeros in AYA^T */
+	size_t half_bandwidth;
+	unsigned int iterations;	/* PCG iterations or multigrid cycles, 0 for direct methods */
+	size_t subdomains;		/* Subdomains of the Schur solver, 0 for the other methods */
+	double residual_norm;		/* ||A(J - YE) - (AYA^T)V|| */
+	double assemble_time;		/* Seconds spent building AYA^T and A(J - YE) */
+	double factor_time;		/* Seconds spent factoring, or building the preconditioner or hierarchy */
+	double solve_time;		/* Seconds spent in substitutions or iterations */
+};
+
 /* Fill out a CircuitDescription from an input file. */
 int circuits_parse_file(struct CircuitDescription *circuit, const char *filename);
 
+/* Branch list operations */
+struct BranchList *BranchList_new(size_t nnodes, size_t nbranches);
+void BranchList_delete(struct BranchList *branches);
+
+/* Convert the incidence matrix form into a branch list. Returns -1 if a column of A is not a valid branch. */
+int circuits_to_branches(const struct CircuitDescription *circuit, struct BranchList **branchesp);
+
+/* Write a branch list in the circuit file format read by circuits_parse_file.
+ * The incidence matrix is dense, so the output has O(nnodes * nbranches) characters.
+ * Returns -1 on a write error. */
+int circuits_write_branches(FILE *filePtr, const struct BranchList *branches);
+
+/* Branch list files, for circuits too large for the incidence matrix.
+ *
+ * The text form is a line "branches <nnodes> <nbranches>", with nnodes
+ * counting ground, then a line "<from> <to> <J> <R> <E>" per branch.
+ *
+ * The binary form is a header of BRANCH_HEADER_SIZE bytes: the magic
+ * BRANCH_MAGIC, nnodes and nbranches as 8 byte little-endian integers and
+ * the double 1.0; then a record of BRANCH_RECORD_SIZE bytes per branch:
+ * from and to as 4 byte little-endian integers, then J, R and E. Doubles
+ * are IEEE 754 in the byte order of the writer, which the 1.0 of the
+ * header lets a reader check. Node numbers must fit in 32 bits.
+ */
+enum BranchFileFormat {
+	BRANCH_FILE_INCIDENCE = 0,	/* The circuit file format of circuits_parse_file */
+	BRANCH_FILE_TEXT,
+	BRANCH_FILE_BINARY
+};
+
+#define BRANCH_MAGIC		"CIRCBRL1"
+#define BRANCH_HEADER_SIZE	32
+#define BRANCH_RECORD_SIZE	32
+#define BRANCH_TEXT_MAX		128	/* Longest header or branch line of the text form */
+
+/* Format the header or one branch of a text or binary branch list into
+ * buffer, which must hold BRANCH_TEXT_MAX bytes. Returns the number of
+ * bytes, without a terminating null. These do not allocate and may be
+ * called from any thread. */
+size_t circuits_format_branch_header(char *buffer, enum BranchFileFormat format, size_t nnodes, size_t nbranches);
+size_t circuits_format_branch(char *buffer, enum BranchFileFormat format, size_t from, size_t to, double J, double R, double E);
+
+/* Write a branch list in any of the formats. Returns -1 on a write error,
+ * or if the nodes do not fit in the binary form. */
+int circuits_write_branch_file(FILE *filePtr, const struct BranchList *branches, enum BranchFileFormat format);
+
+/* Read a circuit file in any of the formats, told apart by their first
+ * bytes. Returns -1 if the file cannot be read or is not valid. */
+int circuits_read_branches(const char *filename, struct BranchList **branchesp);
+
 /* Solve for the node voltages in a circuit described by CircuitDescription. */
 struct Vector *circuits_solve_voltages(const struct CircuitDescription *circuit);
 struct Vector *circuits_solve_voltages_banded(const struct CircuitDescription *circuit, size_t hb);
 
+/* Assemble the nodal matrix AYA^T in sparse form and the source vector A(J - YE),
+ * one branch at a time. Returns -1 if a column of A is not a valid branch. */
+int circuits_build_nodal_sparse(const struct CircuitDescription *circuit, struct SparseMatrix **Mp, struct Vector **bp);
+
+/* Assemble the conductance matrix of the passive part of the circuit, i.e. of
+ * the branches with no current or voltage source (J = E = 0). Branches with a
+ * source are taken to be the external test circuit and are left out.
+ * Returns -1 if a column of A is not a valid branch. */
+int circuits_build_passive_sparse(const struct CircuitDescription *circuit, struct SparseMatrix **Gp);
+
+/* Same as the two functions above, straight from a branch list. */
+void circuits_build_nodal_branches(const struct BranchList *branches, struct SparseMatrix **Mp, struct Vector **bp);
+void circuits_build_passive_branches(const struct BranchList *branches, struct SparseMatrix **Gp);
+
+/* Default options: automatic method selection with the default PCG options. */
+void circuits_default_options(struct CircuitSolverOptions *options);
+
+/* Parse a solver name ("auto", "dense", "banded", "mg", "pcg", "pcg-none", "pcg-jacobi",
+ * "pcg-ssor", "pcg-ic0", "pcg-mg") into options. Returns -1 if the name is unknown.
+ * "banded-ooc" is the banded solver with the default out-of-core memory budget,
+ * and "banded-ooc=<MB>" the same with a budget of MB megabytes. "schur" is
+ * the Schur complement solver with one subdomain per CPU, "schur=<k>" with k. */
+int circuits_parse_method(struct CircuitSolverOptions *options, const char *name);
+
+/* Name of a solver method, for reports. */
+const char *circuits_method_name(enum CircuitSolverMethod method);
+
+/* The method CIRCUIT_SOLVER_AUTO resolves to for a nodal matrix. */
+enum CircuitSolverMethod circuits_choose_method(const struct SparseMatrix *M);
+
+/* Solve for the node voltages with the method chosen in options.
+ * If stats is not NULL it receives the method used and the residual.
+ * Returns NULL if the system could not be solved. */
+struct Vector *circuits_solve_voltages_with(const struct CircuitDescription *circuit, const struct CircuitSolverOptions *options, struct CircuitSolverStats *stats);
+struct Vector *circuits_solve_branches_with(const struct BranchList *branches, const struct CircuitSolverOptions *options, struct CircuitSolverStats *stats);
+
 /* Release memory allocated internally for CircuitDescription. */
 void circuits_destroy(struct CircuitDescription *circuit);
 
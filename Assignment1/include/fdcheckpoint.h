@@ -0,0 +1,102 @@
+#ifndef FDCHECKPOINT_H
+#define FDCHECKPOINT_H
+
+#include "fdgrid.h"
+
+/* fdcheckpoint.h
+ * Relaxation of the coax grid in a memory-mapped file, with checkpoints
+ * from which a killed run can resume.
+ *
+ * The file is a header of FD_CHECKPOINT_OFFSET bytes followed by two
+ * slots of nodes, each row after row as in memory, so the kernels sweep
+ * the file itself and the operating system pages it. The header names the
+ * slot of the last checkpoint, which is left alone. Each run of the
+ * kernel, interval iterations, starts from a copy of it in the other slot.
+ * After the run the solve forces that slot to the file, and only then the
+ * header, switched to it, with the iterations done, the norm of the
+ * residual and whether it is below r. The header is smaller than a disk
+ * sector, so it reaches the disk whole or not at all, and always names
+ * nodes that are on disk as well: a killed run resumes from exactly the
+ * iterate of its last checkpoint. The price is a file of two grids and a
+ * copy of the grid on each run.
+ *
+ * The kernels test the residual of their updates, which trails that of
+ * the nodes they leave, so a run that passes its test may still leave a
+ * residual a little above r. The solve only ends once the residual of the
+ * nodes, in the norm of the options, is below r, and otherwise runs the
+ * kernel again with its r lowered by as much as its test fell short.
+ *
+ * The file records the machine's own types, so it is only read back on a
+ * machine like the one that wrote it.
+ */
+
+/* Bytes before the first slot, a multiple of FD_ALIGN */
+#define FD_CHECKPOINT_OFFSET	4096
+
+/* Automatic interval: iterations of the first run, and the share of the
+ * time the checkpoints are held to after it */
+#define FD_CHECKPOINT_FIRST	100
+#define FD_CHECKPOINT_SHARE	0.01
+
+enum FDCheckpointMethod {
+	FD_CHECKPOINT_SOR = 0,		/* fd_red_black_sor */
+	FD_CHECKPOINT_JACOBI		/* fd_jacobi */
+};
+
+struct FDCheckpointHeader {
+	char magic[8];
+	int method;			/* enum FDCheckpointMethod */
+	int norm;			/* enum FDNorm */
+	int complete;			/* Nonzero once the residual is below r */
+	int slot;			/* Slot of the last checkpoint, 0 or 1 */
+	unsigned long N;
+	unsigned long stride;
+	unsigned long inner_x;
+	unsigned long inner_y;
+	double h;
+	double w;
+	double r;
+	unsigned int check_interval;
+	unsigned int time_block;
+	unsigned long iterations;	/* Done at the last checkpoint */
+	double residual;		/* Norm of the residual at the last checkpoint */
+	unsigned long checkpoints;
+};
+
+struct FDCheckpoint {
+	struct FDGrid *slots[2];		/* Mapped from the file */
+	struct FDGrid *grid;			/* The slot of the last checkpoint */
+	struct FDCheckpointHeader *header;	/* At the start of the mapping of slot 0 */
+	int fd;
+	double seconds;				/* Spent on checkpoints since opening */
+};
+
+/* Create the file at path, replacing any, for the coax at spacing h with
+ * the conductors at their potentials, solved by method with the w, r,
+ * norm, check_interval and time_block of options. Returns NULL, after
+ * reporting it, if the file cannot be created. */
+struct FDCheckpoint *FDCheckpoint_create(const char *path, double h, enum FDCheckpointMethod method, const struct FDOptions *options);
+
+/* Open the file at path to go on from its last checkpoint. Returns NULL,
+ * after reporting it, if it is not a checkpoint file. */
+struct FDCheckpoint *FDCheckpoint_resume(const char *path);
+
+void FDCheckpoint_close(struct FDCheckpoint *checkpoint);
+
+/* Relax until the residual is below r, with the parameters of the file on
+ * threads threads, 0 for one per CPU, and a checkpoint every interval
+ * iterations, rounded up to a multiple of check_interval times time_block,
+ * and to an even number for Jacobi.
+ *
+ * A checkpoint copies the grid and forces it to disk, which takes about as
+ * long as a few iterations at best and far longer on a slow disk, so an
+ * interval in the tens of iterations spends more time on checkpoints than
+ * on relaxing. With interval 0, the first run is FD_CHECKPOINT_FIRST
+ * iterations, and each later one as many as make the last checkpoint
+ * FD_CHECKPOINT_SHARE of the time, at the rate of the last run.
+ *
+ * Returns 0, or -1 if a checkpoint cannot be written; the last one written
+ * is still good. */
+int fd_checkpoint_solve(struct FDCheckpoint *checkpoint, size_t threads, unsigned int interval);
+
+#endif
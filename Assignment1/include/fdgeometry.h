@@ -0,0 +1,107 @@
+#ifndef FDGEOMETRY_H
+#define FDGEOMETRY_H
+
+#include <stddef.h>
+
+#include "fdgrid.h"
+
+/* fdgeometry.h
+ * Conductor layouts read from a file, and a finite-difference mesh of them
+ * on which relaxation only visits runs of free nodes.
+ *
+ * A layout is a rectangular domain, 0 <= x <= width and 0 <= y <= height,
+ * whose edges are a conductor, with conductors inside it. The edges x =
+ * width and y = height may be planes of symmetry instead, as for the coax
+ * quarter of fdgrid.h. The file is a list of keywords and their numbers,
+ * one item per line by convention; # starts a comment that runs to the
+ * end of the line wherever a keyword is expected.
+ *
+ *   domain <width> <height> <potential>
+ *   symmetry x | y
+ *   rectangle <x0> <y0> <x1> <y1> <potential>
+ *   polygon <potential> <n> <x1> <y1> ... <xn> <yn>
+ *   probe <x> <y>
+ *
+ * domain must come first. Later conductors override earlier ones where
+ * they overlap. Probes are points where the sweeps report the potential.
+ *
+ * On a mesh of spacing h, node (i, j) is at x = i h, y = j h. A rectangle
+ * covers the nodes from (x0 / h, y0 / h) to (x1 / h, y1 / h), rounded
+ * down, the way successive_over_relaxation places the inner conductor; a
+ * polygon covers the nodes inside it. A plane of symmetry at x = width
+ * passes through row rows - 2, and row rows - 1 mirrors rows - 3, as in
+ * fdgrid.h.
+ *
+ * Compiling the layout fills in the conductor nodes and lists, for each
+ * row, the runs of consecutive free nodes. The kernels loop over the runs
+ * without testing any node, so they vectorize as well for any layout as
+ * the coax kernels do for theirs.
+ */
+
+struct FDConductor {
+	double potential;
+	int rectangle;		/* Nonzero for a rectangle from (x[0], y[0]) to (x[1], y[1]) */
+	size_t nvertices;	/* Polygon vertices, 2 for a rectangle */
+	double *x;
+	double *y;
+};
+
+struct FDGeometry {
+	double width;
+	double height;
+	double potential;		/* Of the domain edges */
+	int symmetry_x;			/* Nonzero if x = width is a plane of symmetry */
+	int symmetry_y;
+	struct FDConductor *conductors;
+	size_t nconductors;
+	double *probes;			/* nprobes (x, y) pairs */
+	size_t nprobes;
+};
+
+struct FDMesh {
+	double *values;		/* rows rows of stride doubles, FD_ALIGN aligned */
+	size_t rows;		/* Nodes along x, false boundary included */
+	size_t cols;		/* Nodes along y */
+	size_t stride;
+	double h;
+	int mirror_rows;	/* Row rows - 1 mirrors rows - 3 */
+	int mirror_cols;	/* Column cols - 1 mirrors cols - 3 */
+	size_t *row_runs;	/* Runs of row i are row_runs[i] ... row_runs[i + 1] - 1 */
+	size_t *run_first;	/* Run k is the free nodes run_first[k] ... run_end[k] - 1 */
+	size_t *run_end;
+	size_t nruns;
+	size_t nfree;
+	void *block;		/* Allocation behind values */
+};
+
+#define FD_MESH_NODE(m, i, j)	((m)->values[(i) * (m)->stride + (j)])
+
+/* Read a layout file into geometry. Returns 0 on success, otherwise -1
+ * after reporting the problem on stderr. */
+int fd_geometry_read(const char *filename, struct FDGeometry *geometry);
+
+void fd_geometry_destroy(struct FDGeometry *geometry);
+
+/* Mesh of spacing h with the conductor nodes at their potentials and the
+ * free nodes at 0. Returns NULL, after reporting it, if h leaves no free
+ * node. */
+struct FDMesh *FDMesh_compile(const struct FDGeometry *geometry, double h);
+void FDMesh_delete(struct FDMesh *mesh);
+
+/* Potential at the node nearest below and left of (x, y), as FDGrid_probe. */
+double FDMesh_probe(const struct FDMesh *mesh, double x, double y);
+
+/* Red-black successive over-relaxation of the free nodes, as
+ * fd_red_black_sor, until the norm of the residual is below r, on one
+ * thread.
+ *
+ * With w = 0 it uses 2 / (1 + sqrt(1 - mu^2)), where mu is the Jacobi
+ * radius of the domain without its inner conductors, a rectangle twice as
+ * long across each plane of symmetry. Conductors lower the radius, so
+ * this errs towards over-relaxing, which costs less than the opposite.
+ *
+ * Returns the number of iterations.
+ */
+unsigned int fd_mesh_sor(struct FDMesh *mesh, const struct FDOptions *options);
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef FDGRID_H
+#define FDGRID_H
+
+#include <stddef.h>
+
+/* fdgrid.h
+ * Finite-difference grid for the potential between the conductors of the
+ * rectangular coaxial line, and relaxation kernels that work on it.
+ *
+ * Only a quarter of the cross-section is stored. Node (i, j) is at
+ * x = i h, y = j h from the corner of the outer conductor; row 0 and
+ * column 0 lie on the outer conductor, and the inner conductor fills
+ * i >= inner_x, j >= inner_y. The planes of symmetry x = y = OUTER_L / 2
+ * pass through row and column N - 2, and row and column N - 1 are false
+ * boundaries that mirror N - 3 (Neumann condition).
+ *
+ * Unlike alloc_grid, the nodes are in one block, each row padded to a
+ * whole number of cache lines, so that row-wise kernels vectorize.
+ */
+
+#define COAX_OUTER_L	0.2
+#define COAX_INNER_L	0.04
+#define COAX_INNER_W	0.08
+
+#define COAX_INNER_V	15.0
+#define COAX_OUTER_V	0.0
+
+/* Bytes a row of the grid is aligned and padded to */
+#define FD_ALIGN	64
+
+struct FDGrid {
+	double *values;		/* N rows of stride doubles, FD_ALIGN aligned */
+	size_t N;		/* Nodes per row and per column, false boundary included */
+	size_t stride;		/* Doubles from one row to the next */
+	size_t inner_x;		/* First row of the inner conductor */
+	size_t inner_y;		/* First column of the inner conductor */
+	size_t *row_end;	/* Free nodes of row i are columns 1 ... row_end[i] - 1 */
+	double h;
+	void *block;		/* Allocation behind values */
+	size_t mapped;		/* Bytes of the file mapping at block, 0 if allocated */
+};
+
+#define FD_NODE(g, i, j)	((g)->values[(i) * (g)->stride + (j)])
+
+/* Grid of N x N nodes with the inner conductor from (inner_x, inner_y),
+ * all 0. */
+struct FDGrid *FDGrid_new(size_t N, size_t inner_x, size_t inner_y, double h);
+
+/* Grid as FDGrid_new whose nodes are in the open file fd, from byte
+ * offset on, a multiple of FD_ALIGN. The file is mapped shared from its
+ * start, so block points at its first offset bytes, and extended to hold
+ * the nodes if it is shorter; the nodes keep what the file holds. The
+ * grid works with every kernel, and FDGrid_delete unmaps it. Returns NULL,
+ * after reporting it, if the file cannot be mapped. */
+struct FDGrid *FDGrid_map(int fd, size_t offset, size_t N, size_t inner_x, size_t inner_y, double h);
+
+/* Grid for spacing h with the conductors at their potentials and 0
+ * everywhere else, sized as in successive_over_relaxation. */
+struct FDGrid *FDGrid_coax(double h);
+void FDGrid_delete(struct FDGrid *grid);
+
+/* Potential at the node nearest below and left of (x, y), as the sweeps report it. */
+double FDGrid_probe(const struct FDGrid *grid, double x, double y);
+
+/* Set the nodes on the conductors to their potentials. Only the nodes
+ * next to the free ones are set, as in successive_over_relaxation. */
+void fd_coax_boundary(struct FDGrid *grid);
+
+/* Copy the nodes next to the planes of symmetry onto the false boundary. */
+void fd_mirror(struct FDGrid *grid);
+
+/* Largest magnitude of the residual phi(i+1,j) + phi(i-1,j) + phi(i,j+1)
+ * + phi(i,j-1) - 4 phi(i,j) over the free nodes. */
+double fd_max_residual(const struct FDGrid *grid);
+
+/* Norm of the residuals that the relaxations compare with r */
+enum FDNorm {
+	FD_NORM_MAX = 0,	/* Largest magnitude */
+	FD_NORM_L2		/* Square root of the sum of squares */
+};
+
+/* Norm of the residual over the free nodes, as fd_max_residual for
+ * FD_NORM_MAX */
+double fd_residual_norm(const struct FDGrid *grid, enum FDNorm norm);
+
+struct FDOptions {
+	double w;			/* SOR over-relaxation factor, 0 for fd_optimal_w */
+	double r;			/* Iterate until the norm of the residual is below r */
+	size_t threads;			/* Threads sharing the grid, 0 for one per CPU */
+	unsigned int check_interval;	/* Test convergence every check_interval iterations, at least 1 */
+	enum FDNorm norm;
+	unsigned int time_block;	/* Jacobi: iterations per pass over the grid, at least 1 */
+	unsigned int max_iterations;	/* Red-black, mixed SOR and Jacobi: stop after as many, 0 for no limit */
+};
+
+/* Default options: w = 1.3, r = 1e-5 on the largest residual, tested on
+ * every iteration, one thread, one Jacobi iteration per pass over the
+ * grid, and no limit on the iterations, as in sweep_h. */
+void fd_default_options(struct FDOptions *options);
+
+/* Spectral radius of the Jacobi iteration on the grid of spacing h.
+ *
+ * It is found by power iteration on a grid no finer than FD_RADIUS_H,
+ * which takes a few hundred sweeps of a few hundred nodes, and carried
+ * over to h using 1 - mu = h^2 lambda / 4 + O(h^4), where lambda is the
+ * smallest eigenvalue of the Laplacian on the cross-section. The
+ * extrapolation errs towards a smaller radius.
+ */
+double fd_jacobi_radius(double h);
+
+/* Optimal SOR factor 2 / (1 + sqrt(1 - mu^2)) for the grid of spacing h,
+ * with mu = fd_jacobi_radius(h). Both sweep orders used here are
+ * consistently ordered, so the formula applies to them. */
+double fd_optimal_w(double h);
+
+/* Red-black successive over-relaxation
+ *
+ * Relax the free nodes until the largest residual drops below r, updating
+ * the nodes with i + j even and then those with i + j odd. Each half-sweep
+ * only reads nodes of the other colour, so the changes of a whole row are
+ * computed at once with a 0/1 colour mask, which the compiler turns into
+ * SIMD code, and added to the nodes of the colour alone. The ordering is
+ * consistent, so the convergence rate for a given w is that of the
+ * lexicographic sweep.
+ *
+ * The residual of each node is taken from its update, before the node
+ * changes, so testing convergence does not take a pass of its own; it is
+ * only accumulated on the iterations that test it.
+ *
+ * With several threads, each relaxes a block of rows of about the same
+ * number of nodes, and they meet at a barrier after each half-sweep. The
+ * result does not depend on the number of threads.
+ *
+ * Returns the number of iterations.
+ */
+unsigned int fd_red_black_sor(struct FDGrid *grid, const struct FDOptions *options);
+
+/* Mixed-precision red-black SOR
+ *
+ * Iterative refinement around fd_red_black_sor. The residual of the grid
+ * is computed in double and stored in float, and red-black SOR in float
+ * solves for the correction it calls for, with the conductors at 0, until
+ * its residual is 1000 times smaller, or r / 2 if that is larger. The
+ * correction is added to the grid in double and the residual taken again,
+ * until its norm is below r. A float sweep reads e and f and writes e,
+ * 12 bytes a node against the 16 of a sweep in double that reads and
+ * writes the grid, so it moves three quarters of the bytes. The double
+ * residual keeps the rounding of the float sweeps out of the solution, so
+ * it meets the same r.
+ *
+ * Unlike fd_red_black_sor, the norm compared with r is that of the true
+ * residual after the correction rather than of the updates, and it runs
+ * on one thread. It also stops, above r, after max_iterations float
+ * iterations, or once a correction does not lower the residual, when r is
+ * below what the rounding of the grid in double allows.
+ *
+ * Returns the number of float iterations.
+ */
+unsigned int fd_mixed_sor(struct FDGrid *grid, const struct FDOptions *options);
+
+/* Jacobi iteration, as jacobi_method, with the same blocks of rows and
+ * barriers as fd_red_black_sor. The residual of each iterate is 4 times
+ * the change the next one makes, so it also comes from the update. w is
+ * not used.
+ *
+ * With time_block above 1 the iteration is temporally blocked instead: one
+ * thread carries out time_block iterations in a single pass over the grid,
+ * a wavefront of rows behind each other, so a grid larger than the cache is
+ * read from memory once per block rather than once per iteration. The
+ * iterates are the same, but convergence is only tested at the end of a
+ * block, so the iterations are a multiple of time_block. So is
+ * max_iterations, rounded up.
+ *
+ * Returns the number of iterations. */
+unsigned int fd_jacobi(struct FDGrid *grid, const struct FDOptions *options);
+
+/* fd_jacobi against copy, a grid of the same size with the same boundary
+ * values, rather than a copy allocated for the call, so that a solve in
+ * many runs allocates it once. The newest grid is left in grid, copied
+ * back after an odd number of iterations; copy keeps an older one. */
+unsigned int fd_jacobi_copy(struct FDGrid *grid, struct FDGrid *copy, const struct FDOptions *options);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef FDMULTIGRID_H
+#define FDMULTIGRID_H
+
+#include <stddef.h>
+
+#include "fdgrid.h"
+
+/* fdmultigrid.h
+ * Geometric multigrid for the finite-difference potential of the coaxial
+ * line, on the grids of fdgrid.h.
+ *
+ * Each coarser level keeps the even rows and columns of the one above it:
+ * coarse node (i, j) is fine node (2i, 2j), and it is fixed if that node
+ * is, so the inner conductor starts at (ceil(inner_x / 2), ceil(inner_y /
+ * 2)) and the planes of symmetry move to row and column ceil((N - 2) / 2).
+ * When N - 2, inner_x and inner_y are not all even, a conductor or plane
+ * lies between two coarse nodes, which a coarse grid of its own could not
+ * represent. So the coarse operators are not rediscretized but Galerkin
+ * products R A P, 9-point stencils that hold the fine boundaries wherever
+ * they are, and the cycle converges as fast at any h as at a dyadic one.
+ * The stencils take 9 doubles per coarse node, 2.25 times the fine grid on
+ * the first coarse level; away from the boundaries they are all the same,
+ * and the smoothing reads that one regular stencil.
+ *
+ * The finest level is smoothed with red-black Gauss-Seidel and the coarse
+ * ones with lexicographic Gauss-Seidel. Interpolation P is bilinear onto
+ * the free nodes, and restriction is its transpose, full weighting of the
+ * residual of the free nodes, so the conductors keep their potentials and
+ * their residual is left out. Coarse levels solve for the correction, with
+ * the conductors at 0. The coarsest level, with a few nodes, is relaxed to
+ * convergence.
+ *
+ * Full multigrid solves the coarsest version of the problem first and
+ * interpolates each solution up as the start of one cycle on the next
+ * finer level. The coarse versions have the potentials of the conductors,
+ * restricted from the finest level, in their right sides.
+ */
+
+enum FDCycle {
+	FD_CYCLE_V = 0,		/* One coarse correction per level */
+	FD_CYCLE_W,		/* Two coarse corrections per level */
+	FD_CYCLE_F		/* An F-cycle then a V-cycle on the coarser level */
+};
+
+struct FDMultigridOptions {
+	enum FDCycle cycle;
+	unsigned int pre_smooth;	/* Red-black Gauss-Seidel sweeps before the coarse correction */
+	unsigned int post_smooth;	/* And after it */
+	int full;			/* Nonzero to start with full multigrid instead of the grid values */
+	double r;			/* Cycle until the largest residual magnitude is below r */
+	unsigned int max_cycles;
+};
+
+struct FDMultigridLevel {
+	struct FDGrid *grid;		/* The solution on level 0, the correction below it */
+	double *f;			/* Right side, with the layout of grid */
+	double *residual;		/* With the layout of grid */
+	double *stencil;		/* Coarse levels: 9 coefficients per node, NULL on level 0 */
+	unsigned char *regular;		/* Coarse levels: nonzero where the stencil is regular_stencil */
+	double regular_stencil[9];	/* Stencil of the nodes away from the conductors and planes */
+};
+
+struct FDMultigrid {
+	struct FDMultigridLevel *levels;	/* levels[0] is the grid being solved */
+	size_t nlevels;
+	const struct FDMultigridOptions *options;
+};
+
+/* Default options: full multigrid, then V(2,2) cycles until the largest
+ * residual is below 1e-5, as in sweep_h, at most 100 cycles. */
+void fd_multigrid_default_options(struct FDMultigridOptions *options);
+
+/* Multigrid solve
+ *
+ * Solve for the potential on grid, whose conductors are at their
+ * potentials, until the largest residual is below r. Negative residuals
+ * count as well: unlike relaxation, a cycle can overshoot, and the
+ * positive ones alone may be small long before the solution is. Without
+ * the full multigrid start the free nodes of grid are the first
+ * approximation.
+ *
+ * Returns the number of cycles, full multigrid excluded. It gives up after
+ * max_cycles, converged or not.
+ */
+unsigned int fd_multigrid(struct FDGrid *grid, const struct FDMultigridOptions *options);
+
+#endif
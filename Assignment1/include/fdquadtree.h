@@ -0,0 +1,103 @@
+#ifndef FDQUADTREE_H
+#define FDQUADTREE_H
+
+#include <stddef.h>
+
+#include "fdgrid.h"
+
+/* fdquadtree.h
+ * Adaptive finite-difference mesh of the coax quarter of fdgrid.h.
+ *
+ * The quarter is split into the 5 x 5 cells of spacing 0.02, and each of
+ * them is the root of a quadtree. All cell corners lie on a lattice of
+ * spacing 0.02 / 2^max_level, so the conductor edges, the planes of
+ * symmetry and the probe point (0.06, 0.04) are always on corners. A leaf
+ * of level l has sides of 0.02 / 2^l, and leaves sharing an edge differ
+ * by at most one level.
+ *
+ * The potentials are at the leaf corners. A corner in the middle of the
+ * edge of a larger leaf (a hanging node) is interpolated quadratically
+ * from that edge's ends: the second derivative along the edge is minus
+ * the one across it, which the free ends provide. The mean of the ends
+ * alone would be off by O(h^2), an O(1) error in the equations that use
+ * it.
+ * Any other free corner has a neighbour along each axis at the next corner
+ * on that line, at distances hl, hr, hd, hu, and satisfies the five point
+ * approximation of Laplace's equation with unequal arms,
+ *
+ *   2 / (hl + hr) ((u_r - u) / hr + (u_l - u) / hl)
+ *     + 2 / (hd + hu) ((u_u - u) / hu + (u_d - u) / hd) = 0,
+ *
+ * which is the equation of successive_over_relaxation when all arms are h.
+ * On the planes of symmetry the missing arm mirrors the other.
+ *
+ * The error of a leaf is estimated as h^2 times the largest second
+ * difference at its free corners, the leading term of the error of
+ * bilinear interpolation. It is large where the potential bends sharply,
+ * at the re-entrant corner of the inner conductor above all.
+ */
+
+struct FDQuadLeaf {
+	size_t i;		/* Lattice coordinates of the corner nearest the origin */
+	size_t j;
+	unsigned int level;
+};
+
+/* A hanging node and the ends of the edge it splits */
+struct FDQuadHanging {
+	size_t node;
+	size_t a;
+	size_t b;
+	long free_a;		/* Index of a among the free nodes, or -1 */
+	long free_b;
+	int axis;		/* Across the edge: 0 for x, 1 for y */
+	size_t size;		/* Of the edge, in lattice steps */
+	double correction;	/* Quadratic term added to the mean of a and b */
+};
+
+struct FDQuadtree {
+	struct FDQuadLeaf *leaves;
+	size_t nleaves;
+	size_t capacity;
+	unsigned int max_level;
+	size_t side;			/* Lattice steps across the quarter */
+	double step;			/* Lattice spacing in m */
+	size_t *cell_leaf;		/* side x side: leaf covering each lattice cell */
+	long *node_at;			/* (side + 1)^2: node at each lattice point, or -1 */
+	size_t nnodes;
+	size_t *node_i;
+	size_t *node_j;
+	double *u;			/* Potential of each node */
+	size_t *free_nodes;		/* Nodes solved for, hanging nodes excluded */
+	size_t nfree;
+	size_t *neighbours;		/* 4 per free node: right, left, up, down */
+	double *arms;			/* 4 per free node, in m */
+	double *weights;		/* 4 per free node, summing to 1 */
+	struct FDQuadHanging *hanging;	/* Larger edges first */
+	size_t nhanging;
+};
+
+/* The 25 root leaves with the conductors at their potentials and 0 on the
+ * free nodes. Leaves are refined down to max_level at most. */
+struct FDQuadtree *FDQuadtree_new(unsigned int max_level);
+void FDQuadtree_delete(struct FDQuadtree *tree);
+
+/* Successive over-relaxation of the free nodes, from their current
+ * potentials, until the largest residual is below r, with the residual
+ * scaled as in successive_over_relaxation. The quadratic terms of the
+ * hanging nodes are held fixed during a pass of sweeps and updated between
+ * passes, until a pass converges in one sweep. w = 0 picks the optimal
+ * factor of a uniform grid with as many nodes. Returns the number of
+ * iterations. */
+unsigned int fd_quadtree_solve(struct FDQuadtree *tree, const struct FDOptions *options);
+
+/* Split every leaf whose error estimate is at least fraction times the
+ * largest one, then the leaves needed to restore the 2:1 balance. The new
+ * nodes start from the interpolated potentials. Returns the number of
+ * leaves split, 0 once none can be. */
+size_t fd_quadtree_refine(struct FDQuadtree *tree, double fraction);
+
+/* Potential at (x, y), interpolated bilinearly in the leaf holding it. */
+double FDQuadtree_probe(const struct FDQuadtree *tree, double x, double y);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef FDSWEEP_H
+#define FDSWEEP_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "fdgrid.h"
+
+/* fdsweep.h
+ * Parameter sweeps of the finite-difference solvers, with the independent
+ * solves run side by side.
+ *
+ * A sweep file gives the values of each parameter on a line of its own,
+ * after its keyword; # starts a comment that runs to the end of the line.
+ *
+ *   method <name> ...
+ *   h <spacing> ...
+ *   w <factor> ...
+ *   r <tolerance> ...
+ *
+ * The sweep is every combination of the values. method and h are
+ * required; w and r default to those of the options. A method that does
+ * not use w is solved once per h and r, with w reported as 0.
+ *
+ * The solves are spread over a pool of threads. The jobs are sorted by
+ * their estimated cost, largest first, and dealt round-robin onto one
+ * queue per thread. A thread takes the largest job left on its own queue,
+ * and once that is empty steals the smallest one left on another's, so the
+ * large jobs start early and the small ones fill in at the end. Before a
+ * job starts, its grids are counted against a memory budget; a thread
+ * waits while they do not fit beside those of the jobs already running.
+ *
+ * Each result is written as a line of CSV as soon as its solve is done,
+ *
+ *   job,method,h,w,r,iterations,phi,seconds,bytes
+ *
+ * where job is the position of the combination in the file order and phi
+ * the potential at the probe point of the sweeps, (0.06, 0.04).
+ */
+
+struct FDSweepMethod {
+	const char *name;
+	int uses_w;		/* Nonzero if w is a parameter of the method */
+
+	/* Solve the coax at spacing h, on one thread, and set *phi to the
+	 * potential at the probe. Returns the number of iterations. It is
+	 * called from several threads at once. */
+	unsigned int (*solve)(double h, const struct FDOptions *options, double *phi);
+
+	/* Bytes the solve keeps allocated at spacing h */
+	size_t (*bytes)(double h);
+
+	/* Estimated time of the solve, in any unit common to all methods */
+	double (*cost)(double h, const struct FDOptions *options);
+};
+
+struct FDSweepJob {
+	const struct FDSweepMethod *method;
+	struct FDOptions options;	/* w and r of the job, one thread */
+	double h;
+	size_t index;			/* Position in the file order */
+	size_t bytes;
+	double cost;
+};
+
+struct FDSweep {
+	struct FDSweepJob *jobs;
+	size_t njobs;
+};
+
+/* Read a sweep file into sweep, with the methods named in it looked up
+ * among methods and the other options taken from options. Returns 0 on
+ * success, otherwise -1 after reporting the problem on stderr. */
+int fd_sweep_read(const char *filename, const struct FDSweepMethod *methods, size_t nmethods,
+		const struct FDOptions *options, struct FDSweep *sweep);
+
+void fd_sweep_destroy(struct FDSweep *sweep);
+
+/* Run the jobs of sweep on threads threads, 0 for one per CPU, with at
+ * most budget bytes of grids allocated at once, 0 for no limit, and write
+ * the results to filePtr. The jobs are sorted in the process.
+ *
+ * Returns 0, or -1 without running anything, after reporting it, if a job
+ * alone is over the budget. */
+int fd_sweep_run(struct FDSweep *sweep, size_t threads, size_t budget, FILE *filePtr);
+
+#endif
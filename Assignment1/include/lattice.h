@@ -0,0 +1,154 @@
+#ifndef LATTICE_H
+#define LATTICE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "circuits.h"
+#include "multigrid.h"
+#include "utils.h"
+
+/* lattice.h
+ * Rectangular resistor lattices, generated directly in memory.
+ *
+ * A lattice has rows x cols nodes numbered row by row (node = i * cols + j).
+ * Node (i, j) is joined to (i, j + 1) by a horizontal branch and to (i + 1, j)
+ * by a vertical one, each with its own resistance. One lattice node is chosen
+ * as ground when the lattice is turned into a circuit.
+ */
+
+struct Lattice {
+	double *horizontal;	/* rows x (cols - 1) resistances, see LATTICE_HORIZONTAL */
+	double *vertical;	/* (rows - 1) x cols resistances, see LATTICE_VERTICAL */
+	size_t rows;
+	size_t cols;
+};
+
+#define LATTICE_HORIZONTAL(L, i, j)	((L)->horizontal[(i) * ((L)->cols - 1) + (j)])
+#define LATTICE_VERTICAL(L, i, j)	((L)->vertical[(i) * (L)->cols + (j)])
+
+/* A branch added on top of the lattice, between two lattice nodes, such as a
+ * source with its series resistor. J, R and E are as in the circuit files. */
+struct LatticeBranch {
+	size_t from;
+	size_t to;
+	double J;
+	double R;
+	double E;
+};
+
+/* New lattice with every branch set to resistance R. */
+struct Lattice *Lattice_new(size_t rows, size_t cols, double R);
+void Lattice_delete(struct Lattice *lattice);
+
+/* Return 1 if every branch of the lattice has the same resistance. */
+int Lattice_is_uniform(const struct Lattice *lattice);
+
+/* Circuit node number of a lattice node when lattice node 'ground' is grounded.
+ * Nodes before the ground keep their index plus one, later nodes keep it, so
+ * grounding node 0 gives the numbering meshgen uses. */
+size_t lattice_circuit_node(size_t node, size_t ground);
+
+/* Lattice layout for the multigrid solver with the given ground node. */
+void lattice_info(const struct Lattice *lattice, size_t ground, struct LatticeInfo *info);
+
+/* Branch list of the lattice with node 'ground' grounded, followed by the
+ * nextra extra branches. Within each row of nodes, the horizontal branches
+ * come first and then the vertical ones to the next row, as in meshgen. */
+struct BranchList *lattice_to_branches(const struct Lattice *lattice, size_t ground, const struct LatticeBranch *extra, size_t nextra);
+
+/* The test circuit of meshgen and meshsolve: an N x 2N lattice (N columns,
+ * 2N rows) of 1000 ohm branches grounded at node 0, with a 1 V source and
+ * 1000 ohm series resistor from ground into the last node. */
+struct BranchList *lattice_mesh_circuit(size_t N);
+
+/* The lattice of the same circuit, grounded at node 0, with its source branch stored in source. */
+struct Lattice *lattice_mesh(size_t N, struct LatticeBranch *source);
+
+/* Recognize a circuit of the same shape as lattice_mesh_circuit: a rows x cols
+ * lattice grounded at node 0, every branch present once, plus one source
+ * branch (J or E nonzero) between ground and some lattice node. The branch
+ * resistances may differ. Returns the lattice and stores the source branch,
+ * or NULL if the circuit has any other shape. */
+struct Lattice *lattice_mesh_from_branches(const struct BranchList *branches, size_t rows, size_t cols, struct LatticeBranch *source);
+
+/* Generated lattices
+ *
+ * A rows x cols lattice whose branch resistances are drawn at random, for
+ * stress tests and Monte Carlo runs. Each branch draws from its own
+ * counter-based stream, seeded by the seed and the branch index (the
+ * horizontal branches row by row, then the vertical ones), so a lattice
+ * is the same whatever the number of threads or the chunk size.
+ *
+ * A branch is left out with probability 'missing', and the resistance of
+ * one that is kept is multiplied by defect_factor with probability
+ * 'defect'. Missing branches can cut nodes off from ground, in which case
+ * the circuit has no solution.
+ *
+ * The rows are generated in independent chunks, one thread per chunk.
+ */
+enum LatticeDistribution {
+	LATTICE_DIST_CONSTANT = 0,	/* Every branch R */
+	LATTICE_DIST_UNIFORM,		/* Uniform on [R (1 - spread), R (1 + spread)], spread < 1 */
+	LATTICE_DIST_LOGNORMAL		/* R exp(spread z) with z standard normal */
+};
+
+struct LatticeGenOptions {
+	size_t rows;
+	size_t cols;
+	enum LatticeDistribution distribution;
+	double R;
+	double spread;
+	double missing;			/* Probability that a branch is left out */
+	double defect;			/* Probability that a branch is defective */
+	double defect_factor;		/* Resistance multiplier of a defective branch */
+	unsigned long seed;
+	size_t ground;			/* Lattice node that becomes circuit node 0 */
+	const struct LatticeBranch *terminals;	/* Extra branches, such as sources, added after the lattice */
+	size_t nterminals;
+	size_t threads;			/* 0 for one per CPU */
+	size_t chunk_rows;		/* Rows per chunk when writing, 0 to pick one */
+};
+
+/* Default options: constant 1000 ohm branches, no defects, seed 1, ground
+ * at node 0 and no terminals. rows and cols must still be set. */
+void lattice_default_gen_options(struct LatticeGenOptions *options);
+
+/* Resistance of branch k of the generated lattice, or 0.0 if it is missing. */
+double lattice_gen_resistance(const struct LatticeGenOptions *options, size_t k);
+
+/* Branch list of the generated lattice, numbered and ordered as by
+ * lattice_to_branches, with the missing branches left out. */
+struct BranchList *lattice_generate_branches(const struct LatticeGenOptions *options);
+
+/* Write the generated lattice as a branch list file, chunk by chunk,
+ * without holding the whole list in memory (except for the incidence
+ * format). Returns -1 on a write error. */
+int lattice_write_generated(FILE *filePtr, const struct LatticeGenOptions *options, enum BranchFileFormat format);
+
+/* Uniform lattice resistance
+ *
+ * Equivalent resistance between nodes a and b of a rows x cols lattice whose
+ * branches all have resistance R, without forming the nodal matrix.
+ *
+ * The Laplacian of the lattice is L_rows (x) I + I (x) L_cols, where L_n is
+ * the Laplacian of a path of n nodes. Its eigenvectors are products of the
+ * cosine (DCT-II) modes of the paths, with eigenvalues 4 sin^2(pi k / 2n)
+ * added, so
+ *
+ *	R(a, b) = R * sum over (k, l) != (0, 0) of (psi_kl(a) - psi_kl(b))^2 / (lambda_k + mu_l)
+ *
+ * which takes O(rows cols) operations and O(rows + cols) memory. Only the
+ * modes at the two nodes are needed, so no transform of a full grid is done.
+ */
+double lattice_uniform_resistance(size_t rows, size_t cols, double R, size_t a, size_t b);
+
+/* Same for a lattice given branch by branch. Returns 0 and stores the
+ * resistance in R, or -1 if the branches are not all equal. */
+int lattice_resistance_spectral(const struct Lattice *lattice, size_t a, size_t b, double *R);
+
+/* Resistance of the lattice in the meshgen circuit of size N, between the
+ * ground and the source node, computed with lattice_uniform_resistance. */
+double lattice_mesh_resistance(size_t N);
+
+#endif
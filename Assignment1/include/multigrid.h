@@ -0,0 +1,111 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include <stddef.h>
+
+#include "sparse.h"
+#include "utils.h"
+
+/* multigrid.h
+ * Geometric multigrid for the nodal equations of 2-D resistor lattices.
+ *
+ * The lattice has rows x cols nodes numbered row by row (node = i * cols + j),
+ * like the meshes written by meshgen. The ground node is not an unknown, so
+ * unknown k is node k for k < ground and node k + 1 otherwise. Branches
+ * may only join horizontal or vertical neighbours, but need not all be
+ * present, and any node may have extra conductance to ground on the diagonal
+ * (e.g. the series resistor of a source).
+ *
+ * The hierarchy is built for the floating lattice, with the ground node as
+ * one more unknown and each conductance to ground as a branch to it, so that
+ * every level sees the same kind of operator and the ground needs no special
+ * treatment when coarsening. Each coarser level keeps the even rows and
+ * columns of the one above it, plus the last row and column, so the corners
+ * (and a ground there) are kept on every level. Prolongation is bilinear
+ * interpolation, restriction is its transpose and the coarse matrices are
+ * Galerkin products, so the hierarchy stays exact for arbitrary branch
+ * conductances. The coarsest level is solved directly with banded Cholesky,
+ * with the coarse ground pinned at 0, and a cycle returns the potentials
+ * relative to the ground.
+ */
+
+struct LatticeInfo {
+	size_t rows;
+	size_t cols;
+	size_t ground;		/* Node index of the ground node */
+};
+
+struct MultigridOptions {
+	const struct LatticeInfo *lattice;	/* NULL to detect it with multigrid_detect_lattice */
+	unsigned int pre_smooth;		/* Forward Gauss-Seidel sweeps before the coarse correction */
+	unsigned int post_smooth;		/* Backward Gauss-Seidel sweeps after it */
+	size_t coarse_max;			/* Stop coarsening at this many unknowns */
+	double tolerance;			/* multigrid_solve_system: stop when ||b - Ax|| <= tolerance * ||b|| */
+	unsigned int max_cycles;
+};
+
+struct MultigridStats {
+	unsigned int cycles;
+	size_t levels;
+	double residual_norm;
+	double relative_residual;
+	int converged;
+	double setup_time;		/* Seconds spent building the hierarchy */
+	double solve_time;		/* Seconds spent cycling */
+};
+
+struct MultigridLevel {
+	struct SparseMatrix *A;
+	struct SparseMatrix *P;		/* Prolongation from the next coarser level, NULL on the coarsest */
+	struct LatticeInfo lattice;
+	double *x, *b, *r;		/* Work vectors of the level */
+};
+
+struct Multigrid {
+	struct MultigridLevel *levels;	/* levels[0] is the finest */
+	size_t nlevels;
+	struct BandMatrix *coarse_L;	/* Cholesky factor of the coarsest matrix */
+	unsigned int pre_smooth;
+	unsigned int post_smooth;
+};
+
+/* Fill options with the defaults: detect the lattice, V(2,2) cycles,
+ * coarsen down to 500 unknowns, relative tolerance 1e-10, 200 cycles. */
+void multigrid_default_options(struct MultigridOptions *options);
+
+/* Check whether A is the nodal matrix of a lattice grounded at node 0
+ * (the numbering used by meshgen and the circuit files), and if so find
+ * its dimensions. Returns 0 and fills lattice on success, -1 otherwise. */
+int multigrid_detect_lattice(const struct SparseMatrix *A, struct LatticeInfo *lattice);
+
+/* Build the level hierarchy for A. The hierarchy keeps a copy of A, so A may
+ * be released afterwards. Returns NULL if the lattice does not match A or
+ * the coarsest matrix is not positive-definite. */
+struct Multigrid *multigrid_setup(const struct SparseMatrix *A, const struct MultigridOptions *options);
+
+void multigrid_delete(struct Multigrid *mg);
+
+/* Apply one V-cycle to Ax = b, improving x in place. */
+void multigrid_vcycle(const struct Multigrid *mg, double *x, const double *b);
+
+/* z = M^-1 r, where M^-1 is one V-cycle started from zero. The cycle is
+ * symmetric (forward smoothing down, backward smoothing up), so it can be
+ * used as a PCG preconditioner. */
+void multigrid_precondition(const struct Multigrid *mg, double *z, const double *r);
+
+/* Multigrid solve system
+ *
+ * Solve Ax = b from x = 0 with conjugate gradients preconditioned by one
+ * V-cycle per step, until the relative residual drops below
+ * options->tolerance. Branches to ground from nodes far from it, such as a
+ * source, are not lattice edges and slow plain cycling down as the lattice
+ * grows; the Krylov acceleration keeps the number of cycles independent of
+ * the lattice size. stats->cycles counts the V-cycles.
+ *
+ * Returns:
+ * 0 if the iteration converged
+ * -1 if the hierarchy could not be built or max_cycles was reached.
+ */
+int multigrid_solve_system(struct Vector **xp, const struct SparseMatrix *A, const struct Vector *b, const struct MultigridOptions *options, struct MultigridStats *stats);
+
+#endif
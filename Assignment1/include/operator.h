@@ -0,0 +1,35 @@
+#ifndef OPERATOR_H
+#define OPERATOR_H
+
+#include <stddef.h>
+
+#include "sparse.h"
+
+/* operator.h
+ * Square linear operators y = Ax, given either by an explicit sparse matrix
+ * or by a function that applies A without storing it (see stencil.h).
+ * The iterative solvers take an operator, so the two are interchangeable
+ * wherever only products with A are needed.
+ */
+
+struct LinearOperator {
+	size_t n;
+	void (*multiply)(const void *data, const double *x, double *y);	/* y = Ax */
+	void (*diagonal)(const void *data, double *d);			/* d = diag(A) */
+	const void *data;
+	const struct SparseMatrix *matrix;	/* The explicit matrix, or NULL for a matrix-free operator */
+};
+
+/* Operator of an explicit square sparse matrix. Only A is referenced, not copied. */
+void LinearOperator_from_sparse(struct LinearOperator *op, const struct SparseMatrix *A);
+
+/* y = Ax. The arrays x and y must not overlap. */
+void LinearOperator_multiply(const struct LinearOperator *op, const double *x, double *y);
+
+/* d = diag(A) */
+void LinearOperator_diagonal(const struct LinearOperator *op, double *d);
+
+/* Compute r = b - Ax and return ||r||. */
+double LinearOperator_residual(const struct LinearOperator *op, const double *x, const double *b, double *r);
+
+#endif
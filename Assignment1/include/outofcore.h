@@ -0,0 +1,71 @@
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include <stddef.h>
+
+#include "sparse.h"
+
+/* outofcore.h
+ * Banded Cholesky factorization for bands larger than memory.
+ *
+ * The band is kept in a scratch file, one BandMatrix row after the other,
+ * and brought into memory a panel of rows at a time. Factoring row i needs
+ * rows i - hb + 1 ... i, so a window of ceil((hb - 1) / P) + 2 panels of P
+ * rows is enough: the panels the current one depends on, the current one,
+ * and the next one being read ahead. Panels are read and written by a
+ * second thread while the factorization runs, in the order they were
+ * requested, so a write of a finished panel always completes before its
+ * buffer is refilled.
+ *
+ * The triangular solves stream the factor through the same window, forward
+ * for Ly = b and backward for (L^T)x = y. Only the vectors stay in memory.
+ *
+ * The panel size is the largest that keeps the window within the memory
+ * budget. The scratch file is removed as soon as it is created, so it
+ * disappears with the process whatever happens.
+ */
+
+/* Default memory budget for the window, in bytes */
+#define OUTOFCORE_DEFAULT_BUDGET	((size_t)256 << 20)
+
+struct OutOfCoreOptions {
+	size_t memory_budget;		/* Bytes for the panels in memory */
+	const char *scratch_dir;	/* Directory of the scratch file, NULL for $TMPDIR or /tmp */
+};
+
+struct OutOfCoreBand {
+	size_t n;
+	size_t hb;
+	size_t panel_rows;		/* Rows per panel */
+	size_t npanels;
+	size_t window;			/* Panels in memory at once */
+	int fd;				/* Scratch file, already unlinked */
+	double *buffers;		/* window panels of panel_rows * hb doubles */
+};
+
+/* Default options: OUTOFCORE_DEFAULT_BUDGET, scratch file in $TMPDIR or /tmp. */
+void outofcore_default_options(struct OutOfCoreOptions *options);
+
+/* Write the lower band of a square sparse matrix, with half bandwidth hb,
+ * to a new scratch file a panel at a time.
+ *
+ * Returns NULL if the budget cannot hold hb + 2 rows of the band, or if the
+ * scratch file cannot be created or written (the reason is printed). */
+struct OutOfCoreBand *OutOfCoreBand_from_sparse(const struct SparseMatrix *S, size_t hb, const struct OutOfCoreOptions *options);
+
+/* Close and release the scratch file. */
+void OutOfCoreBand_delete(struct OutOfCoreBand *B);
+
+/* Factor the band into L*L^T in place, in the scratch file.
+ *
+ * Returns:
+ * 0 if operation successful
+ * -1 if the matrix is not positive-definite or on an I/O error.
+ */
+int outofcore_cholesky_factor(struct OutOfCoreBand *B);
+
+/* Solve (LL^T)x = b in place with a factor from outofcore_cholesky_factor.
+ * x holds b on entry. Returns 0, or -1 on an I/O error. */
+int outofcore_cholesky_solve(const struct OutOfCoreBand *L, double *x);
+
+#endif
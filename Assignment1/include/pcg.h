@@ -0,0 +1,68 @@
+#ifndef PCG_H
+#define PCG_H
+
+#include "multigrid.h"
+#include "operator.h"
+#include "sparse.h"
+#include "utils.h"
+
+/* pcg.h
+ * Preconditioned conjugate gradient for sparse symmetric positive-definite systems.
+ */
+
+enum PCGPreconditioner {
+	PCG_PRECONDITIONER_NONE = 0,
+	PCG_PRECONDITIONER_JACOBI,	/* M = diag(A) */
+	PCG_PRECONDITIONER_SSOR,	/* Symmetric successive over-relaxation with parameter omega */
+	PCG_PRECONDITIONER_IC0,		/* Incomplete Cholesky with the sparsity pattern of A */
+	PCG_PRECONDITIONER_MULTIGRID	/* One multigrid V-cycle, for lattice matrices */
+};
+
+struct PCGOptions {
+	enum PCGPreconditioner preconditioner;
+	double tolerance;		/* Stop when ||b - Ax|| <= tolerance * ||b|| */
+	unsigned int max_iterations;
+	double omega;			/* Relaxation parameter for SSOR, in (0, 2) */
+	const struct MultigridOptions *multigrid;	/* Multigrid preconditioner options, NULL for the defaults */
+};
+
+struct PCGStats {
+	unsigned int iterations;
+	double residual_norm;		/* ||b - Ax|| of the returned x */
+	double relative_residual;	/* residual_norm / ||b|| */
+	int converged;
+	double setup_time;		/* Seconds spent building the preconditioner */
+	double solve_time;		/* Seconds spent iterating */
+};
+
+/* Fill options with the defaults: IC(0), relative tolerance 1e-10,
+ * at most 10n iterations (0 means pick from n), omega = 1.5,
+ * default multigrid options. */
+void pcg_default_options(struct PCGOptions *options);
+
+/* PCG solve system
+ *
+ * Solve Ax = b, where A is a sparse real symmetric positive-definite matrix,
+ * with the conjugate gradient method preconditioned by options->preconditioner.
+ * The iteration starts from x = 0.
+ *
+ * Parameters:
+ * xp - pointer to solution vector that will be set after success
+ * A - n x n sparse symmetric positive-definite matrix
+ * b - n x 1 real vector in the equation Ax = b
+ * options - solver options, or NULL for the defaults
+ * stats - if not NULL, receives the iteration count and final residual
+ *
+ * Returns:
+ * 0 if the iteration converged
+ * -1 if A is not positive-definite, the preconditioner could not be built,
+ *    or the tolerance was not reached within max_iterations.
+ */
+int pcg_solve_system(struct Vector **xp, const struct SparseMatrix *A, const struct Vector *b, const struct PCGOptions *options, struct PCGStats *stats);
+
+/* Same, for A given as a linear operator (see operator.h). A matrix-free
+ * operator only supports the NONE and JACOBI preconditioners, the others
+ * need the explicit matrix and make the solve return -1. */
+int pcg_solve_operator(struct Vector **xp, const struct LinearOperator *A, const struct Vector *b, const struct PCGOptions *options, struct PCGStats *stats);
+
+#endif
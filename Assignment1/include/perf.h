@@ -0,0 +1,51 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+
+/* perf.h
+ * Lightweight performance instrumentation.
+ *
+ * A stage is a named piece of work (parse, assemble, factor, solve,
+ * relaxation, ...) timed with the monotonic clock between perf_begin and
+ * perf_end. Stages may nest; each records its calls, inclusive and
+ * exclusive time and the bytes allocated through malloc_or_fail while it ran.
+ * Counters are named running totals such as flops or iterations.
+ *
+ * The calls may be made from several threads at once. Each thread nests
+ * its own stages, and a stage counts only the time and bytes of the thread
+ * that ran it, so its totals add up over the threads that ran it.
+ *
+ * Nothing is recorded unless the program was started with --perf-json,
+ * so the calls cost a single test otherwise. Stage and counter names must
+ * be string literals or otherwise outlive the program.
+ */
+
+#define PERF_MAX_STAGES		64
+#define PERF_MAX_COUNTERS	32
+#define PERF_MAX_DEPTH		16
+
+/* Look for --perf-json or --perf-json=<file> among the arguments. If found,
+ * remove it from argv, enable recording and write the report when the
+ * program exits: to the file, to stdout for "-", or to stderr by default.
+ *
+ * --mem-report or --mem-report=<file> is handled the same way: it enables
+ * allocation accounting (see utils.h) and prints malloc_accounting_report
+ * at exit. The JSON report then also gives the peak and live bytes. */
+void perf_parse_args(int *argc, const char *argv[]);
+
+/* Nonzero if recording is enabled. */
+int perf_enabled(void);
+
+/* Start and finish a stage. perf_end must name the innermost stage the
+ * calling thread has open. */
+void perf_begin(const char *stage);
+void perf_end(const char *stage);
+
+/* Add amount to a counter. */
+void perf_count(const char *counter, double amount);
+
+/* Write the report as a JSON object. Returns 0, or -1 on a write error. */
+int perf_write_json(FILE *filePtr);
+
+#endif
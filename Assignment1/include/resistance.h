@@ -0,0 +1,67 @@
+#ifndef RESISTANCE_H
+#define RESISTANCE_H
+
+#include <stddef.h>
+
+#include "circuits.h"
+#include "sparse.h"
+#include "utils.h"
+
+/* resistance.h
+ * Equivalent resistance between pairs of nodes of a resistor network.
+ *
+ * The conductance matrix G of the network (ground removed) is factored once
+ * into LL^T. The resistance between nodes a and b is then
+ *
+ *	R(a, b) = (e_a - e_b)^T G^-1 (e_a - e_b) = ||L^-1 (e_a - e_b)||^2
+ *
+ * which costs a single forward elimination per pair, starting from the
+ * smaller of the two node indices.
+ *
+ * Nodes are numbered as in the circuit files: node 0 is ground and node
+ * k > 0 is row k - 1 of the reduced incidence matrix.
+ */
+
+struct ResistanceSolver {
+	struct BandMatrix *L;	/* Banded Cholesky factor of G */
+	size_t nnodes;		/* Number of nodes other than ground */
+};
+
+/* Queries are answered this many at a time, so each row of L is read once per batch. */
+#define RESISTANCE_BATCH	8
+
+/* Factor the conductance matrix of a circuit. Only the passive branches
+ * are used (see circuits_build_passive_sparse), so a circuit written for
+ * meshsolve, with its source branch, gives the resistance of the mesh itself.
+ *
+ * Returns:
+ * 0 if operation successful
+ * -1 if the circuit is invalid or some node has no resistive path to ground.
+ */
+int resistance_solver_create(struct ResistanceSolver *rs, const struct CircuitDescription *circuit);
+
+/* Same, from a conductance matrix with the ground node already removed. */
+int resistance_solver_create_from_matrix(struct ResistanceSolver *rs, const struct SparseMatrix *G);
+
+void resistance_solver_destroy(struct ResistanceSolver *rs);
+
+/* Resistance between nodes a and b. */
+double resistance_between(const struct ResistanceSolver *rs, size_t a, size_t b);
+
+/* Resistances between count pairs (a[k], b[k]), stored in R[k]. */
+void resistance_between_batch(const struct ResistanceSolver *rs, size_t count, const size_t *a, const size_t *b, double *R);
+
+/* Entry (i, j) of G^-1, i.e. the voltage at node i for 1 A injected at node j.
+ * Entries involving ground are 0. */
+double resistance_inverse_entry(const struct ResistanceSolver *rs, size_t i, size_t j);
+
+/* Selected inversion
+ *
+ * Computes every entry of G^-1 inside the band of L, with the Takahashi
+ * recurrences, in O(n hb^2) operations. The result is returned in band
+ * storage (lower half, same half bandwidth as L) and gives the resistance
+ * across every branch of the network as Z_ii + Z_jj - 2 Z_ij at once.
+ */
+struct BandMatrix *resistance_selected_inverse(const struct ResistanceSolver *rs);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SCHUR_H
+#define SCHUR_H
+
+#include <stddef.h>
+
+#include "sparse.h"
+#include "utils.h"
+
+/* schur.h
+ * Domain decomposition with a Schur complement, for large SPD systems.
+ *
+ * The graph of A is ordered breadth first from a peripheral node and cut
+ * into contiguous pieces of the ordering. A node is on the interface if it
+ * has a neighbour in an earlier piece; the others are interior, and no
+ * branch joins the interiors of two different pieces. With the interiors
+ * numbered first, A becomes
+ *
+ *	[ A_1            A_1I ]
+ *	[      ...       ...  ]
+ *	[           A_k  A_kI ]
+ *	[ A_I1 ... A_Ik  A_II ]
+ *
+ * Each subdomain factors its interior A_i = L_i L_i^T with the banded
+ * Cholesky kernels, on its own thread, and forms its share of the Schur
+ * complement
+ *
+ *	S = A_II - sum_i A_Ii A_i^-1 A_iI = A_II - sum_i Y_i^T Y_i,  Y_i = L_i^-1 A_iI
+ *
+ * which is factored with dense Cholesky. A solve then takes one parallel
+ * solve per subdomain for the interface right side, the interface solve,
+ * and one more parallel solve per subdomain for the interiors.
+ *
+ * The threads only run the row kernels of cholesky.h, so no allocation or
+ * performance recording happens outside the calling thread.
+ */
+
+struct SchurOptions {
+	size_t subdomains;		/* Number of pieces, 0 for one per CPU (at least 2) */
+};
+
+struct SchurStats {
+	size_t subdomains;
+	size_t interface;		/* Interface nodes, the order of S */
+	double setup_time;		/* Seconds spent partitioning and factoring */
+	double solve_time;		/* Seconds spent in the solve */
+};
+
+struct SchurSubdomain {
+	size_t n;			/* Interior nodes */
+	size_t *nodes;			/* Unknown of each interior node, in local order */
+	size_t ninterface;		/* Interface nodes next to the interior */
+	size_t *interface;		/* Their positions in the interface */
+	struct BandMatrix *L;		/* Cholesky factor of A_i */
+	double **rows;			/* Rows of L, for the kernels */
+	struct SparseMatrix *coupling;	/* A_Ii in local numbering, ninterface x n, NULL if ninterface is 0 */
+	double *work;			/* n doubles */
+	double *Y;			/* Setup only: Y_i by columns, n x ninterface */
+	size_t *first;			/* Setup only: first nonzero of each column of Y_i */
+	double *schur;			/* Setup only: Y_i^T Y_i, ninterface x ninterface */
+	int status;			/* Set by the setup thread, 0 if A_i is positive-definite */
+};
+
+struct SchurSolver {
+	size_t n;
+	struct SchurSubdomain *subdomains;
+	size_t nsubdomains;
+	size_t ninterface;
+	size_t *interface;		/* Unknown of each interface node */
+	struct Matrix *S;		/* Cholesky factor of the Schur complement, NULL if no interface */
+	double *g;			/* ninterface doubles */
+};
+
+/* Default options: one subdomain per CPU, at least 2. */
+void schur_default_options(struct SchurOptions *options);
+
+/* Partition A and factor the subdomains and the Schur complement. A may be
+ * released afterwards. Returns NULL if A is not positive-definite. */
+struct SchurSolver *schur_setup(const struct SparseMatrix *A, const struct SchurOptions *options);
+
+void schur_delete(struct SchurSolver *solver);
+
+/* Solve Ax = b with the factored system. b and x may be the same array. */
+void schur_solve(const struct SchurSolver *solver, const double *b, double *x);
+
+/* Schur solve system
+ *
+ * Solve Ax = b by domain decomposition, for a symmetric positive-definite A.
+ *
+ * Returns:
+ * 0 if operation successful
+ * -1 if A is not positive-definite.
+ */
+int schur_solve_system(struct Vector **xp, const struct SparseMatrix *A, const struct Vector *b, const struct SchurOptions *options, struct SchurStats *stats);
+
+#endif
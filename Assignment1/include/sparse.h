@@ -0,0 +1,59 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stddef.h>
+
+#include "utils.h"
+
+/* sparse.h
+ * Sparse matrices in compressed sparse row (CSR) format.
+ *
+ * The nonzeros of row i are values[row_ptr[i]] ... values[row_ptr[i + 1] - 1],
+ * with their column indices in col_idx. Columns are sorted in increasing
+ * order within each row and appear at most once.
+ *
+ * Most operations expect a square matrix (m == n); rectangular ones are
+ * used for the transfer operators between multigrid levels.
+ */
+
+struct SparseMatrix {
+	size_t *row_ptr;
+	size_t *col_idx;
+	double *values;
+	size_t m;
+	size_t n;
+	size_t nnz;
+};
+
+/* Build an m x n CSR matrix from a list of nnz (row, column, value) triplets.
+ * Duplicate entries are summed. */
+struct SparseMatrix *SparseMatrix_from_triplets(size_t m, size_t n, size_t nnz, const size_t *rows, const size_t *cols, const double *values);
+
+/* Build a CSR matrix from the nonzero entries of a square dense matrix. */
+struct SparseMatrix *SparseMatrix_from_dense(const struct Matrix *M);
+
+void SparseMatrix_delete(struct SparseMatrix *S);
+
+/* Compute y = Sx (x has n entries, y has m). The arrays x and y must not overlap. */
+void SparseMatrix_multiply_vector(const struct SparseMatrix *S, const double *x, double *y);
+
+/* Return the value stored at (i, j), or 0.0 if the entry is not in the pattern. */
+double SparseMatrix_get(const struct SparseMatrix *S, size_t i, size_t j);
+
+/* Half bandwidth in the same convention as cholesky_solve_system_banded:
+ * the smallest hb such that S[i][j] == 0 whenever |i - j| >= hb. */
+size_t SparseMatrix_half_bandwidth(const struct SparseMatrix *S);
+
+/* Expand into a dense matrix (for the direct solvers). */
+struct Matrix *SparseMatrix_to_dense(const struct SparseMatrix *S);
+
+/* Copy the lower band of a square matrix into band storage with half bandwidth hb.
+ * Entries outside the band are dropped. */
+struct BandMatrix *SparseMatrix_to_band(const struct SparseMatrix *S, size_t hb);
+
+struct SparseMatrix *SparseMatrix_transpose(const struct SparseMatrix *S);
+
+/* Galerkin product P^T A P, where A is n x n and P is n x k. */
+struct SparseMatrix *SparseMatrix_galerkin(const struct SparseMatrix *A, const struct SparseMatrix *P);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+#include <stddef.h>
+
+#include "lattice.h"
+#include "operator.h"
+#include "utils.h"
+
+/* stencil.h
+ * Matrix-free nodal operator of a resistor lattice.
+ *
+ * The nodal matrix of a lattice has at most five nonzeros per row: the sum
+ * of the conductances at a node and minus the conductance to each of its
+ * four neighbours. Instead of assembling it, the operator keeps the branch
+ * conductances and the diagonal, three doubles per node, and forms y = Ax
+ * row by row of the lattice. The unknowns are numbered as in the circuit
+ * files and multigrid.h: unknown k is node k for k < ground and node k + 1
+ * otherwise.
+ *
+ * Rows away from the ground node are done by a kernel over whole lattice
+ * rows, vectorized with SSE2 where the compiler targets it.
+ */
+
+struct StencilOperator {
+	size_t rows;
+	size_t cols;
+	size_t ground;		/* Node index of the ground node */
+	double *horizontal;	/* rows x (cols - 1) conductances, laid out like Lattice */
+	double *vertical;	/* (rows - 1) x cols conductances */
+	double *diag;		/* rows x cols sums of the conductances at each node */
+	double *zeros;		/* cols zeros, the missing neighbour row at the lattice edges */
+};
+
+/* Operator of a lattice with node 'ground' grounded and the nextra extra
+ * branches added. Extra branches must join ground to a lattice node or two
+ * neighbouring lattice nodes. Returns NULL if one does not. */
+struct StencilOperator *StencilOperator_from_lattice(const struct Lattice *lattice, size_t ground, const struct LatticeBranch *extra, size_t nextra);
+
+void StencilOperator_delete(struct StencilOperator *S);
+
+/* Number of unknowns: every node but the ground */
+size_t StencilOperator_size(const struct StencilOperator *S);
+
+/* y = Ax. The arrays x and y must not overlap. */
+void StencilOperator_multiply(const struct StencilOperator *S, const double *x, double *y);
+
+/* Fill op with the operator of S, for the iterative solvers. */
+void StencilOperator_operator(const struct StencilOperator *S, struct LinearOperator *op);
+
+/* Right-hand side A(J - YE) of the extra branches, whose sources drive the
+ * lattice, in the same unknown numbering. */
+struct Vector *StencilOperator_sources(const struct StencilOperator *S, const struct LatticeBranch *extra, size_t nextra);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/* timer.h
+ * Wall-clock timing of solver phases.
+ */
+
+/* Seconds elapsed since an arbitrary fixed point, from a monotonic clock.
+ * Only differences between two calls are meaningful. */
+double timer_now(void);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
 #include <stddef.h>
 
 /* utils.h
@@ -18,6 +19,19 @@ struct Matrix {
 	size_t n;
 };
 
+/* Symmetric band matrix with half bandwidth hb, of which only the lower
+ * half is stored, row by row: row i holds columns i - hb + 1 ... i in
+ * entries[i * hb] ... entries[i * hb + hb - 1]. Positions left of column 0
+ * in the first rows are unused. */
+struct BandMatrix {
+	double *entries;
+	size_t n;
+	size_t hb;
+};
+
+/* Entry (i, j) of a band matrix, for j <= i < j + hb. */
+#define BAND_ENTRY(B, i, j)	((B)->entries[(i) * (B)->hb + (B)->hb - 1 - ((i) - (j))])
+
 enum MatrixPattern {
 	MATRIX_PATTERN_NONE = 0,
 	MATRIX_PATTERN_LOWER_TRIANGULAR,
@@ -31,8 +45,54 @@ double random_double_in_range(double max_absvalue, double resolution);
 /* Exit program with errormsg printed on stderr. */
 void exit_with_error(const char *errmsg);
 
-/* Attempt to malloc memory for 'count' elements of size 'size', or exit with error. */
-void *malloc_or_fail(size_t count, size_t size);
+/* Attempt to malloc memory for 'count' elements of size 'size', or exit with error.
+ * The call site is recorded when allocation accounting is enabled. */
+#define malloc_or_fail(count, size)	malloc_or_fail_at((count), (size), __FILE__, __LINE__)
+void *malloc_or_fail_at(size_t count, size_t size, const char *file, int line);
+
+/* Free memory obtained from malloc_or_fail. Same as free() when accounting
+ * is disabled; otherwise the block is removed from the live total. */
+void free_tracked(void *ptr);
+
+/* Total bytes requested from malloc_or_fail since counting was enabled,
+ * by malloc_counting_enable or malloc_accounting_enable. The count is kept
+ * under a lock, and only while one of them is on. */
+void malloc_counting_enable(void);
+size_t malloc_allocated_bytes(void);
+
+/* Same, for the calling thread alone, and only with malloc_counting_enable. */
+size_t malloc_thread_allocated_bytes(void);
+
+/* Allocation accounting
+ *
+ * Once enabled, every block from malloc_or_fail is recorded with its size
+ * and call site until it is released with free_tracked, giving the live and
+ * peak bytes of the program and a histogram per call site. Blocks allocated
+ * before accounting was enabled, or released with plain free(), are not
+ * followed. Accounting is meant for measurement runs: each allocation and
+ * free costs a hash table lookup, under the lock that lets threads
+ * allocate at the same time. Enable it before any thread starts.
+ */
+
+/* Power of two size classes of the allocation histogram: class k counts
+ * blocks of 2^k up to 2^(k+1) - 1 bytes, the last class everything larger. */
+#define MALLOC_SIZE_CLASSES	32
+
+struct MallocStats {
+	unsigned long allocations;	/* Blocks allocated while enabled */
+	unsigned long frees;		/* Blocks released with free_tracked */
+	size_t live_bytes;		/* Bytes still allocated */
+	size_t peak_bytes;		/* Largest value of live_bytes */
+	size_t total_bytes;		/* Bytes allocated while enabled */
+};
+
+void malloc_accounting_enable(void);
+int malloc_accounting_enabled(void);
+void malloc_accounting_stats(struct MallocStats *stats);
+
+/* Print the totals, the size histogram and the call sites sorted by the
+ * bytes they allocated. Returns 0, or -1 on a write error. */
+int malloc_accounting_report(FILE *filePtr);
 
 /* Vector operations */
 struct Vector *Vector_new(size_t n);
@@ -55,4 +115,8 @@ struct Matrix *Matrix_multiply(const struct Matrix *A, const struct Matrix *B);
 struct Matrix *Matrix_transpose(const struct Matrix *A);
 int Matrix_is_symmetric(const struct Matrix *M);
 
+/* Band matrix operations */
+struct BandMatrix *BandMatrix_zero(size_t n, size_t hb);
+void BandMatrix_delete(struct BandMatrix *B);
+
 #endif
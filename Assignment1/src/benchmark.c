@@ -0,0 +1,837 @@
+/* uname, sysconf and gethostname are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "cholesky.h"
+#include "circuits.h"
+#include "lattice.h"
+#include "operator.h"
+#include "pcg.h"
+#include "perf.h"
+#include "sparse.h"
+#include "stencil.h"
+#include "timer.h"
+#include "utils.h"
+
+/* benchmark.c
+ * Reproducible timings of the solvers, as a baseline for performance
+ * regressions. Every case is run a number of times untimed to warm the
+ * caches, then timed over a number of repetitions; random inputs are
+ * generated from a fixed seed, so two runs with the same options time the
+ * same work. Each case reports the median and percentiles of its samples.
+ */
+
+#define BENCH_MAX_CASES		256
+#define BENCH_MAX_SAMPLES	1000
+
+/* Above this many unknowns the dense solver is left out of the sweeps */
+#define BENCH_DENSE_MAX_NODES	2000
+
+/* One timed repetition */
+struct BenchSample {
+	double seconds;
+	unsigned int iterations;	/* Iterations or cycles, 0 for direct methods */
+	double residual;		/* ||b - Ax||, relative to ||b|| except for the circuit solvers */
+};
+
+struct BenchResult {
+	char name[48];			/* Input: file name, lattice size or matrix size */
+	const char *kind;		/* "file", "lattice" or "spd" */
+	const char *method;
+	size_t n;			/* Unknowns */
+	int status;			/* 0 if every repetition succeeded */
+	unsigned int iterations;	/* Of the last repetition */
+	double residual;		/* Largest over the repetitions */
+	size_t samples;
+	double min, p10, median, p90, max, mean;
+};
+
+/* A case is a run function and its input. The run function times the work
+ * it is benchmarking itself, so setup and checks stay out of the samples. */
+typedef int (*bench_run)(void *data, struct BenchSample *sample);
+
+struct BenchOptions {
+	unsigned int repetitions;
+	unsigned int warmup;
+	unsigned long seed;
+	int quick;
+	const char *filter;
+	const char *directory;
+	const char *csv_path;
+	const char *json_path;
+};
+
+/* Inputs of the different cases */
+
+struct CircuitCase {
+	struct CircuitDescription *circuit;	/* Either this */
+	const struct BranchList *branches;	/* or this */
+	struct CircuitSolverOptions options;
+};
+
+struct FileCase {
+	const char *filename;
+};
+
+struct LatticeCase {
+	size_t N;
+};
+
+struct DenseCase {
+	const struct Matrix *A;
+	const struct Vector *b;
+	size_t hb;
+	const struct SparseMatrix *S;
+	struct PCGOptions pcg;
+};
+
+static struct BenchResult results[BENCH_MAX_CASES];
+static size_t nresults = 0;
+
+/* Progress table, on stderr when a report goes to stdout */
+static FILE *table;
+
+static void print_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-r repetitions] [-w warmup] [-s seed] [-q] [-f filter]\n", name);
+	fprintf(stderr, "       [-d directory] [-c file.csv] [-j file.json]\n");
+	fprintf(stderr, "Times the solvers on the circuits/mesh_*.txt files, on generated\n");
+	fprintf(stderr, "lattices and on random symmetric positive-definite matrices.\n");
+	fprintf(stderr, "Defaults: 10 repetitions after 2 warm-up runs, seed 1. -q uses\n");
+	fprintf(stderr, "smaller sizes, -f runs only the cases whose name or method contains\n");
+	fprintf(stderr, "filter, -d gives the directory of the circuit files (default circuits).\n");
+	fprintf(stderr, "-c and -j write the results as CSV or JSON, with the machine details\n");
+	fprintf(stderr, "(\"-\" for stdout).\n");
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/* Percentile q of n sorted samples, interpolating between the closest ranks. */
+static double percentile(const double *sorted, size_t n, double q)
+{
+	double position = q * (double)(n - 1);
+	size_t k = (size_t)position;
+
+	if (k + 1 >= n)
+		return sorted[n - 1];
+
+	return sorted[k] + (position - (double)k) * (sorted[k + 1] - sorted[k]);
+}
+
+static double relative_residual(const struct Matrix *A, const struct Vector *x, const struct Vector *b)
+{
+	double r, norm_r, norm_b;
+	size_t i, j;
+
+	norm_r = 0.0;
+	norm_b = 0.0;
+
+	for (i = 0; i < A->m; i++) {
+		r = b->entries[i];
+
+		for (j = 0; j < A->n; j++)
+			r -= A->entries[i][j] * x->entries[j];
+
+		norm_r += r * r;
+		norm_b += b->entries[i] * b->entries[i];
+	}
+
+	return (norm_b > 0.0) ? sqrt(norm_r / norm_b) : sqrt(norm_r);
+}
+
+static int selected(const struct BenchOptions *options, const char *name, const char *method)
+{
+	return options->filter == NULL || strstr(name, options->filter) != NULL || strstr(method, options->filter) != NULL;
+}
+
+/* Run a case and store its statistics in the next result. */
+static void bench_case(const struct BenchOptions *options, const char *kind, const char *name, const char *method, size_t n, bench_run run, void *data)
+{
+	struct BenchResult *result;
+	struct BenchSample sample;
+	double samples[BENCH_MAX_SAMPLES];
+	unsigned int k;
+
+	if (!selected(options, name, method))
+		return;
+
+	if (nresults == BENCH_MAX_CASES)
+		exit_with_error("Too many benchmark cases.");
+
+	result = &results[nresults++];
+	sprintf(result->name, "%.47s", name);
+	result->kind = kind;
+	result->method = method;
+	result->n = n;
+	result->status = 0;
+	result->iterations = 0;
+	result->residual = 0.0;
+	result->samples = 0;
+	result->mean = 0.0;
+
+	perf_begin(method);
+
+	for (k = 0; k < options->warmup; k++) {
+		if (run(data, &sample) != 0) {
+			result->status = -1;
+			break;
+		}
+	}
+
+	for (k = 0; result->status == 0 && k < options->repetitions; k++) {
+		if (run(data, &sample) != 0) {
+			result->status = -1;
+			break;
+		}
+
+		samples[result->samples++] = sample.seconds;
+		result->mean += sample.seconds;
+		result->iterations = sample.iterations;
+
+		if (sample.residual > result->residual)
+			result->residual = sample.residual;
+	}
+
+	perf_end(method);
+
+	if (result->status != 0 || result->samples == 0) {
+		result->status = -1;
+		fprintf(table, "%-16s %-12s %8lu  failed\n", result->name, method, (unsigned long)n);
+		return;
+	}
+
+	qsort(samples, result->samples, sizeof *samples, compare_doubles);
+	result->mean /= (double)result->samples;
+	result->min = samples[0];
+	result->max = samples[result->samples - 1];
+	result->p10 = percentile(samples, result->samples, 0.10);
+	result->median = percentile(samples, result->samples, 0.50);
+	result->p90 = percentile(samples, result->samples, 0.90);
+
+	fprintf(table, "%-16s %-12s %8lu %12.6f %12.6f %12.6f %6u %10.2e\n", result->name, method, (unsigned long)n,
+			result->median, result->p10, result->p90, result->iterations, result->residual);
+	fflush(table);
+}
+
+/* Run functions */
+
+static int run_circuit(void *data, struct BenchSample *sample)
+{
+	struct CircuitCase *c = data;
+	struct CircuitSolverStats stats;
+	struct Vector *V;
+	double start;
+
+	start = timer_now();
+
+	if (c->circuit != NULL)
+		V = circuits_solve_voltages_with(c->circuit, &c->options, &stats);
+	else
+		V = circuits_solve_branches_with(c->branches, &c->options, &stats);
+
+	sample->seconds = timer_now() - start;
+
+	if (V == NULL)
+		return -1;
+
+	sample->iterations = stats.iterations;
+	sample->residual = stats.residual_norm;
+	Vector_delete(V);
+
+	return 0;
+}
+
+static int run_parse(void *data, struct BenchSample *sample)
+{
+	struct FileCase *c = data;
+	struct CircuitDescription circuit;
+	double start;
+
+	start = timer_now();
+
+	if (circuits_parse_file(&circuit, c->filename) != 0)
+		return -1;
+
+	sample->seconds = timer_now() - start;
+	sample->iterations = 0;
+	sample->residual = 0.0;
+	circuits_destroy(&circuit);
+
+	return 0;
+}
+
+static int run_spectral(void *data, struct BenchSample *sample)
+{
+	struct LatticeCase *c = data;
+	double start, R;
+
+	start = timer_now();
+	R = lattice_mesh_resistance(c->N);
+	sample->seconds = timer_now() - start;
+	sample->iterations = 0;
+	sample->residual = 0.0;
+
+	return (R > 0.0) ? 0 : -1;
+}
+
+static int run_stencil(void *data, struct BenchSample *sample)
+{
+	struct LatticeCase *c = data;
+	struct Lattice *lattice;
+	struct LatticeBranch source;
+	struct StencilOperator *S;
+	struct LinearOperator op;
+	struct PCGOptions options;
+	struct PCGStats stats;
+	struct Vector *b, *V;
+	double start;
+	int status;
+
+	start = timer_now();
+	lattice = lattice_mesh(c->N, &source);
+	S = StencilOperator_from_lattice(lattice, 0, &source, 1);
+	b = StencilOperator_sources(S, &source, 1);
+	StencilOperator_operator(S, &op);
+
+	pcg_default_options(&options);
+	options.preconditioner = PCG_PRECONDITIONER_JACOBI;
+	status = pcg_solve_operator(&V, &op, b, &options, &stats);
+	sample->seconds = timer_now() - start;
+
+	if (status == 0) {
+		sample->iterations = stats.iterations;
+		sample->residual = stats.relative_residual;
+		Vector_delete(V);
+	}
+
+	Vector_delete(b);
+	StencilOperator_delete(S);
+	Lattice_delete(lattice);
+
+	return status;
+}
+
+static int run_dense(void *data, struct BenchSample *sample)
+{
+	struct DenseCase *c = data;
+	struct Vector *x;
+	double start;
+	int status;
+
+	start = timer_now();
+
+	if (c->hb == 0)
+		status = cholesky_solve_system(&x, c->A, c->b, NULL);
+	else
+		status = cholesky_solve_system_banded(&x, c->A, c->b, NULL, c->hb);
+
+	sample->seconds = timer_now() - start;
+
+	if (status != 0)
+		return -1;
+
+	sample->iterations = 0;
+	sample->residual = relative_residual(c->A, x, c->b);
+	Vector_delete(x);
+
+	return 0;
+}
+
+static int run_band_storage(void *data, struct BenchSample *sample)
+{
+	struct DenseCase *c = data;
+	struct BandMatrix *L;
+	struct Vector *x;
+	double start;
+	int status;
+
+	x = Vector_copy(c->b);
+	start = timer_now();
+	L = SparseMatrix_to_band(c->S, c->hb);
+	status = cholesky_factor_band(L);
+
+	if (status == 0)
+		cholesky_solve_band(L, x->entries);
+
+	sample->seconds = timer_now() - start;
+	BandMatrix_delete(L);
+
+	if (status == 0) {
+		sample->iterations = 0;
+		sample->residual = relative_residual(c->A, x, c->b);
+	}
+
+	Vector_delete(x);
+
+	return status;
+}
+
+static int run_pcg(void *data, struct BenchSample *sample)
+{
+	struct DenseCase *c = data;
+	struct PCGStats stats;
+	struct Vector *x;
+	double start;
+
+	start = timer_now();
+
+	if (pcg_solve_system(&x, c->S, c->b, &c->pcg, &stats) != 0)
+		return -1;
+
+	sample->seconds = timer_now() - start;
+	sample->iterations = stats.iterations;
+	sample->residual = relative_residual(c->A, x, c->b);
+	Vector_delete(x);
+
+	return 0;
+}
+
+/* Case sets */
+
+static const char *circuit_methods[] = {"dense", "banded", "pcg-jacobi", "pcg-ic0", "pcg-mg", "mg", "schur"};
+#define NCIRCUIT_METHODS	(sizeof circuit_methods / sizeof *circuit_methods)
+
+static void bench_files(const struct BenchOptions *options)
+{
+	struct CircuitDescription circuit;
+	struct CircuitCase c;
+	struct FileCase f;
+	char filename[512], name[48];
+	size_t N, k, nnodes;
+
+	for (N = 2; N <= 10; N++) {
+		sprintf(name, "mesh_%lu.txt", (unsigned long)N);
+		sprintf(filename, "%.400s/%.40s", options->directory, name);
+
+		if (circuits_parse_file(&circuit, filename) != 0) {
+			fprintf(stderr, "Skipping %s.\n", filename);
+			continue;
+		}
+
+		nnodes = circuit.A->m;
+		f.filename = filename;
+		bench_case(options, "file", name, "parse", nnodes, run_parse, &f);
+
+		c.circuit = &circuit;
+		c.branches = NULL;
+
+		for (k = 0; k < NCIRCUIT_METHODS; k++) {
+			circuits_default_options(&c.options);
+			circuits_parse_method(&c.options, circuit_methods[k]);
+			bench_case(options, "file", name, circuit_methods[k], nnodes, run_circuit, &c);
+		}
+
+		circuits_destroy(&circuit);
+	}
+}
+
+static void bench_lattices(const struct BenchOptions *options)
+{
+	static const size_t sizes[] = {10, 20, 40, 80};
+	struct BranchList *branches;
+	struct CircuitCase c;
+	struct LatticeCase l;
+	char name[48];
+	size_t k, m, nsizes, nnodes;
+
+	nsizes = options->quick ? 2 : sizeof sizes / sizeof *sizes;
+
+	for (k = 0; k < nsizes; k++) {
+		sprintf(name, "lattice_%lu", (unsigned long)sizes[k]);
+		branches = lattice_mesh_circuit(sizes[k]);
+		nnodes = branches->nnodes - 1;
+
+		c.circuit = NULL;
+		c.branches = branches;
+
+		for (m = 0; m < NCIRCUIT_METHODS; m++) {
+			if (strcmp(circuit_methods[m], "dense") == 0 && nnodes > BENCH_DENSE_MAX_NODES)
+				continue;
+
+			circuits_default_options(&c.options);
+			circuits_parse_method(&c.options, circuit_methods[m]);
+			bench_case(options, "lattice", name, circuit_methods[m], nnodes, run_circuit, &c);
+		}
+
+		l.N = sizes[k];
+		bench_case(options, "lattice", name, "stencil", nnodes, run_stencil, &l);
+		bench_case(options, "lattice", name, "spectral", nnodes, run_spectral, &l);
+
+		BranchList_delete(branches);
+	}
+}
+
+/* Random SPD matrix with half bandwidth hb (n for a full matrix), made
+ * diagonally dominant so it is safely positive-definite. */
+static struct Matrix *random_spd(size_t n, size_t hb)
+{
+	struct Matrix *A;
+	double offdiag;
+	size_t i, j;
+
+	A = Matrix_zero(n, n);
+
+	for (i = 0; i < n; i++) {
+		offdiag = 0.0;
+
+		for (j = (i + 1 > hb) ? i + 1 - hb : 0; j < i; j++) {
+			A->entries[i][j] = random_double_in_range(1.0, 0.001);
+			A->entries[j][i] = A->entries[i][j];
+		}
+
+		for (j = 0; j < n; j++) {
+			if (j != i)
+				offdiag += fabs(A->entries[i][j]);
+		}
+
+		/* Rows after i are filled later, so leave room for them */
+		A->entries[i][i] = offdiag + (double)hb + 1.0;
+	}
+
+	return A;
+}
+
+static void bench_spd(const struct BenchOptions *options)
+{
+	static const size_t sizes[] = {100, 200, 400};
+	static const size_t hbs[] = {0, 10};
+	struct DenseCase c;
+	struct Matrix *A;
+	struct Vector *b;
+	char name[48];
+	size_t k, h, nsizes, hb;
+
+	nsizes = options->quick ? 2 : sizeof sizes / sizeof *sizes;
+
+	for (k = 0; k < nsizes; k++) {
+		for (h = 0; h < sizeof hbs / sizeof *hbs; h++) {
+			hb = (hbs[h] == 0) ? sizes[k] : hbs[h];
+
+			/* Each matrix depends only on the seed and its size */
+			srand((unsigned int)(options->seed + 1000 * sizes[k] + hb));
+			A = random_spd(sizes[k], hb);
+			b = Vector_random(sizes[k], 100.0, 0.1);
+
+			if (hb == sizes[k])
+				sprintf(name, "spd_%lu", (unsigned long)sizes[k]);
+			else
+				sprintf(name, "spd_%lu_hb%lu", (unsigned long)sizes[k], (unsigned long)hb);
+
+			c.A = A;
+			c.b = b;
+			c.S = SparseMatrix_from_dense(A);
+			pcg_default_options(&c.pcg);
+
+			c.hb = 0;
+			bench_case(options, "spd", name, "dense", sizes[k], run_dense, &c);
+
+			c.hb = hb;
+			bench_case(options, "spd", name, "banded", sizes[k], run_dense, &c);
+			bench_case(options, "spd", name, "band-storage", sizes[k], run_band_storage, &c);
+
+			c.pcg.preconditioner = PCG_PRECONDITIONER_JACOBI;
+			bench_case(options, "spd", name, "pcg-jacobi", sizes[k], run_pcg, &c);
+			c.pcg.preconditioner = PCG_PRECONDITIONER_IC0;
+			bench_case(options, "spd", name, "pcg-ic0", sizes[k], run_pcg, &c);
+
+			SparseMatrix_delete((struct SparseMatrix *)c.S);
+			Vector_delete(b);
+			Matrix_delete(A);
+		}
+	}
+}
+
+/* Machine details */
+
+struct MachineInfo {
+	char host[128];
+	char system[128];
+	char cpu[128];
+	long cpus;
+	char compiler[128];
+	char date[32];
+};
+
+static void machine_info(struct MachineInfo *info)
+{
+	struct utsname names;
+	FILE *filePtr;
+	char line[256];
+	char *value;
+	time_t now;
+
+	strcpy(info->host, "unknown");
+	strcpy(info->system, "unknown");
+	strcpy(info->cpu, "unknown");
+
+	if (uname(&names) == 0) {
+		sprintf(info->host, "%.127s", names.nodename);
+		sprintf(info->system, "%.40s %.40s %.40s", names.sysname, names.release, names.machine);
+	}
+
+	/* Linux only; elsewhere the CPU stays unknown */
+	filePtr = fopen("/proc/cpuinfo", "r");
+
+	if (filePtr != NULL) {
+		while (fgets(line, sizeof line, filePtr) != NULL) {
+			if (strncmp(line, "model name", 10) != 0 || (value = strchr(line, ':')) == NULL)
+				continue;
+
+			for (++value; *value == ' ' || *value == '\t'; value++)
+				;
+
+			value[strcspn(value, "\n")] = '\0';
+			sprintf(info->cpu, "%.127s", value);
+			break;
+		}
+
+		fclose(filePtr);
+	}
+
+	info->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+#ifdef __VERSION__
+	/* GCC gives only the version number, clang its name as well */
+	sprintf(info->compiler, "%s%.100s%s",
+#if defined(__GNUC__) && !defined(__clang__)
+			"gcc ",
+#else
+			"",
+#endif
+			__VERSION__,
+#ifdef __OPTIMIZE__
+			" (optimized)"
+#else
+			""
+#endif
+			);
+#else
+	strcpy(info->compiler, "unknown");
+#endif
+
+	now = time(NULL);
+	strftime(info->date, sizeof info->date, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+}
+
+static FILE *open_output(const char *path)
+{
+	FILE *filePtr;
+
+	if (strcmp(path, "-") == 0)
+		return stdout;
+
+	filePtr = fopen(path, "w");
+
+	if (filePtr == NULL)
+		perror(path);
+
+	return filePtr;
+}
+
+static int close_output(FILE *filePtr)
+{
+	int status = ferror(filePtr) ? -1 : 0;
+
+	if (filePtr != stdout && fclose(filePtr) != 0)
+		status = -1;
+
+	return status;
+}
+
+/* The machine details go in comment lines, which CSV readers can skip. */
+static int write_csv(const char *path, const struct BenchOptions *options, const struct MachineInfo *info)
+{
+	FILE *filePtr;
+	size_t k;
+
+	if ((filePtr = open_output(path)) == NULL)
+		return -1;
+
+	fprintf(filePtr, "# host: %s\n# system: %s\n# cpu: %s\n# cpus: %ld\n# compiler: %s\n# date: %s\n",
+			info->host, info->system, info->cpu, info->cpus, info->compiler, info->date);
+	fprintf(filePtr, "# seed: %lu\n# warmup: %u\n# repetitions: %u\n", options->seed, options->warmup, options->repetitions);
+	fprintf(filePtr, "kind,name,method,n,status,samples,min,p10,median,p90,max,mean,iterations,residual\n");
+
+	for (k = 0; k < nresults; k++) {
+		fprintf(filePtr, "%s,%s,%s,%lu,%s,%lu,", results[k].kind, results[k].name, results[k].method,
+				(unsigned long)results[k].n, (results[k].status == 0) ? "ok" : "failed", (unsigned long)results[k].samples);
+
+		if (results[k].status == 0)
+			fprintf(filePtr, "%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%u,%.3e\n", results[k].min, results[k].p10, results[k].median,
+					results[k].p90, results[k].max, results[k].mean, results[k].iterations, results[k].residual);
+		else
+			fprintf(filePtr, ",,,,,,,\n");
+	}
+
+	return close_output(filePtr);
+}
+
+/* Strings here come from uname, /proc/cpuinfo and the compiler, so escape them. */
+static void write_json_string(FILE *filePtr, const char *s)
+{
+	fputc('"', filePtr);
+
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', filePtr);
+
+		if ((unsigned char)*s >= 0x20)
+			fputc(*s, filePtr);
+	}
+
+	fputc('"', filePtr);
+}
+
+static int write_json(const char *path, const struct BenchOptions *options, const struct MachineInfo *info)
+{
+	FILE *filePtr;
+	size_t k;
+
+	if ((filePtr = open_output(path)) == NULL)
+		return -1;
+
+	fprintf(filePtr, "{\n\t\"machine\": {\n\t\t\"host\": ");
+	write_json_string(filePtr, info->host);
+	fprintf(filePtr, ",\n\t\t\"system\": ");
+	write_json_string(filePtr, info->system);
+	fprintf(filePtr, ",\n\t\t\"cpu\": ");
+	write_json_string(filePtr, info->cpu);
+	fprintf(filePtr, ",\n\t\t\"cpus\": %ld,\n\t\t\"compiler\": ", info->cpus);
+	write_json_string(filePtr, info->compiler);
+	fprintf(filePtr, ",\n\t\t\"date\": ");
+	write_json_string(filePtr, info->date);
+	fprintf(filePtr, "\n\t},\n\t\"seed\": %lu,\n\t\"warmup\": %u,\n\t\"repetitions\": %u,\n\t\"results\": [",
+			options->seed, options->warmup, options->repetitions);
+
+	for (k = 0; k < nresults; k++) {
+		fprintf(filePtr, "%s\n\t\t{\"kind\": \"%s\", \"name\": ", (k == 0) ? "" : ",", results[k].kind);
+		write_json_string(filePtr, results[k].name);
+		fprintf(filePtr, ", \"method\": \"%s\", \"n\": %lu, \"status\": \"%s\", \"samples\": %lu", results[k].method,
+				(unsigned long)results[k].n, (results[k].status == 0) ? "ok" : "failed", (unsigned long)results[k].samples);
+
+		if (results[k].status == 0)
+			fprintf(filePtr, ", \"min\": %.9f, \"p10\": %.9f, \"median\": %.9f, \"p90\": %.9f, \"max\": %.9f, \"mean\": %.9f, \"iterations\": %u, \"residual\": %.3e",
+					results[k].min, results[k].p10, results[k].median, results[k].p90, results[k].max, results[k].mean,
+					results[k].iterations, results[k].residual);
+
+		fprintf(filePtr, "}");
+	}
+
+	fprintf(filePtr, "%s]\n}\n", (nresults > 0) ? "\n\t" : "");
+
+	return close_output(filePtr);
+}
+
+static int parse_count(const char *s, unsigned long *value)
+{
+	char *end;
+
+	*value = strtoul(s, &end, 10);
+
+	return (*s == '\0' || *end != '\0') ? -1 : 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	struct BenchOptions options;
+	struct MachineInfo info;
+	unsigned long value;
+	int i, status;
+
+	perf_parse_args(&argc, argv);
+
+	options.repetitions = 10;
+	options.warmup = 2;
+	options.seed = 1;
+	options.quick = 0;
+	options.filter = NULL;
+	options.directory = "circuits";
+	options.csv_path = NULL;
+	options.json_path = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			options.quick = 1;
+			continue;
+		}
+
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 == argc) {
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		switch (argv[i][1]) {
+			case 'r':
+				if (parse_count(argv[++i], &value) != 0 || value == 0 || value > BENCH_MAX_SAMPLES)
+					exit_with_error("Repetitions must be between 1 and 1000.");
+
+				options.repetitions = (unsigned int)value;
+				break;
+			case 'w':
+				if (parse_count(argv[++i], &value) != 0 || value > BENCH_MAX_SAMPLES)
+					exit_with_error("Invalid number of warm-up runs.");
+
+				options.warmup = (unsigned int)value;
+				break;
+			case 's':
+				if (parse_count(argv[++i], &options.seed) != 0)
+					exit_with_error("Invalid seed.");
+
+				break;
+			case 'f':
+				options.filter = argv[++i];
+				break;
+			case 'd':
+				options.directory = argv[++i];
+				break;
+			case 'c':
+				options.csv_path = argv[++i];
+				break;
+			case 'j':
+				options.json_path = argv[++i];
+				break;
+			default:
+				print_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	machine_info(&info);
+
+	table = stdout;
+
+	if ((options.csv_path != NULL && strcmp(options.csv_path, "-") == 0) || (options.json_path != NULL && strcmp(options.json_path, "-") == 0))
+		table = stderr;
+
+	fprintf(table, "Host %s, %s, %s, %ld CPUs\n", info.host, info.system, info.cpu, info.cpus);
+	fprintf(table, "Seed %lu, %u warm-up runs, %u repetitions\n\n", options.seed, options.warmup, options.repetitions);
+	fprintf(table, "%-16s %-12s %8s %12s %12s %12s %6s %10s\n", "case", "method", "n", "median (s)", "p10 (s)", "p90 (s)", "iter", "residual");
+
+	bench_files(&options);
+	bench_lattices(&options);
+	bench_spd(&options);
+
+	status = 0;
+
+	if (options.csv_path != NULL && write_csv(options.csv_path, &options, &info) != 0)
+		status = -1;
+
+	if (options.json_path != NULL && write_json(options.json_path, &options, &info) != 0)
+		status = -1;
+
+	return (status == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
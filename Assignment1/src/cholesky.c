@@ -1,6 +1,7 @@
 #include <stddef.h>
 #include <math.h>
 
+#include "perf.h"
 #include "utils.h"
 
 /* Initialize upper triangle values of L to zero. */
@@ -177,17 +178,25 @@ int cholesky_solve_system(struct Vector **xp, const struct Matrix *A, const stru
 	if (!Matrix_is_symmetric(A))
 		return -1;
 
+	perf_begin("factor");
 	L = Matrix_copy(A);
 
 	if (cholesky_decomposition(L->entries, L->n) != 0) {
 		Matrix_delete(L);
+		perf_end("factor");
 		return -1;
 	}
 
+	perf_count("flops", (double)L->n * L->n * L->n / 3.0);
+	perf_end("factor");
+
+	perf_begin("solve");
 	x = Vector_copy(b);
 
 	forward_elimination(x->entries, L->entries, x->n);
 	back_substitution(x->entries, L->entries, x->n);
+	perf_count("flops", 2.0 * (double)x->n * x->n);
+	perf_end("solve");
 
 	if (Lp != NULL) {
 		zero_upper_triangle(L);
@@ -216,17 +225,26 @@ int cholesky_solve_system_banded(struct Vector **xp, const struct Matrix *A, con
 	if (!Matrix_is_symmetric(A))
 		return -1;
 
+	perf_begin("factor");
 	L = Matrix_copy(A);
 
 	if (cholesky_decomposition_banded(L->entries, L->n, hb) != 0) {
 		Matrix_delete(L);
+		perf_end("factor");
 		return -1;
 	}
 
+	perf_count("flops", (double)L->n * hb * hb);
+	perf_end("factor");
+
+	/* The substitutions do not use the band */
+	perf_begin("solve");
 	x = Vector_copy(b);
 
 	forward_elimination(x->entries, L->entries, x->n);
 	back_substitution(x->entries, L->entries, x->n);
+	perf_count("flops", 2.0 * (double)x->n * x->n);
+	perf_end("solve");
 
 	if (Lp != NULL) {
 		zero_upper_triangle(L);
@@ -239,3 +257,158 @@ int cholesky_solve_system_banded(struct Vector **xp, const struct Matrix *A, con
 
 	return 0;
 }
+
+/* See cholesky.h header for documentation */
+int cholesky_factor(struct Matrix *A, size_t hb)
+{
+	int result;
+
+	if (A->m != A->n)
+		exit_with_error("Matrix A must be a square matrix.");
+
+	if (!Matrix_is_symmetric(A))
+		return -1;
+
+	perf_begin("factor");
+
+	if (hb == 0) {
+		result = cholesky_decomposition(A->entries, A->n);
+		perf_count("flops", (double)A->n * A->n * A->n / 3.0);
+	} else {
+		result = cholesky_decomposition_banded(A->entries, A->n, hb);
+		perf_count("flops", (double)A->n * hb * hb);
+	}
+
+	perf_end("factor");
+
+	return result;
+}
+
+/* See cholesky.h header for documentation */
+void cholesky_solve_factored(const struct Matrix *L, double *x)
+{
+	perf_begin("solve");
+	forward_elimination(x, L->entries, L->n);
+	back_substitution(x, L->entries, L->n);
+	perf_count("flops", 2.0 * (double)L->n * L->n);
+	perf_end("solve");
+}
+
+/* Pointers to the rows of a band matrix, for the row kernels. */
+static double **band_rows(const struct BandMatrix *A)
+{
+	double **rows;
+	size_t i;
+
+	rows = malloc_or_fail(A->n, sizeof *rows);
+
+	for (i = 0; i < A->n; i++)
+		rows[i] = &A->entries[i * A->hb];
+
+	return rows;
+}
+
+/* See cholesky.h header for documentation */
+int cholesky_factor_band_rows(double *const *rows, size_t base, size_t hb, size_t first, size_t last)
+{
+	size_t i, j, k, first_i, first_j;
+	double *Li, *Lj;
+	double sum;
+
+	for (i = first; i < last; i++) {
+		first_i = (i + 1 > hb) ? i + 1 - hb : 0;
+		Li = rows[i - base] + hb - 1 - i;	/* Li[k] is L[i][k] for k in the band */
+
+		for (j = first_i; j <= i; j++) {
+			Lj = rows[j - base] + hb - 1 - j;
+			first_j = (j + 1 > hb) ? j + 1 - hb : 0;
+
+			if (first_j < first_i)
+				first_j = first_i;
+
+			/* L[i][j] = (A[i][j] - sum_k L[i][k] L[j][k]) / L[j][j] */
+			sum = Li[j];
+
+			for (k = first_j; k < j; k++)
+				sum -= Li[k] * Lj[k];
+
+			if (j < i) {
+				Li[j] = sum / Lj[j];
+			} else {
+				/* Check that the matrix is positive-definite */
+				if (sum <= 0.0)
+					return -1;
+
+				Li[i] = sqrt(sum);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* See cholesky.h header for documentation */
+void cholesky_forward_band_rows(const double *const *rows, size_t base, size_t hb, size_t first, size_t last, double *x)
+{
+	size_t i, k, first_i;
+	const double *Li;
+	double sum;
+
+	for (i = first; i < last; i++) {
+		first_i = (i + 1 > hb) ? i + 1 - hb : 0;
+		Li = rows[i - base] + hb - 1 - i;
+		sum = x[i];
+
+		for (k = first_i; k < i; k++)
+			sum -= Li[k] * x[k];
+
+		x[i] = sum / Li[i];
+	}
+}
+
+/* See cholesky.h header for documentation */
+void cholesky_backward_band_rows(const double *const *rows, size_t base, size_t hb, size_t first, size_t last, double *x)
+{
+	size_t i, k, first_i;
+	const double *Li;
+
+	/* One column of L^T at a time */
+	for (i = last; i-- > first; ) {
+		first_i = (i + 1 > hb) ? i + 1 - hb : 0;
+		Li = rows[i - base] + hb - 1 - i;
+		x[i] /= Li[i];
+
+		for (k = first_i; k < i; k++)
+			x[k] -= Li[k] * x[i];
+	}
+}
+
+/* See cholesky.h header for documentation */
+int cholesky_factor_band(struct BandMatrix *A)
+{
+	double **rows;
+	int result;
+
+	perf_begin("factor");
+	rows = band_rows(A);
+	result = cholesky_factor_band_rows(rows, 0, A->hb, 0, A->n);
+	free_tracked(rows);
+	perf_count("flops", (double)A->n * A->hb * A->hb);
+	perf_end("factor");
+
+	return result;
+}
+
+/* See cholesky.h header for documentation */
+void cholesky_solve_band(const struct BandMatrix *L, double *x)
+{
+	double **rows;
+
+	perf_begin("solve");
+	rows = band_rows(L);
+	cholesky_forward_band_rows((const double *const *)rows, 0, L->hb, 0, L->n, x);
+	cholesky_backward_band_rows((const double *const *)rows, 0, L->hb, 0, L->n, x);
+	free_tracked(rows);
+	perf_count("flops", 4.0 * (double)L->n * L->hb);
+	perf_end("solve");
+}
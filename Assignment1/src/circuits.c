@@ -1,8 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include "circuits.h"
 #include "cholesky.h"
+#include "multigrid.h"
+#include "operator.h"
+#include "outofcore.h"
+#include "pcg.h"
+#include "perf.h"
+#include "schur.h"
+#include "sparse.h"
+#include "timer.h"
 #include "utils.h"
 
 int circuits_parse_file(struct CircuitDescription *circuit, const char *filename)
@@ -17,6 +27,7 @@ int circuits_parse_file(struct CircuitDescription *circuit, const char *filename
 	double Jk, Rk, Ek;
 	int result = -1;
 
+	perf_begin("parse");
 	filePtr = fopen(filename, "r");
 
 	if (filePtr == NULL) {
@@ -137,6 +148,7 @@ cleanup_A:
 cleanup_filePtr:
 	fclose(filePtr);
 cleanup_:
+	perf_end("parse");
 	return result;
 }
 
@@ -147,6 +159,7 @@ struct Vector *circuits_solve_voltages(const struct CircuitDescription *circuit)
 	struct Vector *V;
 
 	/* Compute M = AYA^T, which is the matrix that is obtained from KCL. */
+	perf_begin("assemble");
 	Atranspose = Matrix_transpose(circuit->A);
 	YAtranspose = Matrix_multiply(circuit->Y, Atranspose);
 	M = Matrix_multiply(circuit->A, YAtranspose);
@@ -161,6 +174,7 @@ struct Vector *circuits_solve_voltages(const struct CircuitDescription *circuit)
 
 	Vector_delete(YE);
 	Vector_delete(JminusYE);
+	perf_end("assemble");
 
 	/* Solve the system (AYA^T)V = A(J - YE) for the node voltages V. */
 	if (cholesky_solve_system(&V, M, b, NULL) != 0)
@@ -179,6 +193,7 @@ struct Vector *circuits_solve_voltages_banded(const struct CircuitDescription *c
 	struct Vector *V;
 
 	/* Compute M = AYA^T, which is the matrix that is obtained from KCL. */
+	perf_begin("assemble");
 	Atranspose = Matrix_transpose(circuit->A);
 	YAtranspose = Matrix_multiply(circuit->Y, Atranspose);
 	M = Matrix_multiply(circuit->A, YAtranspose);
@@ -193,6 +208,7 @@ struct Vector *circuits_solve_voltages_banded(const struct CircuitDescription *c
 
 	Vector_delete(YE);
 	Vector_delete(JminusYE);
+	perf_end("assemble");
 
 	/* Solve the system (AYA^T)V = A(J - YE) for the node voltages V. */
 	if (cholesky_solve_system_banded(&V, M, b, NULL, hb) != 0)
@@ -204,6 +220,753 @@ struct Vector *circuits_solve_voltages_banded(const struct CircuitDescription *c
 	return V;
 }
 
+struct BranchList *BranchList_new(size_t nnodes, size_t nbranches)
+{
+	struct BranchList *branches;
+
+	branches = malloc_or_fail(1, sizeof *branches);
+	branches->from = malloc_or_fail(nbranches, sizeof *(branches->from));
+	branches->to = malloc_or_fail(nbranches, sizeof *(branches->to));
+	branches->J = malloc_or_fail(nbranches, sizeof *(branches->J));
+	branches->R = malloc_or_fail(nbranches, sizeof *(branches->R));
+	branches->E = malloc_or_fail(nbranches, sizeof *(branches->E));
+	branches->nnodes = nnodes;
+	branches->nbranches = nbranches;
+
+	return branches;
+}
+
+void BranchList_delete(struct BranchList *branches)
+{
+	free_tracked(branches->E);
+	free_tracked(branches->R);
+	free_tracked(branches->J);
+	free_tracked(branches->to);
+	free_tracked(branches->from);
+	free_tracked(branches);
+}
+
+int circuits_to_branches(const struct CircuitDescription *circuit, struct BranchList **branchesp)
+{
+	const struct Matrix *A = circuit->A;
+	struct BranchList *branches;
+	size_t nnodes, nbranches;
+	size_t i, j;
+	size_t from, to;
+
+	nnodes = A->m;
+	nbranches = A->n;
+	branches = BranchList_new(nnodes + 1, nbranches);
+
+	for (j = 0; j < nbranches; j++) {
+		/* Find the nodes the branch leaves (+1) and enters (-1).
+		 * A missing end is the ground node, which has no row in A. */
+		from = to = 0;
+
+		for (i = 0; i < nnodes; i++) {
+			if (A->entries[i][j] == 1.0 && from == 0) {
+				from = i + 1;
+			} else if (A->entries[i][j] == -1.0 && to == 0) {
+				to = i + 1;
+			} else if (A->entries[i][j] != 0.0) {
+				fprintf(stderr, "Branch %lu connects more than two nodes.\n", (unsigned long)j);
+				BranchList_delete(branches);
+				return -1;
+			}
+		}
+
+		branches->from[j] = from;
+		branches->to[j] = to;
+		branches->J[j] = circuit->J->entries[j];
+		branches->R[j] = 1.0 / circuit->Y->entries[j][j];
+		branches->E[j] = circuit->E->entries[j];
+	}
+
+	*branchesp = branches;
+
+	return 0;
+}
+
+/* Assemble AYA^T and A(J - YE) branch by branch. If passive_only is set,
+ * branches carrying a source are skipped and bp may be NULL. */
+static void build_nodal(const struct BranchList *branches, int passive_only, struct SparseMatrix **Mp, struct Vector **bp)
+{
+	size_t *rows, *cols;
+	double *values;
+	struct Vector *b;
+	size_t nnodes, nnz;
+	size_t i, j;
+	size_t from, to;
+	double g, source;
+
+	if (branches->nnodes < 2)
+		exit_with_error("Circuit needs at least one node besides ground.");
+
+	perf_begin("assemble");
+
+	/* Ground (node 0) has no equation, node k is unknown k - 1. */
+	nnodes = branches->nnodes - 1;
+
+	/* Each branch contributes at most four entries to AYA^T. */
+	rows = malloc_or_fail(4 * branches->nbranches + 1, sizeof *rows);
+	cols = malloc_or_fail(4 * branches->nbranches + 1, sizeof *cols);
+	values = malloc_or_fail(4 * branches->nbranches + 1, sizeof *values);
+
+	b = Vector_new(nnodes);
+
+	for (i = 0; i < nnodes; i++)
+		b->entries[i] = 0.0;
+
+	nnz = 0;
+
+	for (j = 0; j < branches->nbranches; j++) {
+		from = branches->from[j];
+		to = branches->to[j];
+
+		if (from >= branches->nnodes || to >= branches->nnodes)
+			exit_with_error("Branch node index out of range.");
+
+		if (passive_only && (branches->J[j] != 0.0 || branches->E[j] != 0.0))
+			continue;
+
+		/* A branch from a node to itself carries no current */
+		if (from == to)
+			continue;
+
+		g = 1.0 / branches->R[j];
+		source = branches->J[j] - g * branches->E[j];
+
+		if (from != 0) {
+			rows[nnz] = from - 1;
+			cols[nnz] = from - 1;
+			values[nnz++] = g;
+			b->entries[from - 1] += source;
+		}
+
+		if (to != 0) {
+			rows[nnz] = to - 1;
+			cols[nnz] = to - 1;
+			values[nnz++] = g;
+			b->entries[to - 1] -= source;
+		}
+
+		if (from != 0 && to != 0) {
+			rows[nnz] = from - 1;
+			cols[nnz] = to - 1;
+			values[nnz++] = -g;
+			rows[nnz] = to - 1;
+			cols[nnz] = from - 1;
+			values[nnz++] = -g;
+		}
+	}
+
+	*Mp = SparseMatrix_from_triplets(nnodes, nnodes, nnz, rows, cols, values);
+
+	if (bp != NULL)
+		*bp = b;
+	else
+		Vector_delete(b);
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+	perf_end("assemble");
+}
+
+void circuits_build_nodal_branches(const struct BranchList *branches, struct SparseMatrix **Mp, struct Vector **bp)
+{
+	build_nodal(branches, 0, Mp, bp);
+}
+
+void circuits_build_passive_branches(const struct BranchList *branches, struct SparseMatrix **Gp)
+{
+	build_nodal(branches, 1, Gp, NULL);
+}
+
+int circuits_build_nodal_sparse(const struct CircuitDescription *circuit, struct SparseMatrix **Mp, struct Vector **bp)
+{
+	struct BranchList *branches;
+
+	if (circuits_to_branches(circuit, &branches) != 0)
+		return -1;
+
+	build_nodal(branches, 0, Mp, bp);
+	BranchList_delete(branches);
+
+	return 0;
+}
+
+int circuits_build_passive_sparse(const struct CircuitDescription *circuit, struct SparseMatrix **Gp)
+{
+	struct BranchList *branches;
+
+	if (circuits_to_branches(circuit, &branches) != 0)
+		return -1;
+
+	build_nodal(branches, 1, Gp, NULL);
+	BranchList_delete(branches);
+
+	return 0;
+}
+
+int circuits_write_branches(FILE *filePtr, const struct BranchList *branches)
+{
+	size_t *first, *next;
+	size_t node, j, k;
+	int value;
+
+	/* For each node, chain the branches incident on it so that each row of
+	 * the incidence matrix is written in one pass. */
+	first = malloc_or_fail(branches->nnodes, sizeof *first);
+	next = malloc_or_fail(2 * branches->nbranches, sizeof *next);
+
+	for (node = 0; node < branches->nnodes; node++)
+		first[node] = 2 * branches->nbranches;
+
+	/* Entry 2j is the 'from' end of branch j, 2j + 1 its 'to' end. Inserting
+	 * in reverse keeps every chain in increasing branch order. */
+	for (k = 2 * branches->nbranches; k > 0; k--) {
+		node = ((k - 1) % 2 == 0) ? branches->from[(k - 1) / 2] : branches->to[(k - 1) / 2];
+		next[k - 1] = first[node];
+		first[node] = k - 1;
+	}
+
+	fprintf(filePtr, "%lu %lu\n", (unsigned long)(branches->nnodes - 1), (unsigned long)branches->nbranches);
+
+	/* The reduced incidence matrix has no row for ground */
+	for (node = 1; node < branches->nnodes; node++) {
+		k = first[node];
+
+		for (j = 0; j < branches->nbranches; j++) {
+			value = 0;
+
+			while (k < 2 * branches->nbranches && k / 2 == j) {
+				value += (k % 2 == 0) ? 1 : -1;
+				k = next[k];
+			}
+
+			/* Entries are separated by spaces, rows end with a newline */
+			fprintf(filePtr, "%d%c", value, (j == branches->nbranches - 1) ? '\n' : ' ');
+		}
+	}
+
+	for (j = 0; j < branches->nbranches; j++)
+		fprintf(filePtr, "%.15g %.15g %.15g\n", branches->J[j], branches->R[j], branches->E[j]);
+
+	free_tracked(next);
+	free_tracked(first);
+
+	return ferror(filePtr) ? -1 : 0;
+}
+
+/* Store value in the first 'bytes' bytes of p, least significant first. */
+static void put_little_endian(char *p, size_t value, size_t bytes)
+{
+	size_t k;
+
+	for (k = 0; k < bytes; k++) {
+		p[k] = (char)(value & 0xff);
+		value >>= 8;
+	}
+}
+
+/* Read an integer stored by put_little_endian. Returns -1 if it does not fit in a size_t. */
+static int get_little_endian(const unsigned char *p, size_t bytes, size_t *value)
+{
+	size_t k;
+
+	*value = 0;
+
+	for (k = bytes; k > 0; k--) {
+		if (*value > ((size_t)-1) >> 8)
+			return -1;
+
+		*value = (*value << 8) | p[k - 1];
+	}
+
+	return 0;
+}
+
+/* See circuits.h header for documentation */
+size_t circuits_format_branch_header(char *buffer, enum BranchFileFormat format, size_t nnodes, size_t nbranches)
+{
+	double one = 1.0;
+
+	if (format == BRANCH_FILE_TEXT)
+		return (size_t)sprintf(buffer, "branches %lu %lu\n", (unsigned long)nnodes, (unsigned long)nbranches);
+
+	memcpy(buffer, BRANCH_MAGIC, 8);
+	put_little_endian(buffer + 8, nnodes, 8);
+	put_little_endian(buffer + 16, nbranches, 8);
+	memcpy(buffer + 24, &one, sizeof one);
+
+	return BRANCH_HEADER_SIZE;
+}
+
+/* See circuits.h header for documentation */
+size_t circuits_format_branch(char *buffer, enum BranchFileFormat format, size_t from, size_t to, double J, double R, double E)
+{
+	/* %.17g reads back to the same double */
+	if (format == BRANCH_FILE_TEXT)
+		return (size_t)sprintf(buffer, "%lu %lu %.17g %.17g %.17g\n", (unsigned long)from, (unsigned long)to, J, R, E);
+
+	put_little_endian(buffer, from, 4);
+	put_little_endian(buffer + 4, to, 4);
+	memcpy(buffer + 8, &J, sizeof J);
+	memcpy(buffer + 16, &R, sizeof R);
+	memcpy(buffer + 24, &E, sizeof E);
+
+	return BRANCH_RECORD_SIZE;
+}
+
+/* See circuits.h header for documentation */
+int circuits_write_branch_file(FILE *filePtr, const struct BranchList *branches, enum BranchFileFormat format)
+{
+	char buffer[BRANCH_TEXT_MAX];
+	size_t j, length;
+
+	if (format == BRANCH_FILE_INCIDENCE)
+		return circuits_write_branches(filePtr, branches);
+
+	if (format == BRANCH_FILE_BINARY && (branches->nnodes - 1) >> 16 >> 16 != 0) {
+		fprintf(stderr, "Too many nodes for the binary branch format.\n");
+		return -1;
+	}
+
+	length = circuits_format_branch_header(buffer, format, branches->nnodes, branches->nbranches);
+	fwrite(buffer, 1, length, filePtr);
+
+	for (j = 0; j < branches->nbranches; j++) {
+		length = circuits_format_branch(buffer, format, branches->from[j], branches->to[j], branches->J[j], branches->R[j], branches->E[j]);
+		fwrite(buffer, 1, length, filePtr);
+	}
+
+	return ferror(filePtr) ? -1 : 0;
+}
+
+/* Read the branches of a binary branch list after its magic. */
+static int read_binary_branches(FILE *filePtr, struct BranchList **branchesp)
+{
+	unsigned char buffer[BRANCH_HEADER_SIZE];
+	struct BranchList *branches;
+	size_t nnodes, nbranches, j;
+	double one = 1.0;
+
+	if (fread(buffer + 8, 1, BRANCH_HEADER_SIZE - 8, filePtr) != BRANCH_HEADER_SIZE - 8) {
+		fprintf(stderr, "Truncated branch list header.\n");
+		return -1;
+	}
+
+	if (get_little_endian(buffer + 8, 8, &nnodes) != 0 || get_little_endian(buffer + 16, 8, &nbranches) != 0) {
+		fprintf(stderr, "Branch list too large for this machine.\n");
+		return -1;
+	}
+
+	if (memcmp(buffer + 24, &one, sizeof one) != 0) {
+		fprintf(stderr, "Branch list written with a different byte order.\n");
+		return -1;
+	}
+
+	if (nnodes < 2 || nbranches == 0) {
+		fprintf(stderr, "Node and branch counts cannot be zero.\n");
+		return -1;
+	}
+
+	branches = BranchList_new(nnodes, nbranches);
+
+	for (j = 0; j < nbranches; j++) {
+		if (fread(buffer, 1, BRANCH_RECORD_SIZE, filePtr) != BRANCH_RECORD_SIZE) {
+			fprintf(stderr, "Truncated branch list.\n");
+			BranchList_delete(branches);
+			return -1;
+		}
+
+		get_little_endian(buffer, 4, &branches->from[j]);
+		get_little_endian(buffer + 4, 4, &branches->to[j]);
+		memcpy(&branches->J[j], buffer + 8, sizeof(double));
+		memcpy(&branches->R[j], buffer + 16, sizeof(double));
+		memcpy(&branches->E[j], buffer + 24, sizeof(double));
+	}
+
+	*branchesp = branches;
+
+	return 0;
+}
+
+/* Read the branches of a text branch list after its "branches" keyword. */
+static int read_text_branches(FILE *filePtr, struct BranchList **branchesp)
+{
+	struct BranchList *branches;
+	unsigned long nnodes, nbranches, from, to;
+	size_t j;
+
+	if (fscanf(filePtr, "%lu %lu", &nnodes, &nbranches) != 2) {
+		perror("fscanf");
+		return -1;
+	}
+
+	if (nnodes < 2 || nbranches == 0) {
+		fprintf(stderr, "Node and branch counts cannot be zero.\n");
+		return -1;
+	}
+
+	branches = BranchList_new(nnodes, nbranches);
+
+	for (j = 0; j < nbranches; j++) {
+		if (fscanf(filePtr, "%lu %lu %lf %lf %lf", &from, &to, &branches->J[j], &branches->R[j], &branches->E[j]) != 5) {
+			fprintf(stderr, "Expected %lu branches, read %lu.\n", nbranches, (unsigned long)j);
+			BranchList_delete(branches);
+			return -1;
+		}
+
+		branches->from[j] = from;
+		branches->to[j] = to;
+	}
+
+	*branchesp = branches;
+
+	return 0;
+}
+
+/* See circuits.h header for documentation */
+int circuits_read_branches(const char *filename, struct BranchList **branchesp)
+{
+	struct CircuitDescription circuit;
+	struct BranchList *branches;
+	FILE *filePtr;
+	char magic[8];
+	size_t j;
+	int result;
+
+	filePtr = fopen(filename, "rb");
+
+	if (filePtr == NULL) {
+		perror("fopen");
+		return -1;
+	}
+
+	if (fread(magic, 1, sizeof magic, filePtr) != sizeof magic)
+		memset(magic, 0, sizeof magic);
+
+	/* The incidence format starts with a number */
+	if (memcmp(magic, BRANCH_MAGIC, 8) != 0 && memcmp(magic, "branches", 8) != 0) {
+		fclose(filePtr);
+
+		if (circuits_parse_file(&circuit, filename) != 0)
+			return -1;
+
+		result = circuits_to_branches(&circuit, branchesp);
+		circuits_destroy(&circuit);
+
+		return result;
+	}
+
+	perf_begin("parse");
+
+	if (memcmp(magic, BRANCH_MAGIC, 8) == 0)
+		result = read_binary_branches(filePtr, &branches);
+	else
+		result = read_text_branches(filePtr, &branches);
+
+	fclose(filePtr);
+
+	for (j = 0; result == 0 && j < branches->nbranches; j++) {
+		if (branches->from[j] >= branches->nnodes || branches->to[j] >= branches->nnodes || branches->from[j] == branches->to[j]) {
+			fprintf(stderr, "Branch %lu does not join two nodes of the circuit.\n", (unsigned long)j);
+			result = -1;
+		} else if (branches->R[j] == 0.0) {
+			fprintf(stderr, "Branch with zero resistance is not supported.\n");
+			result = -1;
+		}
+
+		if (result != 0)
+			BranchList_delete(branches);
+	}
+
+	if (result == 0)
+		*branchesp = branches;
+
+	perf_end("parse");
+
+	return result;
+}
+
+void circuits_default_options(struct CircuitSolverOptions *options)
+{
+	options->method = CIRCUIT_SOLVER_AUTO;
+	pcg_default_options(&options->pcg);
+	multigrid_default_options(&options->multigrid);
+	options->band_memory = 0;
+	schur_default_options(&options->schur);
+}
+
+int circuits_parse_method(struct CircuitSolverOptions *options, const char *name)
+{
+	char *end;
+
+	if (strcmp(name, "auto") == 0) {
+		options->method = CIRCUIT_SOLVER_AUTO;
+	} else if (strcmp(name, "dense") == 0) {
+		options->method = CIRCUIT_SOLVER_DENSE;
+	} else if (strcmp(name, "banded") == 0) {
+		options->method = CIRCUIT_SOLVER_BANDED;
+	} else if (strcmp(name, "banded-ooc") == 0) {
+		options->method = CIRCUIT_SOLVER_BANDED;
+		options->band_memory = OUTOFCORE_DEFAULT_BUDGET;
+	} else if (strncmp(name, "banded-ooc=", 11) == 0) {
+		options->method = CIRCUIT_SOLVER_BANDED;
+		options->band_memory = (size_t)strtoul(name + 11, &end, 10) << 20;
+
+		if (name[11] == '\0' || *end != '\0' || options->band_memory == 0)
+			return -1;
+	} else if (strcmp(name, "schur") == 0) {
+		options->method = CIRCUIT_SOLVER_SCHUR;
+	} else if (strncmp(name, "schur=", 6) == 0) {
+		options->method = CIRCUIT_SOLVER_SCHUR;
+		options->schur.subdomains = (size_t)strtoul(name + 6, &end, 10);
+
+		if (name[6] == '\0' || *end != '\0' || options->schur.subdomains == 0)
+			return -1;
+	} else if (strcmp(name, "mg") == 0) {
+		options->method = CIRCUIT_SOLVER_MULTIGRID;
+	} else if (strcmp(name, "pcg") == 0) {
+		options->method = CIRCUIT_SOLVER_PCG;
+	} else if (strcmp(name, "pcg-none") == 0) {
+		options->method = CIRCUIT_SOLVER_PCG;
+		options->pcg.preconditioner = PCG_PRECONDITIONER_NONE;
+	} else if (strcmp(name, "pcg-jacobi") == 0) {
+		options->method = CIRCUIT_SOLVER_PCG;
+		options->pcg.preconditioner = PCG_PRECONDITIONER_JACOBI;
+	} else if (strcmp(name, "pcg-ssor") == 0) {
+		options->method = CIRCUIT_SOLVER_PCG;
+		options->pcg.preconditioner = PCG_PRECONDITIONER_SSOR;
+	} else if (strcmp(name, "pcg-ic0") == 0) {
+		options->method = CIRCUIT_SOLVER_PCG;
+		options->pcg.preconditioner = PCG_PRECONDITIONER_IC0;
+	} else if (strcmp(name, "pcg-mg") == 0) {
+		options->method = CIRCUIT_SOLVER_PCG;
+		options->pcg.preconditioner = PCG_PRECONDITIONER_MULTIGRID;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+const char *circuits_method_name(enum CircuitSolverMethod method)
+{
+	switch (method) {
+		case CIRCUIT_SOLVER_DENSE:
+			return "dense";
+		case CIRCUIT_SOLVER_BANDED:
+			return "banded";
+		case CIRCUIT_SOLVER_PCG:
+			return "pcg";
+		case CIRCUIT_SOLVER_MULTIGRID:
+			return "mg";
+		case CIRCUIT_SOLVER_SCHUR:
+			return "schur";
+		case CIRCUIT_SOLVER_AUTO:
+		default:
+			return "auto";
+	}
+}
+
+enum CircuitSolverMethod circuits_choose_method(const struct SparseMatrix *M)
+{
+	size_t n = M->n;
+
+	/* Large sparse systems: the direct solvers need n hb to n^2 doubles of
+	 * storage, PCG only needs the nonzeros and a few vectors. */
+	if (n > CIRCUIT_AUTO_DIRECT_MAX_NODES && M->nnz < n * (n / 4))
+		return CIRCUIT_SOLVER_PCG;
+
+	/* Banded elimination pays off when the band is narrow compared to n. */
+	if (4 * SparseMatrix_half_bandwidth(M) <= n)
+		return CIRCUIT_SOLVER_BANDED;
+
+	return CIRCUIT_SOLVER_DENSE;
+}
+
+/* Banded Cholesky with the band in a scratch file. factoredp receives the
+ * time the factorization ended. Returns 0, or -1 if it failed. */
+static int solve_band_out_of_core(const struct SparseMatrix *M, size_t hb, const struct Vector *b, size_t budget, struct Vector **Vp, double *factoredp)
+{
+	struct OutOfCoreOptions options;
+	struct OutOfCoreBand *L;
+	int result;
+
+	outofcore_default_options(&options);
+	options.memory_budget = budget;
+	*factoredp = timer_now();
+
+	if ((L = OutOfCoreBand_from_sparse(M, hb, &options)) == NULL)
+		return -1;
+
+	result = outofcore_cholesky_factor(L);
+	*factoredp = timer_now();
+
+	if (result == 0) {
+		*Vp = Vector_copy(b);
+
+		if (outofcore_cholesky_solve(L, (*Vp)->entries) != 0) {
+			Vector_delete(*Vp);
+			*Vp = NULL;
+			result = -1;
+		}
+	}
+
+	OutOfCoreBand_delete(L);
+
+	return result;
+}
+
+struct Vector *circuits_solve_branches_with(const struct BranchList *branches, const struct CircuitSolverOptions *options, struct CircuitSolverStats *stats)
+{
+	struct SparseMatrix *M;
+	struct Matrix *D;
+	struct BandMatrix *B;
+	struct Vector *b, *V;
+	struct PCGOptions pcg_options;
+	struct PCGStats pcg_stats;
+	struct MultigridStats mg_stats;
+	struct SchurStats schur_stats;
+	struct LatticeInfo lattice;
+	enum CircuitSolverMethod method;
+	struct LinearOperator op;
+	size_t hb;
+	double *r;
+	double rnorm;
+	double start, assembled, factored;
+	int result;
+
+	start = timer_now();
+	circuits_build_nodal_branches(branches, &M, &b);
+	assembled = timer_now();
+
+	method = options->method;
+	pcg_options = options->pcg;
+	pcg_options.multigrid = &options->multigrid;
+
+	if (method == CIRCUIT_SOLVER_AUTO) {
+		method = circuits_choose_method(M);
+
+		/* On a lattice, a multigrid V-cycle is by far the best preconditioner */
+		if (method == CIRCUIT_SOLVER_PCG && (options->multigrid.lattice != NULL || multigrid_detect_lattice(M, &lattice) == 0))
+			pcg_options.preconditioner = PCG_PRECONDITIONER_MULTIGRID;
+	}
+
+	hb = SparseMatrix_half_bandwidth(M);
+	pcg_stats.iterations = 0;
+	pcg_stats.setup_time = 0.0;
+	pcg_stats.solve_time = 0.0;
+	schur_stats.subdomains = 0;
+	V = NULL;
+
+	switch (method) {
+		case CIRCUIT_SOLVER_PCG:
+			result = pcg_solve_system(&V, M, b, &pcg_options, &pcg_stats);
+			break;
+
+		case CIRCUIT_SOLVER_MULTIGRID:
+			result = multigrid_solve_system(&V, M, b, &options->multigrid, &mg_stats);
+			pcg_stats.iterations = mg_stats.cycles;
+			pcg_stats.setup_time = mg_stats.setup_time;
+			pcg_stats.solve_time = mg_stats.solve_time;
+			break;
+
+		case CIRCUIT_SOLVER_SCHUR:
+			result = schur_solve_system(&V, M, b, &options->schur, &schur_stats);
+			pcg_stats.setup_time = schur_stats.setup_time;
+			pcg_stats.solve_time = schur_stats.solve_time;
+			break;
+
+		case CIRCUIT_SOLVER_BANDED:
+			if (options->band_memory != 0 && M->n > options->band_memory / sizeof(double) / hb) {
+				result = solve_band_out_of_core(M, hb, b, options->band_memory, &V, &factored);
+			} else {
+				perf_begin("convert");
+				B = SparseMatrix_to_band(M, hb);
+				perf_end("convert");
+				result = cholesky_factor_band(B);
+				factored = timer_now();
+
+				if (result == 0) {
+					V = Vector_copy(b);
+					cholesky_solve_band(B, V->entries);
+				}
+
+				BandMatrix_delete(B);
+			}
+
+			pcg_stats.setup_time = factored - assembled;
+			pcg_stats.solve_time = timer_now() - factored;
+			break;
+
+		case CIRCUIT_SOLVER_DENSE:
+		case CIRCUIT_SOLVER_AUTO:
+		default:
+			perf_begin("convert");
+			D = SparseMatrix_to_dense(M);
+			perf_end("convert");
+			result = cholesky_factor(D, 0);
+			factored = timer_now();
+
+			if (result == 0) {
+				V = Vector_copy(b);
+				cholesky_solve_factored(D, V->entries);
+			}
+
+			Matrix_delete(D);
+			pcg_stats.setup_time = factored - assembled;
+			pcg_stats.solve_time = timer_now() - factored;
+			break;
+	}
+
+	if (result != 0) {
+		Vector_delete(b);
+		SparseMatrix_delete(M);
+		return NULL;
+	}
+
+	if (stats != NULL) {
+		LinearOperator_from_sparse(&op, M);
+		r = malloc_or_fail(M->n, sizeof *r);
+		rnorm = LinearOperator_residual(&op, V->entries, b->entries, r);
+		free_tracked(r);
+
+		stats->method = method;
+		stats->nnodes = M->n;
+		stats->nnz = M->nnz;
+		stats->half_bandwidth = hb;
+		stats->iterations = pcg_stats.iterations;
+		stats->subdomains = schur_stats.subdomains;
+		stats->residual_norm = rnorm;
+		stats->assemble_time = assembled - start;
+		stats->factor_time = pcg_stats.setup_time;
+		stats->solve_time = pcg_stats.solve_time;
+	}
+
+	Vector_delete(b);
+	SparseMatrix_delete(M);
+
+	return V;
+}
+
+struct Vector *circuits_solve_voltages_with(const struct CircuitDescription *circuit, const struct CircuitSolverOptions *options, struct CircuitSolverStats *stats)
+{
+	struct BranchList *branches;
+	struct Vector *V;
+
+	if (circuits_to_branches(circuit, &branches) != 0)
+		return NULL;
+
+	V = circuits_solve_branches_with(branches, options, stats);
+	BranchList_delete(branches);
+
+	return V;
+}
+
 void circuits_destroy(struct CircuitDescription *circuit)
 {
 	Vector_delete(circuit->E);
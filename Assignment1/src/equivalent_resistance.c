@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "circuits.h"
+#include "perf.h"
+#include "resistance.h"
+#include "utils.h"
+
+int main(int argc, const char *argv[])
+{
+	struct CircuitDescription circuit;
+	struct ResistanceSolver rs;
+	size_t *a, *b;
+	double *R;
+	size_t npairs, k;
+
+	perf_parse_args(&argc, argv);
+
+	if (argc < 4 || argc % 2 != 0) {
+		fprintf(stderr, "Usage: %s <filename> <node a> <node b> [<node a> <node b> ...]\n", argv[0]);
+		fprintf(stderr, "Node 0 is ground, node k is row k of the incidence matrix (counting from 1).\n");
+		return 0;
+	}
+
+	if (circuits_parse_file(&circuit, argv[1]) != 0) {
+		fprintf(stderr, "Failed to parse circuit file.\n");
+		return -1;
+	}
+
+	if (resistance_solver_create(&rs, &circuit) != 0) {
+		fprintf(stderr, "Some node has no resistive path to ground.\n");
+		circuits_destroy(&circuit);
+		return -1;
+	}
+
+	npairs = (argc - 2) / 2;
+	a = malloc_or_fail(npairs, sizeof *a);
+	b = malloc_or_fail(npairs, sizeof *b);
+	R = malloc_or_fail(npairs, sizeof *R);
+
+	for (k = 0; k < npairs; k++) {
+		a[k] = strtoul(argv[2 + 2 * k], NULL, 10);
+		b[k] = strtoul(argv[3 + 2 * k], NULL, 10);
+
+		if (a[k] > rs.nnodes || b[k] > rs.nnodes) {
+			fprintf(stderr, "Node index out of range (the circuit has nodes 0 to %lu).\n", (unsigned long)rs.nnodes);
+			free_tracked(R);
+			free_tracked(b);
+			free_tracked(a);
+			resistance_solver_destroy(&rs);
+			circuits_destroy(&circuit);
+			return -1;
+		}
+	}
+
+	resistance_between_batch(&rs, npairs, a, b, R);
+
+	for (k = 0; k < npairs; k++)
+		printf("R(%lu, %lu) = %f ohms\n", (unsigned long)a[k], (unsigned long)b[k], R[k]);
+
+	free_tracked(R);
+	free_tracked(b);
+	free_tracked(a);
+	resistance_solver_destroy(&rs);
+	circuits_destroy(&circuit);
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+/* open, pread and msync are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+#define _FILE_OFFSET_BITS 64
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "fdcheckpoint.h"
+#include "perf.h"
+#include "timer.h"
+#include "utils.h"
+
+#define FD_CHECKPOINT_MAGIC	"FDGRID2"
+
+/* PROTOTYPES */
+static struct FDCheckpoint *map_file(int fd, const struct FDCheckpointHeader *header);
+static int sync_range(void *block, size_t offset, size_t bytes);
+static int write_checkpoint(struct FDCheckpoint *checkpoint, int slot, unsigned long iterations, double residual, int complete);
+static unsigned int share_interval(double checkpoint_seconds, double relax_seconds, unsigned int iterations);
+/* END PROTOTYPES */
+
+/* Map the two slots that header describes from fd, which is closed on
+ * failure */
+static struct FDCheckpoint *map_file(int fd, const struct FDCheckpointHeader *header)
+{
+	struct FDCheckpoint *checkpoint;
+	struct FDGrid *slots[2];
+	size_t slot_bytes = header->N * header->stride * sizeof(double);
+
+	slots[0] = FDGrid_map(fd, FD_CHECKPOINT_OFFSET, header->N, header->inner_x, header->inner_y, header->h);
+
+	if (slots[0] == NULL)
+		goto cleanup_fd;
+
+	if (slots[0]->stride != header->stride) {
+		fprintf(stderr, "The rows of the checkpoint are laid out for another machine.\n");
+		goto cleanup_slot;
+	}
+
+	slots[1] = FDGrid_map(fd, FD_CHECKPOINT_OFFSET + slot_bytes, header->N, header->inner_x, header->inner_y, header->h);
+
+	if (slots[1] == NULL)
+		goto cleanup_slot;
+
+	checkpoint = malloc_or_fail(1, sizeof *checkpoint);
+	checkpoint->slots[0] = slots[0];
+	checkpoint->slots[1] = slots[1];
+	checkpoint->grid = slots[header->slot];
+	checkpoint->header = slots[0]->block;
+	checkpoint->fd = fd;
+	checkpoint->seconds = 0.0;
+
+	return checkpoint;
+
+cleanup_slot:
+	FDGrid_delete(slots[0]);
+cleanup_fd:
+	close(fd);
+
+	return NULL;
+}
+
+/* Force bytes of the mapping at block, from offset on, to the file. msync
+ * takes a start on a page boundary, so the range is widened down to one. */
+static int sync_range(void *block, size_t offset, size_t bytes)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = offset / page * page;
+
+	if (msync((char *)block + start, offset - start + bytes, MS_SYNC) != 0) {
+		perror("msync");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Force the nodes of slot to the file, then the header that switches to
+ * them, with the iterations that led to the nodes. */
+static int write_checkpoint(struct FDCheckpoint *checkpoint, int slot, unsigned long iterations, double residual, int complete)
+{
+	struct FDGrid *grid = checkpoint->slots[slot];
+	struct FDCheckpointHeader *header = checkpoint->header;
+
+	if (sync_range(grid->block, (char *)grid->values - (char *)grid->block, grid->N * grid->stride * sizeof(double)) != 0)
+		return -1;
+
+	header->slot = slot;
+	header->iterations = iterations;
+	header->residual = residual;
+	header->complete = complete;
+	++header->checkpoints;
+	checkpoint->grid = grid;
+
+	return sync_range(header, 0, sizeof *header);
+}
+
+/* Iterations after which a checkpoint that took checkpoint_seconds is
+ * FD_CHECKPOINT_SHARE of the time, at the rate of the last run */
+static unsigned int share_interval(double checkpoint_seconds, double relax_seconds, unsigned int iterations)
+{
+	double interval;
+
+	if (iterations == 0 || relax_seconds <= 0.0)
+		return FD_CHECKPOINT_FIRST;
+
+	interval = checkpoint_seconds / FD_CHECKPOINT_SHARE / (relax_seconds / iterations);
+
+	return (interval < 1.0) ? 1 : (interval > UINT_MAX / 2) ? UINT_MAX / 2 : (unsigned int)interval;
+}
+
+/* See fdcheckpoint.h header for documentation */
+struct FDCheckpoint *FDCheckpoint_create(const char *path, double h, enum FDCheckpointMethod method, const struct FDOptions *options)
+{
+	struct FDCheckpoint *checkpoint;
+	struct FDCheckpointHeader header;
+	int fd;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, FD_CHECKPOINT_MAGIC, sizeof header.magic);
+	header.method = method;
+	header.norm = options->norm;
+
+	/* Same sizes as FDGrid_coax */
+	header.N = (COAX_OUTER_L / 2.0) / h + 2.0;
+	header.inner_x = ((COAX_OUTER_L - COAX_INNER_W) / 2.0) / h;
+	header.inner_y = ((COAX_OUTER_L - COAX_INNER_L) / 2.0) / h;
+	header.stride = (header.N + FD_ALIGN / sizeof(double) - 1) / (FD_ALIGN / sizeof(double)) * (FD_ALIGN / sizeof(double));
+	header.h = h;
+	header.w = (options->w > 0.0 || method == FD_CHECKPOINT_JACOBI) ? options->w : fd_optimal_w(h);
+	header.r = options->r;
+	header.check_interval = options->check_interval;
+	header.time_block = options->time_block;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		perror("open");
+		return NULL;
+	}
+
+	/* The file starts empty, so the nodes start at 0 */
+	checkpoint = map_file(fd, &header);
+
+	if (checkpoint == NULL)
+		return NULL;
+
+	memcpy(checkpoint->header, &header, sizeof header);
+	fd_coax_boundary(checkpoint->slots[0]);
+
+	if (write_checkpoint(checkpoint, 0, 0, fd_residual_norm(checkpoint->slots[0], options->norm), 0) != 0) {
+		FDCheckpoint_close(checkpoint);
+		return NULL;
+	}
+
+	return checkpoint;
+}
+
+/* See fdcheckpoint.h header for documentation */
+struct FDCheckpoint *FDCheckpoint_resume(const char *path)
+{
+	struct FDCheckpointHeader header;
+	struct stat status;
+	int fd;
+
+	fd = open(path, O_RDWR);
+
+	if (fd < 0) {
+		perror("open");
+		return NULL;
+	}
+
+	if (pread(fd, &header, sizeof header, 0) != (ssize_t)sizeof header
+			|| memcmp(header.magic, FD_CHECKPOINT_MAGIC, sizeof header.magic) != 0) {
+		fprintf(stderr, "%s is not a checkpoint file.\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || (size_t)status.st_size < FD_CHECKPOINT_OFFSET + 2 * header.N * header.stride * sizeof(double)
+			|| (header.slot != 0 && header.slot != 1)) {
+		fprintf(stderr, "%s is shorter than its grid.\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	return map_file(fd, &header);
+}
+
+void FDCheckpoint_close(struct FDCheckpoint *checkpoint)
+{
+	FDGrid_delete(checkpoint->slots[1]);
+	FDGrid_delete(checkpoint->slots[0]);
+	close(checkpoint->fd);
+	free_tracked(checkpoint);
+}
+
+/* See fdcheckpoint.h header for documentation */
+int fd_checkpoint_solve(struct FDCheckpoint *checkpoint, size_t threads, unsigned int interval)
+{
+	struct FDCheckpointHeader *header = checkpoint->header;
+	struct FDGrid *grid, *copy = NULL;
+	struct FDOptions options;
+	unsigned int iterations, unit, next;
+	double start, spent, relax_seconds, residual;
+	int result = -1;
+
+	fd_default_options(&options);
+	options.w = header->w;
+	options.r = header->r;
+	options.norm = (enum FDNorm)header->norm;
+	options.check_interval = header->check_interval;
+	options.time_block = header->time_block;
+	options.threads = threads;
+
+	/* Each run of the kernel tests convergence on its own iterations, so
+	 * it must end on a test. Jacobi runs an even number, which leaves the
+	 * newest grid in the slot rather than in its copy. */
+	unit = options.check_interval * options.time_block;
+
+	if (header->method == FD_CHECKPOINT_JACOBI && unit % 2 == 1)
+		unit *= 2;
+
+	/* The copy Jacobi iterates against, with the boundary of the slots */
+	if (header->method == FD_CHECKPOINT_JACOBI) {
+		copy = FDGrid_new(header->N, header->inner_x, header->inner_y, header->h);
+		memcpy(copy->values, checkpoint->grid->values, copy->N * copy->stride * sizeof(double));
+	}
+
+	next = (interval > 0) ? interval : FD_CHECKPOINT_FIRST;
+
+	while (!header->complete) {
+		options.max_iterations = (next + unit - 1) / unit * unit;
+
+		/* Relax a copy of the last checkpoint in the other slot */
+		perf_begin("checkpoint");
+		start = timer_now();
+
+		grid = checkpoint->slots[1 - header->slot];
+		memcpy(grid->values, checkpoint->grid->values, grid->N * grid->stride * sizeof(double));
+
+		spent = timer_now() - start;
+		perf_end("checkpoint");
+
+		start = timer_now();
+
+		if (header->method == FD_CHECKPOINT_JACOBI)
+			iterations = fd_jacobi_copy(grid, copy, &options);
+		else
+			iterations = fd_red_black_sor(grid, &options);
+
+		relax_seconds = timer_now() - start;
+
+		perf_begin("checkpoint");
+		start = timer_now();
+
+		fd_mirror(grid);
+		residual = fd_residual_norm(grid, options.norm);
+
+		if (write_checkpoint(checkpoint, 1 - header->slot, header->iterations + iterations, residual, residual < options.r) != 0) {
+			perf_end("checkpoint");
+			goto cleanup;
+		}
+
+		/* The kernel passed its own test short of r; aim it lower by as
+		 * much as its norm trailed, rather than stop it after a few
+		 * iterations on each of many runs */
+		if (!header->complete && iterations < options.max_iterations)
+			options.r *= header->r / residual;
+
+		spent += timer_now() - start;
+		checkpoint->seconds += spent;
+		perf_count("checkpoints", 1.0);
+		perf_end("checkpoint");
+
+		if (interval == 0)
+			next = share_interval(spent, relax_seconds, iterations);
+	}
+
+	result = 0;
+
+cleanup:
+	if (copy != NULL)
+		FDGrid_delete(copy);
+
+	return result;
+}
@@ -0,0 +1,564 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdgeometry.h"
+#include "perf.h"
+#include "utils.h"
+
+/* restrict is C99, GCC accepts __restrict__ in C89 as well */
+#if defined(__GNUC__)
+#define FD_RESTRICT	__restrict__
+#else
+#define FD_RESTRICT
+#endif
+
+#define FD_MESH_ROW_ALIGN	(FD_ALIGN / sizeof(double))
+
+/* Longest keyword of a layout file, and the most vertices of a polygon */
+#define FD_KEYWORD_LENGTH	15
+#define FD_MAX_VERTICES		100000
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+/* PROTOTYPES */
+static void *grow(void *array, size_t count, size_t *capacity, size_t size);
+static int read_keyword(FILE *filePtr, char *word);
+static int read_numbers(FILE *filePtr, double *values, size_t n);
+static int read_polygon(FILE *filePtr, struct FDConductor *conductor);
+static size_t node_index(double x, double h, size_t last);
+static int inside_polygon(const struct FDConductor *conductor, double x, double y);
+static void cover_conductor(const struct FDConductor *conductor, struct FDMesh *mesh, unsigned char *fixed);
+static void compile_runs(struct FDMesh *mesh, const unsigned char *fixed);
+static void mirror(struct FDMesh *mesh);
+static void sor_run(double *FD_RESTRICT row, const double *up, const double *down, const double *mask, double *FD_RESTRICT delta, size_t first, size_t end, double w);
+static double run_norm(const double *delta, size_t first, size_t end, enum FDNorm norm);
+static double estimate_w(const struct FDMesh *mesh);
+/* END PROTOTYPES */
+
+/* Make room for one more element after the count already in array,
+ * doubling the capacity when it is full. */
+static void *grow(void *array, size_t count, size_t *capacity, size_t size)
+{
+	void *larger;
+
+	if (count < *capacity)
+		return array;
+
+	*capacity = (*capacity == 0) ? 4 : 2 * *capacity;
+	larger = malloc_or_fail(*capacity, size);
+
+	if (count > 0)
+		memcpy(larger, array, count * size);
+
+	free_tracked(array);
+
+	return larger;
+}
+
+/* Read the next keyword, skipping comments. Returns 0, or 1 at the end of
+ * the file. */
+static int read_keyword(FILE *filePtr, char *word)
+{
+	int c;
+
+	for (;;) {
+		c = fgetc(filePtr);
+
+		if (c == EOF)
+			return 1;
+
+		if (c == '#') {
+			while ((c = fgetc(filePtr)) != EOF && c != '\n')
+				;
+
+			continue;
+		}
+
+		if (!isspace(c)) {
+			ungetc(c, filePtr);
+			break;
+		}
+	}
+
+	return (fscanf(filePtr, "%15s", word) == 1) ? 0 : 1;
+}
+
+static int read_numbers(FILE *filePtr, double *values, size_t n)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		if (fscanf(filePtr, "%lf", &values[k]) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Read the potential, vertex count and vertices of a polygon. */
+static int read_polygon(FILE *filePtr, struct FDConductor *conductor)
+{
+	unsigned long n;
+	size_t k;
+
+	if (fscanf(filePtr, "%lf %lu", &conductor->potential, &n) != 2 || n < 3 || n > FD_MAX_VERTICES) {
+		fprintf(stderr, "A polygon is given as <potential> <n> and 3 or more vertices.\n");
+		return -1;
+	}
+
+	conductor->rectangle = 0;
+	conductor->nvertices = n;
+	conductor->x = malloc_or_fail(n, sizeof *(conductor->x));
+	conductor->y = malloc_or_fail(n, sizeof *(conductor->y));
+
+	for (k = 0; k < n; k++) {
+		if (fscanf(filePtr, "%lf %lf", &conductor->x[k], &conductor->y[k]) != 2) {
+			fprintf(stderr, "Expected %lu polygon vertices, read %lu.\n", n, (unsigned long)k);
+			free_tracked(conductor->x);
+			free_tracked(conductor->y);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* See fdgeometry.h header for documentation */
+int fd_geometry_read(const char *filename, struct FDGeometry *geometry)
+{
+	FILE *filePtr;
+	struct FDConductor *conductor;
+	char word[FD_KEYWORD_LENGTH + 1];
+	double values[5];
+	size_t conductor_capacity, probe_capacity;
+	int have_domain;
+	int result = -1;
+
+	memset(geometry, 0, sizeof *geometry);
+	conductor_capacity = probe_capacity = 0;
+	have_domain = 0;
+
+	perf_begin("parse");
+	filePtr = fopen(filename, "r");
+
+	if (filePtr == NULL) {
+		perror("fopen");
+		goto cleanup_;
+	}
+
+	while (read_keyword(filePtr, word) == 0) {
+		if (!have_domain && strcmp(word, "domain") != 0) {
+			fprintf(stderr, "The layout must start with its domain.\n");
+			goto cleanup_geometry;
+		}
+
+		if (strcmp(word, "domain") == 0) {
+			if (have_domain || read_numbers(filePtr, values, 3) != 0 || values[0] <= 0.0 || values[1] <= 0.0) {
+				fprintf(stderr, "The domain is given once, as <width> <height> <potential>.\n");
+				goto cleanup_geometry;
+			}
+
+			geometry->width = values[0];
+			geometry->height = values[1];
+			geometry->potential = values[2];
+			have_domain = 1;
+		} else if (strcmp(word, "symmetry") == 0) {
+			if (read_keyword(filePtr, word) != 0 || (strcmp(word, "x") != 0 && strcmp(word, "y") != 0)) {
+				fprintf(stderr, "A plane of symmetry is x or y.\n");
+				goto cleanup_geometry;
+			}
+
+			if (word[0] == 'x')
+				geometry->symmetry_x = 1;
+			else
+				geometry->symmetry_y = 1;
+		} else if (strcmp(word, "rectangle") == 0 || strcmp(word, "polygon") == 0) {
+			geometry->conductors = grow(geometry->conductors, geometry->nconductors, &conductor_capacity, sizeof *(geometry->conductors));
+			conductor = &geometry->conductors[geometry->nconductors];
+
+			if (word[0] == 'p') {
+				if (read_polygon(filePtr, conductor) != 0)
+					goto cleanup_geometry;
+			} else {
+				if (read_numbers(filePtr, values, 5) != 0 || values[2] < values[0] || values[3] < values[1]) {
+					fprintf(stderr, "A rectangle is given as <x0> <y0> <x1> <y1> <potential>, with x0 <= x1 and y0 <= y1.\n");
+					goto cleanup_geometry;
+				}
+
+				conductor->rectangle = 1;
+				conductor->nvertices = 2;
+				conductor->x = malloc_or_fail(2, sizeof *(conductor->x));
+				conductor->y = malloc_or_fail(2, sizeof *(conductor->y));
+				conductor->x[0] = values[0];
+				conductor->y[0] = values[1];
+				conductor->x[1] = values[2];
+				conductor->y[1] = values[3];
+				conductor->potential = values[4];
+			}
+
+			++geometry->nconductors;
+		} else if (strcmp(word, "probe") == 0) {
+			if (read_numbers(filePtr, values, 2) != 0 || values[0] < 0.0 || values[0] > geometry->width
+					|| values[1] < 0.0 || values[1] > geometry->height) {
+				fprintf(stderr, "A probe is given as <x> <y>, inside the domain.\n");
+				goto cleanup_geometry;
+			}
+
+			geometry->probes = grow(geometry->probes, geometry->nprobes, &probe_capacity, 2 * sizeof *(geometry->probes));
+			geometry->probes[2 * geometry->nprobes] = values[0];
+			geometry->probes[2 * geometry->nprobes + 1] = values[1];
+			++geometry->nprobes;
+		} else {
+			fprintf(stderr, "Unknown keyword '%s' in the layout.\n", word);
+			goto cleanup_geometry;
+		}
+	}
+
+	if (!have_domain) {
+		fprintf(stderr, "The layout has no domain.\n");
+		goto cleanup_geometry;
+	}
+
+	result = 0;
+	goto cleanup_filePtr;
+
+cleanup_geometry:
+	fd_geometry_destroy(geometry);
+cleanup_filePtr:
+	fclose(filePtr);
+cleanup_:
+	perf_end("parse");
+
+	return result;
+}
+
+/* See fdgeometry.h header for documentation */
+void fd_geometry_destroy(struct FDGeometry *geometry)
+{
+	size_t k;
+
+	for (k = 0; k < geometry->nconductors; k++) {
+		free_tracked(geometry->conductors[k].x);
+		free_tracked(geometry->conductors[k].y);
+	}
+
+	free_tracked(geometry->conductors);
+	free_tracked(geometry->probes);
+	memset(geometry, 0, sizeof *geometry);
+}
+
+/* Index of the node at or below coordinate x, clamped to 0 ... last */
+static size_t node_index(double x, double h, size_t last)
+{
+	if (x <= 0.0)
+		return 0;
+
+	return (x / h < (double)last) ? (size_t)(x / h) : last;
+}
+
+/* Even-odd test of (x, y) against the polygon's edges */
+static int inside_polygon(const struct FDConductor *conductor, double x, double y)
+{
+	const double *px = conductor->x;
+	const double *py = conductor->y;
+	size_t n = conductor->nvertices;
+	size_t k, l;
+	int inside = 0;
+
+	for (k = 0, l = n - 1; k < n; l = k++) {
+		if ((py[k] > y) != (py[l] > y) && x < px[l] + (px[k] - px[l]) * (y - py[l]) / (py[k] - py[l]))
+			inside = !inside;
+	}
+
+	return inside;
+}
+
+/* Set the nodes the conductor covers, the false boundaries included, to
+ * its potential and mark them fixed. */
+static void cover_conductor(const struct FDConductor *conductor, struct FDMesh *mesh, unsigned char *fixed)
+{
+	double min_x, max_x, min_y, max_y;
+	size_t i, j, i0, i1, j0, j1, k;
+
+	min_x = max_x = conductor->x[0];
+	min_y = max_y = conductor->y[0];
+
+	for (k = 1; k < conductor->nvertices; k++) {
+		min_x = (conductor->x[k] < min_x) ? conductor->x[k] : min_x;
+		max_x = (conductor->x[k] > max_x) ? conductor->x[k] : max_x;
+		min_y = (conductor->y[k] < min_y) ? conductor->y[k] : min_y;
+		max_y = (conductor->y[k] > max_y) ? conductor->y[k] : max_y;
+	}
+
+	if (max_x < 0.0 || max_y < 0.0)
+		return;
+
+	i0 = node_index(min_x, mesh->h, mesh->rows - 1);
+	i1 = node_index(max_x, mesh->h, mesh->rows - 1);
+	j0 = node_index(min_y, mesh->h, mesh->cols - 1);
+	j1 = node_index(max_y, mesh->h, mesh->cols - 1);
+
+	/* A rectangle reaching the plane of symmetry goes on into its mirror image */
+	if (conductor->rectangle && mesh->mirror_rows && i1 == mesh->rows - 2)
+		i1 = mesh->rows - 1;
+
+	if (conductor->rectangle && mesh->mirror_cols && j1 == mesh->cols - 2)
+		j1 = mesh->cols - 1;
+
+	for (i = i0; i <= i1; i++) {
+		for (j = j0; j <= j1; j++) {
+			if (!conductor->rectangle && !inside_polygon(conductor, i * mesh->h, j * mesh->h))
+				continue;
+
+			FD_MESH_NODE(mesh, i, j) = conductor->potential;
+			fixed[i * mesh->cols + j] = 1;
+		}
+	}
+}
+
+/* List the runs of nodes that are not fixed, in rows and columns 1 to
+ * rows - 2 and cols - 2. */
+static void compile_runs(struct FDMesh *mesh, const unsigned char *fixed)
+{
+	size_t i, j, k, pass;
+
+	mesh->row_runs = malloc_or_fail(mesh->rows + 1, sizeof *(mesh->row_runs));
+	mesh->run_first = mesh->run_end = NULL;
+
+	/* Count the runs, then fill them in */
+	for (pass = 0; pass < 2; pass++) {
+		k = 0;
+		mesh->nfree = 0;
+		mesh->row_runs[0] = 0;
+
+		for (i = 0; i < mesh->rows; i++) {
+			for (j = 1; i > 0 && i < mesh->rows - 1 && j < mesh->cols - 1; j++) {
+				if (fixed[i * mesh->cols + j])
+					continue;
+
+				if (pass == 1)
+					mesh->run_first[k] = j;
+
+				while (j < mesh->cols - 1 && !fixed[i * mesh->cols + j]) {
+					++j;
+					++mesh->nfree;
+				}
+
+				if (pass == 1)
+					mesh->run_end[k] = j;
+
+				++k;
+			}
+
+			mesh->row_runs[i + 1] = k;
+		}
+
+		if (pass == 0) {
+			mesh->nruns = k;
+			mesh->run_first = malloc_or_fail(k + 1, sizeof *(mesh->run_first));
+			mesh->run_end = malloc_or_fail(k + 1, sizeof *(mesh->run_end));
+		}
+	}
+}
+
+/* See fdgeometry.h header for documentation */
+struct FDMesh *FDMesh_compile(const struct FDGeometry *geometry, double h)
+{
+	struct FDMesh *mesh;
+	unsigned char *fixed;
+	size_t i, j, k, offset;
+
+	perf_begin("compile");
+	mesh = malloc_or_fail(1, sizeof *mesh);
+	mesh->h = h;
+	mesh->mirror_rows = geometry->symmetry_x;
+	mesh->mirror_cols = geometry->symmetry_y;
+
+	/* Nodes 0 ... width / h, and the false boundary past a plane of
+	 * symmetry; the same sizes as successive_over_relaxation for the coax */
+	mesh->rows = geometry->width / h + 1.0 + (mesh->mirror_rows ? 1.0 : 0.0);
+	mesh->cols = geometry->height / h + 1.0 + (mesh->mirror_cols ? 1.0 : 0.0);
+	mesh->stride = (mesh->cols + FD_MESH_ROW_ALIGN - 1) / FD_MESH_ROW_ALIGN * FD_MESH_ROW_ALIGN;
+
+	mesh->block = malloc_or_fail(mesh->rows * mesh->stride + FD_MESH_ROW_ALIGN, sizeof(double));
+	offset = (FD_ALIGN - (size_t)mesh->block % FD_ALIGN) % FD_ALIGN;
+	mesh->values = (double *)((char *)mesh->block + offset);
+	fixed = malloc_or_fail(mesh->rows * mesh->cols, sizeof *fixed);
+
+	/* The domain edges, except where they are planes of symmetry */
+	for (i = 0; i < mesh->rows; i++) {
+		for (j = 0; j < mesh->stride; j++)
+			FD_MESH_NODE(mesh, i, j) = 0.0;
+
+		for (j = 0; j < mesh->cols; j++) {
+			fixed[i * mesh->cols + j] = (i == 0 || j == 0 || i == mesh->rows - 1 || j == mesh->cols - 1);
+
+			if (fixed[i * mesh->cols + j] && (i == 0 || j == 0 || (i == mesh->rows - 1 && !mesh->mirror_rows)
+						|| (j == mesh->cols - 1 && !mesh->mirror_cols)))
+				FD_MESH_NODE(mesh, i, j) = geometry->potential;
+		}
+	}
+
+	for (k = 0; k < geometry->nconductors; k++)
+		cover_conductor(&geometry->conductors[k], mesh, fixed);
+
+	compile_runs(mesh, fixed);
+	free_tracked(fixed);
+
+	perf_count("mesh_runs", mesh->nruns);
+	perf_count("mesh_free_nodes", mesh->nfree);
+	perf_end("compile");
+
+	if (mesh->rows < 3 || mesh->cols < 3 || mesh->nfree == 0) {
+		fprintf(stderr, "The mesh of spacing %g has no free node.\n", h);
+		FDMesh_delete(mesh);
+		return NULL;
+	}
+
+	return mesh;
+}
+
+void FDMesh_delete(struct FDMesh *mesh)
+{
+	free_tracked(mesh->row_runs);
+	free_tracked(mesh->run_first);
+	free_tracked(mesh->run_end);
+	free_tracked(mesh->block);
+	free_tracked(mesh);
+}
+
+/* See fdgeometry.h header for documentation */
+double FDMesh_probe(const struct FDMesh *mesh, double x, double y)
+{
+	return FD_MESH_NODE(mesh, node_index(x, mesh->h, mesh->rows - 1), node_index(y, mesh->h, mesh->cols - 1));
+}
+
+/* Copy the nodes next to the planes of symmetry onto the false boundaries,
+ * whole rows and columns: the conductors are mirrored as well. */
+static void mirror(struct FDMesh *mesh)
+{
+	size_t i;
+
+	if (mesh->mirror_cols) {
+		for (i = 0; i < mesh->rows; i++)
+			FD_MESH_NODE(mesh, i, mesh->cols - 1) = FD_MESH_NODE(mesh, i, mesh->cols - 3);
+	}
+
+	if (mesh->mirror_rows)
+		memcpy(&FD_MESH_NODE(mesh, mesh->rows - 1, 0), &FD_MESH_NODE(mesh, mesh->rows - 3, 0), mesh->cols * sizeof(double));
+}
+
+/* Over-relax the nodes first ... end - 1 of a row where mask is 1, as
+ * sor_half_row in fdgrid.c. */
+static void sor_run(double *FD_RESTRICT row, const double *up, const double *down, const double *mask, double *FD_RESTRICT delta, size_t first, size_t end, double w)
+{
+	size_t j;
+
+	for (j = first; j < end; j++)
+		delta[j] = mask[j] * w * (0.25 * (up[j] + down[j] + row[j - 1] + row[j + 1]) - row[j]);
+
+	for (j = first; j < end; j++)
+		row[j] += delta[j];
+}
+
+/* Largest magnitude, or sum of squares for L2, of delta first ... end - 1 */
+static double run_norm(const double *delta, size_t first, size_t end, enum FDNorm norm)
+{
+	double result = 0.0;
+	size_t j;
+
+	if (norm == FD_NORM_L2) {
+		for (j = first; j < end; j++)
+			result += delta[j] * delta[j];
+	} else {
+		for (j = first; j < end; j++)
+			result = (fabs(delta[j]) > result) ? fabs(delta[j]) : result;
+	}
+
+	return result;
+}
+
+/* See fd_mesh_sor. The Jacobi radius of a rectangle with fixed edges and
+ * n x m steps is (cos(pi / n) + cos(pi / m)) / 2. */
+static double estimate_w(const struct FDMesh *mesh)
+{
+	double n, m, radius;
+
+	n = (mesh->rows - 1 - (mesh->mirror_rows ? 1 : 0)) * (mesh->mirror_rows ? 2.0 : 1.0);
+	m = (mesh->cols - 1 - (mesh->mirror_cols ? 1 : 0)) * (mesh->mirror_cols ? 2.0 : 1.0);
+	radius = 0.5 * (cos(M_PI / n) + cos(M_PI / m));
+
+	return 2.0 / (1.0 + sqrt(1.0 - radius * radius));
+}
+
+/* See fdgeometry.h header for documentation */
+unsigned int fd_mesh_sor(struct FDMesh *mesh, const struct FDOptions *options)
+{
+	size_t stride = mesh->stride;
+	double *mask, *delta, *row;
+	double w, norm, run;
+	unsigned int iterations;
+	size_t i, j, k, colour;
+	int check;
+
+	w = (options->w > 0.0) ? options->w : estimate_w(mesh);
+
+	/* mask[p * stride + j] is 1 for columns j of parity p */
+	mask = malloc_or_fail(2 * stride, sizeof *mask);
+	delta = malloc_or_fail(stride, sizeof *delta);
+
+	for (j = 0; j < stride; j++) {
+		mask[j] = (j % 2 == 0) ? 1.0 : 0.0;
+		mask[stride + j] = 1.0 - mask[j];
+	}
+
+	mirror(mesh);
+	iterations = 0;
+	perf_begin("relaxation");
+
+	do {
+		check = ((iterations + 1) % options->check_interval == 0);
+		norm = 0.0;
+
+		for (colour = 0; colour < 2; colour++) {
+			/* Nodes with i + j = colour modulo 2 */
+			for (i = 1; i < mesh->rows - 1; i++) {
+				row = &FD_MESH_NODE(mesh, i, 0);
+
+				for (k = mesh->row_runs[i]; k < mesh->row_runs[i + 1]; k++) {
+					sor_run(row, row - stride, row + stride, &mask[((i + colour) % 2) * stride], delta,
+							mesh->run_first[k], mesh->run_end[k], w);
+
+					if (check) {
+						run = run_norm(delta, mesh->run_first[k], mesh->run_end[k], options->norm);
+						norm = (options->norm == FD_NORM_L2) ? norm + run : (run > norm) ? run : norm;
+					}
+				}
+			}
+
+			mirror(mesh);
+		}
+
+		if (check && options->norm == FD_NORM_L2)
+			norm = sqrt(norm);
+
+		++iterations;
+	} while (!check || 4.0 / w * norm >= options->r);
+
+	/* Each free node: 7 flops for the update, 2 for the norm when tested */
+	perf_count("sweeps", iterations);
+	perf_count("residual_checks", iterations / options->check_interval);
+	perf_count("node_updates", (double)iterations * mesh->nfree);
+	perf_count("flops", (7.0 * iterations + 2.0 * (iterations / options->check_interval)) * mesh->nfree);
+	perf_end("relaxation");
+
+	free_tracked(mask);
+	free_tracked(delta);
+
+	return iterations;
+}
@@ -0,0 +1,1049 @@
+/* Threads, sysconf and mmap are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+#define _FILE_OFFSET_BITS 64
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "fdgrid.h"
+#include "perf.h"
+#include "utils.h"
+
+/* restrict is C99, GCC accepts __restrict__ in C89 as well */
+#if defined(__GNUC__)
+#define FD_RESTRICT	__restrict__
+#else
+#define FD_RESTRICT
+#endif
+
+#define FD_ROW_ALIGN	(FD_ALIGN / sizeof(double))
+#define FD_FLOAT_ALIGN	(FD_ALIGN / sizeof(float))
+
+/* fd_mixed_sor: factor by which each correction solve reduces the residual.
+ * The float correction is good to a few times FLT_EPSILON of its size, so
+ * much more than this would be lost in rounding. */
+#define FD_MIXED_REDUCTION	1.0e-3
+
+/* fd_jacobi_radius: coarsest spacing of the power iteration, its largest
+ * number of sweeps, and the change of the radius, relative to 1 - radius,
+ * at which it stops */
+#define FD_RADIUS_H		0.005
+#define FD_RADIUS_SWEEPS	10000
+#define FD_RADIUS_TOLERANCE	1.0e-6
+
+/* Barrier for the threads of a team. The threads sleep rather than spin,
+ * so a team larger than the number of CPUs still makes progress. */
+struct FDBarrier {
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+	size_t count;			/* Threads that take part */
+	size_t waiting;
+	unsigned long generation;	/* Times the barrier has been released */
+};
+
+/* The threads sharing one relaxation. Each owns a block of rows. */
+struct FDTeam {
+	struct FDGrid *grid;
+	const struct FDOptions *options;
+	struct FDBarrier barrier;
+	size_t nthreads;
+	double *mask;			/* SOR: colour masks, see fd_red_black_sor */
+	double *values[2];		/* Jacobi: the grid and a copy, old and new in turn */
+	double w;			/* SOR: over-relaxation factor */
+	double scale;			/* Residual of a node over the change of its update */
+	double *partial;		/* Residual norm of each block, on even and odd iterations */
+};
+
+struct FDWorker {
+	struct FDTeam *team;
+	size_t id;
+	size_t first_row;
+	size_t last_row;
+	double *delta;			/* Changes of one row */
+	unsigned int iterations;
+};
+
+/* PROTOTYPES */
+static void sor_half_row(double *FD_RESTRICT row, const double *up, const double *down, const double *mask, double *FD_RESTRICT delta, size_t first, size_t end, double w);
+static void jacobi_row(double *FD_RESTRICT row, const double *up, const double *down, const double *old, size_t end);
+static double residual_row(const double *row, const double *up, const double *down, size_t end);
+static double residual_rows(const struct FDGrid *grid, const double *values, size_t first, size_t last);
+static double combine_norms(double a, double b, enum FDNorm norm);
+static double row_norm(const double *delta, size_t end, enum FDNorm norm);
+static void barrier_wait(struct FDBarrier *barrier);
+static double team_norm(const struct FDTeam *team, const double *partial);
+static void *sor_worker(void *arg);
+static void *jacobi_worker(void *arg);
+static unsigned int run_team(struct FDTeam *team, void *(*routine)(void *));
+static unsigned int jacobi_blocked(struct FDGrid *grid, double *values[2], const struct FDOptions *options);
+static unsigned int jacobi_run(struct FDGrid *grid, double *copy, const struct FDOptions *options);
+static double interior_nodes(const struct FDGrid *grid);
+static struct FDGrid *grid_shape(size_t N, size_t inner_x, size_t inner_y, double h);
+static double mixed_right_side(const struct FDGrid *grid, float *f, size_t fstride, enum FDNorm norm);
+static void sor_half_row_float(float *FD_RESTRICT row, const float *up, const float *down, const float *f, const float *mask, float *FD_RESTRICT delta, size_t end, float w);
+static double float_row_norm(const float *delta, size_t end, enum FDNorm norm);
+static unsigned int mixed_correction(const struct FDGrid *grid, float *e, const float *f, size_t fstride, const float *mask, float *delta, float w, double target, unsigned int limit, const struct FDOptions *options);
+/* END PROTOTYPES */
+
+void fd_default_options(struct FDOptions *options)
+{
+	options->w = 1.3;
+	options->r = 1.0e-5;
+	options->threads = 1;
+	options->check_interval = 1;
+	options->norm = FD_NORM_MAX;
+	options->time_block = 1;
+	options->max_iterations = 0;
+}
+
+/* Grid of N x N nodes without them */
+static struct FDGrid *grid_shape(size_t N, size_t inner_x, size_t inner_y, double h)
+{
+	struct FDGrid *grid;
+	size_t i;
+
+	grid = malloc_or_fail(1, sizeof *grid);
+	grid->N = N;
+	grid->h = h;
+	grid->stride = (N + FD_ROW_ALIGN - 1) / FD_ROW_ALIGN * FD_ROW_ALIGN;
+	grid->inner_x = inner_x;
+	grid->inner_y = inner_y;
+	grid->mapped = 0;
+
+	grid->row_end = malloc_or_fail(N, sizeof *(grid->row_end));
+
+	for (i = 0; i < N; i++)
+		grid->row_end[i] = (i == 0 || i == N - 1) ? 1 : (i < grid->inner_x) ? N - 1 : grid->inner_y;
+
+	return grid;
+}
+
+/* See fdgrid.h header for documentation */
+struct FDGrid *FDGrid_new(size_t N, size_t inner_x, size_t inner_y, double h)
+{
+	struct FDGrid *grid;
+	size_t i, j, offset;
+
+	grid = grid_shape(N, inner_x, inner_y, h);
+	grid->block = malloc_or_fail(N * grid->stride + FD_ROW_ALIGN, sizeof(double));
+	offset = (FD_ALIGN - (size_t)grid->block % FD_ALIGN) % FD_ALIGN;
+	grid->values = (double *)((char *)grid->block + offset);
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < grid->stride; j++)
+			FD_NODE(grid, i, j) = 0.0;
+	}
+
+	return grid;
+}
+
+/* See fdgrid.h header for documentation */
+struct FDGrid *FDGrid_map(int fd, size_t offset, size_t N, size_t inner_x, size_t inner_y, double h)
+{
+	struct FDGrid *grid;
+	struct stat status;
+	size_t bytes;
+	void *mapping;
+
+	grid = grid_shape(N, inner_x, inner_y, h);
+	bytes = offset + N * grid->stride * sizeof(double);
+
+	if (fstat(fd, &status) != 0) {
+		perror("fstat");
+		goto cleanup_grid;
+	}
+
+	if ((size_t)status.st_size < bytes && ftruncate(fd, (off_t)bytes) != 0) {
+		perror("ftruncate");
+		goto cleanup_grid;
+	}
+
+	mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (mapping == MAP_FAILED) {
+		perror("mmap");
+		goto cleanup_grid;
+	}
+
+	grid->block = mapping;
+	grid->mapped = bytes;
+	grid->values = (double *)((char *)mapping + offset);
+
+	return grid;
+
+cleanup_grid:
+	free_tracked(grid->row_end);
+	free_tracked(grid);
+
+	return NULL;
+}
+
+/* See fdgrid.h header for documentation */
+struct FDGrid *FDGrid_coax(double h)
+{
+	struct FDGrid *grid;
+	size_t N;
+
+	/* Same sizes as successive_over_relaxation */
+	N = (COAX_OUTER_L / 2.0) / h + 2.0;
+	grid = FDGrid_new(N, ((COAX_OUTER_L - COAX_INNER_W) / 2.0) / h, ((COAX_OUTER_L - COAX_INNER_L) / 2.0) / h, h);
+	fd_coax_boundary(grid);
+
+	return grid;
+}
+
+/* See fdgrid.h header for documentation */
+void fd_coax_boundary(struct FDGrid *grid)
+{
+	size_t N = grid->N;
+	size_t i, j;
+
+	/* Set boundary conditions on inner and outer conductors */
+	for (i = 0; i < N; i++)
+		FD_NODE(grid, i, 0) = COAX_OUTER_V;
+
+	for (j = 0; j < N; j++)
+		FD_NODE(grid, 0, j) = COAX_OUTER_V;
+
+	for (i = grid->inner_x; i < N; i++)
+		FD_NODE(grid, i, grid->inner_y) = COAX_INNER_V;
+
+	for (j = grid->inner_y; j < N; j++)
+		FD_NODE(grid, grid->inner_x, j) = COAX_INNER_V;
+}
+
+void FDGrid_delete(struct FDGrid *grid)
+{
+	free_tracked(grid->row_end);
+
+	if (grid->mapped > 0)
+		munmap(grid->block, grid->mapped);
+	else
+		free_tracked(grid->block);
+
+	free_tracked(grid);
+}
+
+/* See fdgrid.h header for documentation */
+double FDGrid_probe(const struct FDGrid *grid, double x, double y)
+{
+	return FD_NODE(grid, (int)(x / grid->h), (int)(y / grid->h));
+}
+
+/* See fdgrid.h header for documentation */
+void fd_mirror(struct FDGrid *grid)
+{
+	size_t N = grid->N;
+	size_t i, j;
+
+	for (i = 1; i < grid->inner_x; i++)
+		FD_NODE(grid, i, N - 1) = FD_NODE(grid, i, N - 3);
+
+	for (j = 1; j < grid->inner_y; j++)
+		FD_NODE(grid, N - 1, j) = FD_NODE(grid, N - 3, j);
+}
+
+/* Largest residual magnitude of row nodes 1 ... end - 1. The maximum is
+ * kept in four independent parts so that the comparisons can overlap. */
+static double residual_row(const double *row, const double *up, const double *down, size_t end)
+{
+	double max_r[4] = {0.0, 0.0, 0.0, 0.0};
+	double current_r;
+	size_t j, k;
+
+	for (j = 1; j + 4 <= end; j += 4) {
+		for (k = 0; k < 4; k++) {
+			current_r = fabs(up[j + k] + down[j + k] + row[j + k - 1] + row[j + k + 1] - 4.0 * row[j + k]);
+			max_r[k] = (current_r > max_r[k]) ? current_r : max_r[k];
+		}
+	}
+
+	for (; j < end; j++) {
+		current_r = fabs(up[j] + down[j] + row[j - 1] + row[j + 1] - 4.0 * row[j]);
+		max_r[0] = (current_r > max_r[0]) ? current_r : max_r[0];
+	}
+
+	max_r[0] = (max_r[1] > max_r[0]) ? max_r[1] : max_r[0];
+	max_r[2] = (max_r[3] > max_r[2]) ? max_r[3] : max_r[2];
+
+	return (max_r[2] > max_r[0]) ? max_r[2] : max_r[0];
+}
+
+/* Largest residual magnitude of rows first ... last - 1 of a grid with the layout of grid. */
+static double residual_rows(const struct FDGrid *grid, const double *values, size_t first, size_t last)
+{
+	double max_r = 0.0;
+	double current_r;
+	size_t i;
+
+	for (i = first; i < last; i++) {
+		current_r = residual_row(&values[i * grid->stride], &values[(i - 1) * grid->stride], &values[(i + 1) * grid->stride], grid->row_end[i]);
+
+		if (current_r > max_r)
+			max_r = current_r;
+	}
+
+	return max_r;
+}
+
+/* See fdgrid.h header for documentation */
+double fd_max_residual(const struct FDGrid *grid)
+{
+	return residual_rows(grid, grid->values, 1, grid->N - 1);
+}
+
+/* See fdgrid.h header for documentation */
+double fd_residual_norm(const struct FDGrid *grid, enum FDNorm norm)
+{
+	double total = 0.0;
+	double current_r;
+	size_t i, j;
+
+	if (norm == FD_NORM_MAX)
+		return fd_max_residual(grid);
+
+	for (i = 1; i < grid->N - 1; i++) {
+		for (j = 1; j < grid->row_end[i]; j++) {
+			current_r = FD_NODE(grid, i - 1, j) + FD_NODE(grid, i + 1, j) + FD_NODE(grid, i, j - 1) + FD_NODE(grid, i, j + 1)
+					- 4.0 * FD_NODE(grid, i, j);
+			total += current_r * current_r;
+		}
+	}
+
+	return sqrt(total);
+}
+
+/* Norm of the residuals of two parts of the grid, from their own norms
+ * (sums of squares for L2). */
+static double combine_norms(double a, double b, enum FDNorm norm)
+{
+	if (norm == FD_NORM_L2)
+		return a + b;
+
+	return (b > a) ? b : a;
+}
+
+/* Largest magnitude, or sum of squares for L2, of delta 1 ... end - 1, in
+ * four independent parts like residual_row. */
+static double row_norm(const double *delta, size_t end, enum FDNorm norm)
+{
+	double part[4] = {0.0, 0.0, 0.0, 0.0};
+	double d;
+	size_t j, k;
+
+	for (j = 1; j + 4 <= end; j += 4) {
+		for (k = 0; k < 4; k++) {
+			d = (norm == FD_NORM_L2) ? delta[j + k] * delta[j + k] : fabs(delta[j + k]);
+			part[k] = (norm == FD_NORM_L2) ? part[k] + d : (d > part[k]) ? d : part[k];
+		}
+	}
+
+	for (; j < end; j++) {
+		d = (norm == FD_NORM_L2) ? delta[j] * delta[j] : fabs(delta[j]);
+		part[0] = combine_norms(part[0], d, norm);
+	}
+
+	return combine_norms(combine_norms(part[0], part[1], norm), combine_norms(part[2], part[3], norm), norm);
+}
+
+/* Over-relax the nodes of row nodes 1 ... end - 1 where mask is 1, every
+ * other one from column first. They only depend on nodes where it is 0,
+ * so the new values can all be found before any is stored, and delta is 0
+ * where the row does not change. Only the nodes that change are stored:
+ * the others are read meanwhile by the threads of the rows next to it. */
+static void sor_half_row(double *FD_RESTRICT row, const double *up, const double *down, const double *mask, double *FD_RESTRICT delta, size_t first, size_t end, double w)
+{
+	size_t j;
+
+	for (j = 1; j < end; j++)
+		delta[j] = mask[j] * w * (0.25 * (up[j] + down[j] + row[j - 1] + row[j + 1]) - row[j]);
+
+	for (j = first; j < end; j += 2)
+		row[j] += delta[j];
+}
+
+/* Jacobi update of row nodes 1 ... end - 1 from the old grid. */
+static void jacobi_row(double *FD_RESTRICT row, const double *up, const double *down, const double *old, size_t end)
+{
+	size_t j;
+
+	for (j = 1; j < end; j++)
+		row[j] = (up[j] + old[j - 1] + down[j] + old[j + 1]) / 4.0;
+}
+
+static void barrier_wait(struct FDBarrier *barrier)
+{
+	unsigned long generation;
+
+	if (barrier->count == 1)
+		return;
+
+	pthread_mutex_lock(&barrier->lock);
+	generation = barrier->generation;
+
+	if (++barrier->waiting == barrier->count) {
+		barrier->waiting = 0;
+		++barrier->generation;
+		pthread_cond_broadcast(&barrier->released);
+	} else {
+		while (generation == barrier->generation)
+			pthread_cond_wait(&barrier->released, &barrier->lock);
+	}
+
+	pthread_mutex_unlock(&barrier->lock);
+}
+
+/* Residual norm of the grid from the norms of the changes in each block.
+ * Every thread computes it after the same barrier, so they all take the
+ * same decision. */
+static double team_norm(const struct FDTeam *team, const double *partial)
+{
+	double norm = 0.0;
+	size_t t;
+
+	for (t = 0; t < team->nthreads; t++)
+		norm = combine_norms(norm, partial[t], team->options->norm);
+
+	if (team->options->norm == FD_NORM_L2)
+		norm = sqrt(norm);
+
+	return team->scale * norm;
+}
+
+/* One block of red-black SOR. A half-sweep reads whole rows of the blocks
+ * above and below while their owners update them, but only the nodes of
+ * the colour not being updated contribute; the others are masked out.
+ *
+ * The partial norms alternate between two arrays, so a thread that has
+ * gone on to the next iteration does not overwrite those the others are
+ * still reading. */
+static void *sor_worker(void *arg)
+{
+	struct FDWorker *worker = arg;
+	struct FDTeam *team = worker->team;
+	const struct FDOptions *options = team->options;
+	struct FDGrid *grid = team->grid;
+	size_t N = grid->N;
+	size_t stride = grid->stride;
+	size_t i, j, colour;
+	double *partial;
+	double norm;
+	int check;
+
+	worker->iterations = 0;
+
+	do {
+		check = ((worker->iterations + 1) % options->check_interval == 0);
+		partial = &team->partial[(worker->iterations % 2) * team->nthreads];
+		norm = 0.0;
+
+		for (colour = 0; colour < 2; colour++) {
+			/* Nodes with i + j = colour modulo 2 */
+			for (i = worker->first_row; i < worker->last_row; i++) {
+				sor_half_row(&FD_NODE(grid, i, 0), &FD_NODE(grid, i - 1, 0), &FD_NODE(grid, i + 1, 0),
+						&team->mask[((i + colour) % 2) * stride], worker->delta, 2 - (i + colour) % 2, grid->row_end[i], team->w);
+
+				if (check)
+					norm = combine_norms(norm, row_norm(worker->delta, grid->row_end[i], options->norm), options->norm);
+
+				/* Column N - 1 is only read by its own row */
+				if (i < grid->inner_x)
+					FD_NODE(grid, i, N - 1) = FD_NODE(grid, i, N - 3);
+
+				/* Row N - 2 reads the other colour of row N - 1 meanwhile */
+				if (i == N - 3) {
+					for (j = 2 - (colour + N - 3) % 2; j < grid->inner_y; j += 2)
+						FD_NODE(grid, N - 1, j) = FD_NODE(grid, N - 3, j);
+				}
+			}
+
+			if (colour == 1)
+				partial[worker->id] = norm;
+
+			barrier_wait(&team->barrier);
+		}
+
+		++worker->iterations;
+	} while ((!check || team_norm(team, partial) >= options->r)
+			&& (options->max_iterations == 0 || worker->iterations < options->max_iterations));
+
+	return NULL;
+}
+
+/* One block of Jacobi. The false boundary of the new grid mirrors the
+ * old one, as in jacobi_method. */
+static void *jacobi_worker(void *arg)
+{
+	struct FDWorker *worker = arg;
+	struct FDTeam *team = worker->team;
+	const struct FDOptions *options = team->options;
+	struct FDGrid *grid = team->grid;
+	size_t N = grid->N;
+	size_t stride = grid->stride;
+	double *old, *new;
+	size_t i, j;
+	double *partial;
+	double norm;
+	int check;
+
+	worker->iterations = 0;
+
+	do {
+		check = ((worker->iterations + 1) % options->check_interval == 0);
+		partial = &team->partial[(worker->iterations % 2) * team->nthreads];
+		norm = 0.0;
+		old = team->values[worker->iterations % 2];
+		new = team->values[(worker->iterations + 1) % 2];
+
+		for (i = worker->first_row; i < worker->last_row; i++) {
+			jacobi_row(&new[i * stride], &old[(i - 1) * stride], &old[(i + 1) * stride], &old[i * stride], grid->row_end[i]);
+
+			if (check) {
+				for (j = 1; j < grid->row_end[i]; j++)
+					worker->delta[j] = new[i * stride + j] - old[i * stride + j];
+
+				norm = combine_norms(norm, row_norm(worker->delta, grid->row_end[i], options->norm), options->norm);
+			}
+
+			if (i < grid->inner_x)
+				new[i * stride + N - 1] = old[i * stride + N - 3];
+
+			if (i == N - 2) {
+				for (j = 1; j < grid->inner_y; j++)
+					new[(N - 1) * stride + j] = old[(N - 3) * stride + j];
+			}
+		}
+
+		partial[worker->id] = norm;
+		barrier_wait(&team->barrier);
+		++worker->iterations;
+	} while ((!check || team_norm(team, partial) >= options->r)
+			&& (options->max_iterations == 0 || worker->iterations < options->max_iterations));
+
+	return NULL;
+}
+
+/* Split the free rows into blocks of about the same number of nodes, run
+ * routine on each, the first on the calling thread, and return the
+ * number of iterations. */
+static unsigned int run_team(struct FDTeam *team, void *(*routine)(void *))
+{
+	struct FDGrid *grid = team->grid;
+	struct FDWorker *workers;
+	pthread_t *threads;
+	size_t total, done, t, i;
+	unsigned int iterations;
+	long cpus;
+
+	team->nthreads = team->options->threads;
+
+	if (team->nthreads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		team->nthreads = (cpus > 1) ? (size_t)cpus : 1;
+	}
+
+	/* At least one row per thread */
+	if (team->nthreads > grid->N - 2)
+		team->nthreads = grid->N - 2;
+
+	workers = malloc_or_fail(team->nthreads, sizeof *workers);
+	threads = malloc_or_fail(team->nthreads, sizeof *threads);
+	team->partial = malloc_or_fail(2 * team->nthreads, sizeof *(team->partial));
+
+	total = 0;
+
+	for (i = 1; i < grid->N - 1; i++)
+		total += grid->row_end[i];
+
+	/* Block t takes rows until it has t + 1 shares of the nodes, and
+	 * leaves at least one row for each of the blocks after it */
+	done = 0;
+	i = 1;
+
+	for (t = 0; t < team->nthreads; t++) {
+		workers[t].team = team;
+		workers[t].id = t;
+		workers[t].first_row = i;
+		workers[t].delta = malloc_or_fail(grid->stride, sizeof *(workers[t].delta));
+
+		do {
+			done += grid->row_end[i++];
+		} while (i < grid->N - 1 - (team->nthreads - 1 - t) && done * team->nthreads < total * (t + 1));
+
+		workers[t].last_row = i;
+	}
+
+	pthread_mutex_init(&team->barrier.lock, NULL);
+	pthread_cond_init(&team->barrier.released, NULL);
+	team->barrier.count = team->nthreads;
+	team->barrier.waiting = 0;
+	team->barrier.generation = 0;
+
+	for (t = 1; t < team->nthreads; t++) {
+		if (pthread_create(&threads[t], NULL, routine, &workers[t]) != 0)
+			exit_with_error("Could not start the relaxation threads.");
+	}
+
+	routine(&workers[0]);
+
+	for (t = 1; t < team->nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	iterations = workers[0].iterations;
+
+	pthread_cond_destroy(&team->barrier.released);
+	pthread_mutex_destroy(&team->barrier.lock);
+
+	for (t = 0; t < team->nthreads; t++)
+		free_tracked(workers[t].delta);
+
+	free_tracked(team->partial);
+	free_tracked(threads);
+	free_tracked(workers);
+
+	return iterations;
+}
+
+/* Jacobi on one thread, time_block iterations per pass over the grid.
+ *
+ * Row i of iteration t + 1 needs rows i - 1 ... i + 1 of iteration t, and
+ * overwrites row i of iteration t - 1, which row i + 1 of iteration t
+ * reads. A pass therefore moves a front down the grid: at front row r,
+ * iteration t of the block updates row r - t, so each row is updated
+ * time_block times while the few rows around the front are in cache.
+ *
+ * The norm of the changes is taken on the last iteration of a block, so
+ * convergence is tested once a block has passed a multiple of
+ * check_interval. Returns the number of iterations; the newest grid is
+ * values[iterations % 2]. */
+static unsigned int jacobi_blocked(struct FDGrid *grid, double *values[2], const struct FDOptions *options)
+{
+	size_t N = grid->N;
+	size_t stride = grid->stride;
+	unsigned int depth = options->time_block;
+	unsigned int iterations, t;
+	size_t front, i, j;
+	double *old, *new, *delta;
+	double norm;
+	int check;
+
+	delta = malloc_or_fail(stride, sizeof *delta);
+	iterations = 0;
+
+	do {
+		check = ((iterations + depth) / options->check_interval > iterations / options->check_interval);
+		norm = 0.0;
+
+		for (front = 1; front < N - 2 + depth; front++) {
+			for (t = 0; t < depth && t < front; t++) {
+				i = front - t;
+
+				if (i > N - 2)
+					continue;
+
+				old = values[(iterations + t) % 2];
+				new = values[(iterations + t + 1) % 2];
+				jacobi_row(&new[i * stride], &old[(i - 1) * stride], &old[(i + 1) * stride], &old[i * stride], grid->row_end[i]);
+
+				if (check && t == depth - 1) {
+					for (j = 1; j < grid->row_end[i]; j++)
+						delta[j] = new[i * stride + j] - old[i * stride + j];
+
+					norm = combine_norms(norm, row_norm(delta, grid->row_end[i], options->norm), options->norm);
+				}
+
+				if (i < grid->inner_x)
+					new[i * stride + N - 1] = old[i * stride + N - 3];
+
+				if (i == N - 2) {
+					for (j = 1; j < grid->inner_y; j++)
+						new[(N - 1) * stride + j] = old[(N - 3) * stride + j];
+				}
+			}
+		}
+
+		iterations += depth;
+
+		if (check && options->norm == FD_NORM_L2)
+			norm = sqrt(norm);
+	} while ((!check || 4.0 * norm >= options->r) && (options->max_iterations == 0 || iterations < options->max_iterations));
+
+	free_tracked(delta);
+
+	return iterations;
+}
+
+/* See fdgrid.h header for documentation */
+double fd_jacobi_radius(double h)
+{
+	struct FDGrid *grid[2];
+	double H = (h > FD_RADIUS_H) ? h : FD_RADIUS_H;
+	double radius, last, norm, last_norm;
+	size_t i, j, k;
+	unsigned int sweep;
+
+	perf_begin("jacobi_radius");
+
+	/* Power iteration with the conductors at 0, from 1 on the free nodes */
+	grid[0] = FDGrid_coax(H);
+	grid[1] = FDGrid_new(grid[0]->N, grid[0]->inner_x, grid[0]->inner_y, H);
+	memset(grid[0]->values, 0, grid[0]->N * grid[0]->stride * sizeof(double));
+
+	for (i = 1; i < grid[0]->N - 1; i++) {
+		for (j = 1; j < grid[0]->row_end[i]; j++)
+			FD_NODE(grid[0], i, j) = 1.0;
+	}
+
+	radius = last = last_norm = 0.0;
+
+	for (sweep = 0, k = 0; sweep < FD_RADIUS_SWEEPS; sweep++, k = 1 - k) {
+		fd_mirror(grid[k]);
+		norm = 0.0;
+
+		for (i = 1; i < grid[k]->N - 1; i++) {
+			jacobi_row(&FD_NODE(grid[1 - k], i, 0), &FD_NODE(grid[k], i - 1, 0), &FD_NODE(grid[k], i + 1, 0), &FD_NODE(grid[k], i, 0), grid[k]->row_end[i]);
+
+			for (j = 1; j < grid[k]->row_end[i]; j++)
+				norm += FD_NODE(grid[1 - k], i, j) * FD_NODE(grid[1 - k], i, j);
+		}
+
+		norm = sqrt(norm);
+
+		for (i = 1; i < grid[k]->N - 1; i++) {
+			for (j = 1; j < grid[k]->row_end[i]; j++)
+				FD_NODE(grid[1 - k], i, j) /= norm;
+		}
+
+		/* Every iterate but the first has norm 1. -radius is an eigenvalue
+		 * as well, and with the false boundary the iteration is not
+		 * symmetric, so the growth of one sweep oscillates about radius
+		 * while that of two sweeps converges to its square. */
+		if (sweep == 0) {
+			last_norm = norm / sqrt(interior_nodes(grid[k]));
+			continue;
+		}
+
+		last = radius;
+		radius = sqrt(last_norm * norm);
+		last_norm = norm;
+
+		if (sweep > 1 && fabs(radius - last) < FD_RADIUS_TOLERANCE * (1.0 - radius))
+			break;
+	}
+
+	FDGrid_delete(grid[0]);
+	FDGrid_delete(grid[1]);
+
+	perf_count("jacobi_radius_sweeps", sweep);
+	perf_end("jacobi_radius");
+
+	return 1.0 - (1.0 - radius) * (h / H) * (h / H);
+}
+
+/* See fdgrid.h header for documentation */
+double fd_optimal_w(double h)
+{
+	double radius = fd_jacobi_radius(h);
+
+	return 2.0 / (1.0 + sqrt(1.0 - radius * radius));
+}
+
+/* Nodes updated by one sweep */
+static double interior_nodes(const struct FDGrid *grid)
+{
+	return (double)(grid->inner_x - 1) * (grid->N - 2) + (double)(grid->N - 1 - grid->inner_x) * (grid->inner_y - 1);
+}
+
+/* See fdgrid.h header for documentation */
+unsigned int fd_red_black_sor(struct FDGrid *grid, const struct FDOptions *options)
+{
+	struct FDTeam team;
+	unsigned int iterations;
+	size_t j;
+
+	team.grid = grid;
+	team.options = options;
+	team.w = (options->w > 0.0) ? options->w : fd_optimal_w(grid->h);
+	team.scale = 4.0 / team.w;
+
+	/* mask[p * stride + j] is 1 for columns j of parity p */
+	team.mask = malloc_or_fail(2 * grid->stride, sizeof *(team.mask));
+
+	for (j = 0; j < grid->stride; j++) {
+		team.mask[j] = (j % 2 == 0) ? 1.0 : 0.0;
+		team.mask[grid->stride + j] = 1.0 - team.mask[j];
+	}
+
+	perf_begin("relaxation");
+	iterations = run_team(&team, sor_worker);
+
+	/* Each interior node: 7 flops for the update, 2 for the norm when tested */
+	perf_count("sweeps", iterations);
+	perf_count("residual_checks", iterations / options->check_interval);
+	perf_count("node_updates", iterations * interior_nodes(grid));
+	perf_count("flops", (7.0 * iterations + 2.0 * (iterations / options->check_interval)) * interior_nodes(grid));
+	perf_end("relaxation");
+
+	free_tracked(team.mask);
+
+	return iterations;
+}
+
+/* Jacobi between the nodes of grid and copy, which holds the same boundary
+ * values. Returns the number of iterations; the newest grid is in copy if
+ * it is odd. */
+static unsigned int jacobi_run(struct FDGrid *grid, double *copy, const struct FDOptions *options)
+{
+	struct FDTeam team;
+	unsigned int iterations;
+
+	team.grid = grid;
+	team.options = options;
+	team.scale = 4.0;
+	team.values[0] = grid->values;
+	team.values[1] = copy;
+
+	perf_begin("relaxation");
+
+	if (options->time_block > 1)
+		iterations = jacobi_blocked(grid, team.values, options);
+	else
+		iterations = run_team(&team, jacobi_worker);
+
+	/* Each interior node: 4 flops for the update, 3 for the norm when tested */
+	perf_count("sweeps", iterations);
+	perf_count("residual_checks", iterations / options->check_interval);
+	perf_count("node_updates", iterations * interior_nodes(grid));
+	perf_count("time_blocks", iterations / options->time_block);
+	perf_count("flops", (4.0 * iterations + 3.0 * (iterations / options->check_interval)) * interior_nodes(grid));
+	perf_end("relaxation");
+
+	return iterations;
+}
+
+/* See fdgrid.h header for documentation */
+unsigned int fd_jacobi(struct FDGrid *grid, const struct FDOptions *options)
+{
+	unsigned int iterations;
+	void *block, *copy;
+	size_t offset;
+
+	/* The copy starts with the same boundary values */
+	block = malloc_or_fail(grid->N * grid->stride + FD_ROW_ALIGN, sizeof(double));
+	offset = (FD_ALIGN - (size_t)block % FD_ALIGN) % FD_ALIGN;
+	copy = (char *)block + offset;
+	memcpy(copy, grid->values, grid->N * grid->stride * sizeof(double));
+
+	iterations = jacobi_run(grid, copy, options);
+
+	/* Keep the newest grid, in place if it is mapped from a file */
+	if (iterations % 2 == 1 && grid->mapped > 0) {
+		memcpy(grid->values, copy, grid->N * grid->stride * sizeof(double));
+		free_tracked(block);
+	} else if (iterations % 2 == 1) {
+		grid->values = copy;
+		copy = grid->block;
+		grid->block = block;
+		free_tracked(copy);
+	} else {
+		free_tracked(block);
+	}
+
+	return iterations;
+}
+
+/* See fdgrid.h header for documentation */
+unsigned int fd_jacobi_copy(struct FDGrid *grid, struct FDGrid *copy, const struct FDOptions *options)
+{
+	unsigned int iterations;
+
+	iterations = jacobi_run(grid, copy->values, options);
+
+	if (iterations % 2 == 1)
+		memcpy(grid->values, copy->values, grid->N * grid->stride * sizeof(double));
+
+	return iterations;
+}
+
+/* Residual of every free node of grid, in double, into f with rows of
+ * fstride floats, 0 elsewhere. Returns its norm. */
+static double mixed_right_side(const struct FDGrid *grid, float *f, size_t fstride, enum FDNorm norm)
+{
+	double total = 0.0;
+	double current_r;
+	size_t i, j;
+
+	for (i = 1; i < grid->N - 1; i++) {
+		for (j = 1; j < grid->row_end[i]; j++) {
+			current_r = FD_NODE(grid, i - 1, j) + FD_NODE(grid, i + 1, j) + FD_NODE(grid, i, j - 1) + FD_NODE(grid, i, j + 1)
+					- 4.0 * FD_NODE(grid, i, j);
+			f[i * fstride + j] = (float)current_r;
+			total = combine_norms(total, (norm == FD_NORM_L2) ? current_r * current_r : fabs(current_r), norm);
+		}
+	}
+
+	return (norm == FD_NORM_L2) ? sqrt(total) : total;
+}
+
+/* sor_half_row in float, for the correction e with e(i+1,j) + e(i-1,j) +
+ * e(i,j+1) + e(i,j-1) - 4 e(i,j) = -f(i,j). */
+static void sor_half_row_float(float *FD_RESTRICT row, const float *up, const float *down, const float *f, const float *mask, float *FD_RESTRICT delta, size_t end, float w)
+{
+	size_t j;
+
+	for (j = 1; j < end; j++)
+		delta[j] = mask[j] * w * (0.25f * (up[j] + down[j] + row[j - 1] + row[j + 1] + f[j]) - row[j]);
+
+	for (j = 1; j < end; j++)
+		row[j] += delta[j];
+}
+
+/* row_norm of float changes, in four independent parts, the sums of
+ * squares accumulated in double */
+static double float_row_norm(const float *delta, size_t end, enum FDNorm norm)
+{
+	double part[4] = {0.0, 0.0, 0.0, 0.0};
+	double d;
+	size_t j, k;
+
+	for (j = 1; j + 4 <= end; j += 4) {
+		for (k = 0; k < 4; k++) {
+			d = (norm == FD_NORM_L2) ? (double)delta[j + k] * delta[j + k] : fabs(delta[j + k]);
+			part[k] = (norm == FD_NORM_L2) ? part[k] + d : (d > part[k]) ? d : part[k];
+		}
+	}
+
+	for (; j < end; j++) {
+		d = (norm == FD_NORM_L2) ? (double)delta[j] * delta[j] : fabs(delta[j]);
+		part[0] = combine_norms(part[0], d, norm);
+	}
+
+	return combine_norms(combine_norms(part[0], part[1], norm), combine_norms(part[2], part[3], norm), norm);
+}
+
+/* Red-black SOR of the correction e, from 0, until the norm of its residual
+ * is below target, or for at most limit iterations unless it is 0. The
+ * false boundary mirrors as in sor_worker. Returns the number of
+ * iterations. */
+static unsigned int mixed_correction(const struct FDGrid *grid, float *e, const float *f, size_t fstride, const float *mask, float *delta, float w, double target, unsigned int limit, const struct FDOptions *options)
+{
+	size_t N = grid->N;
+	size_t i, colour;
+	unsigned int iterations = 0;
+	double norm;
+	int check;
+
+	memset(e, 0, N * fstride * sizeof *e);
+
+	do {
+		check = ((iterations + 1) % options->check_interval == 0);
+		norm = 0.0;
+
+		for (colour = 0; colour < 2; colour++) {
+			for (i = 1; i < N - 1; i++) {
+				sor_half_row_float(&e[i * fstride], &e[(i - 1) * fstride], &e[(i + 1) * fstride], &f[i * fstride],
+						&mask[((i + colour) % 2) * fstride], delta, grid->row_end[i], w);
+
+				if (check)
+					norm = combine_norms(norm, float_row_norm(delta, grid->row_end[i], options->norm), options->norm);
+
+				if (i < grid->inner_x)
+					e[i * fstride + N - 1] = e[i * fstride + N - 3];
+
+				if (i == N - 3)
+					memcpy(&e[(N - 1) * fstride + 1], &e[(N - 3) * fstride + 1], (grid->inner_y - 1) * sizeof *e);
+			}
+		}
+
+		++iterations;
+
+		if (check && options->norm == FD_NORM_L2)
+			norm = sqrt(norm);
+	} while ((!check || 4.0 / w * norm >= target) && (limit == 0 || iterations < limit));
+
+	return iterations;
+}
+
+/* See fdgrid.h header for documentation */
+unsigned int fd_mixed_sor(struct FDGrid *grid, const struct FDOptions *options)
+{
+	size_t N = grid->N;
+	size_t fstride = (N + FD_FLOAT_ALIGN - 1) / FD_FLOAT_ALIGN * FD_FLOAT_ALIGN;
+	void *block[2];
+	float *e, *f, *mask, *delta;
+	double norm, last, target;
+	unsigned int iterations, corrections;
+	size_t i, j;
+	float w;
+
+	w = (float)((options->w > 0.0) ? options->w : fd_optimal_w(grid->h));
+
+	/* e and f are aligned as the rows of grid */
+	block[0] = malloc_or_fail(N * fstride + FD_FLOAT_ALIGN, sizeof(float));
+	block[1] = malloc_or_fail(N * fstride + FD_FLOAT_ALIGN, sizeof(float));
+	e = (float *)((char *)block[0] + (FD_ALIGN - (size_t)block[0] % FD_ALIGN) % FD_ALIGN);
+	f = (float *)((char *)block[1] + (FD_ALIGN - (size_t)block[1] % FD_ALIGN) % FD_ALIGN);
+	memset(f, 0, N * fstride * sizeof *f);
+	mask = malloc_or_fail(2 * fstride, sizeof *mask);
+	delta = malloc_or_fail(fstride, sizeof *delta);
+
+	for (j = 0; j < fstride; j++) {
+		mask[j] = (j % 2 == 0) ? 1.0f : 0.0f;
+		mask[fstride + j] = 1.0f - mask[j];
+	}
+
+	iterations = 0;
+	corrections = 0;
+	last = HUGE_VAL;
+	perf_begin("relaxation");
+
+	for (;;) {
+		fd_mirror(grid);
+		norm = mixed_right_side(grid, f, fstride, options->norm);
+
+		/* A correction that did not lower the residual was lost in the
+		 * rounding of the grid, and so would the next ones be */
+		if (norm < options->r || norm >= last)
+			break;
+
+		if (options->max_iterations > 0 && iterations >= options->max_iterations)
+			break;
+
+		last = norm;
+
+		/* Aim a little below r when it is in reach, to finish in this pass */
+		target = norm * FD_MIXED_REDUCTION;
+		target = (target > 0.5 * options->r) ? target : 0.5 * options->r;
+		iterations += mixed_correction(grid, e, f, fstride, mask, delta, w, target,
+				(options->max_iterations > 0) ? options->max_iterations - iterations : 0, options);
+		++corrections;
+
+		for (i = 1; i < N - 1; i++) {
+			for (j = 1; j < grid->row_end[i]; j++)
+				FD_NODE(grid, i, j) += e[i * fstride + j];
+		}
+	}
+
+	/* Each interior node: 8 flops for the update, 2 for the norm when
+	 * tested, 8 for each residual and correction in double */
+	perf_count("sweeps", iterations);
+	perf_count("corrections", corrections);
+	perf_count("residual_checks", iterations / options->check_interval + corrections + 1);
+	perf_count("node_updates", iterations * interior_nodes(grid));
+	perf_count("flops", (8.0 * iterations + 2.0 * (iterations / options->check_interval) + 8.0 * (corrections + 1)) * interior_nodes(grid));
+	perf_end("relaxation");
+
+	free_tracked(delta);
+	free_tracked(mask);
+	free_tracked(block[1]);
+	free_tracked(block[0]);
+
+	return iterations;
+}
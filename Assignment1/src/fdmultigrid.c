@@ -0,0 +1,553 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdmultigrid.h"
+#include "perf.h"
+#include "utils.h"
+
+/* Sweeps and residual reduction of the coarsest solve */
+#define FD_COARSE_SWEEPS	1000
+#define FD_COARSE_REDUCTION	1.0e-10
+
+/* Entries of a coarse stencil, for offsets -1 ... 1 in i and j */
+#define FD_STENCIL		9
+#define FD_STENCIL_CENTRE	4
+
+/* PROTOTYPES */
+static int is_free(const struct FDGrid *grid, size_t i, size_t j);
+static double interpolation_weight(size_t i, size_t c);
+static void operator_row(const struct FDMultigridLevel *level, size_t i, size_t j, double *a);
+static int is_regular(const struct FDMultigridLevel *level, size_t i, size_t j);
+static void galerkin_row(const struct FDMultigridLevel *fine, const struct FDGrid *cgrid, size_t i, size_t j, double *s);
+static void galerkin_stencil(const struct FDMultigridLevel *fine, struct FDMultigridLevel *coarse);
+static void boundary_source(const struct FDGrid *grid, double *b);
+static void smooth(struct FDMultigridLevel *level, unsigned int sweeps);
+static double compute_residual(struct FDMultigridLevel *level);
+static void restrict_vector(const struct FDGrid *fine, const double *r, const struct FDGrid *coarse, double *f);
+static void interpolate(const struct FDGrid *coarse, struct FDGrid *fine, int add);
+static void coarse_solve(struct FDMultigridLevel *level);
+static void cycle(const struct FDMultigrid *mg, size_t l, enum FDCycle type);
+static void full_multigrid(const struct FDMultigrid *mg);
+static struct FDMultigrid *multigrid_levels(struct FDGrid *grid, const struct FDMultigridOptions *options);
+static void multigrid_free(struct FDMultigrid *mg);
+/* END PROTOTYPES */
+
+void fd_multigrid_default_options(struct FDMultigridOptions *options)
+{
+	options->cycle = FD_CYCLE_V;
+	options->pre_smooth = 2;
+	options->post_smooth = 2;
+	options->full = 1;
+	options->r = 1.0e-5;
+	options->max_cycles = 100;
+}
+
+static int is_free(const struct FDGrid *grid, size_t i, size_t j)
+{
+	return i >= 1 && i < grid->N - 1 && j >= 1 && j < grid->row_end[i];
+}
+
+/* Weight of coarse row or column c in the interpolation onto fine row or
+ * column i. */
+static double interpolation_weight(size_t i, size_t c)
+{
+	if (i % 2 == 0)
+		return (c == i / 2) ? 1.0 : 0.0;
+
+	return (c == i / 2 || c == (i + 1) / 2) ? 0.5 : 0.0;
+}
+
+/* Coefficients of the correction equation of free node (i, j) of level,
+ * a[3 (di + 1) + dj + 1] for node (i + di, j + dj). Only free nodes have
+ * one: the conductors are at 0, and on the finest level a neighbour on the
+ * false boundary is its mirror image, so its coefficient goes to the node
+ * on the other side. */
+static void operator_row(const struct FDMultigridLevel *level, size_t i, size_t j, double *a)
+{
+	static const int di[4] = {-1, 1, 0, 0};
+	static const int dj[4] = {0, 0, -1, 1};
+	const struct FDGrid *grid = level->grid;
+	size_t d, ni, nj;
+
+	if (level->stencil != NULL) {
+		memcpy(a, &level->stencil[(i * grid->stride + j) * FD_STENCIL], FD_STENCIL * sizeof *a);
+		return;
+	}
+
+	memset(a, 0, FD_STENCIL * sizeof *a);
+	a[FD_STENCIL_CENTRE] = 4.0;
+
+	for (d = 0; d < 4; d++) {
+		ni = i + di[d];
+		nj = j + dj[d];
+
+		if (ni == grid->N - 1)
+			ni = grid->N - 3;
+
+		if (nj == grid->N - 1)
+			nj = grid->N - 3;
+
+		if (is_free(grid, ni, nj))
+			a[3 * (ni + 1 - i) + (nj + 1 - j)] -= 1.0;
+	}
+}
+
+/* Whether the operator of free node (i, j) is the regular stencil of the
+ * level: the 5-point one, with no neighbour on a conductor or mirrored, on
+ * the finest level, and regular_stencil on the coarse ones. */
+static int is_regular(const struct FDMultigridLevel *level, size_t i, size_t j)
+{
+	const struct FDGrid *grid = level->grid;
+
+	if (level->regular != NULL)
+		return level->regular[i * grid->stride + j];
+
+	return is_free(grid, i, j) && is_free(grid, i - 1, j) && is_free(grid, i + 1, j)
+		&& is_free(grid, i, j - 1) && is_free(grid, i, j + 1);
+}
+
+/* Stencil s of free coarse node (i, j) as row (i, j) of the Galerkin product
+ * R A P of the operator A of the fine level, where P is the interpolation
+ * and R = P^T the restriction. Coarse node (i, j) is fine node (2i, 2j),
+ * and the product follows the conductors and planes of symmetry wherever
+ * the fine grid has them, even between two coarse nodes. */
+static void galerkin_row(const struct FDMultigridLevel *fine, const struct FDGrid *cgrid, size_t i, size_t j, double *s)
+{
+	const struct FDGrid *fgrid = fine->grid;
+	double a[FD_STENCIL];
+	double p, q;
+	size_t ki, kj, mi, mj, ci, cj, d;
+
+	memset(s, 0, FD_STENCIL * sizeof *s);
+
+	/* Fine nodes k that node (i, j) interpolates onto */
+	for (ki = 2 * i - 1; ki <= 2 * i + 1; ki++) {
+		for (kj = 2 * j - 1; kj <= 2 * j + 1; kj++) {
+			if (!is_free(fgrid, ki, kj))
+				continue;
+
+			p = interpolation_weight(ki, i) * interpolation_weight(kj, j);
+			operator_row(fine, ki, kj, a);
+
+			/* Fine nodes m in the row of k, and the coarse nodes that interpolate onto them */
+			for (d = 0; d < FD_STENCIL; d++) {
+				if (a[d] == 0.0)
+					continue;
+
+				mi = ki + d / 3 - 1;
+				mj = kj + d % 3 - 1;
+
+				for (ci = mi / 2; ci <= (mi + 1) / 2; ci++) {
+					for (cj = mj / 2; cj <= (mj + 1) / 2; cj++) {
+						if (!is_free(cgrid, ci, cj))
+							continue;
+
+						q = interpolation_weight(mi, ci) * interpolation_weight(mj, cj);
+						s[3 * (ci + 1 - i) + (cj + 1 - j)] += p * a[d] * q;
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Stencils of the coarse level from the operator of the fine one. A coarse
+ * node whose fine nodes all have the regular stencil, and whose coarse
+ * neighbours are all free, gets the same product as every other such node,
+ * which is only computed once; it becomes the regular stencil of the coarse
+ * level, and the smoothing reads it instead of the node's own copy. */
+static void galerkin_stencil(const struct FDMultigridLevel *fine, struct FDMultigridLevel *coarse)
+{
+	const struct FDGrid *cgrid = coarse->grid;
+	double *s;
+	size_t i, j, k, a, b;
+	int regular, found = 0;
+
+	memset(coarse->stencil, 0, cgrid->N * cgrid->stride * FD_STENCIL * sizeof *(coarse->stencil));
+	memset(coarse->regular, 0, cgrid->N * cgrid->stride * sizeof *(coarse->regular));
+
+	for (i = 1; i < cgrid->N - 1; i++) {
+		for (j = 1; j < cgrid->row_end[i]; j++) {
+			k = i * cgrid->stride + j;
+			s = &coarse->stencil[k * FD_STENCIL];
+			regular = 1;
+
+			for (a = 0; a < 3 && regular; a++) {
+				for (b = 0; b < 3 && regular; b++) {
+					regular = is_regular(fine, 2 * i + a - 1, 2 * j + b - 1) && is_free(cgrid, i + a - 1, j + b - 1);
+				}
+			}
+
+			if (regular && found) {
+				memcpy(s, coarse->regular_stencil, FD_STENCIL * sizeof *s);
+			} else {
+				galerkin_row(fine, cgrid, i, j, s);
+
+				if (regular) {
+					memcpy(coarse->regular_stencil, s, FD_STENCIL * sizeof *s);
+					found = 1;
+				}
+			}
+
+			coarse->regular[k] = (unsigned char)regular;
+		}
+	}
+}
+
+/* b = the part of -Au that comes from the conductors, on the free nodes of
+ * the finest level, and 0 elsewhere. It is the right side of the problem
+ * with the conductors at 0, as the coarse levels see it. */
+static void boundary_source(const struct FDGrid *grid, double *b)
+{
+	size_t stride = grid->stride;
+	size_t i, j, k;
+
+	memset(b, 0, grid->N * stride * sizeof *b);
+
+	for (i = 1; i < grid->N - 1; i++) {
+		for (j = 1; j < grid->row_end[i]; j++) {
+			k = i * stride + j;
+
+			if (!is_free(grid, i - 1, j))
+				b[k] += grid->values[k - stride];
+
+			if (i + 1 < grid->N - 1 && !is_free(grid, i + 1, j))
+				b[k] += grid->values[k + stride];
+
+			if (!is_free(grid, i, j - 1))
+				b[k] += grid->values[k - 1];
+
+			if (j + 1 < grid->N - 1 && !is_free(grid, i, j + 1))
+				b[k] += grid->values[k + 1];
+		}
+	}
+}
+
+/* Red-black Gauss-Seidel for 4 u(i,j) - u(i+1,j) - u(i-1,j) - u(i,j+1) - u(i,j-1) = f(i,j)
+ * on the finest level, and lexicographic Gauss-Seidel with the stencils of
+ * the coarse ones. */
+static void smooth(struct FDMultigridLevel *level, unsigned int sweeps)
+{
+	struct FDGrid *grid = level->grid;
+	size_t stride = grid->stride;
+	double *u = grid->values;
+	const double *f = level->f;
+	const double *s;
+	size_t i, j, k, colour;
+	unsigned int sweep;
+
+	if (level->stencil != NULL) {
+		for (sweep = 0; sweep < sweeps; sweep++) {
+			for (i = 1; i < grid->N - 1; i++) {
+				for (j = 1; j < grid->row_end[i]; j++) {
+					k = i * stride + j;
+					s = level->regular[k] ? level->regular_stencil : &level->stencil[k * FD_STENCIL];
+					u[k] = (f[k] - s[0] * u[k - stride - 1] - s[1] * u[k - stride] - s[2] * u[k - stride + 1]
+						- s[3] * u[k - 1] - s[5] * u[k + 1]
+						- s[6] * u[k + stride - 1] - s[7] * u[k + stride] - s[8] * u[k + stride + 1]) * (1.0 / s[FD_STENCIL_CENTRE]);
+				}
+			}
+		}
+
+		return;
+	}
+
+	for (sweep = 0; sweep < sweeps; sweep++) {
+		for (colour = 0; colour < 2; colour++) {
+			for (i = 1; i < grid->N - 1; i++) {
+				/* Nodes with i + j = colour modulo 2 */
+				for (j = 1 + (i + colour + 1) % 2; j < grid->row_end[i]; j += 2) {
+					k = i * stride + j;
+					u[k] = 0.25 * (u[k - stride] + u[k + stride] + u[k - 1] + u[k + 1] + f[k]);
+				}
+			}
+
+			fd_mirror(grid);
+		}
+	}
+}
+
+/* residual = f - Au on the free nodes and 0 elsewhere. Returns the largest
+ * magnitude. */
+static double compute_residual(struct FDMultigridLevel *level)
+{
+	struct FDGrid *grid = level->grid;
+	size_t stride = grid->stride;
+	const double *u = grid->values;
+	double *residual = level->residual;
+	const double *s;
+	double max_r = 0.0;
+	size_t i, j, k;
+
+	memset(residual, 0, grid->N * stride * sizeof *residual);
+
+	for (i = 1; i < grid->N - 1; i++) {
+		for (j = 1; j < grid->row_end[i]; j++) {
+			k = i * stride + j;
+
+			if (level->stencil != NULL) {
+				s = level->regular[k] ? level->regular_stencil : &level->stencil[k * FD_STENCIL];
+				residual[k] = level->f[k] - s[0] * u[k - stride - 1] - s[1] * u[k - stride] - s[2] * u[k - stride + 1]
+					- s[3] * u[k - 1] - s[4] * u[k] - s[5] * u[k + 1]
+					- s[6] * u[k + stride - 1] - s[7] * u[k + stride] - s[8] * u[k + stride + 1];
+			} else {
+				residual[k] = level->f[k] + u[k - stride] + u[k + stride] + u[k - 1] + u[k + 1] - 4.0 * u[k];
+			}
+
+			if (fabs(residual[k]) > max_r)
+				max_r = fabs(residual[k]);
+		}
+	}
+
+	return max_r;
+}
+
+/* f = P^T r on the free coarse nodes, for r that is 0 off the free fine
+ * nodes: full weighting, scaled by 4 since the operator is not scaled by
+ * 1 / h^2. */
+static void restrict_vector(const struct FDGrid *fine, const double *r, const struct FDGrid *coarse, double *f)
+{
+	size_t stride = fine->stride;
+	size_t i, j, k, fi, fj;
+	double sum;
+
+	for (i = 1; i < coarse->N - 1; i++) {
+		for (j = 1; j < coarse->row_end[i]; j++) {
+			k = 2 * i * stride + 2 * j;
+
+			if (2 * i + 1 < fine->N && 2 * j + 1 < fine->N) {
+				f[i * coarse->stride + j] = r[k] + 0.5 * (r[k - stride] + r[k + stride] + r[k - 1] + r[k + 1])
+					+ 0.25 * (r[k - stride - 1] + r[k - stride + 1] + r[k + stride - 1] + r[k + stride + 1]);
+				continue;
+			}
+
+			/* Next to a plane of symmetry between two coarse nodes, the
+			 * last fine row or column is past the grid */
+			sum = 0.0;
+
+			for (fi = 2 * i - 1; fi <= 2 * i + 1 && fi < fine->N; fi++) {
+				for (fj = 2 * j - 1; fj <= 2 * j + 1 && fj < fine->N; fj++)
+					sum += interpolation_weight(fi, i) * interpolation_weight(fj, j) * r[fi * stride + fj];
+			}
+
+			f[i * coarse->stride + j] = sum;
+		}
+	}
+}
+
+/* Bilinear interpolation of coarse onto the free nodes of fine, added to
+ * them if add is nonzero, otherwise replacing them. */
+static void interpolate(const struct FDGrid *coarse, struct FDGrid *fine, int add)
+{
+	size_t i, j, i0, i1, j0, j1;
+	double value;
+
+	for (i = 1; i < fine->N - 1; i++) {
+		i0 = i / 2;
+		i1 = (i + 1) / 2;
+
+		for (j = 1; j < fine->row_end[i]; j++) {
+			j0 = j / 2;
+			j1 = (j + 1) / 2;
+			value = 0.25 * (FD_NODE(coarse, i0, j0) + FD_NODE(coarse, i0, j1) + FD_NODE(coarse, i1, j0) + FD_NODE(coarse, i1, j1));
+
+			if (add)
+				FD_NODE(fine, i, j) += value;
+			else
+				FD_NODE(fine, i, j) = value;
+		}
+	}
+
+	fd_mirror(fine);
+}
+
+/* Relax the coarsest level until its residual has dropped by FD_COARSE_REDUCTION. */
+static void coarse_solve(struct FDMultigridLevel *level)
+{
+	double initial_r;
+	unsigned int sweep;
+
+	initial_r = compute_residual(level);
+
+	for (sweep = 0; sweep < FD_COARSE_SWEEPS; sweep++) {
+		smooth(level, 1);
+
+		if (compute_residual(level) <= FD_COARSE_REDUCTION * initial_r)
+			break;
+	}
+}
+
+/* One cycle on level l, improving its grid values. */
+static void cycle(const struct FDMultigrid *mg, size_t l, enum FDCycle type)
+{
+	struct FDMultigridLevel *level = &mg->levels[l];
+	struct FDMultigridLevel *coarse;
+
+	if (l == mg->nlevels - 1) {
+		coarse_solve(level);
+		return;
+	}
+
+	coarse = &mg->levels[l + 1];
+
+	smooth(level, mg->options->pre_smooth);
+	compute_residual(level);
+	restrict_vector(level->grid, level->residual, coarse->grid, coarse->f);
+
+	/* The correction starts at 0, conductors included */
+	memset(coarse->grid->values, 0, coarse->grid->N * coarse->grid->stride * sizeof(double));
+
+	switch (type) {
+		case FD_CYCLE_V:
+			cycle(mg, l + 1, FD_CYCLE_V);
+			break;
+		case FD_CYCLE_W:
+			cycle(mg, l + 1, FD_CYCLE_W);
+			cycle(mg, l + 1, FD_CYCLE_W);
+			break;
+		case FD_CYCLE_F:
+			cycle(mg, l + 1, FD_CYCLE_F);
+			cycle(mg, l + 1, FD_CYCLE_V);
+			break;
+	}
+
+	interpolate(coarse->grid, level->grid, 1);
+	smooth(level, mg->options->post_smooth);
+}
+
+/* Solve the problem on the coarsest level, then on each finer one start
+ * from the interpolated coarse solution and apply one cycle. The coarse
+ * problems have the conductors at 0 and their potentials restricted from
+ * the finest level in the right side. */
+static void full_multigrid(const struct FDMultigrid *mg)
+{
+	struct FDMultigridLevel *level;
+	size_t l;
+
+	for (l = 0; l + 1 < mg->nlevels; l++) {
+		if (l == 0)
+			boundary_source(mg->levels[0].grid, mg->levels[0].residual);
+
+		restrict_vector(mg->levels[l].grid, (l == 0) ? mg->levels[0].residual : mg->levels[l].f, mg->levels[l + 1].grid, mg->levels[l + 1].f);
+	}
+
+	for (l = mg->nlevels; l-- > 0; ) {
+		level = &mg->levels[l];
+
+		if (l == 0)
+			memset(level->f, 0, level->grid->N * level->grid->stride * sizeof(double));
+
+		/* Coarse levels hold the potential, not a correction, for now. Their
+		 * stencils leave the conductors out, which only keep their
+		 * potentials for the interpolation */
+		if (l > 0) {
+			memset(level->grid->values, 0, level->grid->N * level->grid->stride * sizeof(double));
+			fd_coax_boundary(level->grid);
+		}
+
+		if (l == mg->nlevels - 1) {
+			coarse_solve(level);
+		} else {
+			interpolate(mg->levels[l + 1].grid, level->grid, 0);
+			cycle(mg, l, mg->options->cycle);
+		}
+	}
+}
+
+/* Build the coarse levels below grid, which becomes level 0. */
+static struct FDMultigrid *multigrid_levels(struct FDGrid *grid, const struct FDMultigridOptions *options)
+{
+	struct FDMultigrid *mg;
+	struct FDGrid *fine;
+	size_t nlevels, inner_x, inner_y, l;
+
+	/* Coarsen while the coarse grid keeps a free row and column between
+	 * the outer and the inner conductor */
+	nlevels = 1;
+	inner_x = grid->inner_x;
+	inner_y = grid->inner_y;
+
+	while ((inner_x + 1) / 2 >= 2 && (inner_y + 1) / 2 >= 2) {
+		inner_x = (inner_x + 1) / 2;
+		inner_y = (inner_y + 1) / 2;
+		++nlevels;
+	}
+
+	mg = malloc_or_fail(1, sizeof *mg);
+	mg->options = options;
+	mg->levels = malloc_or_fail(nlevels, sizeof *(mg->levels));
+	mg->nlevels = nlevels;
+	mg->levels[0].grid = grid;
+
+	for (l = 0; l < nlevels; l++) {
+		fine = mg->levels[l].grid;
+
+		/* Coarse node (i, j) is fine node (2i, 2j), so the conductor starts
+		 * at ceil(inner_x / 2) and the plane of symmetry N - 2 moves to
+		 * ceil((N - 2) / 2) */
+		if (l + 1 < nlevels)
+			mg->levels[l + 1].grid = FDGrid_new((fine->N - 1) / 2 + 2, (fine->inner_x + 1) / 2, (fine->inner_y + 1) / 2, 2.0 * fine->h);
+
+		mg->levels[l].f = malloc_or_fail(fine->N * fine->stride, sizeof(double));
+		mg->levels[l].residual = malloc_or_fail(fine->N * fine->stride, sizeof(double));
+		memset(mg->levels[l].f, 0, fine->N * fine->stride * sizeof(double));
+		mg->levels[l].stencil = NULL;
+		mg->levels[l].regular = NULL;
+
+		if (l > 0) {
+			mg->levels[l].stencil = malloc_or_fail(fine->N * fine->stride * FD_STENCIL, sizeof(double));
+			mg->levels[l].regular = malloc_or_fail(fine->N * fine->stride, sizeof(unsigned char));
+			galerkin_stencil(&mg->levels[l - 1], &mg->levels[l]);
+		}
+	}
+
+	return mg;
+}
+
+static void multigrid_free(struct FDMultigrid *mg)
+{
+	size_t l;
+
+	for (l = 0; l < mg->nlevels; l++) {
+		if (l > 0)
+			FDGrid_delete(mg->levels[l].grid);
+
+		free_tracked(mg->levels[l].f);
+		free_tracked(mg->levels[l].residual);
+
+		free_tracked(mg->levels[l].stencil);
+		free_tracked(mg->levels[l].regular);
+	}
+
+	free_tracked(mg->levels);
+	free_tracked(mg);
+}
+
+/* See fdmultigrid.h header for documentation */
+unsigned int fd_multigrid(struct FDGrid *grid, const struct FDMultigridOptions *options)
+{
+	struct FDMultigrid *mg;
+	unsigned int cycles;
+
+	perf_begin("multigrid");
+	mg = multigrid_levels(grid, options);
+
+	if (options->full)
+		full_multigrid(mg);
+
+	cycles = 0;
+
+	while (compute_residual(&mg->levels[0]) >= options->r && cycles < options->max_cycles) {
+		cycle(mg, 0, options->cycle);
+		++cycles;
+	}
+
+	perf_count("multigrid_cycles", cycles);
+	perf_count("multigrid_levels", mg->nlevels);
+	perf_end("multigrid");
+
+	multigrid_free(mg);
+
+	return cycles;
+}
@@ -0,0 +1,613 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdquadtree.h"
+#include "perf.h"
+#include "utils.h"
+
+/* The quarter is FD_QUAD_ROOTS x FD_QUAD_ROOTS root cells of FD_QUAD_ROOT_H */
+#define FD_QUAD_ROOTS	5
+#define FD_QUAD_ROOT_H	0.02
+
+/* PROTOTYPES */
+static size_t leaf_size(const struct FDQuadtree *tree, const struct FDQuadLeaf *leaf);
+static int in_conductor(const struct FDQuadtree *tree, size_t i, size_t j);
+static void split(struct FDQuadtree *tree, size_t k);
+static void build_cells(struct FDQuadtree *tree);
+static double interpolate(const struct FDQuadtree *tree, double i, double j);
+static int compare_hanging(const void *a, const void *b);
+static int compare_nodes(const void *a, const void *b);
+static void build_nodes(struct FDQuadtree *tree, const struct FDQuadtree *old);
+static void build_stencils(struct FDQuadtree *tree);
+static void free_nodes(struct FDQuadtree *tree);
+static double second_difference(const struct FDQuadtree *tree, size_t f, int axis);
+static void estimate_corrections(struct FDQuadtree *tree);
+static void update_hanging(struct FDQuadtree *tree);
+static size_t balance(struct FDQuadtree *tree);
+/* END PROTOTYPES */
+
+/* qsort has no context argument, so compare_nodes reads the node
+ * coordinates of the tree being built from here */
+static const struct FDQuadtree *sorted_tree;
+
+static size_t leaf_size(const struct FDQuadtree *tree, const struct FDQuadLeaf *leaf)
+{
+	return (size_t)1 << (tree->max_level - leaf->level);
+}
+
+/* Lattice point (i, j) is on or inside the inner conductor */
+static int in_conductor(const struct FDQuadtree *tree, size_t i, size_t j)
+{
+	size_t inner_i = (size_t)(((COAX_OUTER_L - COAX_INNER_W) / 2.0) / tree->step + 0.5);
+	size_t inner_j = (size_t)(((COAX_OUTER_L - COAX_INNER_L) / 2.0) / tree->step + 0.5);
+
+	return i >= inner_i && j >= inner_j;
+}
+
+/* Replace leaf k by its four children, the first in its place and the
+ * others at the end. */
+static void split(struct FDQuadtree *tree, size_t k)
+{
+	struct FDQuadLeaf *larger;
+	struct FDQuadLeaf leaf = tree->leaves[k];
+	size_t half = leaf_size(tree, &leaf) / 2;
+	size_t c;
+
+	if (tree->nleaves + 3 > tree->capacity) {
+		tree->capacity *= 2;
+		larger = malloc_or_fail(tree->capacity, sizeof *larger);
+		memcpy(larger, tree->leaves, tree->nleaves * sizeof *larger);
+		free_tracked(tree->leaves);
+		tree->leaves = larger;
+	}
+
+	for (c = 0; c < 4; c++) {
+		struct FDQuadLeaf *child = (c == 0) ? &tree->leaves[k] : &tree->leaves[tree->nleaves++];
+
+		child->i = leaf.i + (c % 2) * half;
+		child->j = leaf.j + (c / 2) * half;
+		child->level = leaf.level + 1;
+	}
+}
+
+static void build_cells(struct FDQuadtree *tree)
+{
+	const struct FDQuadLeaf *leaf;
+	size_t k, i, j, s;
+
+	for (k = 0; k < tree->nleaves; k++) {
+		leaf = &tree->leaves[k];
+		s = leaf_size(tree, leaf);
+
+		for (i = leaf->i; i < leaf->i + s; i++) {
+			for (j = leaf->j; j < leaf->j + s; j++)
+				tree->cell_leaf[i * tree->side + j] = k;
+		}
+	}
+}
+
+/* Bilinear interpolation of the corners of the leaf holding lattice
+ * position (i, j), which need not be a lattice point. */
+static double interpolate(const struct FDQuadtree *tree, double i, double j)
+{
+	const struct FDQuadLeaf *leaf;
+	size_t ci, cj, s;
+	double x, y;
+
+	ci = (i < tree->side - 1) ? (size_t)i : tree->side - 1;
+	cj = (j < tree->side - 1) ? (size_t)j : tree->side - 1;
+	leaf = &tree->leaves[tree->cell_leaf[ci * tree->side + cj]];
+	s = leaf_size(tree, leaf);
+	x = (i - leaf->i) / s;
+	y = (j - leaf->j) / s;
+
+	return (1.0 - x) * (1.0 - y) * tree->u[tree->node_at[leaf->i * (tree->side + 1) + leaf->j]]
+		+ x * (1.0 - y) * tree->u[tree->node_at[(leaf->i + s) * (tree->side + 1) + leaf->j]]
+		+ (1.0 - x) * y * tree->u[tree->node_at[leaf->i * (tree->side + 1) + leaf->j + s]]
+		+ x * y * tree->u[tree->node_at[(leaf->i + s) * (tree->side + 1) + leaf->j + s]];
+}
+
+static int compare_hanging(const void *a, const void *b)
+{
+	const struct FDQuadHanging *x = a, *y = b;
+
+	return (x->size < y->size) - (x->size > y->size);
+}
+
+/* Row by row, as the sweeps of successive_over_relaxation */
+static int compare_nodes(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+	size_t kx = sorted_tree->node_i[x] * (sorted_tree->side + 1) + sorted_tree->node_j[x];
+	size_t ky = sorted_tree->node_i[y] * (sorted_tree->side + 1) + sorted_tree->node_j[y];
+
+	return (kx > ky) - (kx < ky);
+}
+
+/* Number the leaf corners, set the conductors, find the hanging nodes and
+ * start the others from old, if not NULL, or from 0. */
+static void build_nodes(struct FDQuadtree *tree, const struct FDQuadtree *old)
+{
+	static const size_t corner[4][2] = {{0, 0}, {1, 0}, {0, 1}, {1, 1}};
+	const struct FDQuadLeaf *leaf;
+	unsigned char *kind;		/* 0 free, 1 fixed, 2 hanging */
+	long *free_index;
+	size_t points = (tree->side + 1) * (tree->side + 1);
+	size_t k, c, n, s, p, mid[4], ends[4][2];
+	size_t i, j;
+
+	tree->node_at = malloc_or_fail(points, sizeof *(tree->node_at));
+
+	for (p = 0; p < points; p++)
+		tree->node_at[p] = -1;
+
+	tree->nnodes = 0;
+	tree->node_i = malloc_or_fail(4 * tree->nleaves, sizeof *(tree->node_i));
+	tree->node_j = malloc_or_fail(4 * tree->nleaves, sizeof *(tree->node_j));
+
+	for (k = 0; k < tree->nleaves; k++) {
+		leaf = &tree->leaves[k];
+		s = leaf_size(tree, leaf);
+
+		for (c = 0; c < 4; c++) {
+			p = (leaf->i + corner[c][0] * s) * (tree->side + 1) + leaf->j + corner[c][1] * s;
+
+			if (tree->node_at[p] < 0) {
+				tree->node_at[p] = (long)tree->nnodes;
+				tree->node_i[tree->nnodes] = leaf->i + corner[c][0] * s;
+				tree->node_j[tree->nnodes] = leaf->j + corner[c][1] * s;
+				++tree->nnodes;
+			}
+		}
+	}
+
+	tree->u = malloc_or_fail(tree->nnodes, sizeof *(tree->u));
+	kind = malloc_or_fail(tree->nnodes, sizeof *kind);
+
+	for (n = 0; n < tree->nnodes; n++) {
+		i = tree->node_i[n];
+		j = tree->node_j[n];
+		kind[n] = 1;
+
+		if (i == 0 || j == 0)
+			tree->u[n] = COAX_OUTER_V;
+		else if (in_conductor(tree, i, j))
+			tree->u[n] = COAX_INNER_V;
+		else if (old != NULL)
+			tree->u[n] = (old->node_at[i * (old->side + 1) + j] >= 0) ? old->u[old->node_at[i * (old->side + 1) + j]] : interpolate(old, i, j);
+		else
+			tree->u[n] = 0.0;
+
+		if (i > 0 && j > 0 && !in_conductor(tree, i, j))
+			kind[n] = 0;
+	}
+
+	/* A corner in the middle of a leaf edge hangs from the edge's ends */
+	tree->hanging = malloc_or_fail(tree->nnodes, sizeof *(tree->hanging));
+	tree->nhanging = 0;
+
+	for (k = 0; k < tree->nleaves; k++) {
+		leaf = &tree->leaves[k];
+		s = leaf_size(tree, leaf);
+
+		if (s < 2)
+			continue;
+
+		mid[0] = (leaf->i + s / 2) * (tree->side + 1) + leaf->j;
+		ends[0][0] = leaf->i * (tree->side + 1) + leaf->j;
+		ends[0][1] = (leaf->i + s) * (tree->side + 1) + leaf->j;
+		mid[1] = mid[0] + s;
+		ends[1][0] = ends[0][0] + s;
+		ends[1][1] = ends[0][1] + s;
+		mid[2] = leaf->i * (tree->side + 1) + leaf->j + s / 2;
+		ends[2][0] = ends[0][0];
+		ends[2][1] = ends[1][0];
+		mid[3] = mid[2] + s * (tree->side + 1);
+		ends[3][0] = ends[0][1];
+		ends[3][1] = ends[1][1];
+
+		for (c = 0; c < 4; c++) {
+			if (tree->node_at[mid[c]] < 0 || kind[tree->node_at[mid[c]]] != 0)
+				continue;
+
+			n = (size_t)tree->node_at[mid[c]];
+			kind[n] = 2;
+			tree->hanging[tree->nhanging].node = n;
+			tree->hanging[tree->nhanging].a = (size_t)tree->node_at[ends[c][0]];
+			tree->hanging[tree->nhanging].b = (size_t)tree->node_at[ends[c][1]];
+			tree->hanging[tree->nhanging].axis = (c < 2) ? 1 : 0;
+			tree->hanging[tree->nhanging].size = s;
+			tree->hanging[tree->nhanging].correction = 0.0;
+			++tree->nhanging;
+		}
+	}
+
+	/* The ends of an edge may hang from a larger one */
+	qsort(tree->hanging, tree->nhanging, sizeof *(tree->hanging), compare_hanging);
+
+	tree->free_nodes = malloc_or_fail(tree->nnodes, sizeof *(tree->free_nodes));
+	tree->nfree = 0;
+
+	for (n = 0; n < tree->nnodes; n++) {
+		if (kind[n] == 0)
+			tree->free_nodes[tree->nfree++] = n;
+	}
+
+	sorted_tree = tree;
+	qsort(tree->free_nodes, tree->nfree, sizeof *(tree->free_nodes), compare_nodes);
+
+	/* The ends of the edges, where they have an equation of their own */
+	free_index = malloc_or_fail(tree->nnodes, sizeof *free_index);
+
+	for (n = 0; n < tree->nnodes; n++)
+		free_index[n] = -1;
+
+	for (k = 0; k < tree->nfree; k++)
+		free_index[tree->free_nodes[k]] = (long)k;
+
+	for (k = 0; k < tree->nhanging; k++) {
+		tree->hanging[k].free_a = free_index[tree->hanging[k].a];
+		tree->hanging[k].free_b = free_index[tree->hanging[k].b];
+	}
+
+	free_tracked(free_index);
+	free_tracked(kind);
+}
+
+/* Arms and weights of the five point equation of each free node */
+static void build_stencils(struct FDQuadtree *tree)
+{
+	static const int direction[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+	size_t f, n, d, k, i, j;
+	long node;
+	double a[4], total;
+
+	tree->neighbours = malloc_or_fail(4 * tree->nfree, sizeof *(tree->neighbours));
+	tree->arms = malloc_or_fail(4 * tree->nfree, sizeof *(tree->arms));
+	tree->weights = malloc_or_fail(4 * tree->nfree, sizeof *(tree->weights));
+
+	for (f = 0; f < tree->nfree; f++) {
+		n = tree->free_nodes[f];
+
+		for (d = 0; d < 4; d++) {
+			i = tree->node_i[n];
+			j = tree->node_j[n];
+			node = -1;
+
+			/* Free nodes are inside the quarter, or on a plane of
+			 * symmetry, where the arm past it mirrors the other */
+			for (k = 1; node < 0; k++) {
+				if ((direction[d][0] > 0 && i + k > tree->side) || (direction[d][1] > 0 && j + k > tree->side))
+					break;
+
+				node = tree->node_at[(i + direction[d][0] * (long)k) * (tree->side + 1) + j + direction[d][1] * (long)k];
+			}
+
+			tree->neighbours[4 * f + d] = (node < 0) ? n : (size_t)node;
+			tree->arms[4 * f + d] = (node < 0) ? 0.0 : (k - 1) * tree->step;
+		}
+
+		for (d = 0; d < 4; d += 2) {
+			if (tree->neighbours[4 * f + d] == n) {
+				tree->neighbours[4 * f + d] = tree->neighbours[4 * f + d + 1];
+				tree->arms[4 * f + d] = tree->arms[4 * f + d + 1];
+			}
+		}
+
+		for (d = 0; d < 4; d++)
+			a[d] = 1.0 / (tree->arms[4 * f + d] * (tree->arms[4 * f + (d ^ 1)] + tree->arms[4 * f + d]));
+
+		total = a[0] + a[1] + a[2] + a[3];
+
+		for (d = 0; d < 4; d++)
+			tree->weights[4 * f + d] = a[d] / total;
+	}
+}
+
+static void free_nodes(struct FDQuadtree *tree)
+{
+	free_tracked(tree->node_at);
+	free_tracked(tree->node_i);
+	free_tracked(tree->node_j);
+	free_tracked(tree->u);
+	free_tracked(tree->free_nodes);
+	free_tracked(tree->neighbours);
+	free_tracked(tree->arms);
+	free_tracked(tree->weights);
+	free_tracked(tree->hanging);
+}
+
+/* Second difference along x (axis 0) or y at free node f */
+static double second_difference(const struct FDQuadtree *tree, size_t f, int axis)
+{
+	const double *arm = &tree->arms[4 * f + 2 * axis];
+	const size_t *nb = &tree->neighbours[4 * f + 2 * axis];
+	double u = tree->u[tree->free_nodes[f]];
+
+	return 2.0 / (arm[0] + arm[1]) * ((tree->u[nb[0]] - u) / arm[0] + (tree->u[nb[1]] - u) / arm[1]);
+}
+
+/* u = (u_a + u_b) / 2 - (d^2 / 2) u'' along the edge, with half length d
+ * and u'' = -(second difference across it) at the free ends. Larger edges
+ * come first, so ends that hang are up to date. */
+/* Set the quadratic term of each hanging node from the current potentials */
+static void estimate_corrections(struct FDQuadtree *tree)
+{
+	struct FDQuadHanging *hanging;
+	double d, across;
+	size_t k;
+	int count;
+
+	for (k = 0; k < tree->nhanging; k++) {
+		hanging = &tree->hanging[k];
+		across = 0.0;
+		count = 0;
+
+		if (hanging->free_a >= 0) {
+			across += second_difference(tree, (size_t)hanging->free_a, hanging->axis);
+			++count;
+		}
+
+		if (hanging->free_b >= 0) {
+			across += second_difference(tree, (size_t)hanging->free_b, hanging->axis);
+			++count;
+		}
+
+		d = 0.5 * hanging->size * tree->step;
+		hanging->correction = (count > 0) ? 0.5 * d * d * across / count : 0.0;
+	}
+}
+
+/* Hanging nodes from their ends and quadratic terms, larger edges first
+ * so that the ends are up to date */
+static void update_hanging(struct FDQuadtree *tree)
+{
+	const struct FDQuadHanging *hanging;
+	size_t k;
+
+	for (k = 0; k < tree->nhanging; k++) {
+		hanging = &tree->hanging[k];
+		tree->u[hanging->node] = 0.5 * (tree->u[hanging->a] + tree->u[hanging->b]) + hanging->correction;
+	}
+}
+
+/* See fdquadtree.h header for documentation */
+struct FDQuadtree *FDQuadtree_new(unsigned int max_level)
+{
+	struct FDQuadtree *tree;
+	size_t a, b;
+
+	tree = malloc_or_fail(1, sizeof *tree);
+	tree->max_level = max_level;
+	tree->side = (size_t)FD_QUAD_ROOTS << max_level;
+	tree->step = FD_QUAD_ROOT_H / ((size_t)1 << max_level);
+	tree->capacity = 4 * FD_QUAD_ROOTS * FD_QUAD_ROOTS;
+	tree->leaves = malloc_or_fail(tree->capacity, sizeof *(tree->leaves));
+	tree->nleaves = 0;
+
+	for (a = 0; a < FD_QUAD_ROOTS; a++) {
+		for (b = 0; b < FD_QUAD_ROOTS; b++) {
+			tree->leaves[tree->nleaves].i = a << max_level;
+			tree->leaves[tree->nleaves].j = b << max_level;
+			tree->leaves[tree->nleaves].level = 0;
+			++tree->nleaves;
+		}
+	}
+
+	tree->cell_leaf = malloc_or_fail(tree->side * tree->side, sizeof *(tree->cell_leaf));
+	build_cells(tree);
+	build_nodes(tree, NULL);
+	build_stencils(tree);
+
+	return tree;
+}
+
+void FDQuadtree_delete(struct FDQuadtree *tree)
+{
+	free_nodes(tree);
+	free_tracked(tree->cell_leaf);
+	free_tracked(tree->leaves);
+	free_tracked(tree);
+}
+
+/* See fdquadtree.h header for documentation */
+unsigned int fd_quadtree_solve(struct FDQuadtree *tree, const struct FDOptions *options)
+{
+	const size_t *neighbours = tree->neighbours;
+	const double *weights = tree->weights;
+	double *u = tree->u;
+	double h, w, norm, current_r;
+	unsigned int iterations, sweeps, passes;
+	size_t f;
+
+	/* The free nodes of the coax quarter at spacing h are about 0.92 (0.1 / h)^2 */
+	h = 0.1 * sqrt(0.92 / tree->nfree);
+	w = (options->w > 0.0) ? options->w : fd_optimal_w((h < FD_QUAD_ROOT_H) ? h : FD_QUAD_ROOT_H);
+	iterations = 0;
+	passes = 0;
+	perf_begin("relaxation");
+
+	/* The quadratic terms give the hanging nodes negative weights on their
+	 * neighbours, and over-relaxing that system diverges for w near 2. With
+	 * the terms held fixed the weights are positive, so relax that system,
+	 * then update the terms, until a pass converges in one sweep. */
+	do {
+		estimate_corrections(tree);
+		sweeps = 0;
+
+		do {
+			update_hanging(tree);
+			norm = 0.0;
+
+			for (f = 0; f < tree->nfree; f++) {
+				current_r = 4.0 * (weights[4 * f] * u[neighbours[4 * f]] + weights[4 * f + 1] * u[neighbours[4 * f + 1]]
+						+ weights[4 * f + 2] * u[neighbours[4 * f + 2]] + weights[4 * f + 3] * u[neighbours[4 * f + 3]]
+						- u[tree->free_nodes[f]]);
+				u[tree->free_nodes[f]] += (w / 4.0) * current_r;
+				norm = (fabs(current_r) > norm) ? fabs(current_r) : norm;
+			}
+
+			++sweeps;
+		} while (norm >= options->r);
+
+		iterations += sweeps;
+		++passes;
+	} while (sweeps > 1);
+
+	update_hanging(tree);
+
+	perf_count("sweeps", iterations);
+	perf_count("passes", passes);
+	perf_count("node_updates", (double)iterations * tree->nfree);
+	perf_end("relaxation");
+
+	return iterations;
+}
+
+/* Split the leaves with an edge neighbour more than one level finer until
+ * there are none. Returns the number split. */
+static size_t balance(struct FDQuadtree *tree)
+{
+	unsigned char *marked;
+	const struct FDQuadLeaf *leaf, *other;
+	size_t total = 0, count, nleaves, k, e, s;
+	size_t cell[8][2];
+
+	do {
+		build_cells(tree);
+		nleaves = tree->nleaves;
+		marked = malloc_or_fail(nleaves, sizeof *marked);
+		memset(marked, 0, nleaves);
+		count = 0;
+
+		for (k = 0; k < nleaves; k++) {
+			leaf = &tree->leaves[k];
+			s = leaf_size(tree, leaf);
+
+			/* The lattice cells just outside both ends of each edge, or
+			 * the leaf itself where the edge is on the border */
+			cell[0][0] = cell[1][0] = (leaf->i > 0) ? leaf->i - 1 : leaf->i;
+			cell[0][1] = leaf->j;
+			cell[1][1] = leaf->j + s - 1;
+			cell[2][0] = cell[3][0] = (leaf->i + s < tree->side) ? leaf->i + s : leaf->i;
+			cell[2][1] = leaf->j;
+			cell[3][1] = leaf->j + s - 1;
+			cell[4][1] = cell[5][1] = (leaf->j > 0) ? leaf->j - 1 : leaf->j;
+			cell[4][0] = leaf->i;
+			cell[5][0] = leaf->i + s - 1;
+			cell[6][1] = cell[7][1] = (leaf->j + s < tree->side) ? leaf->j + s : leaf->j;
+			cell[6][0] = leaf->i;
+			cell[7][0] = leaf->i + s - 1;
+
+			for (e = 0; e < 8; e++) {
+				other = &tree->leaves[tree->cell_leaf[cell[e][0] * tree->side + cell[e][1]]];
+
+				if (other->level + 1 < leaf->level && !marked[other - tree->leaves]) {
+					marked[other - tree->leaves] = 1;
+					++count;
+				}
+			}
+		}
+
+		for (k = 0; k < nleaves; k++) {
+			if (marked[k])
+				split(tree, k);
+		}
+
+		free_tracked(marked);
+		total += count;
+	} while (count > 0);
+
+	return total;
+}
+
+/* See fdquadtree.h header for documentation */
+size_t fd_quadtree_refine(struct FDQuadtree *tree, double fraction)
+{
+	struct FDQuadtree old;
+	const struct FDQuadLeaf *leaf;
+	double *curvature, *error;
+	double dxx, dyy, max_error, size;
+	size_t f, n, k, s, nleaves, count;
+
+	perf_begin("refine");
+
+	/* Second differences at the free nodes */
+	curvature = malloc_or_fail(tree->nnodes, sizeof *curvature);
+
+	for (n = 0; n < tree->nnodes; n++)
+		curvature[n] = 0.0;
+
+	for (f = 0; f < tree->nfree; f++) {
+		dxx = fabs(second_difference(tree, f, 0));
+		dyy = fabs(second_difference(tree, f, 1));
+		curvature[tree->free_nodes[f]] = (dxx > dyy) ? dxx : dyy;
+	}
+
+	/* h^2 times the largest at the corners, for the leaves that can be split */
+	nleaves = tree->nleaves;
+	error = malloc_or_fail(nleaves, sizeof *error);
+	max_error = 0.0;
+
+	for (k = 0; k < nleaves; k++) {
+		leaf = &tree->leaves[k];
+		s = leaf_size(tree, leaf);
+		error[k] = 0.0;
+
+		if (leaf->level == tree->max_level || (in_conductor(tree, leaf->i, leaf->j)))
+			continue;
+
+		size = s * tree->step;
+		error[k] = curvature[tree->node_at[leaf->i * (tree->side + 1) + leaf->j]];
+		error[k] = (curvature[tree->node_at[(leaf->i + s) * (tree->side + 1) + leaf->j]] > error[k])
+			? curvature[tree->node_at[(leaf->i + s) * (tree->side + 1) + leaf->j]] : error[k];
+		error[k] = (curvature[tree->node_at[leaf->i * (tree->side + 1) + leaf->j + s]] > error[k])
+			? curvature[tree->node_at[leaf->i * (tree->side + 1) + leaf->j + s]] : error[k];
+		error[k] = (curvature[tree->node_at[(leaf->i + s) * (tree->side + 1) + leaf->j + s]] > error[k])
+			? curvature[tree->node_at[(leaf->i + s) * (tree->side + 1) + leaf->j + s]] : error[k];
+		error[k] *= size * size;
+		max_error = (error[k] > max_error) ? error[k] : max_error;
+	}
+
+	free_tracked(curvature);
+
+	/* The old mesh stays until the new nodes are interpolated from it */
+	old = *tree;
+	old.leaves = malloc_or_fail(nleaves, sizeof *(old.leaves));
+	memcpy(old.leaves, tree->leaves, nleaves * sizeof *(old.leaves));
+	tree->cell_leaf = malloc_or_fail(tree->side * tree->side, sizeof *(tree->cell_leaf));
+	count = 0;
+
+	for (k = 0; k < nleaves; k++) {
+		if (max_error > 0.0 && error[k] >= fraction * max_error) {
+			split(tree, k);
+			++count;
+		}
+	}
+
+	free_tracked(error);
+
+	if (count > 0)
+		count += balance(tree);
+	else
+		build_cells(tree);
+
+	build_nodes(tree, &old);
+	build_stencils(tree);
+
+	free_nodes(&old);
+	free_tracked(old.cell_leaf);
+	free_tracked(old.leaves);
+
+	perf_count("leaves_split", count);
+	perf_end("refine");
+
+	return count;
+}
+
+/* See fdquadtree.h header for documentation */
+double FDQuadtree_probe(const struct FDQuadtree *tree, double x, double y)
+{
+	return interpolate(tree, x / tree->step, y / tree->step);
+}
@@ -0,0 +1,425 @@
+/* Threads and sysconf are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "fdsweep.h"
+#include "perf.h"
+#include "timer.h"
+#include "utils.h"
+
+/* Longest line of a sweep file, and the most values of a parameter */
+#define FD_SWEEP_LINE		4096
+#define FD_SWEEP_VALUES		256
+
+/* The jobs dealt to one thread, largest first. The owner takes them from
+ * head, thieves from tail. */
+struct FDSweepQueue {
+	struct FDSweepJob **jobs;
+	size_t head;
+	size_t tail;
+	pthread_mutex_t lock;
+};
+
+struct FDSweepPool {
+	struct FDSweepQueue *queues;
+	size_t nthreads;
+	size_t budget;			/* Bytes, 0 for no limit */
+	size_t in_use;			/* Bytes of the jobs running */
+	pthread_mutex_t memory_lock;
+	pthread_cond_t released;
+	pthread_mutex_t output_lock;
+	FILE *filePtr;
+	unsigned long steals;
+};
+
+struct FDSweepThread {
+	struct FDSweepPool *pool;
+	size_t id;
+};
+
+/* PROTOTYPES */
+static int read_values(char *list, double *values, size_t *n, const char *keyword);
+static int compare_jobs(const void *a, const void *b);
+static struct FDSweepJob *take_job(struct FDSweepPool *pool, size_t id);
+static void reserve_memory(struct FDSweepPool *pool, size_t bytes);
+static void release_memory(struct FDSweepPool *pool, size_t bytes);
+static void *sweep_thread(void *arg);
+/* END PROTOTYPES */
+
+/* Read the numbers of a parameter line into values. Returns 0, or -1 after
+ * reporting the problem. */
+static int read_values(char *list, double *values, size_t *n, const char *keyword)
+{
+	char *token, *end;
+
+	*n = 0;
+
+	for (token = strtok(list, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+		if (*n == FD_SWEEP_VALUES) {
+			fprintf(stderr, "At most %d values of %s.\n", FD_SWEEP_VALUES, keyword);
+			return -1;
+		}
+
+		values[*n] = strtod(token, &end);
+
+		if (end == token || *end != '\0') {
+			fprintf(stderr, "Invalid value of %s: %s.\n", keyword, token);
+			return -1;
+		}
+
+		++*n;
+	}
+
+	if (*n == 0) {
+		fprintf(stderr, "%s needs at least one value.\n", keyword);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* See fdsweep.h header for documentation */
+int fd_sweep_read(const char *filename, const struct FDSweepMethod *methods, size_t nmethods,
+		const struct FDOptions *options, struct FDSweep *sweep)
+{
+	FILE *filePtr;
+	const struct FDSweepMethod *used[FD_SWEEP_VALUES];
+	double h[FD_SWEEP_VALUES], w[FD_SWEEP_VALUES], r[FD_SWEEP_VALUES];
+	size_t nused, nh, nw, nr, nwm, length;
+	size_t m, a, b, c, k;
+	char line[FD_SWEEP_LINE];
+	char *keyword, *comment, *token;
+	struct FDSweepJob *job;
+	int result = -1;
+
+	sweep->jobs = NULL;
+	sweep->njobs = 0;
+	nused = nh = 0;
+	nw = nr = 1;
+	w[0] = options->w;
+	r[0] = options->r;
+
+	filePtr = fopen(filename, "r");
+
+	if (filePtr == NULL) {
+		perror("fopen");
+		return -1;
+	}
+
+	while (fgets(line, sizeof line, filePtr) != NULL) {
+		if (strchr(line, '\n') == NULL && !feof(filePtr)) {
+			fprintf(stderr, "Lines of a sweep file are at most %d characters.\n", FD_SWEEP_LINE - 2);
+			goto cleanup_file;
+		}
+
+		comment = strchr(line, '#');
+
+		if (comment != NULL)
+			*comment = '\0';
+
+		length = strlen(line);
+		keyword = strtok(line, " \t\r\n");
+
+		if (keyword == NULL)
+			continue;
+
+		/* The values start after the terminator strtok put in, if any */
+		token = keyword + strlen(keyword);
+
+		if (token < line + length)
+			++token;
+
+		if (strcmp(keyword, "method") == 0) {
+			for (token = strtok(token, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+				for (m = 0; m < nmethods && strcmp(methods[m].name, token) != 0; m++)
+					;
+
+				if (m == nmethods) {
+					fprintf(stderr, "Unknown method %s.\n", token);
+					goto cleanup_file;
+				}
+
+				if (nused == FD_SWEEP_VALUES) {
+					fprintf(stderr, "At most %d methods.\n", FD_SWEEP_VALUES);
+					goto cleanup_file;
+				}
+
+				used[nused++] = &methods[m];
+			}
+		} else if (strcmp(keyword, "h") == 0) {
+			if (read_values(token, h, &nh, keyword) != 0)
+				goto cleanup_file;
+
+			for (k = 0; k < nh; k++) {
+				if (h[k] <= 0.0 || h[k] > 0.02) {
+					fprintf(stderr, "h must be in (0, 0.02].\n");
+					goto cleanup_file;
+				}
+			}
+		} else if (strcmp(keyword, "w") == 0) {
+			if (read_values(token, w, &nw, keyword) != 0)
+				goto cleanup_file;
+
+			for (k = 0; k < nw; k++) {
+				if (w[k] < 0.0 || w[k] >= 2.0) {
+					fprintf(stderr, "w must be in (0, 2), or 0 to estimate it.\n");
+					goto cleanup_file;
+				}
+			}
+		} else if (strcmp(keyword, "r") == 0) {
+			if (read_values(token, r, &nr, keyword) != 0)
+				goto cleanup_file;
+
+			for (k = 0; k < nr; k++) {
+				if (r[k] <= 0.0) {
+					fprintf(stderr, "r must be positive.\n");
+					goto cleanup_file;
+				}
+			}
+		} else {
+			fprintf(stderr, "Unknown sweep parameter %s.\n", keyword);
+			goto cleanup_file;
+		}
+	}
+
+	if (ferror(filePtr)) {
+		perror("fgets");
+		goto cleanup_file;
+	}
+
+	if (nused == 0 || nh == 0) {
+		fprintf(stderr, "A sweep needs a method and h.\n");
+		goto cleanup_file;
+	}
+
+	for (m = 0; m < nused; m++)
+		sweep->njobs += nh * (used[m]->uses_w ? nw : 1) * nr;
+
+	sweep->jobs = malloc_or_fail(sweep->njobs, sizeof *(sweep->jobs));
+	job = sweep->jobs;
+
+	for (m = 0; m < nused; m++) {
+		nwm = used[m]->uses_w ? nw : 1;
+
+		for (a = 0; a < nh; a++) {
+			for (b = 0; b < nwm; b++) {
+				for (c = 0; c < nr; c++, job++) {
+					job->method = used[m];
+					job->options = *options;
+					job->options.w = used[m]->uses_w ? w[b] : 0.0;
+					job->options.r = r[c];
+					job->options.threads = 1;
+					job->h = h[a];
+					job->index = (size_t)(job - sweep->jobs);
+					job->bytes = used[m]->bytes(h[a]);
+					job->cost = used[m]->cost(h[a], &job->options);
+				}
+			}
+		}
+	}
+
+	result = 0;
+
+cleanup_file:
+	fclose(filePtr);
+
+	return result;
+}
+
+void fd_sweep_destroy(struct FDSweep *sweep)
+{
+	free_tracked(sweep->jobs);
+	sweep->jobs = NULL;
+	sweep->njobs = 0;
+}
+
+/* Larger cost first, then file order */
+static int compare_jobs(const void *a, const void *b)
+{
+	const struct FDSweepJob *x = a, *y = b;
+
+	if (x->cost != y->cost)
+		return (x->cost > y->cost) ? -1 : 1;
+
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+/* Next job for thread id: the head of its own queue, otherwise the tail of
+ * the next queue round that has one. NULL once every queue is empty; no
+ * job is added after the start, so the thread can stop. */
+static struct FDSweepJob *take_job(struct FDSweepPool *pool, size_t id)
+{
+	struct FDSweepQueue *queue = &pool->queues[id];
+	struct FDSweepJob *job = NULL;
+	size_t k;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->head < queue->tail)
+		job = queue->jobs[queue->head++];
+
+	pthread_mutex_unlock(&queue->lock);
+
+	for (k = 1; job == NULL && k < pool->nthreads; k++) {
+		queue = &pool->queues[(id + k) % pool->nthreads];
+		pthread_mutex_lock(&queue->lock);
+
+		if (queue->head < queue->tail) {
+			job = queue->jobs[--queue->tail];
+
+			pthread_mutex_lock(&pool->output_lock);
+			++pool->steals;
+			pthread_mutex_unlock(&pool->output_lock);
+		}
+
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	return job;
+}
+
+/* Wait until bytes more fit in the budget, then count them. A job runs
+ * regardless once nothing else does, but fd_sweep_run has made sure each
+ * fits on its own. */
+static void reserve_memory(struct FDSweepPool *pool, size_t bytes)
+{
+	pthread_mutex_lock(&pool->memory_lock);
+
+	while (pool->budget > 0 && pool->in_use > 0 && pool->in_use + bytes > pool->budget)
+		pthread_cond_wait(&pool->released, &pool->memory_lock);
+
+	pool->in_use += bytes;
+	pthread_mutex_unlock(&pool->memory_lock);
+}
+
+static void release_memory(struct FDSweepPool *pool, size_t bytes)
+{
+	pthread_mutex_lock(&pool->memory_lock);
+	pool->in_use -= bytes;
+	pthread_cond_broadcast(&pool->released);
+	pthread_mutex_unlock(&pool->memory_lock);
+}
+
+static void *sweep_thread(void *arg)
+{
+	struct FDSweepThread *thread = arg;
+	struct FDSweepPool *pool = thread->pool;
+	struct FDSweepJob *job;
+	unsigned int iterations;
+	double start, elapsed, phi;
+
+	while ((job = take_job(pool, thread->id)) != NULL) {
+		reserve_memory(pool, job->bytes);
+		start = timer_now();
+		iterations = job->method->solve(job->h, &job->options, &phi);
+		elapsed = timer_now() - start;
+		release_memory(pool, job->bytes);
+
+		pthread_mutex_lock(&pool->output_lock);
+		fprintf(pool->filePtr, "%lu,%s,%g,%g,%g,%u,%.9f,%f,%lu\n", (unsigned long)job->index, job->method->name,
+				job->h, job->options.w, job->options.r, iterations, phi, elapsed, (unsigned long)job->bytes);
+		fflush(pool->filePtr);
+		pthread_mutex_unlock(&pool->output_lock);
+	}
+
+	return NULL;
+}
+
+/* See fdsweep.h header for documentation */
+int fd_sweep_run(struct FDSweep *sweep, size_t threads, size_t budget, FILE *filePtr)
+{
+	struct FDSweepPool pool;
+	struct FDSweepThread *workers;
+	struct FDSweepJob **dealt;
+	pthread_t *ids;
+	size_t k, t;
+	long cpus;
+
+	for (k = 0; k < sweep->njobs; k++) {
+		if (budget > 0 && sweep->jobs[k].bytes > budget) {
+			fprintf(stderr, "Job %lu, %s at h = %g, needs %lu bytes, over the budget of %lu.\n",
+					(unsigned long)sweep->jobs[k].index, sweep->jobs[k].method->name, sweep->jobs[k].h,
+					(unsigned long)sweep->jobs[k].bytes, (unsigned long)budget);
+			return -1;
+		}
+	}
+
+	if (threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 1) ? (size_t)cpus : 1;
+	}
+
+	if (threads > sweep->njobs)
+		threads = (sweep->njobs > 0) ? sweep->njobs : 1;
+
+	qsort(sweep->jobs, sweep->njobs, sizeof *(sweep->jobs), compare_jobs);
+
+	pool.nthreads = threads;
+	pool.budget = budget;
+	pool.in_use = 0;
+	pool.filePtr = filePtr;
+	pool.steals = 0;
+	pool.queues = malloc_or_fail(threads, sizeof *(pool.queues));
+	dealt = malloc_or_fail(sweep->njobs + 1, sizeof *dealt);
+	workers = malloc_or_fail(threads, sizeof *workers);
+	ids = malloc_or_fail(threads, sizeof *ids);
+
+	/* Queue t holds jobs t, t + threads, ..., contiguous in dealt */
+	k = 0;
+
+	for (t = 0; t < threads; t++) {
+		pool.queues[t].jobs = &dealt[k];
+		pool.queues[t].head = 0;
+		pool.queues[t].tail = 0;
+		pthread_mutex_init(&pool.queues[t].lock, NULL);
+
+		for (; pool.queues[t].tail * threads + t < sweep->njobs; pool.queues[t].tail++)
+			dealt[k++] = &sweep->jobs[pool.queues[t].tail * threads + t];
+
+		workers[t].pool = &pool;
+		workers[t].id = t;
+	}
+
+	pthread_mutex_init(&pool.memory_lock, NULL);
+	pthread_cond_init(&pool.released, NULL);
+	pthread_mutex_init(&pool.output_lock, NULL);
+
+	fprintf(filePtr, "job,method,h,w,r,iterations,phi,seconds,bytes\n");
+	fflush(filePtr);
+
+	perf_begin("sweep");
+
+	for (t = 1; t < threads; t++) {
+		if (pthread_create(&ids[t], NULL, sweep_thread, &workers[t]) != 0)
+			exit_with_error("Could not start the sweep threads.");
+	}
+
+	sweep_thread(&workers[0]);
+
+	for (t = 1; t < threads; t++)
+		pthread_join(ids[t], NULL);
+
+	perf_count("sweep_jobs", sweep->njobs);
+	perf_count("sweep_steals", pool.steals);
+	perf_end("sweep");
+
+	pthread_mutex_destroy(&pool.output_lock);
+	pthread_cond_destroy(&pool.released);
+	pthread_mutex_destroy(&pool.memory_lock);
+
+	for (t = 0; t < threads; t++)
+		pthread_mutex_destroy(&pool.queues[t].lock);
+
+	free_tracked(ids);
+	free_tracked(workers);
+	free_tracked(dealt);
+	free_tracked(pool.queues);
+
+	return 0;
+}
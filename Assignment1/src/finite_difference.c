@@ -1,33 +1,36 @@
+/* sysconf is POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
+#include <float.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
 
-#define OUTER_L	0.2
-#define INNER_L 0.04
-#define INNER_W 0.08
+#include "fdcheckpoint.h"
+#include "fdgeometry.h"
+#include "fdgrid.h"
+#include "fdmultigrid.h"
+#include "fdquadtree.h"
+#include "fdsweep.h"
+#include "perf.h"
+#include "timer.h"
+#include "utils.h"
 
-#define INNER_V 15.0
-#define OUTER_V 0.0
+/* Finest level of adaptive_report, on the uniform grids and the quadtree */
+#define FD_ADAPTIVE_LEVELS	8
 
 double **alloc_grid(size_t N)
 {
 	double **phi;
 	size_t i;
 
-	phi = malloc(N * sizeof *phi);
-
-	if (phi == NULL) {
-		perror("malloc");
-		exit(-1);
-	}
-
-	for (i = 0; i < N; i++) {
-		phi[i] = malloc(N * sizeof *phi[i]);
+	phi = malloc_or_fail(N, sizeof *phi);
 
-		if (phi[i] == NULL) {
-			perror("malloc");
-			exit(-1);
-		}
-	}
+	for (i = 0; i < N; i++)
+		phi[i] = malloc_or_fail(N, sizeof *phi[i]);
 
 	return phi;
 }
@@ -37,9 +40,9 @@ void free_grid(double **phi, size_t N)
 	size_t i;
 
 	for (i = 0; i < N; i++)
-		free(phi[i]);
+		free_tracked(phi[i]);
 
-	free(phi);
+	free_tracked(phi);
 }
 
 void print_grid(double **phi, size_t N)
@@ -60,35 +63,113 @@ void print_grid(double **phi, size_t N)
 	printf("\n");
 }
 
+/* Add the residual of one node to the norm being accumulated: the
+ * largest magnitude, or the sum of squares for L2. */
+static double accumulate_residual(double norm, double current_r, enum FDNorm type)
+{
+	if (type == FD_NORM_L2)
+		return norm + current_r * current_r;
+
+	return (fabs(current_r) > norm) ? fabs(current_r) : norm;
+}
+
+/* A converged solution on a coarser grid, to start a finer solve from */
+struct CoarseSolution {
+	double **phi;
+	size_t N;
+	double h;
+};
+
+/* Potential of the coarse solution at node (i, j). The mesh only holds the
+ * inner conductor's surface, so the nodes inside it are set here. */
+static double coarse_node(const struct CoarseSolution *coarse, size_t inner_Nx, size_t inner_Ny, size_t i, size_t j)
+{
+	if (i >= inner_Nx && j >= inner_Ny)
+		return COAX_INNER_V;
+
+	return coarse->phi[i][j];
+}
+
+/* Set the free nodes of phi, of N nodes per row at spacing h, to the
+ * bilinear interpolation of the coarse solution at the same x and y, and
+ * mirror them onto the false boundaries. The spacings need not divide each
+ * other. */
+static void interpolate_coarse(double **phi, size_t N, double h, size_t inner_Nx, size_t inner_Ny,
+		const struct CoarseSolution *coarse)
+{
+	size_t coarse_Nx, coarse_Ny;
+	size_t i, j, ic, jc;
+	double x, y;
+
+	coarse_Nx = ((COAX_OUTER_L - COAX_INNER_W) / 2.0) / coarse->h;
+	coarse_Ny = ((COAX_OUTER_L - COAX_INNER_L) / 2.0) / coarse->h;
+
+	for (i = 1; i < N - 1; i++) {
+		/* Node i lies between coarse rows ic and ic + 1, the last of which may be the false boundary */
+		x = i * h / coarse->h;
+		ic = (x < coarse->N - 2) ? (size_t)x : coarse->N - 2;
+		x -= ic;
+
+		for (j = 1; j < ((i < inner_Nx) ? N - 1 : inner_Ny); j++) {
+			y = j * h / coarse->h;
+			jc = (y < coarse->N - 2) ? (size_t)y : coarse->N - 2;
+			y -= jc;
+
+			phi[i][j] = (1.0 - x) * (1.0 - y) * coarse_node(coarse, coarse_Nx, coarse_Ny, ic, jc)
+				+ (1.0 - x) * y * coarse_node(coarse, coarse_Nx, coarse_Ny, ic, jc + 1)
+				+ x * (1.0 - y) * coarse_node(coarse, coarse_Nx, coarse_Ny, ic + 1, jc)
+				+ x * y * coarse_node(coarse, coarse_Nx, coarse_Ny, ic + 1, jc + 1);
+		}
+	}
+
+	for (i = 1; i < inner_Nx; i++)
+		phi[i][N - 1] = phi[i][N - 3];
+
+	for (j = 1; j < inner_Ny; j++)
+		phi[N - 1][j] = phi[N - 3][j];
+}
+
 /* Applies successive over-relaxation on the potential finite-difference mesh
  * by using the finite-difference approximation to Laplace's equation.
  * - h is the node spacing in m,
- * - w is the SOR parameter,
- * - r is the residual for termination.
+ * - options->w is the SOR parameter, or 0 for fd_optimal_w(h),
+ * - options->r is the residual for termination, in options->norm, tested
+ *   every options->check_interval iterations.
  *
- * The function returns the number of iterations before convergence.
+ * The residual of each node is the one its update is computed from, so no
+ * separate pass over the mesh is needed to test convergence.
+ *
+ * The relaxation starts from 0, or if coarse is not NULL, from coarse
+ * interpolated onto the mesh (nested iteration).
+ *
+ * The function returns the number of iterations before convergence, and
+ * sets *wp, if wp is not NULL, to the final w.
  * The parameter phip is a pointer that will be set to allocated memory
  * for the finite-difference mesh. Np will be set to the number of nodes per row.
  *
  * We exploit the symmetry in both the vertical and horizontal half-planes,
  * by applying the Neumann boundary conditions at x = 0.1m and y = 0.1m.
  */
-unsigned int successive_over_relaxation(double ***phip, size_t *Np, double h, double w, double r)
+unsigned int successive_over_relaxation(double ***phip, size_t *Np, double h, const struct FDOptions *options,
+		const struct CoarseSolution *coarse, double *wp)
 {
 	double **phi;
-	unsigned int iterations;
-	double max_r, current_r;
+	unsigned int iterations, checks;
+	double norm, current_r;
+	double w = options->w;
+	int check;
 	size_t N;
 	size_t inner_Nx, inner_Ny;
+	size_t interior;
 	size_t i, j;
 
 	/* Need false boundary for Neumann condition at planes of symmetry. */
-	N = (OUTER_L / 2.0) / h + 2.0;
+	N = (COAX_OUTER_L / 2.0) / h + 2.0;
 	phi = alloc_grid(N);
 
 	/* Nodes at which we have the inner boundary */
-	inner_Nx = ((OUTER_L - INNER_W) / 2.0) / h;
-	inner_Ny = ((OUTER_L - INNER_L) / 2.0) / h;
+	inner_Nx = ((COAX_OUTER_L - COAX_INNER_W) / 2.0) / h;
+	inner_Ny = ((COAX_OUTER_L - COAX_INNER_L) / 2.0) / h;
 
 	/* Initialize everything to 0. */
 	for (i = 0; i < N; i++) {
@@ -98,72 +179,99 @@ unsigned int successive_over_relaxation(double ***phip, size_t *Np, double h, do
 
 	/* Set boundary conditions on inner and outer conductors */
 	for (i = 0; i < N; i++)
-		phi[i][0] = OUTER_V;
+		phi[i][0] = COAX_OUTER_V;
 
 	for (j = 0; j < N; j++)
-		phi[0][j] = OUTER_V;
+		phi[0][j] = COAX_OUTER_V;
 
 	for (i = inner_Nx; i < N; i++)
-		phi[i][inner_Ny] = INNER_V;
+		phi[i][inner_Ny] = COAX_INNER_V;
 
 	for (j = inner_Ny; j < N; j++)
-		phi[inner_Nx][j] = INNER_V;
+		phi[inner_Nx][j] = COAX_INNER_V;
+
+	if (coarse != NULL)
+		interpolate_coarse(phi, N, h, inner_Nx, inner_Ny, coarse);
+
+	if (w <= 0.0)
+		w = fd_optimal_w(h);
 
 	iterations = 0;
+	checks = 0;
+	perf_begin("relaxation");
 
 	do {
-		max_r = 0.0;
+		/* Only iterations that test convergence accumulate the norm */
+		check = ((iterations + 1) % options->check_interval == 0);
+		norm = 0.0;
 
 		for (i = 1; i < inner_Nx; i++) {
 			/* Apply Laplace equation */
-			for (j = 1; j < N - 1; j++)
-				phi[i][j] = (1.0 - w) * phi[i][j] + (w / 4.0) * (phi[i - 1][j] + phi[i][j - 1] + phi[i + 1][j] + phi[i][j + 1]);
+			for (j = 1; j < N - 1; j++) {
+				current_r = phi[i - 1][j] + phi[i][j - 1] + phi[i + 1][j] + phi[i][j + 1] - 4.0 * phi[i][j];
+				phi[i][j] += (w / 4.0) * current_r;
+
+				if (check)
+					norm = accumulate_residual(norm, current_r, options->norm);
+			}
 
 			/* Apply Neumann boundary condition at false boundary */
 			phi[i][N - 1] = phi[i][N - 3];
 		}
 
 		for (i = inner_Nx; i < N - 1; i++) {
-			for (j = 1; j < inner_Ny; j++)
-				phi[i][j] = (1.0 - w) * phi[i][j] + (w / 4.0) * (phi[i - 1][j] + phi[i][j - 1] + phi[i + 1][j] + phi[i][j + 1]);
+			for (j = 1; j < inner_Ny; j++) {
+				current_r = phi[i - 1][j] + phi[i][j - 1] + phi[i + 1][j] + phi[i][j + 1] - 4.0 * phi[i][j];
+				phi[i][j] += (w / 4.0) * current_r;
+
+				if (check)
+					norm = accumulate_residual(norm, current_r, options->norm);
+			}
 		}
 
 		/* Neumann boundary on half plane */
 		for (j = 1; j < inner_Ny; j++)
 			phi[N - 1][j] = phi[N - 3][j];
 
-		/* Compute residuals at each node */
-		for (i = 1; i < inner_Nx; i++) {
-			for (j = 1; j < N - 1; j++) {
-				current_r = phi[i + 1][j] + phi[i - 1][j] + phi[i][j + 1] + phi[i][j - 1] - 4.0 * phi[i][j];
+		if (check) {
+			++checks;
 
-				if (current_r > max_r)
-					max_r = current_r;
-			}
-		}
-
-		for (i = inner_Nx; i < N - 1; i++) {
-			for (j = 1; j < inner_Ny; j++) {
-				current_r = phi[i + 1][j] + phi[i - 1][j] + phi[i][j + 1] + phi[i][j - 1] - 4.0 * phi[i][j];
-
-				if (current_r > max_r)
-					max_r = current_r;
-			}
+			if (options->norm == FD_NORM_L2)
+				norm = sqrt(norm);
 		}
 
 		++iterations;
-	} while (max_r >= r);
+	} while (!check || norm >= options->r);
+
+	/* Each interior node: 7 flops for the update and residual, 2 for the norm when tested */
+	interior = (inner_Nx - 1) * (N - 2) + (N - 1 - inner_Nx) * (inner_Ny - 1);
+	perf_count("sweeps", iterations);
+	perf_count("residual_checks", checks);
+	perf_count("node_updates", (double)iterations * interior);
+	perf_count("flops", (7.0 * iterations + 2.0 * checks) * interior);
+	perf_end("relaxation");
 
 	*phip = phi;
 	*Np = N;
 
+	if (wp != NULL)
+		*wp = w;
+
 	return iterations;
 }
 
 /* Applies Jacobi method on the potential finite-difference mesh
  * by using the finite-difference approximation to Laplace's equation.
  * - h is the node spacing in m,
- * - r is the residual for termination.
+ * - options->r is the residual for termination, in options->norm, tested
+ *   every options->check_interval iterations.
+ *
+ * The sum of the neighbours gives both the new value and the residual of
+ * the old one, so convergence is tested on the previous iterate without a
+ * separate pass over the mesh.
+ *
+ * The iteration starts from 0, or if coarse is not NULL, from coarse
+ * interpolated onto the mesh (nested iteration).
  *
  * The function returns the number of iterations before convergence.
  * The parameter phip is a pointer that will be set to allocated memory
@@ -172,17 +280,20 @@ unsigned int successive_over_relaxation(double ***phip, size_t *Np, double h, do
  * We exploit the symmetry in both the vertical and horizontal half-planes,
  * by applying the Neumann boundary conditions at x = 0.1m and y = 0.1m.
  */
-unsigned int jacobi_method(double ***phip, size_t *Np, double h, double r)
+unsigned int jacobi_method(double ***phip, size_t *Np, double h, const struct FDOptions *options,
+		const struct CoarseSolution *coarse)
 {
 	double **phi1, **phi2, **phi, **old_phi;
-	unsigned int iterations;
-	double max_r, current_r;
+	unsigned int iterations, checks;
+	double norm, sum;
+	int check;
 	size_t N;
 	size_t inner_Nx, inner_Ny;
+	size_t interior;
 	size_t i, j;
 
 	/* Need false boundary for Neumann condition at planes of symmetry. */
-	N = (OUTER_L / 2.0) / h + 2.0;
+	N = (COAX_OUTER_L / 2.0) / h + 2.0;
 
 	/* Jacobi needs a copy of the grid because we can't overwrite the entries,
 	 * their values are used to compute the potential everywhere for one iteration. */
@@ -190,8 +301,8 @@ unsigned int jacobi_method(double ***phip, size_t *Np, double h, double r)
 	phi2 = alloc_grid(N);
 
 	/* Nodes at which we have the inner boundary */
-	inner_Nx = ((OUTER_L - INNER_W) / 2.0) / h;
-	inner_Ny = ((OUTER_L - INNER_L) / 2.0) / h;
+	inner_Nx = ((COAX_OUTER_L - COAX_INNER_W) / 2.0) / h;
+	inner_Ny = ((COAX_OUTER_L - COAX_INNER_L) / 2.0) / h;
 
 	/* Initialize everything to 0. */
 	for (i = 0; i < N; i++) {
@@ -203,26 +314,32 @@ unsigned int jacobi_method(double ***phip, size_t *Np, double h, double r)
 
 	/* Set boundary conditions on inner and outer conductors */
 	for (i = 0; i < N; i++) {
-		phi1[i][0] = OUTER_V;
-		phi2[i][0] = OUTER_V;
+		phi1[i][0] = COAX_OUTER_V;
+		phi2[i][0] = COAX_OUTER_V;
 	}
 
 	for (j = 0; j < N; j++) {
-		phi1[0][j] = OUTER_V;
-		phi2[0][j] = OUTER_V;
+		phi1[0][j] = COAX_OUTER_V;
+		phi2[0][j] = COAX_OUTER_V;
 	}
 
 	for (i = inner_Nx; i < N; i++) {
-		phi1[i][inner_Ny] = INNER_V;
-		phi2[i][inner_Ny] = INNER_V;
+		phi1[i][inner_Ny] = COAX_INNER_V;
+		phi2[i][inner_Ny] = COAX_INNER_V;
 	}
 
 	for (j = inner_Ny; j < N; j++) {
-		phi1[inner_Nx][j] = INNER_V;
-		phi2[inner_Nx][j] = INNER_V;
+		phi1[inner_Nx][j] = COAX_INNER_V;
+		phi2[inner_Nx][j] = COAX_INNER_V;
 	}
 
+	/* The first iteration reads phi1 */
+	if (coarse != NULL)
+		interpolate_coarse(phi1, N, h, inner_Nx, inner_Ny, coarse);
+
 	iterations = 0;
+	checks = 0;
+	perf_begin("relaxation");
 
 	do {
 		/* Swap grids */
@@ -234,47 +351,55 @@ unsigned int jacobi_method(double ***phip, size_t *Np, double h, double r)
 			phi = phi1;
 		}
 
-		max_r = 0.0;
+		/* Only iterations that test convergence accumulate the norm */
+		check = ((iterations + 1) % options->check_interval == 0);
+		norm = 0.0;
 
 		for (i = 1; i < inner_Nx; i++) {
 			/* Apply Laplace equation */
-			for (j = 1; j < N - 1; j++)
-				phi[i][j] = (old_phi[i - 1][j] + old_phi[i][j - 1] + old_phi[i + 1][j] + old_phi[i][j + 1]) / 4.0;
+			for (j = 1; j < N - 1; j++) {
+				sum = old_phi[i - 1][j] + old_phi[i][j - 1] + old_phi[i + 1][j] + old_phi[i][j + 1];
+				phi[i][j] = sum / 4.0;
+
+				if (check)
+					norm = accumulate_residual(norm, sum - 4.0 * old_phi[i][j], options->norm);
+			}
 
 			/* Apply Neumann boundary condition at false boundary */
 			phi[i][N - 1] = old_phi[i][N - 3];
 		}
 
 		for (i = inner_Nx; i < N - 1; i++) {
-			for (j = 1; j < inner_Ny; j++)
-				phi[i][j] = (old_phi[i - 1][j] + old_phi[i][j - 1] + old_phi[i + 1][j] + old_phi[i][j + 1]) / 4.0;
+			for (j = 1; j < inner_Ny; j++) {
+				sum = old_phi[i - 1][j] + old_phi[i][j - 1] + old_phi[i + 1][j] + old_phi[i][j + 1];
+				phi[i][j] = sum / 4.0;
+
+				if (check)
+					norm = accumulate_residual(norm, sum - 4.0 * old_phi[i][j], options->norm);
+			}
 		}
 
 		/* Neumann boundary on half plane */
 		for (j = 1; j < inner_Ny; j++)
 			phi[N - 1][j] = old_phi[N - 3][j];
 
-		/* Compute residuals at each node */
-		for (i = 1; i < inner_Nx; i++) {
-			for (j = 1; j < N - 1; j++) {
-				current_r = phi[i + 1][j] + phi[i - 1][j] + phi[i][j + 1] + phi[i][j - 1] - 4.0 * phi[i][j];
-
-				if (current_r > max_r)
-					max_r = current_r;
-			}
-		}
-
-		for (i = inner_Nx; i < N - 1; i++) {
-			for (j = 1; j < inner_Ny; j++) {
-				current_r = phi[i + 1][j] + phi[i - 1][j] + phi[i][j + 1] + phi[i][j - 1] - 4.0 * phi[i][j];
+		if (check) {
+			++checks;
 
-				if (current_r > max_r)
-					max_r = current_r;
-			}
+			if (options->norm == FD_NORM_L2)
+				norm = sqrt(norm);
 		}
 
 		++iterations;
-	} while (max_r >= r);
+	} while (!check || norm >= options->r);
+
+	/* Each interior node: 4 flops for the update, 4 for the residual and norm when tested */
+	interior = (inner_Nx - 1) * (N - 2) + (N - 1 - inner_Nx) * (inner_Ny - 1);
+	perf_count("sweeps", iterations);
+	perf_count("residual_checks", checks);
+	perf_count("node_updates", (double)iterations * interior);
+	perf_count("flops", (4.0 * iterations + 4.0 * checks) * interior);
+	perf_end("relaxation");
 
 	free_grid(old_phi, N);
 
@@ -285,43 +410,43 @@ unsigned int jacobi_method(double ***phip, size_t *Np, double h, double r)
 }
 
 
-void sweep_w(void)
+void sweep_w(const struct FDOptions *options)
 {
 	double **phi;
 	size_t N;
+	struct FDOptions sor_options = *options;
 	unsigned int iterations;
 	double x = 0.06, y = 0.04;
 	double h = 0.02;
-	double r = 1.0e-5;
-	double w;
 	int i;
 
 	printf("w parameter\titerations\tphi at (%f, %f)\n", x, y);
 
 	for (i = 0; i < 10; i++) {
-		w = 1.0 + 0.1 * i;
-		iterations = successive_over_relaxation(&phi, &N, h, w, r);
-		printf("%f\t%u\t\t%f\n", w, iterations, phi[(int)(x / h)][(int)(y / h)]);
+		sor_options.w = 1.0 + 0.1 * i;
+		iterations = successive_over_relaxation(&phi, &N, h, &sor_options, NULL, NULL);
+		printf("%f\t%u\t\t%f\n", sor_options.w, iterations, phi[(int)(x / h)][(int)(y / h)]);
 		free_grid(phi, N);
 	}
 }
 
-void sweep_h(void)
+/* options->w = 1.3 gives the minimal number of iterations */
+void sweep_h(const struct FDOptions *options)
 {
 	double **phi;
 	size_t N;
 	unsigned int iterations;
 	double x = 0.06, y = 0.04;
 	double h = 0.02;
-	double r = 1.0e-5;
-	double w = 1.3;	/* Minimal number of iterations */
+	double start;
 	int i;
 
-	printf("h distance\titerations\tphi at (%f, %f)\n", x, y);
+	printf("h distance\titerations\tphi at (%f, %f)\ttime (s)\n", x, y);
 
 	for (i = 0; i < 10; i++) {
-		iterations = successive_over_relaxation(&phi, &N, h, w, r);
-		printf("%f\t%u\t\t%f\n", h, iterations, phi[(int)(x / h)][(int)(y / h)]);
+		start = timer_now();
+		iterations = successive_over_relaxation(&phi, &N, h, options, NULL, NULL);
+		printf("%f\t%u\t\t%f\t\t%f\n", h, iterations, phi[(int)(x / h)][(int)(y / h)], timer_now() - start);
 		free_grid(phi, N);
 
 		/* Program becomes too slow after some point */
@@ -332,21 +457,263 @@ void sweep_h(void)
 	}
 }
 
-void sweep_h_jacobi(void)
+/* For the first spacings of sweep_h, compare the best w of the sweep_w
+ * range, and the time taken to find it, with a single solve with the w of
+ * fd_optimal_w, estimate included. */
+void compare_estimated_w(const struct FDOptions *options)
+{
+	double **phi;
+	size_t N;
+	struct FDOptions sor_options = *options;
+	unsigned int iterations, best_iterations;
+	double h = 0.02;
+	double start, solve_time, sweep_time, best_w, best_time;
+	int i, k;
+
+	printf("h distance\tbest w\titerations\ttime (s)\tsweep time (s)\testimated w\titerations\ttime (s)\n");
+
+	for (i = 0; i < 5; i++) {
+		best_iterations = 0;
+		best_w = best_time = sweep_time = 0.0;
+
+		for (k = 0; k < 10; k++) {
+			sor_options.w = 1.0 + 0.1 * k;
+			start = timer_now();
+			iterations = successive_over_relaxation(&phi, &N, h, &sor_options, NULL, NULL);
+			solve_time = timer_now() - start;
+			sweep_time += solve_time;
+			free_grid(phi, N);
+
+			if (k == 0 || iterations < best_iterations) {
+				best_iterations = iterations;
+				best_w = sor_options.w;
+				best_time = solve_time;
+			}
+		}
+
+		printf("%f\t%.1f\t%u\t\t%f\t%f\t", h, best_w, best_iterations, best_time, sweep_time);
+
+		sor_options.w = 0.0;
+		start = timer_now();
+		iterations = successive_over_relaxation(&phi, &N, h, &sor_options, NULL, &best_w);
+		printf("%f\t%u\t\t%f\n", best_w, iterations, timer_now() - start);
+		free_grid(phi, N);
+
+		h /= 2.0;
+	}
+}
+
+/* Same as sweep_w with red-black SOR on the contiguous grid, with the time of each solve. */
+void sweep_w_red_black(const struct FDOptions *options)
+{
+	struct FDGrid *grid;
+	struct FDOptions sor_options = *options;
+	unsigned int iterations;
+	double x = 0.06, y = 0.04;
+	double h = 0.02;
+	double start;
+	int i;
+
+	printf("w parameter\titerations\tphi at (%f, %f)\ttime (s)\n", x, y);
+
+	for (i = 0; i < 10; i++) {
+		sor_options.w = 1.0 + 0.1 * i;
+		start = timer_now();
+		grid = FDGrid_coax(h);
+		iterations = fd_red_black_sor(grid, &sor_options);
+		printf("%f\t%u\t\t%f\t\t%f\n", sor_options.w, iterations, FDGrid_probe(grid, x, y), timer_now() - start);
+		FDGrid_delete(grid);
+	}
+}
+
+/* Same as sweep_h with red-black SOR (jacobi == 0) or Jacobi on the
+ * contiguous grid, with the time of each solve. */
+void sweep_h_grid(const struct FDOptions *options, int jacobi)
+{
+	struct FDGrid *grid;
+	unsigned int iterations;
+	double x = 0.06, y = 0.04;
+	double h = 0.02;
+	double start;
+	int i;
+
+	printf("h distance\titerations\tphi at (%f, %f)\ttime (s)\n", x, y);
+
+	for (i = 0; i < 10; i++) {
+		start = timer_now();
+		grid = FDGrid_coax(h);
+		iterations = jacobi ? fd_jacobi(grid, options) : fd_red_black_sor(grid, options);
+		printf("%f\t%u\t\t%f\t\t%f\n", h, iterations, FDGrid_probe(grid, x, y), timer_now() - start);
+		FDGrid_delete(grid);
+
+		if (i < 5)
+			h /= 2.0;
+		else
+			h /= 1.2;
+	}
+}
+
+/* Time red-black SOR and Jacobi at spacing h with 1, 2, 4, ... threads up
+ * to the number of CPUs, and report the speedup and parallel efficiency
+ * over one thread. */
+void scaling_report(double h, const struct FDOptions *options)
+{
+	struct FDGrid *grid;
+	struct FDOptions team_options = *options;
+	unsigned int iterations;
+	size_t threads, max_threads;
+	double start, elapsed, serial;
+	long cpus;
+	int jacobi;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	max_threads = (cpus > 1) ? (size_t)cpus : 1;
+
+	printf("h = %f, %lu CPUs\n", h, (unsigned long)max_threads);
+	printf("method\t\tthreads\titerations\ttime (s)\tspeedup\tefficiency\n");
+
+	for (jacobi = 0; jacobi < 2; jacobi++) {
+		serial = 0.0;
+
+		for (threads = 1; ; threads = (2 * threads < max_threads) ? 2 * threads : max_threads) {
+			team_options.threads = threads;
+			grid = FDGrid_coax(h);
+			start = timer_now();
+			iterations = jacobi ? fd_jacobi(grid, &team_options) : fd_red_black_sor(grid, &team_options);
+			elapsed = timer_now() - start;
+			FDGrid_delete(grid);
+
+			if (threads == 1)
+				serial = elapsed;
+
+			printf("%s\t%lu\t%u\t\t%f\t%.2f\t%.2f\n", jacobi ? "jacobi\t" : "red-black", (unsigned long)threads,
+					iterations, elapsed, serial / elapsed, serial / elapsed / threads);
+
+			if (threads == max_threads)
+				break;
+		}
+	}
+}
+
+/* Time 960 Jacobi iterations on the contiguous grid at spacing h with 1,
+ * 2, 4, ... up to 32 iterations per pass over the grid, and report the time
+ * per iteration and the speedup over plain sweeps. Converging takes far too
+ * long at the spacings where blocking pays, so r is set so that the first
+ * test, after the 960 iterations, ends the solve. */
+void time_block_report(double h, const struct FDOptions *options)
+{
+	struct FDGrid *grid;
+	struct FDOptions block_options = *options;
+	unsigned int iterations;
+	double start, elapsed, plain;
+
+	block_options.check_interval = 960;
+	block_options.r = DBL_MAX;
+
+	printf("h = %f\n", h);
+	printf("time block\titerations\ttime (s)\ttime per iteration (s)\tspeedup\n");
+	plain = 0.0;
+
+	for (block_options.time_block = 1; block_options.time_block <= 32; block_options.time_block *= 2) {
+		grid = FDGrid_coax(h);
+		start = timer_now();
+		iterations = fd_jacobi(grid, &block_options);
+		elapsed = timer_now() - start;
+		FDGrid_delete(grid);
+
+		if (block_options.time_block == 1)
+			plain = elapsed / iterations;
+
+		printf("%u\t\t%u\t\t%f\t%e\t\t%.2f\n", block_options.time_block, iterations, elapsed,
+				elapsed / iterations, plain / (elapsed / iterations));
+	}
+}
+
+/* Solve at spacings h, h / 2, h / 4 with red-black SOR in double and in
+ * mixed precision, and report the time of each, the largest residual they
+ * leave and the difference between their potentials at the probe point. */
+void mixed_precision_report(double h, const struct FDOptions *options)
+{
+	struct FDGrid *grid;
+	unsigned int iterations;
+	double x = 0.06, y = 0.04;
+	double start, elapsed, plain, phi;
+	int i, mixed;
+
+	printf("h distance\tmethod\titerations\tphi at (%f, %f)\tresidual\ttime (s)\tspeedup\n", x, y);
+
+	for (i = 0; i < 3; i++, h /= 2.0) {
+		plain = phi = 0.0;
+
+		for (mixed = 0; mixed < 2; mixed++) {
+			grid = FDGrid_coax(h);
+			start = timer_now();
+			iterations = mixed ? fd_mixed_sor(grid, options) : fd_red_black_sor(grid, options);
+			elapsed = timer_now() - start;
+
+			if (!mixed)
+				plain = elapsed;
+
+			fd_mirror(grid);
+			printf("%f\t%s\t%u\t\t%.9f\t\t%e\t%f\t%.2f\n", h, mixed ? "mixed" : "double", iterations,
+					FDGrid_probe(grid, x, y), fd_max_residual(grid), elapsed, plain / elapsed);
+
+			if (mixed)
+				printf("\t\tphi difference %e\n", FDGrid_probe(grid, x, y) - phi);
+			else
+				phi = FDGrid_probe(grid, x, y);
+
+			FDGrid_delete(grid);
+		}
+	}
+}
+
+/* Same as sweep_h with multigrid, with the number of cycles on the finest
+ * grid, which should not grow as h shrinks. */
+void sweep_h_multigrid(const struct FDMultigridOptions *options)
+{
+	static const char *cycle_names[] = {"V", "W", "F"};
+	struct FDGrid *grid;
+	unsigned int cycles;
+	double x = 0.06, y = 0.04;
+	double h = 0.02;
+	double start;
+	int i;
+
+	printf("%s(%u,%u) cycles%s\n", cycle_names[options->cycle], options->pre_smooth, options->post_smooth,
+			options->full ? " after full multigrid" : "");
+	printf("h distance\tcycles\t\tphi at (%f, %f)\ttime (s)\n", x, y);
+
+	for (i = 0; i < 10; i++) {
+		start = timer_now();
+		grid = FDGrid_coax(h);
+		cycles = fd_multigrid(grid, options);
+		printf("%f\t%u\t\t%f\t\t%f\n", h, cycles, FDGrid_probe(grid, x, y), timer_now() - start);
+		FDGrid_delete(grid);
+
+		if (i < 5)
+			h /= 2.0;
+		else
+			h /= 1.2;
+	}
+}
+
+void sweep_h_jacobi(const struct FDOptions *options)
 {
 	double **phi;
 	size_t N;
 	unsigned int iterations;
 	double x = 0.06, y = 0.04;
 	double h = 0.02;
-	double r = 1.0e-5;
+	double start;
 	int i;
 
-	printf("h distance\titerations\tphi at (%f, %f)\n", x, y);
+	printf("h distance\titerations\tphi at (%f, %f)\ttime (s)\n", x, y);
 
 	for (i = 0; i < 10; i++) {
-		iterations = jacobi_method(&phi, &N, h, r);
-		printf("%f\t%u\t\t%f\n", h, iterations, phi[(int)(x / h)][(int)(y / h)]);
+		start = timer_now();
+		iterations = jacobi_method(&phi, &N, h, options, NULL);
+		printf("%f\t%u\t\t%f\t\t%f\n", h, iterations, phi[(int)(x / h)][(int)(y / h)], timer_now() - start);
 		free_grid(phi, N);
 
 		/* Program becomes too slow after some point */
@@ -357,10 +724,607 @@ void sweep_h_jacobi(void)
 	}
 }
 
-int main(void)
+/* The spacings of sweep_h, each solved with SOR (jacobi == 0) or Jacobi
+ * from 0 and from the solution on the previous spacing, interpolated. The
+ * warm start time includes the interpolation; the probe is that of the warm
+ * start solution. */
+void sweep_h_nested(const struct FDOptions *options, int jacobi)
+{
+	struct CoarseSolution coarse;
+	double **phi;
+	size_t N;
+	unsigned int cold_iterations, warm_iterations;
+	double x = 0.06, y = 0.04;
+	double h = 0.02;
+	double start, cold_time;
+	int i;
+
+	printf("h distance\titerations\ttime (s)\twarm start\ttime (s)\tphi at (%f, %f)\n", x, y);
+	coarse.phi = NULL;
+
+	for (i = 0; i < 10; i++) {
+		start = timer_now();
+		cold_iterations = jacobi ? jacobi_method(&phi, &N, h, options, NULL)
+			: successive_over_relaxation(&phi, &N, h, options, NULL, NULL);
+		cold_time = timer_now() - start;
+		free_grid(phi, N);
+
+		/* The first spacing has nothing to start from */
+		start = timer_now();
+		warm_iterations = jacobi ? jacobi_method(&phi, &N, h, options, (i > 0) ? &coarse : NULL)
+			: successive_over_relaxation(&phi, &N, h, options, (i > 0) ? &coarse : NULL, NULL);
+		printf("%f\t%u\t\t%f\t%u\t\t%f\t%f\n", h, cold_iterations, cold_time, warm_iterations,
+				timer_now() - start, phi[(int)(x / h)][(int)(y / h)]);
+
+		if (coarse.phi != NULL)
+			free_grid(coarse.phi, coarse.N);
+
+		coarse.phi = phi;
+		coarse.N = N;
+		coarse.h = h;
+
+		if (i < 5)
+			h /= 2.0;
+		else
+			h /= 1.2;
+	}
+
+	free_grid(coarse.phi, coarse.N);
+}
+
+/* Same as sweep_h for the layout in filename, with red-black SOR on its
+ * compiled mesh, starting from a fifth of the smaller side of the domain.
+ * Reports the potential at each probe of the layout. Returns 0, or -1 if
+ * the layout cannot be read. */
+int sweep_h_geometry(const char *filename, const struct FDOptions *options)
+{
+	struct FDGeometry geometry;
+	struct FDMesh *mesh;
+	unsigned int iterations;
+	double h, start;
+	size_t k;
+	int i;
+
+	if (fd_geometry_read(filename, &geometry) != 0)
+		return -1;
+
+	h = ((geometry.width < geometry.height) ? geometry.width : geometry.height) / 5.0;
+	printf("h distance\titerations\ttime (s)");
+
+	for (k = 0; k < geometry.nprobes; k++)
+		printf("\tphi at (%f, %f)", geometry.probes[2 * k], geometry.probes[2 * k + 1]);
+
+	printf("\n");
+
+	for (i = 0; i < 10; i++) {
+		start = timer_now();
+		mesh = FDMesh_compile(&geometry, h);
+
+		if (mesh != NULL) {
+			iterations = fd_mesh_sor(mesh, options);
+			printf("%f\t%u\t\t%f", h, iterations, timer_now() - start);
+
+			for (k = 0; k < geometry.nprobes; k++)
+				printf("\t%f", FDMesh_probe(mesh, geometry.probes[2 * k], geometry.probes[2 * k + 1]));
+
+			printf("\n");
+			FDMesh_delete(mesh);
+		}
+
+		if (i < 5)
+			h /= 2.0;
+		else
+			h /= 1.2;
+	}
+
+	fd_geometry_destroy(&geometry);
+
+	return 0;
+}
+
+/* Nodes needed for the potential at (0.06, 0.04) to be within tolerance,
+ * on uniform grids of spacing 0.02 / 2^k and on quadtree meshes refined
+ * where the error estimate is at least half the largest. The exact value
+ * is extrapolated from the three finest uniform grids, solved with
+ * multigrid; both solvers iterate until the residual is below 1e-9. */
+void adaptive_report(double tolerance, const struct FDOptions *options)
+{
+	struct FDMultigridOptions mg_options;
+	struct FDOptions tree_options = *options;
+	struct FDQuadtree *tree;
+	struct FDGrid *grid;
+	double phi[FD_ADAPTIVE_LEVELS + 1];
+	size_t nodes[FD_ADAPTIVE_LEVELS + 1];
+	double x = 0.06, y = 0.04;
+	double h, order, exact, value, start;
+	size_t uniform_nodes, adaptive_nodes;
+	unsigned int iterations;
+	int k, step;
+
+	fd_multigrid_default_options(&mg_options);
+	mg_options.r = 1.0e-9;
+	tree_options.r = 1.0e-9;
+
+	for (k = 0, h = 0.02; k <= FD_ADAPTIVE_LEVELS; k++, h /= 2.0) {
+		grid = FDGrid_coax(h);
+		fd_multigrid(grid, &mg_options);
+		phi[k] = FDGrid_probe(grid, x, y);
+		nodes[k] = (grid->inner_x - 1) * (grid->N - 2) + (grid->N - 1 - grid->inner_x) * (grid->inner_y - 1);
+		FDGrid_delete(grid);
+	}
+
+	/* Richardson extrapolation with the observed order */
+	k = FD_ADAPTIVE_LEVELS;
+	order = log((phi[k - 2] - phi[k - 1]) / (phi[k - 1] - phi[k])) / log(2.0);
+	exact = phi[k] + (phi[k] - phi[k - 1]) / (pow(2.0, order) - 1.0);
+
+	printf("phi at (%f, %f) = %f extrapolated with order %.2f, tolerance %g\n", x, y, exact, order, tolerance);
+	printf("uniform\nh distance\tnodes\t\tphi\t\terror\n");
+	uniform_nodes = 0;
+
+	for (k = 0, h = 0.02; k <= FD_ADAPTIVE_LEVELS; k++, h /= 2.0) {
+		printf("%f\t%lu\t\t%f\t%e\n", h, (unsigned long)nodes[k], phi[k], fabs(phi[k] - exact));
+
+		if (uniform_nodes == 0 && fabs(phi[k] - exact) < tolerance)
+			uniform_nodes = nodes[k];
+	}
+
+	printf("adaptive\nstep\tleaves\tnodes\t\titerations\tphi\t\terror\t\ttime (s)\n");
+	tree = FDQuadtree_new(FD_ADAPTIVE_LEVELS);
+	adaptive_nodes = 0;
+
+	for (step = 0; ; step++) {
+		start = timer_now();
+		iterations = fd_quadtree_solve(tree, &tree_options);
+		value = FDQuadtree_probe(tree, x, y);
+		printf("%d\t%lu\t%lu\t\t%u\t\t%f\t%e\t%f\n", step, (unsigned long)tree->nleaves, (unsigned long)tree->nfree,
+				iterations, value, fabs(value - exact), timer_now() - start);
+
+		if (fabs(value - exact) < tolerance) {
+			adaptive_nodes = tree->nfree;
+			break;
+		}
+
+		if (fd_quadtree_refine(tree, 0.5) == 0)
+			break;
+	}
+
+	FDQuadtree_delete(tree);
+
+	printf("nodes for the tolerance: %lu uniform, %lu adaptive (0 if not reached)\n",
+			(unsigned long)uniform_nodes, (unsigned long)adaptive_nodes);
+}
+
+/* Solvers of sweep_file. The legacy ones work on alloc_grid, the others on
+ * the contiguous grid of fdgrid.h, all from 0 on the coax at spacing h. */
+static unsigned int sweep_sor(double h, const struct FDOptions *options, double *phi)
+{
+	double **grid;
+	size_t N;
+	unsigned int iterations;
+
+	iterations = successive_over_relaxation(&grid, &N, h, options, NULL, NULL);
+	*phi = grid[(int)(0.06 / h)][(int)(0.04 / h)];
+	free_grid(grid, N);
+
+	return iterations;
+}
+
+static unsigned int sweep_jacobi(double h, const struct FDOptions *options, double *phi)
+{
+	double **grid;
+	size_t N;
+	unsigned int iterations;
+
+	iterations = jacobi_method(&grid, &N, h, options, NULL);
+	*phi = grid[(int)(0.06 / h)][(int)(0.04 / h)];
+	free_grid(grid, N);
+
+	return iterations;
+}
+
+static unsigned int sweep_grid(double h, const struct FDOptions *options, double *phi,
+		unsigned int (*solve)(struct FDGrid *, const struct FDOptions *))
+{
+	struct FDGrid *grid;
+	unsigned int iterations;
+
+	grid = FDGrid_coax(h);
+	iterations = solve(grid, options);
+	*phi = FDGrid_probe(grid, 0.06, 0.04);
+	FDGrid_delete(grid);
+
+	return iterations;
+}
+
+static unsigned int sweep_red_black(double h, const struct FDOptions *options, double *phi)
+{
+	return sweep_grid(h, options, phi, fd_red_black_sor);
+}
+
+static unsigned int sweep_grid_jacobi(double h, const struct FDOptions *options, double *phi)
+{
+	return sweep_grid(h, options, phi, fd_jacobi);
+}
+
+static unsigned int sweep_mixed(double h, const struct FDOptions *options, double *phi)
+{
+	return sweep_grid(h, options, phi, fd_mixed_sor);
+}
+
+/* Cycles of the default multigrid options, to r */
+static unsigned int sweep_multigrid(double h, const struct FDOptions *options, double *phi)
+{
+	struct FDMultigridOptions mg_options;
+	struct FDGrid *grid;
+	unsigned int cycles;
+
+	fd_multigrid_default_options(&mg_options);
+	mg_options.r = options->r;
+	grid = FDGrid_coax(h);
+	cycles = fd_multigrid(grid, &mg_options);
+	*phi = FDGrid_probe(grid, 0.06, 0.04);
+	FDGrid_delete(grid);
+
+	return cycles;
+}
+
+/* Nodes per row at spacing h, as in successive_over_relaxation */
+static size_t sweep_nodes(double h)
+{
+	return (size_t)((COAX_OUTER_L / 2.0) / h + 2.0);
+}
+
+/* Bytes of an alloc_grid, and of a grid of fdgrid.h with its rows padded
+ * to FD_ALIGN */
+static size_t sweep_legacy_bytes(double h)
+{
+	size_t N = sweep_nodes(h);
+
+	return N * (N * sizeof(double) + sizeof(double *));
+}
+
+static size_t sweep_grid_bytes(double h)
+{
+	size_t N = sweep_nodes(h);
+	size_t row = FD_ALIGN / sizeof(double);
+
+	return N * ((N + row - 1) / row * row) * sizeof(double) + N * sizeof(size_t);
+}
+
+static size_t sweep_jacobi_bytes(double h)
+{
+	return 2 * sweep_legacy_bytes(h);
+}
+
+static size_t sweep_grid_jacobi_bytes(double h)
 {
-/*	sweep_w(); */
-/*	sweep_h(); */
-	sweep_h_jacobi();
+	return 2 * sweep_grid_bytes(h);
+}
+
+/* The correction and its right side in float take as much as the grid */
+static size_t sweep_mixed_bytes(double h)
+{
+	return 2 * sweep_grid_bytes(h);
+}
+
+/* The solution, right side and residual on every level, the coarser
+ * levels adding a third */
+static size_t sweep_multigrid_bytes(double h)
+{
+	return 4 * sweep_grid_bytes(h);
+}
+
+/* Node updates to bring the residual from the potential of the inner
+ * conductor down to r, for an iteration that reduces it by rate */
+static double sweep_updates(double h, double rate, double r)
+{
+	double N = (double)sweep_nodes(h);
+
+	return N * N * log(r / COAX_INNER_V) / log(rate);
+}
+
+/* By Young's theory, SOR reduces the error by w - 1 per iteration at and
+ * above the optimal w, and below it by the square of (w mu + sqrt(w^2 mu^2
+ * - 4 (w - 1))) / 2, with mu the Jacobi radius. */
+static double sweep_sor_cost(double h, const struct FDOptions *options)
+{
+	double mu = fd_jacobi_radius(h);
+	double optimal = 2.0 / (1.0 + sqrt(1.0 - mu * mu));
+	double w = (options->w > 0.0) ? options->w : optimal;
+	double root;
+
+	if (w >= optimal)
+		return sweep_updates(h, w - 1.0, options->r);
+
+	root = 0.5 * (w * mu + sqrt(w * w * mu * mu - 4.0 * (w - 1.0)));
+
+	return sweep_updates(h, root * root, options->r);
+}
+
+static double sweep_jacobi_cost(double h, const struct FDOptions *options)
+{
+	return sweep_updates(h, fd_jacobi_radius(h), options->r);
+}
+
+/* A V(2,2) cycle costs about 8 sweeps and reduces the residual about 10 times */
+static double sweep_multigrid_cost(double h, const struct FDOptions *options)
+{
+	return 8.0 * sweep_updates(h, 0.1, options->r);
+}
+
+static const struct FDSweepMethod sweep_methods[] = {
+	{"sor", 1, sweep_sor, sweep_legacy_bytes, sweep_sor_cost},
+	{"jacobi", 0, sweep_jacobi, sweep_jacobi_bytes, sweep_jacobi_cost},
+	{"red-black", 1, sweep_red_black, sweep_grid_bytes, sweep_sor_cost},
+	{"grid-jacobi", 0, sweep_grid_jacobi, sweep_grid_jacobi_bytes, sweep_jacobi_cost},
+	{"mixed", 1, sweep_mixed, sweep_mixed_bytes, sweep_sor_cost},
+	{"multigrid", 0, sweep_multigrid, sweep_multigrid_bytes, sweep_multigrid_cost}
+};
+
+/* Run the sweep in filename, described in fdsweep.h, with the methods
+ * sor and jacobi of sweep_h and sweep_h_jacobi, red-black, grid-jacobi and
+ * mixed on the contiguous grid, and multigrid, on threads threads within a
+ * budget of bytes, and print the results as CSV. Returns 0, or -1 if the
+ * sweep cannot be read or run. */
+int sweep_file(const char *filename, size_t threads, size_t budget, const struct FDOptions *options)
+{
+	struct FDSweep sweep;
+	int result;
+
+	if (fd_sweep_read(filename, sweep_methods, sizeof sweep_methods / sizeof sweep_methods[0], options, &sweep) != 0)
+		return -1;
+
+	result = fd_sweep_run(&sweep, threads, budget, stdout);
+	fd_sweep_destroy(&sweep);
+
+	return result;
+}
+
+/* Solve the coax at spacing h with red-black SOR (jacobi == 0) or Jacobi
+ * on a grid in the file at path, with a checkpoint every interval
+ * iterations, or 0 for fd_checkpoint_solve to pick it. With resume
+ * nonzero, go on from the last checkpoint in the file instead, with its
+ * spacing, method and options, threads excepted.
+ * Reports the time spent on checkpoints over that spent relaxing. Returns
+ * 0, or -1 if the file cannot be used. */
+int checkpoint_run(const char *path, double h, int jacobi, int resume, unsigned int interval, const struct FDOptions *options)
+{
+	struct FDCheckpoint *checkpoint;
+	double x = 0.06, y = 0.04;
+	double start, elapsed;
+	int result;
+
+	if (resume)
+		checkpoint = FDCheckpoint_resume(path);
+	else
+		checkpoint = FDCheckpoint_create(path, h, jacobi ? FD_CHECKPOINT_JACOBI : FD_CHECKPOINT_SOR, options);
+
+	if (checkpoint == NULL)
+		return -1;
+
+	if (resume)
+		printf("Resuming at iteration %lu.\n", checkpoint->header->iterations);
+
+	start = timer_now();
+	result = fd_checkpoint_solve(checkpoint, options->threads, interval);
+	elapsed = timer_now() - start;
+
+	printf("method\t\th distance\titerations\tphi at (%f, %f)\tresidual\ttime (s)\tcheckpoints\tcheckpoint time (s)\toverhead\n", x, y);
+	printf("%s\t%f\t%lu\t\t%f\t\t%e\t%f\t%lu\t\t%f\t\t%.2f%%\n",
+			(checkpoint->header->method == FD_CHECKPOINT_JACOBI) ? "jacobi\t" : "red-black", checkpoint->header->h,
+			checkpoint->header->iterations, FDGrid_probe(checkpoint->grid, x, y), checkpoint->header->residual, elapsed,
+			checkpoint->header->checkpoints, checkpoint->seconds,
+			(elapsed > checkpoint->seconds) ? 100.0 * checkpoint->seconds / (elapsed - checkpoint->seconds) : 0.0);
+
+	FDCheckpoint_close(checkpoint);
+
+	return result;
+}
+
+/* Run the report called name, with its spacing h, or its own default if
+ * h is 0. Returns 0, or -1 if there is no such report. */
+static int run_report(const char *name, double h, const struct FDOptions *options, const struct FDMultigridOptions *mg_options)
+{
+	if (strcmp(name, "jacobi") == 0)
+		sweep_h_jacobi(options);
+	else if (strcmp(name, "sweep-w") == 0)
+		sweep_w(options);
+	else if (strcmp(name, "sweep-h") == 0)
+		sweep_h(options);
+	else if (strcmp(name, "estimated-w") == 0)
+		compare_estimated_w(options);
+	else if (strcmp(name, "sweep-w-red-black") == 0)
+		sweep_w_red_black(options);
+	else if (strcmp(name, "grid-sor") == 0 || strcmp(name, "grid-jacobi") == 0)
+		sweep_h_grid(options, strcmp(name, "grid-jacobi") == 0);
+	else if (strcmp(name, "scaling") == 0)
+		scaling_report((h > 0.0) ? h : 0.0005, options);
+	else if (strcmp(name, "time-block") == 0)
+		time_block_report((h > 0.0) ? h : 0.00003, options);
+	else if (strcmp(name, "adaptive") == 0)
+		adaptive_report(1.0e-3, options);
+	else if (strcmp(name, "mixed") == 0)
+		mixed_precision_report((h > 0.0) ? h : 0.0005, options);
+	else if (strcmp(name, "multigrid") == 0)
+		sweep_h_multigrid(mg_options);
+	else if (strcmp(name, "nested-sor") == 0 || strcmp(name, "nested-jacobi") == 0)
+		sweep_h_nested(options, strcmp(name, "nested-jacobi") == 0);
+	else
+		return -1;
+
+	return 0;
+}
+
+static void print_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-w w] [-t threads] [-k interval] [-n max|l2] [-b iterations] [-g layout]\n", name);
+	fprintf(stderr, "       [-s sweep] [-j threads] [-m megabytes] [-c file | -R file] [-h h] [-M sor|jacobi] [-i interval]\n");
+	fprintf(stderr, "       [-r report]\n");
+	fprintf(stderr, "-w sets the SOR factor of sweep_h, 0 for the estimated optimum.\n");
+	fprintf(stderr, "-t sets the threads of the solvers on the contiguous grid, 0 for one per CPU.\n");
+	fprintf(stderr, "-k tests convergence every interval iterations (default 1), and -n picks\n");
+	fprintf(stderr, "the norm of the residual compared with r (default max).\n");
+	fprintf(stderr, "-b sets the Jacobi iterations per pass over the contiguous grid (default 1).\n");
+	fprintf(stderr, "-g solves the conductor layout in a file, described in fdgeometry.h, instead\n");
+	fprintf(stderr, "of the coax built in.\n");
+	fprintf(stderr, "-s runs the parameter sweep in a file, described in fdsweep.h, as CSV, with\n");
+	fprintf(stderr, "its solves on -j threads (default 0, one per CPU) and their grids within -m\n");
+	fprintf(stderr, "megabytes (default 0, no limit).\n");
+	fprintf(stderr, "-c solves at spacing -h (default 0.0001) with the method of -M (default sor)\n");
+	fprintf(stderr, "on a grid mapped from a file, described in fdcheckpoint.h, with a checkpoint\n");
+	fprintf(stderr, "every -i iterations (default 0, as often as keeps checkpoints to about 1%% of\n");
+	fprintf(stderr, "the time). -R resumes such a solve from the file.\n");
+	fprintf(stderr, "-r runs one of the reports on the coax instead (default jacobi):\n");
+	fprintf(stderr, "  jacobi             sweep_h with Jacobi\n");
+	fprintf(stderr, "  sweep-w, sweep-h   SOR over a range of w, and over h with the w of -w\n");
+	fprintf(stderr, "  estimated-w        best w of sweep-w against the estimated optimum\n");
+	fprintf(stderr, "  sweep-w-red-black  sweep-w with red-black SOR on the contiguous grid\n");
+	fprintf(stderr, "  grid-sor, grid-jacobi\n");
+	fprintf(stderr, "                     sweep-h with red-black SOR or Jacobi on the contiguous grid\n");
+	fprintf(stderr, "  scaling            speedup with the threads, at -h (default 0.0005)\n");
+	fprintf(stderr, "  time-block         temporally blocked Jacobi, at -h (default 0.00003)\n");
+	fprintf(stderr, "  adaptive           uniform grids against quadtree meshes\n");
+	fprintf(stderr, "  mixed              SOR in double and in mixed precision, at -h (default 0.0005)\n");
+	fprintf(stderr, "  multigrid          sweep-h with multigrid\n");
+	fprintf(stderr, "  nested-sor, nested-jacobi\n");
+	fprintf(stderr, "                     sweep-h from 0 and from the previous spacing\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	struct FDOptions options;
+	struct FDMultigridOptions mg_options;
+	const char *layout = NULL;
+	const char *sweep = NULL;
+	size_t sweep_threads = 0;
+	double budget = 0.0;
+	const char *checkpoint = NULL;
+	const char *report = "jacobi";
+	double h = 0.0;
+	unsigned int interval = 0;
+	int resume = 0, jacobi = 0;
+	char *end;
+	int i;
+
+	perf_parse_args(&argc, argv);
+	fd_default_options(&options);
+	fd_multigrid_default_options(&mg_options);
+
+	for (i = 1; i < argc; i += 2) {
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 == argc) {
+			print_usage(argv[0]);
+			return -1;
+		}
+
+		switch (argv[i][1]) {
+			case 'w':
+				options.w = strtod(argv[i + 1], &end);
+
+				if (end == argv[i + 1] || *end != '\0' || options.w < 0.0 || options.w >= 2.0)
+					exit_with_error("w must be in (0, 2), or 0 to estimate it.");
+
+				break;
+			case 't':
+				options.threads = strtoul(argv[i + 1], &end, 10);
+
+				if (end == argv[i + 1] || *end != '\0')
+					exit_with_error("Invalid number of threads.");
+
+				break;
+			case 'k':
+				options.check_interval = strtoul(argv[i + 1], &end, 10);
+
+				if (end == argv[i + 1] || *end != '\0' || options.check_interval == 0)
+					exit_with_error("The check interval must be a positive integer.");
+
+				break;
+			case 'n':
+				if (strcmp(argv[i + 1], "max") == 0)
+					options.norm = FD_NORM_MAX;
+				else if (strcmp(argv[i + 1], "l2") == 0)
+					options.norm = FD_NORM_L2;
+				else
+					exit_with_error("Unknown norm.");
+
+				break;
+			case 'b':
+				options.time_block = strtoul(argv[i + 1], &end, 10);
+
+				if (end == argv[i + 1] || *end != '\0' || options.time_block == 0)
+					exit_with_error("The time block must be a positive integer.");
+
+				break;
+			case 'g':
+				layout = argv[i + 1];
+				break;
+			case 's':
+				sweep = argv[i + 1];
+				break;
+			case 'j':
+				sweep_threads = strtoul(argv[i + 1], &end, 10);
+
+				if (end == argv[i + 1] || *end != '\0')
+					exit_with_error("Invalid number of sweep threads.");
+
+				break;
+			case 'm':
+				budget = strtod(argv[i + 1], &end);
+
+				if (end == argv[i + 1] || *end != '\0' || budget < 0.0)
+					exit_with_error("The memory budget must be a number of megabytes, 0 for no limit.");
+
+				break;
+			case 'c':
+			case 'R':
+				checkpoint = argv[i + 1];
+				resume = (argv[i][1] == 'R');
+				break;
+			case 'h':
+				h = strtod(argv[i + 1], &end);
+
+				if (end == argv[i + 1] || *end != '\0' || h <= 0.0 || h > 0.02)
+					exit_with_error("h must be in (0, 0.02].");
+
+				break;
+			case 'M':
+				if (strcmp(argv[i + 1], "sor") == 0)
+					jacobi = 0;
+				else if (strcmp(argv[i + 1], "jacobi") == 0)
+					jacobi = 1;
+				else
+					exit_with_error("Unknown method.");
+
+				break;
+			case 'r':
+				report = argv[i + 1];
+				break;
+			case 'i':
+				interval = strtoul(argv[i + 1], &end, 10);
+
+				if (end == argv[i + 1] || *end != '\0')
+					exit_with_error("The checkpoint interval must be a non-negative integer.");
+
+				break;
+			default:
+				print_usage(argv[0]);
+				return -1;
+		}
+	}
+
+	if (layout != NULL)
+		return sweep_h_geometry(layout, &options);
+
+	if (sweep != NULL)
+		return sweep_file(sweep, sweep_threads, (size_t)(budget * 1024.0 * 1024.0), &options);
+
+	if (checkpoint != NULL)
+		return checkpoint_run(checkpoint, (h > 0.0) ? h : 0.0001, jacobi, resume, interval, &options);
+
+	if (run_report(report, h, &options, &mg_options) != 0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
 	return 0;
 }
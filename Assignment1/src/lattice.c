@@ -0,0 +1,705 @@
+/* Threads and sysconf are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "circuits.h"
+#include "lattice.h"
+#include "multigrid.h"
+#include "perf.h"
+#include "utils.h"
+
+#define MESH_BRANCH_R	1000.0
+#define MESH_SOURCE_R	1000.0
+#define MESH_SOURCE_E	1.0
+
+/* Branches per chunk when writing a generated lattice */
+#define GEN_CHUNK_BRANCHES	16384
+
+enum GenPhase {
+	GEN_COUNT = 0,		/* Count the branches present */
+	GEN_FILL,		/* Store them in a branch list */
+	GEN_FORMAT		/* Format them into a buffer */
+};
+
+/* Rows first_row to last_row - 1 of a generated lattice, with the branches
+ * of each row (horizontal, then vertical to the next row) in order. */
+struct GenTask {
+	const struct LatticeGenOptions *options;
+	enum GenPhase phase;
+	size_t first_row;
+	size_t last_row;
+	size_t count;			/* Branches present, set by GEN_COUNT and GEN_FORMAT */
+	struct BranchList *branches;	/* GEN_FILL: filled from branch offset */
+	size_t offset;
+	enum BranchFileFormat format;	/* GEN_FORMAT: bytes written to buffer */
+	char *buffer;
+	size_t length;
+};
+
+struct Lattice *Lattice_new(size_t rows, size_t cols, double R)
+{
+	struct Lattice *lattice;
+	size_t k;
+
+	if (rows == 0 || cols == 0 || rows * cols < 2)
+		exit_with_error("Lattice needs at least two nodes.");
+
+	lattice = malloc_or_fail(1, sizeof *lattice);
+	lattice->rows = rows;
+	lattice->cols = cols;
+	lattice->horizontal = NULL;
+	lattice->vertical = NULL;
+
+	if (cols > 1) {
+		lattice->horizontal = malloc_or_fail(rows * (cols - 1), sizeof *(lattice->horizontal));
+
+		for (k = 0; k < rows * (cols - 1); k++)
+			lattice->horizontal[k] = R;
+	}
+
+	if (rows > 1) {
+		lattice->vertical = malloc_or_fail((rows - 1) * cols, sizeof *(lattice->vertical));
+
+		for (k = 0; k < (rows - 1) * cols; k++)
+			lattice->vertical[k] = R;
+	}
+
+	return lattice;
+}
+
+void Lattice_delete(struct Lattice *lattice)
+{
+	if (lattice->horizontal != NULL)
+		free_tracked(lattice->horizontal);
+
+	if (lattice->vertical != NULL)
+		free_tracked(lattice->vertical);
+
+	free_tracked(lattice);
+}
+
+int Lattice_is_uniform(const struct Lattice *lattice)
+{
+	size_t nh, nv, k;
+	double R;
+
+	nh = lattice->rows * (lattice->cols - 1);
+	nv = (lattice->rows - 1) * lattice->cols;
+	R = (nh > 0) ? lattice->horizontal[0] : lattice->vertical[0];
+
+	for (k = 0; k < nh; k++) {
+		if (lattice->horizontal[k] != R)
+			return 0;
+	}
+
+	for (k = 0; k < nv; k++) {
+		if (lattice->vertical[k] != R)
+			return 0;
+	}
+
+	return 1;
+}
+
+size_t lattice_circuit_node(size_t node, size_t ground)
+{
+	if (node == ground)
+		return 0;
+
+	return (node < ground) ? node + 1 : node;
+}
+
+void lattice_info(const struct Lattice *lattice, size_t ground, struct LatticeInfo *info)
+{
+	info->rows = lattice->rows;
+	info->cols = lattice->cols;
+	info->ground = ground;
+}
+
+struct BranchList *lattice_to_branches(const struct Lattice *lattice, size_t ground, const struct LatticeBranch *extra, size_t nextra)
+{
+	struct BranchList *branches;
+	size_t rows = lattice->rows;
+	size_t cols = lattice->cols;
+	size_t nnodes, nbranches;
+	size_t i, j, k, node;
+
+	nnodes = rows * cols;
+	nbranches = rows * (cols - 1) + (rows - 1) * cols;
+
+	if (ground >= nnodes)
+		exit_with_error("Ground node outside the lattice.");
+
+	branches = BranchList_new(nnodes, nbranches + nextra);
+	k = 0;
+
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j + 1 < cols; j++) {
+			node = i * cols + j;
+			branches->from[k] = lattice_circuit_node(node, ground);
+			branches->to[k] = lattice_circuit_node(node + 1, ground);
+			branches->R[k] = LATTICE_HORIZONTAL(lattice, i, j);
+			++k;
+		}
+
+		for (j = 0; i + 1 < rows && j < cols; j++) {
+			node = i * cols + j;
+			branches->from[k] = lattice_circuit_node(node, ground);
+			branches->to[k] = lattice_circuit_node(node + cols, ground);
+			branches->R[k] = LATTICE_VERTICAL(lattice, i, j);
+			++k;
+		}
+	}
+
+	for (k = 0; k < nbranches; k++) {
+		branches->J[k] = 0.0;
+		branches->E[k] = 0.0;
+	}
+
+	for (k = 0; k < nextra; k++) {
+		if (extra[k].from >= nnodes || extra[k].to >= nnodes)
+			exit_with_error("Extra branch outside the lattice.");
+
+		branches->from[nbranches + k] = lattice_circuit_node(extra[k].from, ground);
+		branches->to[nbranches + k] = lattice_circuit_node(extra[k].to, ground);
+		branches->J[nbranches + k] = extra[k].J;
+		branches->R[nbranches + k] = extra[k].R;
+		branches->E[nbranches + k] = extra[k].E;
+	}
+
+	return branches;
+}
+
+struct Lattice *lattice_mesh(size_t N, struct LatticeBranch *source)
+{
+	source->from = 0;
+	source->to = 2 * N * N - 1;
+	source->J = 0.0;
+	source->R = MESH_SOURCE_R;
+	source->E = MESH_SOURCE_E;
+
+	return Lattice_new(2 * N, N, MESH_BRANCH_R);
+}
+
+struct BranchList *lattice_mesh_circuit(size_t N)
+{
+	struct Lattice *lattice;
+	struct LatticeBranch source;
+	struct BranchList *branches;
+
+	lattice = lattice_mesh(N, &source);
+	branches = lattice_to_branches(lattice, 0, &source, 1);
+	Lattice_delete(lattice);
+
+	return branches;
+}
+
+struct Lattice *lattice_mesh_from_branches(const struct BranchList *branches, size_t rows, size_t cols, struct LatticeBranch *source)
+{
+	struct Lattice *lattice;
+	size_t nh, nv, nsources, k, lo, hi;
+	double *slot;
+
+	/* With ground at lattice node 0, circuit node k is lattice node k */
+	if (rows == 0 || cols == 0 || rows * cols < 2 || branches->nnodes != rows * cols)
+		return NULL;
+
+	lattice = Lattice_new(rows, cols, 0.0);
+	nsources = 0;
+
+	for (k = 0; k < branches->nbranches; k++) {
+		if (branches->J[k] != 0.0 || branches->E[k] != 0.0) {
+			if (nsources++ > 0 || (branches->from[k] != 0 && branches->to[k] != 0))
+				goto fail;
+
+			source->from = branches->from[k];
+			source->to = branches->to[k];
+			source->J = branches->J[k];
+			source->R = branches->R[k];
+			source->E = branches->E[k];
+			continue;
+		}
+
+		lo = branches->from[k];
+		hi = branches->to[k];
+
+		if (lo > hi) {
+			lo = branches->to[k];
+			hi = branches->from[k];
+		}
+
+		if (hi == lo + 1 && lo / cols == hi / cols)
+			slot = &LATTICE_HORIZONTAL(lattice, lo / cols, lo % cols);
+		else if (hi == lo + cols)
+			slot = &LATTICE_VERTICAL(lattice, lo / cols, lo % cols);
+		else
+			goto fail;
+
+		/* Each branch once, and only resistors */
+		if (*slot != 0.0 || !(branches->R[k] > 0.0))
+			goto fail;
+
+		*slot = branches->R[k];
+	}
+
+	nh = rows * (cols - 1);
+	nv = (rows - 1) * cols;
+
+	if (nsources != 1)
+		goto fail;
+
+	for (k = 0; k < nh; k++) {
+		if (lattice->horizontal[k] == 0.0)
+			goto fail;
+	}
+
+	for (k = 0; k < nv; k++) {
+		if (lattice->vertical[k] == 0.0)
+			goto fail;
+	}
+
+	return lattice;
+
+fail:
+	Lattice_delete(lattice);
+	return NULL;
+}
+
+/* Orthonormal cosine modes of the Laplacian of a path of n nodes, evaluated
+ * at nodes p and q, with their eigenvalues. */
+static void path_modes(size_t n, size_t p, size_t q, double *psi_p, double *psi_q, double *lambda)
+{
+	double pi = acos(-1.0);
+	double scale, s;
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		scale = sqrt(((k == 0) ? 1.0 : 2.0) / (double)n);
+		psi_p[k] = scale * cos(pi * (double)k * ((double)p + 0.5) / (double)n);
+		psi_q[k] = scale * cos(pi * (double)k * ((double)q + 0.5) / (double)n);
+
+		/* 2 - 2 cos(pi k / n), without the cancellation for small k */
+		s = sin(pi * (double)k / (2.0 * (double)n));
+		lambda[k] = 4.0 * s * s;
+	}
+}
+
+/* See lattice.h header for documentation */
+double lattice_uniform_resistance(size_t rows, size_t cols, double R, size_t a, size_t b)
+{
+	double *row_a, *row_b, *row_lambda;
+	double *col_a, *col_b, *col_lambda;
+	double sum, partial, d;
+	size_t k, l;
+
+	if (a >= rows * cols || b >= rows * cols)
+		exit_with_error("Node outside the lattice.");
+
+	if (a == b)
+		return 0.0;
+
+	row_a = malloc_or_fail(3 * rows, sizeof *row_a);
+	row_b = row_a + rows;
+	row_lambda = row_b + rows;
+	col_a = malloc_or_fail(3 * cols, sizeof *col_a);
+	col_b = col_a + cols;
+	col_lambda = col_b + cols;
+
+	path_modes(rows, a / cols, b / cols, row_a, row_b, row_lambda);
+	path_modes(cols, a % cols, b % cols, col_a, col_b, col_lambda);
+
+	sum = 0.0;
+
+	for (k = 0; k < rows; k++) {
+		partial = 0.0;
+
+		/* The constant mode (0, 0) has eigenvalue 0 and does not contribute */
+		for (l = (k == 0) ? 1 : 0; l < cols; l++) {
+			d = row_a[k] * col_a[l] - row_b[k] * col_b[l];
+			partial += d * d / (row_lambda[k] + col_lambda[l]);
+		}
+
+		sum += partial;
+	}
+
+	free_tracked(col_a);
+	free_tracked(row_a);
+
+	return R * sum;
+}
+
+/* See lattice.h header for documentation */
+int lattice_resistance_spectral(const struct Lattice *lattice, size_t a, size_t b, double *R)
+{
+	double branch_R;
+
+	if (!Lattice_is_uniform(lattice))
+		return -1;
+
+	branch_R = (lattice->cols > 1) ? lattice->horizontal[0] : lattice->vertical[0];
+	*R = lattice_uniform_resistance(lattice->rows, lattice->cols, branch_R, a, b);
+
+	return 0;
+}
+
+/* See lattice.h header for documentation */
+double lattice_mesh_resistance(size_t N)
+{
+	return lattice_uniform_resistance(2 * N, N, MESH_BRANCH_R, 0, 2 * N * N - 1);
+}
+
+void lattice_default_gen_options(struct LatticeGenOptions *options)
+{
+	options->rows = 0;
+	options->cols = 0;
+	options->distribution = LATTICE_DIST_CONSTANT;
+	options->R = MESH_BRANCH_R;
+	options->spread = 0.0;
+	options->missing = 0.0;
+	options->defect = 0.0;
+	options->defect_factor = 1.0;
+	options->seed = 1;
+	options->ground = 0;
+	options->terminals = NULL;
+	options->nterminals = 0;
+	options->threads = 0;
+	options->chunk_rows = 0;
+}
+
+/* 32 bit integer hash with good avalanche, on the low 32 bits of x. */
+static unsigned long mix32(unsigned long x)
+{
+	x &= 0xffffffffUL;
+	x ^= x >> 16;
+	x = (x * 0x7feb352dUL) & 0xffffffffUL;
+	x ^= x >> 15;
+	x = (x * 0x846ca68bUL) & 0xffffffffUL;
+	x ^= x >> 16;
+
+	return x;
+}
+
+/* Draw number 'draw' of branch k, uniform on (0, 1) with 53 random bits. */
+static double gen_uniform(unsigned long seed, size_t k, unsigned long draw)
+{
+	unsigned long h, low;
+
+	h = mix32(seed);
+	h = mix32(h + (seed >> 16 >> 16));
+	h = mix32(h + (unsigned long)(k & 0xffffffffUL));
+	h = mix32(h + (unsigned long)(k >> 16 >> 16));
+	h = mix32(h + draw);
+	low = mix32(h ^ 0x5bd1e995UL);
+
+	return ((double)(h >> 5) * 67108864.0 + (double)(low >> 6) + 0.5) / 9007199254740992.0;
+}
+
+/* See lattice.h header for documentation */
+double lattice_gen_resistance(const struct LatticeGenOptions *options, size_t k)
+{
+	double R = options->R;
+	double u, v;
+
+	if (options->missing > 0.0 && gen_uniform(options->seed, k, 0) < options->missing)
+		return 0.0;
+
+	switch (options->distribution) {
+		case LATTICE_DIST_UNIFORM:
+			R *= 1.0 + options->spread * (2.0 * gen_uniform(options->seed, k, 2) - 1.0);
+			break;
+
+		case LATTICE_DIST_LOGNORMAL:
+			/* Box-Muller */
+			u = gen_uniform(options->seed, k, 2);
+			v = gen_uniform(options->seed, k, 3);
+			R *= exp(options->spread * sqrt(-2.0 * log(u)) * cos(2.0 * acos(-1.0) * v));
+			break;
+
+		case LATTICE_DIST_CONSTANT:
+		default:
+			break;
+	}
+
+	if (options->defect > 0.0 && gen_uniform(options->seed, k, 1) < options->defect)
+		R *= options->defect_factor;
+
+	return R;
+}
+
+/* Visit the branches of the rows of a task. */
+static void gen_rows(struct GenTask *task)
+{
+	const struct LatticeGenOptions *options = task->options;
+	size_t cols = options->cols;
+	size_t nh = options->rows * (cols - 1);
+	size_t i, j, k, node, neighbour, from, to;
+	double R;
+
+	task->count = 0;
+	task->length = 0;
+
+	for (i = task->first_row; i < task->last_row; i++) {
+		/* Horizontal branches of row i, then vertical ones to row i + 1 */
+		for (j = 0; j + 1 < 2 * cols; j++) {
+			if (j + 1 < cols) {
+				k = i * (cols - 1) + j;
+				node = i * cols + j;
+				neighbour = node + 1;
+			} else if (i + 1 < options->rows) {
+				k = nh + i * cols + (j + 1 - cols);
+				node = i * cols + (j + 1 - cols);
+				neighbour = node + cols;
+			} else {
+				break;
+			}
+
+			R = lattice_gen_resistance(options, k);
+
+			if (R == 0.0)
+				continue;
+
+			from = lattice_circuit_node(node, options->ground);
+			to = lattice_circuit_node(neighbour, options->ground);
+
+			if (task->phase == GEN_FILL) {
+				k = task->offset + task->count;
+				task->branches->from[k] = from;
+				task->branches->to[k] = to;
+				task->branches->J[k] = 0.0;
+				task->branches->R[k] = R;
+				task->branches->E[k] = 0.0;
+			} else if (task->phase == GEN_FORMAT) {
+				task->length += circuits_format_branch(task->buffer + task->length, task->format, from, to, 0.0, R, 0.0);
+			}
+
+			++task->count;
+		}
+	}
+}
+
+static void *gen_thread(void *arg)
+{
+	gen_rows(arg);
+
+	return NULL;
+}
+
+/* Run the tasks, one thread each. A task whose thread cannot be started
+ * is done on the calling thread. */
+static void run_gen_tasks(struct GenTask *tasks, size_t ntasks)
+{
+	pthread_t *threads;
+	int *started;
+	size_t t;
+
+	threads = malloc_or_fail(ntasks, sizeof *threads);
+	started = malloc_or_fail(ntasks, sizeof *started);
+
+	for (t = 0; t < ntasks; t++)
+		started[t] = (pthread_create(&threads[t], NULL, gen_thread, &tasks[t]) == 0);
+
+	for (t = 0; t < ntasks; t++) {
+		if (started[t])
+			pthread_join(threads[t], NULL);
+		else
+			gen_rows(&tasks[t]);
+	}
+
+	free_tracked(started);
+	free_tracked(threads);
+}
+
+/* Check the options and return the number of threads to use. */
+static size_t gen_threads(const struct LatticeGenOptions *options)
+{
+	size_t nnodes = options->rows * options->cols;
+	size_t threads = options->threads;
+	long cpus;
+	size_t k;
+
+	if (options->rows == 0 || options->cols == 0 || nnodes < 2)
+		exit_with_error("Lattice needs at least two nodes.");
+
+	if (options->ground >= nnodes)
+		exit_with_error("Ground node outside the lattice.");
+
+	for (k = 0; k < options->nterminals; k++) {
+		if (options->terminals[k].from >= nnodes || options->terminals[k].to >= nnodes)
+			exit_with_error("Extra branch outside the lattice.");
+	}
+
+	if (threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 1) ? (size_t)cpus : 1;
+	}
+
+	return (threads < options->rows) ? threads : options->rows;
+}
+
+/* Split the rows into ntasks bands and run phase on them. */
+static void gen_bands(const struct LatticeGenOptions *options, struct GenTask *tasks, size_t ntasks, enum GenPhase phase)
+{
+	size_t t;
+
+	for (t = 0; t < ntasks; t++) {
+		tasks[t].options = options;
+		tasks[t].phase = phase;
+		tasks[t].first_row = t * options->rows / ntasks;
+		tasks[t].last_row = (t + 1) * options->rows / ntasks;
+	}
+
+	run_gen_tasks(tasks, ntasks);
+}
+
+/* Number of lattice branches present, counted in parallel if any can be missing. */
+static size_t gen_count(const struct LatticeGenOptions *options, struct GenTask *tasks, size_t ntasks)
+{
+	size_t count, t;
+
+	if (options->missing <= 0.0)
+		return options->rows * (options->cols - 1) + (options->rows - 1) * options->cols;
+
+	gen_bands(options, tasks, ntasks, GEN_COUNT);
+	count = 0;
+
+	for (t = 0; t < ntasks; t++)
+		count += tasks[t].count;
+
+	return count;
+}
+
+/* Set the terminal branches from branch k of the list. */
+static void gen_terminals(const struct LatticeGenOptions *options, struct BranchList *branches, size_t k)
+{
+	const struct LatticeBranch *terminal;
+	size_t t;
+
+	for (t = 0; t < options->nterminals; t++, k++) {
+		terminal = &options->terminals[t];
+		branches->from[k] = lattice_circuit_node(terminal->from, options->ground);
+		branches->to[k] = lattice_circuit_node(terminal->to, options->ground);
+		branches->J[k] = terminal->J;
+		branches->R[k] = terminal->R;
+		branches->E[k] = terminal->E;
+	}
+}
+
+/* See lattice.h header for documentation */
+struct BranchList *lattice_generate_branches(const struct LatticeGenOptions *options)
+{
+	struct BranchList *branches;
+	struct GenTask *tasks;
+	size_t ntasks, nbranches, t;
+
+	ntasks = gen_threads(options);
+	tasks = malloc_or_fail(ntasks, sizeof *tasks);
+
+	perf_begin("generate");
+
+	/* Counting gives each band its offset in the list */
+	gen_bands(options, tasks, ntasks, GEN_COUNT);
+	nbranches = 0;
+
+	for (t = 0; t < ntasks; t++) {
+		tasks[t].offset = nbranches;
+		nbranches += tasks[t].count;
+	}
+
+	branches = BranchList_new(options->rows * options->cols, nbranches + options->nterminals);
+
+	for (t = 0; t < ntasks; t++)
+		tasks[t].branches = branches;
+
+	gen_bands(options, tasks, ntasks, GEN_FILL);
+	gen_terminals(options, branches, nbranches);
+
+	perf_count("branches", (double)branches->nbranches);
+	perf_end("generate");
+
+	free_tracked(tasks);
+
+	return branches;
+}
+
+/* See lattice.h header for documentation */
+int lattice_write_generated(FILE *filePtr, const struct LatticeGenOptions *options, enum BranchFileFormat format)
+{
+	const struct LatticeBranch *terminal;
+	struct BranchList *branches;
+	struct GenTask *tasks;
+	char header[BRANCH_TEXT_MAX];
+	char *buffers;
+	size_t ntasks, nround, nbranches, chunk_rows, chunk_bytes, row, length, t;
+	int result;
+
+	if (format == BRANCH_FILE_INCIDENCE) {
+		branches = lattice_generate_branches(options);
+		perf_begin("write");
+		result = circuits_write_branches(filePtr, branches);
+		perf_end("write");
+		BranchList_delete(branches);
+
+		return result;
+	}
+
+	if (format == BRANCH_FILE_BINARY && (options->rows * options->cols - 1) >> 16 >> 16 != 0) {
+		fprintf(stderr, "Too many nodes for the binary branch format.\n");
+		return -1;
+	}
+
+	ntasks = gen_threads(options);
+	tasks = malloc_or_fail(ntasks, sizeof *tasks);
+
+	chunk_rows = options->chunk_rows;
+
+	if (chunk_rows == 0)
+		chunk_rows = GEN_CHUNK_BRANCHES / (2 * options->cols) + 1;
+
+	/* Each row has at most 2 cols - 1 branches */
+	chunk_bytes = chunk_rows * (2 * options->cols - 1) * ((format == BRANCH_FILE_TEXT) ? BRANCH_TEXT_MAX : BRANCH_RECORD_SIZE);
+	buffers = malloc_or_fail(ntasks, chunk_bytes);
+
+	perf_begin("generate");
+	nbranches = gen_count(options, tasks, ntasks) + options->nterminals;
+	length = circuits_format_branch_header(header, format, options->rows * options->cols, nbranches);
+	fwrite(header, 1, length, filePtr);
+
+	/* Rounds of one chunk per thread, written in order */
+	for (row = 0; row < options->rows && !ferror(filePtr); ) {
+		for (nround = 0; nround < ntasks && row < options->rows; nround++) {
+			tasks[nround].options = options;
+			tasks[nround].phase = GEN_FORMAT;
+			tasks[nround].format = format;
+			tasks[nround].buffer = &buffers[nround * chunk_bytes];
+			tasks[nround].first_row = row;
+			row = (options->rows - row > chunk_rows) ? row + chunk_rows : options->rows;
+			tasks[nround].last_row = row;
+		}
+
+		run_gen_tasks(tasks, nround);
+
+		for (t = 0; t < nround; t++)
+			fwrite(tasks[t].buffer, 1, tasks[t].length, filePtr);
+	}
+
+	for (t = 0; t < options->nterminals; t++) {
+		terminal = &options->terminals[t];
+		length = circuits_format_branch(header, format, lattice_circuit_node(terminal->from, options->ground),
+				lattice_circuit_node(terminal->to, options->ground), terminal->J, terminal->R, terminal->E);
+		fwrite(header, 1, length, filePtr);
+	}
+
+	perf_count("branches", (double)nbranches);
+	perf_end("generate");
+
+	free_tracked(buffers);
+	free_tracked(tasks);
+
+	return ferror(filePtr) ? -1 : 0;
+}
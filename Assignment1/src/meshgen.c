@@ -1,66 +1,225 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
-#include <sys/errno.h>
+#include <errno.h>
 
+#include "circuits.h"
+#include "lattice.h"
+#include "perf.h"
+#include "utils.h"
+
+#define MESHGEN_MAX_TERMINALS	64
+
+static void print_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s <N>\n", name);
+	fprintf(stderr, "       %s -l <rows>x<cols> [-d constant|uniform|lognormal] [-R ohms] [-s spread]\n", name);
+	fprintf(stderr, "       [-m missing] [-x defect:factor] [-S seed] [-g ground] [-t from:to:E:R]...\n");
+	fprintf(stderr, "       [-j threads] [-f incidence|text|binary] [-o file]\n");
+	fprintf(stderr, "The first form writes the N x 2N test mesh. The second writes a rows x cols\n");
+	fprintf(stderr, "lattice whose branch resistances are drawn from a distribution around R\n");
+	fprintf(stderr, "(default 1000), of relative width spread, with a fraction 'missing' of the\n");
+	fprintf(stderr, "branches left out and a fraction 'defect' multiplied by factor. -t adds a\n");
+	fprintf(stderr, "source E volts in series with R ohms between two lattice nodes, and may be\n");
+	fprintf(stderr, "repeated; without it the source of the test mesh is used. The rows are\n");
+	fprintf(stderr, "generated in parallel (-j, default one thread per CPU) and written as a\n");
+	fprintf(stderr, "branch list (default text) to stdout or to file.\n");
+}
+
+/* Write the N x 2N test mesh in the circuit file format. meshsolve can
+ * generate the same circuit in memory with -g; the text form is kept
+ * for the other tools that read circuit files. */
 void generate_input_file(size_t N)
 {
-	size_t nnodes, nbranches;
-	size_t node, branch;
-	size_t i, j;
-	size_t bijN, bijS, bijE, bijW; /* North, South, East, West */
+	struct BranchList *branches;
 
-	nnodes = 2 * N * N;
-	nbranches = 2 * N * (N - 1) + (2 * N - 1) * N;
+	perf_begin("generate");
+	branches = lattice_mesh_circuit(N);
+	perf_end("generate");
 
-	/* Don't print node 0 */
-	printf("%lu %lu\n", nnodes - 1, nbranches + 1);
+	perf_begin("write");
 
-	/* Print the reduced incidence matrix (skip row corresponding to node 0) */
-	for (node = 1; node < nnodes; node++) {
-		i = node / N;
-		j = node % N;
+	if (circuits_write_branches(stdout, branches) != 0)
+		perror("fprintf");
 
-		/* -1 means there is no branch in that direction. */
-		bijN = bijS = bijE = bijW = -1; 
+	perf_end("write");
 
-		if (i > 0)
-			bijS = (i - 1) * (2 * N - 1) + (N - 1) + j;
+	BranchList_delete(branches);
+}
 
-		if (j > 0)
-			bijW = i * (2 * N - 1) + j - 1;
+/* Parse a nonnegative number. Returns 0 on success. */
+static int parse_double(const char *text, double *value)
+{
+	char *end;
 
-		if (j < N - 1)
-			bijE = i * (2 * N - 1) + j;
+	*value = strtod(text, &end);
 
-		if (i < 2 * N - 1)
-			bijN = i * (2 * N - 1) + (N - 1) + j;
+	return (end == text || *end != '\0' || *value < 0.0) ? -1 : 0;
+}
 
-		for (branch = 0; branch < nbranches; branch++) {
-			if (branch == bijS || branch == bijW)
-				printf("-1");
-			else if (branch == bijE || branch == bijN)
-				printf("1");
-			else
-				printf("0");
+/* Generate a lattice from the options on the command line. */
+static int generate_lattice(int argc, const char *argv[])
+{
+	struct LatticeGenOptions options;
+	struct LatticeBranch terminals[MESHGEN_MAX_TERMINALS];
+	enum BranchFileFormat format = BRANCH_FILE_TEXT;
+	const char *output = NULL;
+	unsigned long rows, cols, from, to;
+	FILE *filePtr;
+	char *end;
+	int i, result;
+
+	lattice_default_gen_options(&options);
+	options.terminals = terminals;
+	rows = cols = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 == argc) {
+			print_usage(argv[0]);
+			return -1;
+		}
 
-			printf(" ");
+		++i;
+
+		switch (argv[i - 1][1]) {
+			case 'l':
+				if (sscanf(argv[i], "%lux%lu", &rows, &cols) != 2 || rows == 0 || cols == 0 || rows * cols < 2)
+					exit_with_error("The lattice needs at least two nodes, as <rows>x<cols>.");
+
+				break;
+			case 'd':
+				if (strcmp(argv[i], "constant") == 0)
+					options.distribution = LATTICE_DIST_CONSTANT;
+				else if (strcmp(argv[i], "uniform") == 0)
+					options.distribution = LATTICE_DIST_UNIFORM;
+				else if (strcmp(argv[i], "lognormal") == 0)
+					options.distribution = LATTICE_DIST_LOGNORMAL;
+				else
+					exit_with_error("Unknown distribution.");
+
+				break;
+			case 'R':
+				if (parse_double(argv[i], &options.R) != 0 || options.R == 0.0)
+					exit_with_error("The resistance must be positive.");
+
+				break;
+			case 's':
+				if (parse_double(argv[i], &options.spread) != 0)
+					exit_with_error("Invalid spread.");
+
+				break;
+			case 'm':
+				if (parse_double(argv[i], &options.missing) != 0 || options.missing >= 1.0)
+					exit_with_error("The fraction of missing branches must be in [0, 1).");
+
+				break;
+			case 'x':
+				if (sscanf(argv[i], "%lf:%lf", &options.defect, &options.defect_factor) != 2 || options.defect < 0.0
+						|| options.defect > 1.0 || options.defect_factor <= 0.0)
+					exit_with_error("Defects are given as fraction:factor, with a positive factor.");
+
+				break;
+			case 'S':
+				options.seed = strtoul(argv[i], &end, 10);
+
+				if (end == argv[i] || *end != '\0')
+					exit_with_error("Invalid seed.");
+
+				break;
+			case 'g':
+				options.ground = (size_t)strtoul(argv[i], &end, 10);
+
+				if (end == argv[i] || *end != '\0')
+					exit_with_error("Invalid ground node.");
+
+				break;
+			case 't':
+				if (options.nterminals == MESHGEN_MAX_TERMINALS)
+					exit_with_error("Too many terminals.");
+
+				terminals[options.nterminals].J = 0.0;
+
+				if (sscanf(argv[i], "%lu:%lu:%lf:%lf", &from, &to, &terminals[options.nterminals].E, &terminals[options.nterminals].R) != 4
+						|| terminals[options.nterminals].R == 0.0 || from == to)
+					exit_with_error("Terminals are given as from:to:E:R, with R nonzero.");
+
+				terminals[options.nterminals].from = from;
+				terminals[options.nterminals].to = to;
+				++options.nterminals;
+				break;
+			case 'j':
+				options.threads = (size_t)strtoul(argv[i], &end, 10);
+
+				if (end == argv[i] || *end != '\0')
+					exit_with_error("Invalid number of threads.");
+
+				break;
+			case 'f':
+				if (strcmp(argv[i], "incidence") == 0)
+					format = BRANCH_FILE_INCIDENCE;
+				else if (strcmp(argv[i], "text") == 0)
+					format = BRANCH_FILE_TEXT;
+				else if (strcmp(argv[i], "binary") == 0)
+					format = BRANCH_FILE_BINARY;
+				else
+					exit_with_error("Unknown output format.");
+
+				break;
+			case 'o':
+				output = argv[i];
+				break;
+			default:
+				print_usage(argv[0]);
+				return -1;
 		}
+	}
+
+	if (rows == 0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	if (options.distribution == LATTICE_DIST_UNIFORM && options.spread >= 1.0)
+		exit_with_error("A uniform distribution needs a spread below 1.");
 
-		/* Add the external branch for voltage source */
-		if (node == nnodes - 1)
-			printf("-1");
-		else
-			printf("0");
+	options.rows = rows;
+	options.cols = cols;
 
-		printf("\n");
+	if (options.ground >= options.rows * options.cols)
+		exit_with_error("Ground node outside the lattice.");
+
+	/* The source of the test mesh, from ground into the last node */
+	if (options.nterminals == 0) {
+		terminals[0].from = options.ground;
+		terminals[0].to = (options.ground == rows * cols - 1) ? 0 : rows * cols - 1;
+		terminals[0].J = 0.0;
+		terminals[0].R = 1000.0;
+		terminals[0].E = 1.0;
+		options.nterminals = 1;
 	}
 
-	for (branch = 0; branch < nbranches; branch++)
-		printf("0 1000 0\n");
+	for (i = 0; i < (int)options.nterminals; i++) {
+		if (terminals[i].from >= rows * cols || terminals[i].to >= rows * cols)
+			exit_with_error("Terminal outside the lattice.");
+	}
 
-	/* Add voltage source with series 1k resistor */
-	printf("0 1000 1\n");
+	filePtr = stdout;
+
+	if (output != NULL && (filePtr = fopen(output, (format == BRANCH_FILE_BINARY) ? "wb" : "w")) == NULL) {
+		perror("fopen");
+		return -1;
+	}
+
+	result = lattice_write_generated(filePtr, &options, format);
+
+	if (filePtr != stdout && fclose(filePtr) != 0)
+		result = -1;
+
+	if (result != 0)
+		perror("fwrite");
+
+	return result;
 }
 
 int main(int argc, const char *argv[])
@@ -68,8 +227,13 @@ int main(int argc, const char *argv[])
 	unsigned long temp;
 	size_t N;
 
+	perf_parse_args(&argc, argv);
+
+	if (argc > 2)
+		return generate_lattice(argc, argv);
+
 	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <N>\n", argv[0]);
+		print_usage(argv[0]);
 		return 0;
 	}
 
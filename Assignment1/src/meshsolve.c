@@ -1,35 +1,604 @@
+/* fork, pipe, mkstemp and getrusage are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "circuits.h"
+#include "lattice.h"
+#include "operator.h"
+#include "pcg.h"
+#include "perf.h"
+#include "stencil.h"
+#include "timer.h"
 #include "utils.h"
 
+#define SWEEP_MAX_METHODS	16
+
+enum MeshMethod {
+	MESH_CIRCUIT = 0,	/* One of the circuit solvers, see circuits_parse_method */
+	MESH_SPECTRAL,		/* lattice_uniform_resistance, for uniform meshes */
+	MESH_STENCIL		/* Matrix-free Jacobi PCG on the lattice stencil */
+};
+
+/* Result of solving one mesh. In a sweep it is sent back from the child process through a pipe. */
+struct MeshResult {
+	int status;			/* 0 if solved */
+	char solver[16];		/* Solver actually used */
+	struct CircuitSolverStats stats;
+	double parse_time;		/* Seconds to obtain the branch list (parse or generate) */
+	long peak_rss;			/* Peak resident set size of the run, kB */
+	double R;
+};
+
+struct SweepJob {
+	size_t N;
+	const char *method;		/* Method name as given on the command line */
+	enum MeshMethod kind;
+	struct CircuitSolverOptions options;
+	pid_t pid;
+	int fd;				/* Read end of the result pipe */
+	int done;
+	struct MeshResult result;
+};
+
+static void print_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s <filename> <N> [method]\n", name);
+	fprintf(stderr, "       %s -g <N> [method]\n", name);
+	fprintf(stderr, "       %s -s <Nmin>:<Nmax>[:<step>] [-m method,...] [-j jobs] [-t]\n", name);
+	fprintf(stderr, "With -g the N x 2N mesh is generated in memory instead of read from a file.\n");
+	fprintf(stderr, "With -s every size in the range is solved with every method, up to jobs\n");
+	fprintf(stderr, "runs at a time (default 1), and a CSV table is written to stdout. With -t\n");
+	fprintf(stderr, "each mesh goes through the circuit file format, as with meshgen, instead\n");
+	fprintf(stderr, "of being generated in memory.\n");
+	fprintf(stderr, "Methods: auto, spectral, stencil, dense, banded, banded-ooc[=MB], schur[=k], mg,\n");
+	fprintf(stderr, "         pcg-none, pcg-jacobi, pcg-ssor, pcg-ic0, pcg-mg\n");
+	fprintf(stderr, "auto and spectral solve uniform meshes in O(n) with their cosine modes, and other\n");
+	fprintf(stderr, "meshes with the automatic choice of circuit solver. -g without a method is auto.\n");
+	fprintf(stderr, "stencil runs Jacobi PCG without assembling the nodal matrix.\n");
+	fprintf(stderr, "banded-ooc keeps at most MB megabytes (default 256) of the band in memory\n");
+	fprintf(stderr, "and the rest in a scratch file in $TMPDIR.\n");
+	fprintf(stderr, "schur factors k subdomains (default one per CPU) in parallel threads.\n");
+}
+
+/* Parse a method name. Returns 0 on success. */
+static int parse_method(const char *name, enum MeshMethod *kind, struct CircuitSolverOptions *options)
+{
+	circuits_default_options(options);
+
+	/* spectral and stencil fall back to the automatic circuit solver */
+	if (strcmp(name, "auto") == 0 || strcmp(name, "spectral") == 0)
+		*kind = MESH_SPECTRAL;
+	else if (strcmp(name, "stencil") == 0)
+		*kind = MESH_STENCIL;
+	else
+		*kind = MESH_CIRCUIT;
+
+	if (*kind == MESH_CIRCUIT)
+		return circuits_parse_method(options, name);
+
+	return 0;
+}
+
+/* The mesh is in series with the 1000 ohm resistor of the 1 V source, so
+ * the voltage across it gives its resistance. */
+static double mesh_resistance(const struct Vector *V)
+{
+	return (1000.0 * (V->entries[V->n - 1] / 1.0)) / (1.0 - (V->entries[V->n - 1] / 1.0));
+}
+
+/* Resistance of a mesh lattice with lattice_uniform_resistance. Returns -1
+ * if its branches are not all equal. */
+static int mesh_spectral(const struct Lattice *lattice, const struct LatticeBranch *source, struct MeshResult *result)
+{
+	double start;
+	int status;
+
+	perf_begin("spectral");
+	start = timer_now();
+	status = lattice_resistance_spectral(lattice, 0, (source->from == 0) ? source->to : source->from, &result->R);
+	perf_end("spectral");
+
+	if (status != 0)
+		return -1;
+
+	perf_count("flops", 6.0 * lattice->rows * lattice->cols);
+	result->stats.solve_time = timer_now() - start;
+	result->stats.nnodes = lattice->rows * lattice->cols - 1;
+	strcpy(result->solver, "spectral");
+
+	return 0;
+}
+
+/* Solve a mesh lattice with Jacobi PCG on its stencil operator. */
+static int mesh_stencil(const struct Lattice *lattice, const struct LatticeBranch *source, struct MeshResult *result)
+{
+	struct StencilOperator *S;
+	struct LinearOperator op;
+	struct PCGOptions options;
+	struct PCGStats pcg_stats;
+	struct Vector *b, *V;
+	double start, assembled;
+	int status;
+
+	perf_begin("assemble");
+	start = timer_now();
+	S = StencilOperator_from_lattice(lattice, 0, source, 1);
+
+	if (S == NULL) {
+		perf_end("assemble");
+		return -1;
+	}
+
+	b = StencilOperator_sources(S, source, 1);
+	StencilOperator_operator(S, &op);
+	assembled = timer_now();
+	perf_end("assemble");
+
+	pcg_default_options(&options);
+	options.preconditioner = PCG_PRECONDITIONER_JACOBI;
+	status = pcg_solve_operator(&V, &op, b, &options, &pcg_stats);
+
+	if (status == 0) {
+		result->R = mesh_resistance(V);
+		result->stats.method = CIRCUIT_SOLVER_PCG;
+		result->stats.nnodes = op.n;
+		result->stats.iterations = pcg_stats.iterations;
+		result->stats.residual_norm = pcg_stats.residual_norm;
+		result->stats.assemble_time = assembled - start;
+		result->stats.factor_time = pcg_stats.setup_time;
+		result->stats.solve_time = pcg_stats.solve_time;
+		strcpy(result->solver, "stencil");
+		Vector_delete(V);
+	}
+
+	Vector_delete(b);
+	StencilOperator_delete(S);
+
+	return status;
+}
+
+/* Try the spectral or stencil solver on a mesh given as a branch list.
+ * Returns -1 if the circuit is not a 2N x N lattice they can solve. */
+static int mesh_solve_lattice(const struct BranchList *branches, size_t N, enum MeshMethod kind, struct MeshResult *result)
+{
+	struct Lattice *lattice;
+	struct LatticeBranch source;
+	int status;
+
+	lattice = lattice_mesh_from_branches(branches, 2 * N, N, &source);
+
+	if (lattice == NULL)
+		return -1;
+
+	if (kind == MESH_SPECTRAL)
+		status = mesh_spectral(lattice, &source, result);
+	else
+		status = mesh_stencil(lattice, &source, result);
+
+	Lattice_delete(lattice);
+
+	return status;
+}
+
+/* Write the mesh to a temporary circuit file and read it back, as `meshgen N | meshsolve` would. */
+static int mesh_through_file(size_t N, struct BranchList **branchesp, double *parse_time)
+{
+	char path[] = "/tmp/meshsolveXXXXXX";
+	struct CircuitDescription circuit;
+	struct BranchList *branches;
+	FILE *filePtr;
+	double start;
+	int fd, result;
+
+	fd = mkstemp(path);
+
+	if (fd < 0)
+		return -1;
+
+	filePtr = fdopen(fd, "w");
+
+	if (filePtr == NULL) {
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	branches = lattice_mesh_circuit(N);
+	result = circuits_write_branches(filePtr, branches);
+	BranchList_delete(branches);
+
+	if (fclose(filePtr) != 0 || result != 0) {
+		unlink(path);
+		return -1;
+	}
+
+	start = timer_now();
+	result = circuits_parse_file(&circuit, path);
+	unlink(path);
+
+	if (result != 0)
+		return -1;
+
+	result = circuits_to_branches(&circuit, branchesp);
+	circuits_destroy(&circuit);
+	*parse_time = timer_now() - start;
+
+	return result;
+}
+
+/* Mesh solve
+ *
+ * Solve the mesh of size N read from filename, or if filename is NULL
+ * generated in memory (text == 0) or through the circuit file format
+ * (text != 0). The spectral and stencil methods fall back to the circuit
+ * solvers with the options given when the mesh does not suit them.
+ *
+ * Returns:
+ * 0 if operation successful
+ * -1 if the mesh could not be read or solved.
+ */
+static int mesh_solve(const char *filename, int text, size_t N, enum MeshMethod kind, struct CircuitSolverOptions *options, struct MeshResult *result)
+{
+	struct LatticeInfo info;
+	struct Lattice *lattice;
+	struct LatticeBranch source;
+	struct BranchList *branches;
+	struct rusage usage;
+	struct Vector *V;
+	double start;
+	int status;
+
+	memset(result, 0, sizeof *result);
+	result->status = -1;
+
+	/* A generated mesh is known to be a uniform lattice, so no branch list is built */
+	if (filename == NULL && !text && kind != MESH_CIRCUIT) {
+		perf_begin("generate");
+		lattice = lattice_mesh(N, &source);
+		perf_end("generate");
+
+		if (kind == MESH_SPECTRAL)
+			status = mesh_spectral(lattice, &source, result);
+		else
+			status = mesh_stencil(lattice, &source, result);
+
+		Lattice_delete(lattice);
+
+		if (status != 0)
+			return -1;
+
+		goto done;
+	}
+
+	if (filename != NULL) {
+		start = timer_now();
+
+		status = circuits_read_branches(filename, &branches);
+		result->parse_time = timer_now() - start;
+
+		if (status != 0)
+			return -1;
+	} else if (text) {
+		if (mesh_through_file(N, &branches, &result->parse_time) != 0)
+			return -1;
+	} else {
+		perf_begin("generate");
+		start = timer_now();
+		branches = lattice_mesh_circuit(N);
+		result->parse_time = timer_now() - start;
+		perf_end("generate");
+	}
+
+	if (kind != MESH_CIRCUIT && mesh_solve_lattice(branches, N, kind, result) == 0) {
+		BranchList_delete(branches);
+		goto done;
+	}
+
+	/* meshgen writes an N x 2N lattice of nodes grounded at node 0 */
+	info.rows = 2 * N;
+	info.cols = N;
+	info.ground = 0;
+	options->multigrid.lattice = &info;
+
+	V = circuits_solve_branches_with(branches, options, &result->stats);
+	BranchList_delete(branches);
+	options->multigrid.lattice = NULL;
+
+	if (V == NULL)
+		return -1;
+
+	result->R = mesh_resistance(V);
+	strcpy(result->solver, circuits_method_name(result->stats.method));
+	Vector_delete(V);
+
+done:
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		result->peak_rss = usage.ru_maxrss;
+
+	result->status = 0;
+
+	return 0;
+}
+
+static void sweep_start(struct SweepJob *job, int text)
+{
+	struct MeshResult result;
+	int fds[2];
+
+	if (pipe(fds) != 0)
+		exit_with_error("Failed to create a pipe for the sweep.");
+
+	/* Do not let the child inherit unwritten output */
+	fflush(stdout);
+	fflush(stderr);
+
+	job->pid = fork();
+
+	if (job->pid < 0)
+		exit_with_error("Failed to start a sweep process.");
+
+	if (job->pid == 0) {
+		close(fds[0]);
+		mesh_solve(NULL, text, job->N, job->kind, &job->options, &result);
+
+		/* The result is smaller than PIPE_BUF, so this does not block before the parent reads it */
+		if (write(fds[1], &result, sizeof result) != (ssize_t)sizeof result)
+			_exit(1);
+
+		_exit(0);
+	}
+
+	close(fds[1]);
+	job->fd = fds[0];
+	job->done = 0;
+}
+
+static void sweep_finish(struct SweepJob *job, int status)
+{
+	size_t got;
+	ssize_t count;
+
+	got = 0;
+
+	while (got < sizeof job->result) {
+		count = read(job->fd, (char *)&job->result + got, sizeof job->result - got);
+
+		if (count <= 0)
+			break;
+
+		got += (size_t)count;
+	}
+
+	close(job->fd);
+
+	/* Killed (e.g. out of memory) or exited before reporting */
+	if (got != sizeof job->result || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		job->result.status = -1;
+
+	job->done = 1;
+}
+
+static void sweep_print(const struct SweepJob *job)
+{
+	const struct MeshResult *r = &job->result;
+
+	if (r->status != 0) {
+		printf("%lu,%s,,,,,,,,,,,,failed\n", (unsigned long)job->N, job->method);
+		return;
+	}
+
+	printf("%lu,%s,%s,%lu,%lu,%lu,%u,%.6f,%.6f,%.6f,%.6f,%ld,%.6f,ok\n",
+			(unsigned long)job->N, job->method, r->solver,
+			(unsigned long)r->stats.nnodes, (unsigned long)r->stats.nnz,
+			(unsigned long)r->stats.half_bandwidth, r->stats.iterations,
+			r->parse_time, r->stats.assemble_time, r->stats.factor_time, r->stats.solve_time,
+			r->peak_rss, r->R);
+}
+
+/* Parse "Nmin:Nmax[:step]". Returns 0 on success. */
+static int parse_range(const char *arg, size_t *Nmin, size_t *Nmax, size_t *step)
+{
+	char *end;
+
+	*Nmin = strtoul(arg, &end, 10);
+
+	if (*end != ':')
+		return -1;
+
+	*Nmax = strtoul(end + 1, &end, 10);
+	*step = 1;
+
+	if (*end == ':')
+		*step = strtoul(end + 1, &end, 10);
+
+	if (*end != '\0' || *Nmin == 0 || *Nmax < *Nmin || *step == 0)
+		return -1;
+
+	return 0;
+}
+
+/* Mesh-size sweep
+ *
+ * Solves the meshes of every size in the range with every method and
+ * writes one CSV row per pair, in order of size then method. The runs
+ * are independent processes, up to jobs of them at a time. Concurrent
+ * runs compete for memory bandwidth, so keep jobs at 1 for clean timings.
+ */
+static int sweep(int argc, const char *argv[])
+{
+	const char *method_names[SWEEP_MAX_METHODS];
+	char methods[256];
+	struct SweepJob *jobs;
+	size_t Nmin, Nmax, step, N;
+	size_t nmethods, njobs, next, printed, running, k;
+	unsigned long maxjobs;
+	char *name;
+	pid_t pid;
+	int text, status, i;
+
+	if (parse_range(argv[2], &Nmin, &Nmax, &step) != 0) {
+		fprintf(stderr, "Invalid size range '%s'.\n", argv[2]);
+		return -1;
+	}
+
+	strcpy(methods, "banded");
+	maxjobs = 1;
+	text = 0;
+
+	for (i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc && strlen(argv[i + 1]) < sizeof methods) {
+			strcpy(methods, argv[++i]);
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			maxjobs = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-t") == 0) {
+			text = 1;
+		} else {
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (maxjobs == 0)
+		maxjobs = 1;
+
+	nmethods = 0;
+
+	for (name = strtok(methods, ","); name != NULL; name = strtok(NULL, ",")) {
+		if (nmethods == SWEEP_MAX_METHODS) {
+			fprintf(stderr, "At most %d methods per sweep.\n", SWEEP_MAX_METHODS);
+			return -1;
+		}
+
+		method_names[nmethods++] = name;
+	}
+
+	if (nmethods == 0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	njobs = ((Nmax - Nmin) / step + 1) * nmethods;
+	jobs = malloc_or_fail(njobs, sizeof *jobs);
+	k = 0;
+
+	for (N = Nmin; N <= Nmax && N >= Nmin; N += step) {
+		for (i = 0; (size_t)i < nmethods; i++) {
+			jobs[k].N = N;
+			jobs[k].method = method_names[i];
+
+			if (parse_method(method_names[i], &jobs[k].kind, &jobs[k].options) != 0) {
+				fprintf(stderr, "Unknown solver method '%s'.\n", method_names[i]);
+				free_tracked(jobs);
+				return -1;
+			}
+
+			++k;
+		}
+	}
+
+	printf("N,method,solver,nodes,nnz,half_bandwidth,iterations,parse_s,assemble_s,factor_s,solve_s,peak_rss_kb,resistance_ohms,status\n");
+
+	next = 0;
+	printed = 0;
+	running = 0;
+
+	while (printed < njobs) {
+		while (running < maxjobs && next < njobs) {
+			sweep_start(&jobs[next++], text);
+			++running;
+		}
+
+		pid = wait(&status);
+
+		if (pid < 0)
+			exit_with_error("Lost track of the sweep processes.");
+
+		for (k = 0; k < next; k++) {
+			if (jobs[k].pid == pid && !jobs[k].done) {
+				sweep_finish(&jobs[k], status);
+				--running;
+				break;
+			}
+		}
+
+		/* Rows come out in order as soon as all earlier ones are done */
+		while (printed < njobs && printed < next && jobs[printed].done) {
+			sweep_print(&jobs[printed++]);
+			fflush(stdout);
+		}
+	}
+
+	free_tracked(jobs);
+
+	return 0;
+}
+
 int main(int argc, const char *argv[])
 {
 	struct CircuitDescription circuit;
+	struct CircuitSolverOptions options;
+	struct MeshResult result;
 	struct Vector *V;
+	enum MeshMethod kind;
+	int generate;
 	size_t N;
 	double R;
 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <filename> <N>\n", argv[0]);
+	perf_parse_args(&argc, argv);
+
+	if (argc >= 3 && strcmp(argv[1], "-s") == 0)
+		return sweep(argc, argv);
+
+	if (argc != 3 && argc != 4) {
+		print_usage(argv[0]);
 		return 0;
 	}
 
-	if (circuits_parse_file(&circuit, argv[1]) != 0) {
-		fprintf(stderr, "Failed to parse circuit file.\n");
+	generate = (strcmp(argv[1], "-g") == 0);
+
+	if (parse_method((argc == 4) ? argv[3] : "auto", &kind, &options) != 0) {
+		fprintf(stderr, "Unknown solver method '%s'.\n", argv[3]);
 		return -1;
 	}
 
 	N = strtoul(argv[2], NULL, 10);
-	V = circuits_solve_voltages_banded(&circuit, N + 1);
 
-	R = (1000.0 * (V->entries[V->n - 1] / 1.0)) / (1.0 - (V->entries[V->n - 1] / 1.0));
+	if (N == 0) {
+		fprintf(stderr, "N must be at least 1.\n");
+		return -1;
+	}
 
-	printf("Resistance of mesh: %f ohms.\n", R);
+	/* Without a method, keep the original dense banded solve of a file */
+	if (!generate && argc == 3) {
+		if (circuits_parse_file(&circuit, argv[1]) != 0) {
+			fprintf(stderr, "Failed to parse circuit file.\n");
+			return -1;
+		}
 
-	Vector_delete(V);
-	circuits_destroy(&circuit);
+		V = circuits_solve_voltages_banded(&circuit, N + 1);
+		R = mesh_resistance(V);
+		printf("Resistance of mesh: %f ohms.\n", R);
+		Vector_delete(V);
+		circuits_destroy(&circuit);
+		return 0;
+	}
+
+	if (mesh_solve(generate ? NULL : argv[1], 0, N, kind, &options, &result) != 0) {
+		fprintf(stderr, "Failed to solve the mesh.\n");
+		return -1;
+	}
+
+	fprintf(stderr, "Solver: %s, %u iterations, residual %e\n", result.solver, result.stats.iterations, result.stats.residual_norm);
+
+	printf("Resistance of mesh: %f ohms.\n", result.R);
 
 	return 0;
 }
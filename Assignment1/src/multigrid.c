@@ -0,0 +1,586 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "cholesky.h"
+#include "multigrid.h"
+#include "perf.h"
+#include "sparse.h"
+#include "timer.h"
+#include "utils.h"
+
+#define MULTIGRID_MAX_LEVELS		32
+#define MULTIGRID_DEFAULT_COARSE_MAX	500
+#define MULTIGRID_DEFAULT_TOLERANCE	1.0e-10
+#define MULTIGRID_DEFAULT_MAX_CYCLES	200
+
+/* A row of A whose sum is below this fraction of its diagonal has no
+ * conductance to ground; the sum is rounding */
+#define MULTIGRID_GROUND_TOLERANCE	1.0e-12
+
+/* Lattice node of unknown i of the grounded system. */
+static size_t lattice_node(const struct LatticeInfo *lattice, size_t i)
+{
+	return (i < lattice->ground) ? i : i + 1;
+}
+
+static double dot(const double *u, const double *v, size_t n)
+{
+	double sum = 0.0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sum += u[i] * v[i];
+
+	return sum;
+}
+
+static double norm2(const double *v, size_t n)
+{
+	return sqrt(dot(v, v, n));
+}
+
+/* r = b - Ax */
+static void residual(const struct SparseMatrix *A, double *r, const double *x, const double *b)
+{
+	size_t i;
+
+	SparseMatrix_multiply_vector(A, x, r);
+
+	for (i = 0; i < A->m; i++)
+		r[i] = b[i] - r[i];
+}
+
+/* One Gauss-Seidel sweep in increasing (forward) or decreasing row order. */
+static void gauss_seidel(const struct SparseMatrix *A, double *x, const double *b, int forward)
+{
+	size_t n = A->m;
+	size_t i, k, t;
+	double sum, diag;
+
+	for (t = 0; t < n; t++) {
+		i = forward ? t : n - t - 1;
+		sum = b[i];
+		diag = 0.0;
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			if (A->col_idx[k] == i)
+				diag = A->values[k];
+			else
+				sum -= A->values[k] * x[A->col_idx[k]];
+		}
+
+		x[i] = sum / diag;
+	}
+}
+
+/* Coarse index of fine index i of n along one lattice direction. The
+ * coarse lattice keeps the even indices and the last one. */
+static size_t coarse_index(size_t i, size_t n)
+{
+	return (i == n - 1) ? n / 2 : i / 2;
+}
+
+/* Bilinear interpolation weights along one lattice direction of n fine
+ * indices: fine index i takes w[0] of coarse index c[0] and w[1] of c[1].
+ * Returns the number of coarse indices used. */
+static size_t interpolation_weights(size_t i, size_t n, size_t *c, double *w)
+{
+	if (i % 2 == 0 || i == n - 1) {
+		/* A node of the coarse lattice */
+		c[0] = coarse_index(i, n);
+		w[0] = 1.0;
+		return 1;
+	}
+
+	c[0] = coarse_index(i - 1, n);
+	c[1] = coarse_index(i + 1, n);
+	w[0] = 0.5;
+	w[1] = 0.5;
+
+	return 2;
+}
+
+/* Build the prolongation from the lattice made of the even and last rows
+ * and columns of 'fine', over all of its nodes. The ground node of the
+ * coarse lattice is the one at or before the fine ground node. */
+static struct SparseMatrix *build_prolongation(const struct LatticeInfo *fine, struct LatticeInfo *coarse)
+{
+	struct SparseMatrix *P;
+	size_t *rows, *cols;
+	double *values;
+	size_t ci[2], cj[2];
+	double wi[2], wj[2];
+	size_t ni, nj, a, b;
+	size_t i, j, nnz;
+	size_t nfine, ncoarse;
+
+	coarse->rows = fine->rows / 2 + 1;
+	coarse->cols = fine->cols / 2 + 1;
+	coarse->ground = coarse_index(fine->ground / fine->cols, fine->rows) * coarse->cols + coarse_index(fine->ground % fine->cols, fine->cols);
+
+	nfine = fine->rows * fine->cols;
+	ncoarse = coarse->rows * coarse->cols;
+
+	rows = malloc_or_fail(4 * nfine, sizeof *rows);
+	cols = malloc_or_fail(4 * nfine, sizeof *cols);
+	values = malloc_or_fail(4 * nfine, sizeof *values);
+	nnz = 0;
+
+	for (i = 0; i < fine->rows; i++) {
+		ni = interpolation_weights(i, fine->rows, ci, wi);
+
+		for (j = 0; j < fine->cols; j++) {
+			nj = interpolation_weights(j, fine->cols, cj, wj);
+
+			for (a = 0; a < ni; a++) {
+				for (b = 0; b < nj; b++) {
+					rows[nnz] = i * fine->cols + j;
+					cols[nnz] = ci[a] * coarse->cols + cj[b];
+					values[nnz] = wi[a] * wj[b];
+					++nnz;
+				}
+			}
+		}
+	}
+
+	P = SparseMatrix_from_triplets(nfine, ncoarse, nnz, rows, cols, values);
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+
+	return P;
+}
+
+/* Nodal matrix of the floating lattice behind the grounded matrix A: the
+ * ground node becomes an unknown, and the conductance of each node to
+ * ground, the sum of its row of A, a branch to it. Every row sums to 0. */
+static struct SparseMatrix *floating_matrix(const struct SparseMatrix *A, const struct LatticeInfo *lattice)
+{
+	struct SparseMatrix *F;
+	size_t *rows, *cols;
+	double *values;
+	size_t i, k, node, nnz;
+	double sum, diag;
+
+	rows = malloc_or_fail(A->nnz + 3 * A->m, sizeof *rows);
+	cols = malloc_or_fail(A->nnz + 3 * A->m, sizeof *cols);
+	values = malloc_or_fail(A->nnz + 3 * A->m, sizeof *values);
+	nnz = 0;
+
+	for (i = 0; i < A->m; i++) {
+		node = lattice_node(lattice, i);
+		sum = 0.0;
+		diag = 0.0;
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			rows[nnz] = node;
+			cols[nnz] = lattice_node(lattice, A->col_idx[k]);
+			values[nnz] = A->values[k];
+			++nnz;
+
+			sum += A->values[k];
+
+			if (A->col_idx[k] == i)
+				diag = A->values[k];
+		}
+
+		if (sum > MULTIGRID_GROUND_TOLERANCE * diag) {
+			rows[nnz] = node;
+			cols[nnz] = lattice->ground;
+			values[nnz++] = -sum;
+			rows[nnz] = lattice->ground;
+			cols[nnz] = node;
+			values[nnz++] = -sum;
+			rows[nnz] = lattice->ground;
+			cols[nnz] = lattice->ground;
+			values[nnz++] = sum;
+		}
+	}
+
+	F = SparseMatrix_from_triplets(A->m + 1, A->m + 1, nnz, rows, cols, values);
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+
+	return F;
+}
+
+/* A with row and column pin replaced by those of the identity, so that it
+ * is positive-definite and the solution has 0 at pin. */
+static struct SparseMatrix *pinned_matrix(const struct SparseMatrix *A, size_t pin)
+{
+	struct SparseMatrix *B;
+	size_t *rows, *cols;
+	double *values;
+	size_t i, k, nnz;
+
+	rows = malloc_or_fail(A->nnz + 1, sizeof *rows);
+	cols = malloc_or_fail(A->nnz + 1, sizeof *cols);
+	values = malloc_or_fail(A->nnz + 1, sizeof *values);
+	nnz = 0;
+
+	for (i = 0; i < A->m; i++) {
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			if (i == pin || A->col_idx[k] == pin)
+				continue;
+
+			rows[nnz] = i;
+			cols[nnz] = A->col_idx[k];
+			values[nnz] = A->values[k];
+			++nnz;
+		}
+	}
+
+	rows[nnz] = pin;
+	cols[nnz] = pin;
+	values[nnz] = 1.0;
+	++nnz;
+
+	B = SparseMatrix_from_triplets(A->m, A->n, nnz, rows, cols, values);
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+
+	return B;
+}
+
+static void vcycle(const struct Multigrid *mg, size_t l, double *x, const double *b)
+{
+	const struct MultigridLevel *level = &mg->levels[l];
+	const struct MultigridLevel *coarse;
+	const struct SparseMatrix *P;
+	size_t i, k;
+	unsigned int s;
+
+	if (l == mg->nlevels - 1) {
+		for (i = 0; i < level->A->m; i++)
+			x[i] = b[i];
+
+		x[level->lattice.ground] = 0.0;
+		cholesky_solve_band(mg->coarse_L, x);
+		return;
+	}
+
+	coarse = &mg->levels[l + 1];
+	P = coarse->P;
+
+	for (s = 0; s < mg->pre_smooth; s++)
+		gauss_seidel(level->A, x, b, 1);
+
+	/* Restrict the residual with P^T */
+	residual(level->A, level->r, x, b);
+
+	for (k = 0; k < coarse->A->m; k++) {
+		coarse->b[k] = 0.0;
+		coarse->x[k] = 0.0;
+	}
+
+	for (i = 0; i < P->m; i++) {
+		for (k = P->row_ptr[i]; k < P->row_ptr[i + 1]; k++)
+			coarse->b[P->col_idx[k]] += P->values[k] * level->r[i];
+	}
+
+	vcycle(mg, l + 1, coarse->x, coarse->b);
+
+	/* Interpolate the coarse correction */
+	for (i = 0; i < P->m; i++) {
+		for (k = P->row_ptr[i]; k < P->row_ptr[i + 1]; k++)
+			x[i] += P->values[k] * coarse->x[P->col_idx[k]];
+	}
+
+	for (s = 0; s < mg->post_smooth; s++)
+		gauss_seidel(level->A, x, b, 0);
+}
+
+void multigrid_default_options(struct MultigridOptions *options)
+{
+	options->lattice = NULL;
+	options->pre_smooth = 2;
+	options->post_smooth = 2;
+	options->coarse_max = MULTIGRID_DEFAULT_COARSE_MAX;
+	options->tolerance = MULTIGRID_DEFAULT_TOLERANCE;
+	options->max_cycles = MULTIGRID_DEFAULT_MAX_CYCLES;
+}
+
+int multigrid_detect_lattice(const struct SparseMatrix *A, struct LatticeInfo *lattice)
+{
+	size_t hb, cols, rows;
+	size_t i, k, p, q;
+
+	if (A->m != A->n)
+		return -1;
+
+	/* The widest branch of a lattice is vertical, one row of nodes apart. */
+	hb = SparseMatrix_half_bandwidth(A);
+
+	if (hb < 2)
+		return -1;
+
+	cols = hb - 1;
+	rows = (A->n + 1) / cols;
+
+	if (rows * cols != A->n + 1 || rows < 2)
+		return -1;
+
+	/* Every branch must join horizontal or vertical neighbours. */
+	for (i = 0; i < A->m; i++) {
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			p = i + 1;
+			q = A->col_idx[k] + 1;
+
+			if (p == q || (p > q && p - q == cols) || (q > p && q - p == cols))
+				continue;
+
+			if (((p > q && p - q == 1) || (q > p && q - p == 1)) && p / cols == q / cols)
+				continue;
+
+			return -1;
+		}
+	}
+
+	lattice->rows = rows;
+	lattice->cols = cols;
+	lattice->ground = 0;
+
+	return 0;
+}
+
+struct Multigrid *multigrid_setup(const struct SparseMatrix *A, const struct MultigridOptions *options)
+{
+	struct MultigridOptions defaults;
+	struct Multigrid *mg;
+	struct MultigridLevel *level;
+	struct LatticeInfo lattice;
+	struct SparseMatrix *pinned;
+	size_t l, n;
+
+	if (options == NULL) {
+		multigrid_default_options(&defaults);
+		options = &defaults;
+	}
+
+	if (options->lattice != NULL)
+		lattice = *options->lattice;
+	else if (multigrid_detect_lattice(A, &lattice) != 0)
+		return NULL;
+
+	if (A->m != A->n || lattice.cols == 0 || lattice.rows * lattice.cols != A->n + 1 || lattice.ground > A->n)
+		return NULL;
+
+	mg = malloc_or_fail(1, sizeof *mg);
+	mg->levels = malloc_or_fail(MULTIGRID_MAX_LEVELS, sizeof *(mg->levels));
+	mg->pre_smooth = options->pre_smooth;
+	mg->post_smooth = options->post_smooth;
+
+	mg->levels[0].A = floating_matrix(A, &lattice);
+	mg->levels[0].P = NULL;
+	mg->levels[0].lattice = lattice;
+	mg->nlevels = 1;
+
+	/* Coarsen until the problem is small enough for a direct solve. */
+	for (;;) {
+		level = &mg->levels[mg->nlevels - 1];
+		n = level->A->m;
+
+		if (n <= options->coarse_max || level->lattice.rows < 3 || level->lattice.cols < 3
+				|| mg->nlevels == MULTIGRID_MAX_LEVELS)
+			break;
+
+		level[1].P = build_prolongation(&level->lattice, &level[1].lattice);
+		level[1].A = SparseMatrix_galerkin(level->A, level[1].P);
+		++mg->nlevels;
+	}
+
+	for (l = 0; l < mg->nlevels; l++) {
+		n = mg->levels[l].A->m;
+		mg->levels[l].x = malloc_or_fail(n, sizeof *(mg->levels[l].x));
+		mg->levels[l].b = malloc_or_fail(n, sizeof *(mg->levels[l].b));
+		mg->levels[l].r = malloc_or_fail(n, sizeof *(mg->levels[l].r));
+	}
+
+	/* The floating lattice only fixes its potentials up to a constant; the
+	 * coarsest solve picks the one with the ground at 0 */
+	level = &mg->levels[mg->nlevels - 1];
+	pinned = pinned_matrix(level->A, level->lattice.ground);
+	mg->coarse_L = SparseMatrix_to_band(pinned, SparseMatrix_half_bandwidth(pinned));
+	SparseMatrix_delete(pinned);
+
+	if (cholesky_factor_band(mg->coarse_L) != 0) {
+		multigrid_delete(mg);
+		return NULL;
+	}
+
+	return mg;
+}
+
+void multigrid_delete(struct Multigrid *mg)
+{
+	size_t l;
+
+	for (l = 0; l < mg->nlevels; l++) {
+		SparseMatrix_delete(mg->levels[l].A);
+
+		if (l > 0)
+			SparseMatrix_delete(mg->levels[l].P);
+
+		free_tracked(mg->levels[l].x);
+		free_tracked(mg->levels[l].b);
+		free_tracked(mg->levels[l].r);
+	}
+
+	BandMatrix_delete(mg->coarse_L);
+	free_tracked(mg->levels);
+	free_tracked(mg);
+}
+
+/* See multigrid.h header for documentation */
+void multigrid_vcycle(const struct Multigrid *mg, double *x, const double *b)
+{
+	const struct MultigridLevel *fine = &mg->levels[0];
+	size_t ground = fine->lattice.ground;
+	size_t n = fine->A->m - 1;
+	size_t i;
+	double sum = 0.0;
+
+	/* The current into the ground node is what leaves the others */
+	for (i = 0; i < n; i++) {
+		fine->x[lattice_node(&fine->lattice, i)] = x[i];
+		fine->b[lattice_node(&fine->lattice, i)] = b[i];
+		sum += b[i];
+	}
+
+	fine->x[ground] = 0.0;
+	fine->b[ground] = -sum;
+
+	vcycle(mg, 0, fine->x, fine->b);
+
+	for (i = 0; i < n; i++)
+		x[i] = fine->x[lattice_node(&fine->lattice, i)] - fine->x[ground];
+}
+
+/* See multigrid.h header for documentation */
+void multigrid_precondition(const struct Multigrid *mg, double *z, const double *r)
+{
+	size_t i;
+
+	for (i = 0; i < mg->levels[0].A->m - 1; i++)
+		z[i] = 0.0;
+
+	multigrid_vcycle(mg, z, r);
+}
+
+/* See multigrid.h header for documentation */
+int multigrid_solve_system(struct Vector **xp, const struct SparseMatrix *A, const struct Vector *b, const struct MultigridOptions *options, struct MultigridStats *stats)
+{
+	struct MultigridOptions defaults;
+	struct Multigrid *mg;
+	struct Vector *x;
+	double *r, *z, *p, *q;
+	double bnorm, rnorm, rz, rz_old, alpha;
+	unsigned int cycles;
+	size_t n, i;
+	int result;
+	double start, setup_end;
+
+	if (b->n != A->n)
+		exit_with_error("Matrix A and vector b not compatible for the system of equations.");
+
+	if (options == NULL) {
+		multigrid_default_options(&defaults);
+		options = &defaults;
+	}
+
+	perf_begin("multigrid_setup");
+	start = timer_now();
+	mg = multigrid_setup(A, options);
+	perf_end("multigrid_setup");
+
+	if (mg == NULL)
+		return -1;
+
+	setup_end = timer_now();
+	perf_begin("multigrid_cycles");
+	n = A->n;
+	x = Vector_new(n);
+	r = malloc_or_fail(n, sizeof *r);
+	z = malloc_or_fail(n, sizeof *z);
+	p = malloc_or_fail(n, sizeof *p);
+	q = malloc_or_fail(n, sizeof *q);
+
+	for (i = 0; i < n; i++) {
+		x->entries[i] = 0.0;
+		r[i] = b->entries[i];
+	}
+
+	bnorm = norm2(b->entries, n);
+	rnorm = bnorm;
+	rz = 0.0;
+	cycles = 0;
+	result = 0;
+
+	/* The V-cycles are accelerated by conjugate gradients. Branches that
+	 * are not lattice edges (a source from a far corner to the ground,
+	 * say) are missed by the smoother and the interpolation alike, which
+	 * makes plain cycling slow down with N; they are a low-rank change to
+	 * the lattice, which CG removes in as many extra steps. */
+	while (rnorm > options->tolerance * bnorm) {
+		if (cycles >= options->max_cycles) {
+			result = -1;
+			break;
+		}
+
+		multigrid_precondition(mg, z, r);
+		++cycles;
+		rz_old = rz;
+		rz = dot(r, z, n);
+
+		for (i = 0; i < n; i++)
+			p[i] = (cycles == 1) ? z[i] : z[i] + (rz / rz_old) * p[i];
+
+		SparseMatrix_multiply_vector(A, p, q);
+		alpha = rz / dot(p, q, n);
+
+		for (i = 0; i < n; i++) {
+			x->entries[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+		}
+
+		rnorm = norm2(r, n);
+	}
+
+	/* Report the true residual, not the recurrence */
+	residual(A, r, x->entries, b->entries);
+	rnorm = norm2(r, n);
+
+	perf_count("multigrid_cycles", cycles);
+	perf_end("multigrid_cycles");
+
+	if (stats != NULL) {
+		stats->cycles = cycles;
+		stats->levels = mg->nlevels;
+		stats->residual_norm = rnorm;
+		stats->relative_residual = (bnorm > 0.0) ? rnorm / bnorm : 0.0;
+		stats->converged = (result == 0);
+		stats->setup_time = setup_end - start;
+		stats->solve_time = timer_now() - setup_end;
+	}
+
+	free_tracked(r);
+	free_tracked(z);
+	free_tracked(p);
+	free_tracked(q);
+	multigrid_delete(mg);
+
+	if (result != 0) {
+		Vector_delete(x);
+		return -1;
+	}
+
+	*xp = x;
+
+	return 0;
+}
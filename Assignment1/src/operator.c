@@ -0,0 +1,57 @@
+#include <stddef.h>
+#include <math.h>
+
+#include "operator.h"
+#include "sparse.h"
+#include "utils.h"
+
+static void sparse_multiply(const void *data, const double *x, double *y)
+{
+	SparseMatrix_multiply_vector(data, x, y);
+}
+
+static void sparse_diagonal(const void *data, double *d)
+{
+	const struct SparseMatrix *A = data;
+	size_t i;
+
+	for (i = 0; i < A->n; i++)
+		d[i] = SparseMatrix_get(A, i, i);
+}
+
+void LinearOperator_from_sparse(struct LinearOperator *op, const struct SparseMatrix *A)
+{
+	if (A->m != A->n)
+		exit_with_error("A linear operator needs a square matrix.");
+
+	op->n = A->n;
+	op->multiply = sparse_multiply;
+	op->diagonal = sparse_diagonal;
+	op->data = A;
+	op->matrix = A;
+}
+
+void LinearOperator_multiply(const struct LinearOperator *op, const double *x, double *y)
+{
+	op->multiply(op->data, x, y);
+}
+
+void LinearOperator_diagonal(const struct LinearOperator *op, double *d)
+{
+	op->diagonal(op->data, d);
+}
+
+double LinearOperator_residual(const struct LinearOperator *op, const double *x, const double *b, double *r)
+{
+	double sum = 0.0;
+	size_t i;
+
+	op->multiply(op->data, x, r);
+
+	for (i = 0; i < op->n; i++) {
+		r[i] = b[i] - r[i];
+		sum += r[i] * r[i];
+	}
+
+	return sqrt(sum);
+}
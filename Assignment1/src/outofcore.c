@@ -0,0 +1,485 @@
+/* pread, pwrite, mkstemp and threads are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cholesky.h"
+#include "outofcore.h"
+#include "perf.h"
+#include "utils.h"
+
+/* A panel to read into or write from a window buffer */
+struct IORequest {
+	int write;
+	size_t panel;
+	double *buffer;
+};
+
+/* Requests are served in order by one thread. Request k (counting from 1)
+ * is done once completed >= k, so its number is the ticket to wait for. */
+struct IOQueue {
+	const struct OutOfCoreBand *band;
+	struct IORequest *requests;	/* Ring of capacity requests */
+	size_t capacity;
+	unsigned long issued;
+	unsigned long completed;
+	int stop;
+	int error;			/* errno of the first failed request */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t thread;
+};
+
+/* PROTOTYPES */
+static size_t panel_size(const struct OutOfCoreBand *B, size_t p);
+static double *panel_buffer(const struct OutOfCoreBand *B, size_t p);
+static int transfer(const struct OutOfCoreBand *B, const struct IORequest *request);
+static void *io_thread(void *arg);
+static int io_start(struct IOQueue *q, const struct OutOfCoreBand *B);
+static unsigned long io_issue(struct IOQueue *q, int write, size_t panel);
+static int io_wait(struct IOQueue *q, unsigned long ticket);
+static int io_stop(struct IOQueue *q);
+static int choose_panels(struct OutOfCoreBand *B, size_t budget);
+/* END PROTOTYPES */
+
+/* Rows in panel p */
+static size_t panel_size(const struct OutOfCoreBand *B, size_t p)
+{
+	size_t first = p * B->panel_rows;
+
+	return (B->n - first < B->panel_rows) ? B->n - first : B->panel_rows;
+}
+
+/* Window buffer holding panel p */
+static double *panel_buffer(const struct OutOfCoreBand *B, size_t p)
+{
+	return B->buffers + (p % B->window) * B->panel_rows * B->hb;
+}
+
+/* Move one panel between its buffer and the scratch file. Returns 0 or an errno. */
+static int transfer(const struct OutOfCoreBand *B, const struct IORequest *request)
+{
+	char *data = (char *)request->buffer;
+	size_t size = panel_size(B, request->panel) * B->hb * sizeof *request->buffer;
+	off_t offset = (off_t)request->panel * (off_t)(B->panel_rows * B->hb * sizeof *request->buffer);
+	ssize_t done;
+
+	while (size > 0) {
+		if (request->write)
+			done = pwrite(B->fd, data, size, offset);
+		else
+			done = pread(B->fd, data, size, offset);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+
+		if (done < 0)
+			return errno;
+
+		/* The file holds every panel, so it never ends early */
+		if (done == 0)
+			return EIO;
+
+		data += done;
+		offset += done;
+		size -= (size_t)done;
+	}
+
+	return 0;
+}
+
+static void *io_thread(void *arg)
+{
+	struct IOQueue *q = arg;
+	struct IORequest request;
+	int error;
+
+	pthread_mutex_lock(&q->lock);
+
+	for (;;) {
+		while (q->completed == q->issued && !q->stop)
+			pthread_cond_wait(&q->changed, &q->lock);
+
+		/* Stop only once every request is served */
+		if (q->completed == q->issued)
+			break;
+
+		request = q->requests[q->completed % q->capacity];
+		pthread_mutex_unlock(&q->lock);
+
+		error = transfer(q->band, &request);
+
+		pthread_mutex_lock(&q->lock);
+
+		if (error != 0 && q->error == 0)
+			q->error = error;
+
+		++q->completed;
+		pthread_cond_broadcast(&q->changed);
+	}
+
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+static int io_start(struct IOQueue *q, const struct OutOfCoreBand *B)
+{
+	q->band = B;
+	q->capacity = 2 * B->window + 2;
+	q->requests = malloc_or_fail(q->capacity, sizeof *(q->requests));
+	q->issued = 0;
+	q->completed = 0;
+	q->stop = 0;
+	q->error = 0;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->changed, NULL);
+
+	if (pthread_create(&q->thread, NULL, io_thread, q) != 0) {
+		fprintf(stderr, "Could not start the I/O thread.\n");
+		pthread_cond_destroy(&q->changed);
+		pthread_mutex_destroy(&q->lock);
+		free_tracked(q->requests);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Queue a panel transfer and return its ticket. */
+static unsigned long io_issue(struct IOQueue *q, int write, size_t panel)
+{
+	struct IORequest *request;
+	unsigned long ticket;
+
+	perf_count(write ? "bytes_written" : "bytes_read", (double)(panel_size(q->band, panel) * q->band->hb * sizeof(double)));
+
+	pthread_mutex_lock(&q->lock);
+
+	while (q->issued - q->completed == q->capacity)
+		pthread_cond_wait(&q->changed, &q->lock);
+
+	request = &q->requests[q->issued % q->capacity];
+	request->write = write;
+	request->panel = panel;
+	request->buffer = panel_buffer(q->band, panel);
+	ticket = ++q->issued;
+
+	pthread_cond_broadcast(&q->changed);
+	pthread_mutex_unlock(&q->lock);
+
+	return ticket;
+}
+
+/* Wait for a request, and all before it, to be done. Ticket 0 is always done.
+ * Returns -1 if any request so far failed. */
+static int io_wait(struct IOQueue *q, unsigned long ticket)
+{
+	int error;
+
+	perf_begin("io_wait");
+	pthread_mutex_lock(&q->lock);
+
+	while (q->completed < ticket)
+		pthread_cond_wait(&q->changed, &q->lock);
+
+	error = q->error;
+	pthread_mutex_unlock(&q->lock);
+	perf_end("io_wait");
+
+	return (error == 0) ? 0 : -1;
+}
+
+/* Finish the queued requests and stop the thread. Returns -1 if any failed. */
+static int io_stop(struct IOQueue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->changed);
+	pthread_mutex_unlock(&q->lock);
+
+	pthread_join(q->thread, NULL);
+	pthread_cond_destroy(&q->changed);
+	pthread_mutex_destroy(&q->lock);
+	free_tracked(q->requests);
+
+	if (q->error != 0) {
+		fprintf(stderr, "Scratch file: %s\n", strerror(q->error));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Largest panel whose window fits in the budget. Returns -1 if none does. */
+static int choose_panels(struct OutOfCoreBand *B, size_t budget)
+{
+	size_t rows, P, depth, npanels, window;
+
+	/* Rows of the band that fit in the budget */
+	rows = budget / (B->hb * sizeof(double));
+
+	for (P = (rows < B->n) ? rows : B->n; P > 0; P--) {
+		depth = (B->hb - 1 + P - 1) / P;
+		npanels = (B->n + P - 1) / P;
+		window = (depth + 2 < npanels) ? depth + 2 : npanels;
+
+		if (window * P <= rows) {
+			B->panel_rows = P;
+			B->npanels = npanels;
+			B->window = window;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void outofcore_default_options(struct OutOfCoreOptions *options)
+{
+	options->memory_budget = OUTOFCORE_DEFAULT_BUDGET;
+	options->scratch_dir = NULL;
+}
+
+/* See outofcore.h header for documentation */
+struct OutOfCoreBand *OutOfCoreBand_from_sparse(const struct SparseMatrix *S, size_t hb, const struct OutOfCoreOptions *options)
+{
+	struct OutOfCoreBand *B;
+	struct IOQueue q;
+	unsigned long *written;
+	const char *dir;
+	char *path;
+	double *row;
+	size_t p, i, k, first, last;
+	int status;
+
+	if (S->m != S->n)
+		exit_with_error("Matrix must be square to convert to band format.");
+
+	B = malloc_or_fail(1, sizeof *B);
+	B->n = S->n;
+	B->hb = (hb == 0 || hb > S->n) ? S->n : hb;
+
+	if (choose_panels(B, options->memory_budget) != 0) {
+		fprintf(stderr, "Memory budget of %lu bytes is too small for half bandwidth %lu.\n",
+				(unsigned long)options->memory_budget, (unsigned long)B->hb);
+		free_tracked(B);
+		return NULL;
+	}
+
+	dir = options->scratch_dir;
+
+	if (dir == NULL)
+		dir = getenv("TMPDIR");
+
+	if (dir == NULL || *dir == '\0')
+		dir = "/tmp";
+
+	path = malloc_or_fail(strlen(dir) + sizeof "/bandXXXXXX", 1);
+	sprintf(path, "%s/bandXXXXXX", dir);
+	B->fd = mkstemp(path);
+
+	if (B->fd < 0) {
+		perror(path);
+		free_tracked(path);
+		free_tracked(B);
+		return NULL;
+	}
+
+	unlink(path);
+	free_tracked(path);
+
+	B->buffers = malloc_or_fail(B->window * B->panel_rows * B->hb, sizeof *(B->buffers));
+	written = malloc_or_fail(B->window, sizeof *written);
+
+	for (p = 0; p < B->window; p++)
+		written[p] = 0;
+
+	if (io_start(&q, B) != 0) {
+		free_tracked(written);
+		OutOfCoreBand_delete(B);
+		return NULL;
+	}
+
+	perf_begin("convert");
+	status = 0;
+
+	for (p = 0; p < B->npanels && status == 0; p++) {
+		/* The buffer is free once its previous panel is on disk */
+		status = io_wait(&q, written[p % B->window]);
+		first = p * B->panel_rows;
+		last = first + panel_size(B, p);
+
+		for (i = first; i < last; i++) {
+			row = panel_buffer(B, p) + (i - first) * B->hb;
+
+			for (k = 0; k < B->hb; k++)
+				row[k] = 0.0;
+
+			for (k = S->row_ptr[i]; k < S->row_ptr[i + 1] && S->col_idx[k] <= i; k++) {
+				if (i - S->col_idx[k] < B->hb)
+					row[B->hb - 1 - (i - S->col_idx[k])] = S->values[k];
+			}
+		}
+
+		written[p % B->window] = io_issue(&q, 1, p);
+	}
+
+	if (io_stop(&q) != 0)
+		status = -1;
+
+	perf_end("convert");
+	free_tracked(written);
+
+	if (status != 0) {
+		OutOfCoreBand_delete(B);
+		return NULL;
+	}
+
+	return B;
+}
+
+void OutOfCoreBand_delete(struct OutOfCoreBand *B)
+{
+	close(B->fd);
+	free_tracked(B->buffers);
+	free_tracked(B);
+}
+
+/* See outofcore.h header for documentation */
+int outofcore_cholesky_factor(struct OutOfCoreBand *B)
+{
+	struct IOQueue q;
+	double **rows;
+	unsigned long ticket;
+	size_t depth, p, d, i, first, base;
+	int status;
+
+	/* Panels before the current one that hold rows it depends on */
+	depth = (B->hb - 1 + B->panel_rows - 1) / B->panel_rows;
+	rows = malloc_or_fail((depth + 1) * B->panel_rows, sizeof *rows);
+
+	if (io_start(&q, B) != 0) {
+		free_tracked(rows);
+		return -1;
+	}
+
+	perf_begin("factor");
+	ticket = io_issue(&q, 0, 0);
+	status = 0;
+
+	for (p = 0; p < B->npanels; p++) {
+		if (io_wait(&q, ticket) != 0) {
+			status = -1;
+			break;
+		}
+
+		/* Read ahead into the buffer of a panel no longer needed; its
+		 * write was queued earlier, so it is on disk before the read. */
+		if (p + 1 < B->npanels)
+			ticket = io_issue(&q, 0, p + 1);
+
+		d = (p > depth) ? p - depth : 0;
+		base = d * B->panel_rows;
+		first = p * B->panel_rows;
+
+		for (i = base; i < first + panel_size(B, p); i++)
+			rows[i - base] = panel_buffer(B, i / B->panel_rows) + (i % B->panel_rows) * B->hb;
+
+		if (cholesky_factor_band_rows(rows, base, B->hb, first, first + panel_size(B, p)) != 0) {
+			status = -1;
+			break;
+		}
+
+		io_issue(&q, 1, p);
+	}
+
+	if (io_stop(&q) != 0)
+		status = -1;
+
+	perf_count("flops", (double)B->n * B->hb * B->hb);
+	perf_end("factor");
+	free_tracked(rows);
+
+	return status;
+}
+
+/* See outofcore.h header for documentation */
+int outofcore_cholesky_solve(const struct OutOfCoreBand *L, double *x)
+{
+	struct IOQueue q;
+	const double **rows;
+	unsigned long ticket;
+	size_t p, t, i, first, count;
+	int status;
+
+	rows = malloc_or_fail(L->panel_rows, sizeof *rows);
+
+	if (io_start(&q, L) != 0) {
+		free_tracked(rows);
+		return -1;
+	}
+
+	perf_begin("solve");
+	status = 0;
+
+	/* Forward elimination, Ly = b, first panel to last */
+	ticket = io_issue(&q, 0, 0);
+
+	for (p = 0; p < L->npanels && status == 0; p++) {
+		if (io_wait(&q, ticket) != 0) {
+			status = -1;
+			break;
+		}
+
+		if (p + 1 < L->npanels)
+			ticket = io_issue(&q, 0, p + 1);
+
+		first = p * L->panel_rows;
+		count = panel_size(L, p);
+
+		for (i = 0; i < count; i++)
+			rows[i] = panel_buffer(L, p) + i * L->hb;
+
+		cholesky_forward_band_rows(rows, first, L->hb, first, first + count, x);
+	}
+
+	/* Back substitution, (L^T)x = y, last panel to first. The last panel
+	 * is still in its buffer from the forward pass. */
+	for (t = 0; t < L->npanels && status == 0; t++) {
+		p = L->npanels - 1 - t;
+
+		if (io_wait(&q, ticket) != 0) {
+			status = -1;
+			break;
+		}
+
+		if (p > 0)
+			ticket = io_issue(&q, 0, p - 1);
+
+		first = p * L->panel_rows;
+		count = panel_size(L, p);
+
+		for (i = 0; i < count; i++)
+			rows[i] = panel_buffer(L, p) + i * L->hb;
+
+		cholesky_backward_band_rows(rows, first, L->hb, first, first + count, x);
+	}
+
+	if (io_stop(&q) != 0)
+		status = -1;
+
+	perf_count("flops", 4.0 * (double)L->n * L->hb);
+	perf_end("solve");
+	free_tracked(rows);
+
+	return status;
+}
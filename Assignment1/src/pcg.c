@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "multigrid.h"
+#include "operator.h"
+#include "pcg.h"
+#include "perf.h"
+#include "sparse.h"
+#include "timer.h"
+#include "utils.h"
+
+#define PCG_DEFAULT_TOLERANCE	1.0e-10
+#define PCG_DEFAULT_OMEGA	1.5
+
+/* State of a preconditioner M, applied as z = M^-1 r. */
+struct Preconditioner {
+	enum PCGPreconditioner type;
+	const struct SparseMatrix *A;	/* Explicit matrix, NULL for a matrix-free operator */
+	size_t n;
+	double *diag;			/* Diagonal of A (Jacobi, SSOR) */
+	struct SparseMatrix *L;		/* Lower-triangular IC(0) factor, diagonal last in each row */
+	struct Multigrid *mg;		/* Multigrid hierarchy */
+	double omega;
+};
+
+static double dot(const double *u, const double *v, size_t n)
+{
+	double sum = 0.0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sum += u[i] * v[i];
+
+	return sum;
+}
+
+/* Incomplete Cholesky IC(0)
+ *
+ * Computes a lower-triangular L with the same sparsity pattern as the
+ * lower half of A, such that LL^T matches A on that pattern. Each row
+ * of the result stores its diagonal entry last.
+ *
+ * Returns NULL if a nonpositive pivot is met.
+ */
+static struct SparseMatrix *incomplete_cholesky(const struct SparseMatrix *A)
+{
+	struct SparseMatrix *L;
+	size_t *diag_pos;
+	size_t n, nnz;
+	size_t i, k, p, q, col;
+	double sum;
+
+	n = A->n;
+	nnz = 0;
+
+	for (i = 0; i < n; i++) {
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1] && A->col_idx[k] <= i; k++)
+			++nnz;
+	}
+
+	L = malloc_or_fail(1, sizeof *L);
+	L->row_ptr = malloc_or_fail(n + 1, sizeof *(L->row_ptr));
+	L->col_idx = malloc_or_fail(nnz, sizeof *(L->col_idx));
+	L->values = malloc_or_fail(nnz, sizeof *(L->values));
+	L->m = n;
+	L->n = n;
+	L->nnz = nnz;
+
+	/* Copy the lower half of A, which is where the factor lives. */
+	nnz = 0;
+
+	for (i = 0; i < n; i++) {
+		L->row_ptr[i] = nnz;
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1] && A->col_idx[k] <= i; k++) {
+			L->col_idx[nnz] = A->col_idx[k];
+			L->values[nnz] = A->values[k];
+			++nnz;
+		}
+
+		/* IC(0) needs the diagonal in the pattern */
+		if (nnz == L->row_ptr[i] || L->col_idx[nnz - 1] != i) {
+			SparseMatrix_delete(L);
+			return NULL;
+		}
+	}
+
+	L->row_ptr[n] = nnz;
+	diag_pos = malloc_or_fail(n, sizeof *diag_pos);
+
+	for (i = 0; i < n; i++) {
+		/* Off-diagonal entries: L[i][col] = (A[i][col] - sum_m L[i][m] L[col][m]) / L[col][col] */
+		for (k = L->row_ptr[i]; k < L->row_ptr[i + 1] - 1; k++) {
+			col = L->col_idx[k];
+			sum = L->values[k];
+			p = L->row_ptr[i];
+			q = L->row_ptr[col];
+
+			/* Merge the two sorted rows over columns m < col */
+			while (p < k && q < diag_pos[col]) {
+				if (L->col_idx[p] < L->col_idx[q]) {
+					++p;
+				} else if (L->col_idx[p] > L->col_idx[q]) {
+					++q;
+				} else {
+					sum -= L->values[p] * L->values[q];
+					++p;
+					++q;
+				}
+			}
+
+			L->values[k] = sum / L->values[diag_pos[col]];
+		}
+
+		/* Diagonal entry */
+		diag_pos[i] = L->row_ptr[i + 1] - 1;
+		sum = L->values[diag_pos[i]];
+
+		for (k = L->row_ptr[i]; k < diag_pos[i]; k++)
+			sum -= L->values[k] * L->values[k];
+
+		if (sum <= 0.0) {
+			free_tracked(diag_pos);
+			SparseMatrix_delete(L);
+			return NULL;
+		}
+
+		L->values[diag_pos[i]] = sqrt(sum);
+	}
+
+	free_tracked(diag_pos);
+
+	return L;
+}
+
+static int preconditioner_setup(struct Preconditioner *M, const struct LinearOperator *op, const struct PCGOptions *options)
+{
+	const struct SparseMatrix *A = op->matrix;
+	size_t i;
+
+	M->type = options->preconditioner;
+	M->A = A;
+	M->n = op->n;
+	M->diag = NULL;
+	M->L = NULL;
+	M->mg = NULL;
+	M->omega = options->omega;
+
+	/* Only Jacobi can be built from a matrix-free operator */
+	if (A == NULL && M->type != PCG_PRECONDITIONER_JACOBI && M->type != PCG_PRECONDITIONER_NONE)
+		return -1;
+
+	switch (M->type) {
+		case PCG_PRECONDITIONER_JACOBI:
+		case PCG_PRECONDITIONER_SSOR:
+			if (M->type == PCG_PRECONDITIONER_SSOR && (M->omega <= 0.0 || M->omega >= 2.0))
+				return -1;
+
+			M->diag = malloc_or_fail(op->n, sizeof *(M->diag));
+			LinearOperator_diagonal(op, M->diag);
+
+			for (i = 0; i < op->n; i++) {
+				if (M->diag[i] <= 0.0) {
+					free_tracked(M->diag);
+					return -1;
+				}
+			}
+
+			break;
+
+		case PCG_PRECONDITIONER_IC0:
+			M->L = incomplete_cholesky(A);
+
+			if (M->L == NULL)
+				return -1;
+
+			break;
+
+		case PCG_PRECONDITIONER_MULTIGRID:
+			M->mg = multigrid_setup(A, options->multigrid);
+
+			if (M->mg == NULL)
+				return -1;
+
+			break;
+
+		case PCG_PRECONDITIONER_NONE:
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+static void preconditioner_destroy(struct Preconditioner *M)
+{
+	if (M->diag != NULL)
+		free_tracked(M->diag);
+
+	if (M->L != NULL)
+		SparseMatrix_delete(M->L);
+
+	if (M->mg != NULL)
+		multigrid_delete(M->mg);
+}
+
+/* z = M^-1 r */
+static void preconditioner_apply(const struct Preconditioner *M, double *z, const double *r)
+{
+	const struct SparseMatrix *A = M->A;
+	const struct SparseMatrix *L = M->L;
+	size_t n = M->n;
+	size_t i, k, t;
+	double sum;
+
+	switch (M->type) {
+		case PCG_PRECONDITIONER_JACOBI:
+			for (i = 0; i < n; i++)
+				z[i] = r[i] / M->diag[i];
+
+			break;
+
+		case PCG_PRECONDITIONER_SSOR:
+			/* M = w/(2-w) (D/w + L) (D/w)^-1 (D/w + U).
+			 * Forward sweep solves (D/w + L)y = r. */
+			for (i = 0; i < n; i++) {
+				sum = r[i];
+
+				for (k = A->row_ptr[i]; k < A->row_ptr[i + 1] && A->col_idx[k] < i; k++)
+					sum -= A->values[k] * z[A->col_idx[k]];
+
+				z[i] = sum * M->omega / M->diag[i];
+			}
+
+			/* Scale by (2-w)/w (D/w), then backward sweep solves (D/w + U)z = y. */
+			for (i = 0; i < n; i++)
+				z[i] *= (2.0 - M->omega) * M->diag[i] / (M->omega * M->omega);
+
+			for (t = 0; t < n; t++) {
+				i = n - t - 1;
+				sum = z[i];
+
+				for (k = A->row_ptr[i + 1]; k > A->row_ptr[i] && A->col_idx[k - 1] > i; k--)
+					sum -= A->values[k - 1] * z[A->col_idx[k - 1]];
+
+				z[i] = sum * M->omega / M->diag[i];
+			}
+
+			break;
+
+		case PCG_PRECONDITIONER_IC0:
+			/* Forward elimination with L */
+			for (i = 0; i < n; i++) {
+				sum = r[i];
+
+				for (k = L->row_ptr[i]; k < L->row_ptr[i + 1] - 1; k++)
+					sum -= L->values[k] * z[L->col_idx[k]];
+
+				z[i] = sum / L->values[L->row_ptr[i + 1] - 1];
+			}
+
+			/* Back substitution with L^T, done column by column of L^T */
+			for (t = 0; t < n; t++) {
+				i = n - t - 1;
+				z[i] /= L->values[L->row_ptr[i + 1] - 1];
+
+				for (k = L->row_ptr[i]; k < L->row_ptr[i + 1] - 1; k++)
+					z[L->col_idx[k]] -= L->values[k] * z[i];
+			}
+
+			break;
+
+		case PCG_PRECONDITIONER_MULTIGRID:
+			multigrid_precondition(M->mg, z, r);
+			break;
+
+		case PCG_PRECONDITIONER_NONE:
+		default:
+			for (i = 0; i < n; i++)
+				z[i] = r[i];
+
+			break;
+	}
+}
+
+void pcg_default_options(struct PCGOptions *options)
+{
+	options->preconditioner = PCG_PRECONDITIONER_IC0;
+	options->tolerance = PCG_DEFAULT_TOLERANCE;
+	options->max_iterations = 0;
+	options->omega = PCG_DEFAULT_OMEGA;
+	options->multigrid = NULL;
+}
+
+/* See pcg.h header for documentation */
+int pcg_solve_system(struct Vector **xp, const struct SparseMatrix *A, const struct Vector *b, const struct PCGOptions *options, struct PCGStats *stats)
+{
+	struct LinearOperator op;
+
+	LinearOperator_from_sparse(&op, A);
+
+	return pcg_solve_operator(xp, &op, b, options, stats);
+}
+
+/* See pcg.h header for documentation */
+int pcg_solve_operator(struct Vector **xp, const struct LinearOperator *A, const struct Vector *b, const struct PCGOptions *options, struct PCGStats *stats)
+{
+	struct PCGOptions defaults;
+	struct Preconditioner M;
+	struct Vector *x;
+	double *r, *z, *p, *q;
+	double bnorm, rnorm, rz, rz_old, pq, alpha, beta;
+	unsigned int iterations, max_iterations;
+	size_t n, i;
+	int result;
+	double start, setup_end;
+
+	if (b->n != A->n)
+		exit_with_error("Matrix A and vector b not compatible for the system of equations.");
+
+	if (options == NULL) {
+		pcg_default_options(&defaults);
+		options = &defaults;
+	}
+
+	n = A->n;
+	max_iterations = options->max_iterations;
+
+	if (max_iterations == 0)
+		max_iterations = (n < 100) ? 1000 : 10 * (unsigned int)n;
+
+	perf_begin("pcg_setup");
+	start = timer_now();
+
+	if (preconditioner_setup(&M, A, options) != 0) {
+		perf_end("pcg_setup");
+		return -1;
+	}
+
+	setup_end = timer_now();
+	perf_end("pcg_setup");
+	perf_begin("pcg_iterations");
+
+	x = Vector_new(n);
+	r = malloc_or_fail(n, sizeof *r);
+	z = malloc_or_fail(n, sizeof *z);
+	p = malloc_or_fail(n, sizeof *p);
+	q = malloc_or_fail(n, sizeof *q);
+
+	/* x = 0, so r = b */
+	for (i = 0; i < n; i++) {
+		x->entries[i] = 0.0;
+		r[i] = b->entries[i];
+	}
+
+	bnorm = sqrt(dot(b->entries, b->entries, n));
+	rnorm = bnorm;
+	iterations = 0;
+	result = 0;
+
+	if (bnorm > 0.0) {
+		preconditioner_apply(&M, z, r);
+
+		for (i = 0; i < n; i++)
+			p[i] = z[i];
+
+		rz = dot(r, z, n);
+
+		while (rnorm > options->tolerance * bnorm) {
+			if (iterations >= max_iterations) {
+				result = -1;
+				break;
+			}
+
+			LinearOperator_multiply(A, p, q);
+			pq = dot(p, q, n);
+
+			/* p^T A p <= 0 means A is not positive-definite */
+			if (pq <= 0.0) {
+				result = -1;
+				break;
+			}
+
+			alpha = rz / pq;
+
+			for (i = 0; i < n; i++) {
+				x->entries[i] += alpha * p[i];
+				r[i] -= alpha * q[i];
+			}
+
+			rnorm = sqrt(dot(r, r, n));
+			++iterations;
+
+			preconditioner_apply(&M, z, r);
+			rz_old = rz;
+			rz = dot(r, z, n);
+			beta = rz / rz_old;
+
+			for (i = 0; i < n; i++)
+				p[i] = z[i] + beta * p[i];
+		}
+
+		/* Report the true residual rather than the recursively updated one. */
+		rnorm = LinearOperator_residual(A, x->entries, b->entries, r);
+	}
+
+	/* Products with A and vector updates, not counting the preconditioner */
+	perf_count("pcg_iterations", iterations);
+	perf_count("flops", iterations * (((A->matrix != NULL) ? 2.0 * A->matrix->nnz : 9.0 * n) + 10.0 * n));
+	perf_end("pcg_iterations");
+
+	if (stats != NULL) {
+		stats->iterations = iterations;
+		stats->residual_norm = rnorm;
+		stats->relative_residual = (bnorm > 0.0) ? rnorm / bnorm : 0.0;
+		stats->converged = (result == 0);
+		stats->setup_time = setup_end - start;
+		stats->solve_time = timer_now() - setup_end;
+	}
+
+	free_tracked(q);
+	free_tracked(p);
+	free_tracked(z);
+	free_tracked(r);
+	preconditioner_destroy(&M);
+
+	if (result != 0) {
+		Vector_delete(x);
+		return -1;
+	}
+
+	*xp = x;
+
+	return 0;
+}
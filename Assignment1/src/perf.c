@@ -0,0 +1,334 @@
+/* The lock and the frame stack of each thread are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "perf.h"
+#include "timer.h"
+#include "utils.h"
+
+struct PerfStage {
+	const char *name;
+	unsigned long calls;
+	double seconds;		/* Inclusive of nested stages */
+	double self_seconds;	/* Exclusive of nested stages */
+	size_t bytes;		/* Allocated with malloc_or_fail, inclusive */
+};
+
+struct PerfCounter {
+	const char *name;
+	double value;
+};
+
+/* An open stage */
+struct PerfFrame {
+	size_t stage;
+	double start;
+	double nested;		/* Time spent in stages opened inside this one */
+	size_t bytes;		/* malloc_thread_allocated_bytes() at the start */
+};
+
+/* The open stages of one thread */
+struct PerfThread {
+	struct PerfFrame frames[PERF_MAX_DEPTH];
+	size_t depth;
+};
+
+/* Stages and counters are shared by the threads and updated under the
+ * lock; each thread nests its stages on a stack of its own. */
+static struct PerfStage stages[PERF_MAX_STAGES];
+static struct PerfCounter counters[PERF_MAX_COUNTERS];
+static size_t nstages = 0;
+static size_t ncounters = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+
+/* Set before any thread starts and only read afterwards */
+static int enabled = 0;
+static double program_start;
+static const char *program_name = "";
+static const char *report_path = NULL;
+static const char *memory_path = NULL;
+
+/* Names are usually the same literal, so compare the pointers first. */
+static int same_name(const char *a, const char *b)
+{
+	return a == b || strcmp(a, b) == 0;
+}
+
+/* Stack of the calling thread, created on its first stage. */
+static struct PerfThread *this_thread(void)
+{
+	struct PerfThread *thread;
+
+	thread = pthread_getspecific(thread_key);
+
+	if (thread == NULL) {
+		thread = calloc(1, sizeof *thread);
+
+		if (thread == NULL || pthread_setspecific(thread_key, thread) != 0)
+			exit_with_error("Cannot record the performance stages of a thread.");
+	}
+
+	return thread;
+}
+
+/* Index of the stage called name, added if new. Called with the lock held. */
+static size_t find_stage(const char *name)
+{
+	size_t k;
+
+	for (k = 0; k < nstages; k++) {
+		if (same_name(stages[k].name, name))
+			return k;
+	}
+
+	if (nstages == PERF_MAX_STAGES)
+		exit_with_error("Too many performance stages.");
+
+	stages[nstages].name = name;
+	stages[nstages].calls = 0;
+	stages[nstages].seconds = 0.0;
+	stages[nstages].self_seconds = 0.0;
+	stages[nstages].bytes = 0;
+
+	return nstages++;
+}
+
+static void write_report(void)
+{
+	struct PerfThread *thread = this_thread();
+	FILE *filePtr;
+
+	/* Stages the exiting thread left open are closed now */
+	while (thread->depth > 0)
+		perf_end(stages[thread->frames[thread->depth - 1].stage].name);
+
+	if (report_path == NULL) {
+		perf_write_json(stderr);
+	} else if (strcmp(report_path, "-") == 0) {
+		perf_write_json(stdout);
+	} else {
+		filePtr = fopen(report_path, "w");
+
+		if (filePtr == NULL) {
+			perror(report_path);
+			return;
+		}
+
+		perf_write_json(filePtr);
+		fclose(filePtr);
+	}
+}
+
+static void write_memory_report(void)
+{
+	FILE *filePtr;
+
+	if (memory_path == NULL) {
+		malloc_accounting_report(stderr);
+	} else if (strcmp(memory_path, "-") == 0) {
+		malloc_accounting_report(stdout);
+	} else {
+		filePtr = fopen(memory_path, "w");
+
+		if (filePtr == NULL) {
+			perror(memory_path);
+			return;
+		}
+
+		malloc_accounting_report(filePtr);
+		fclose(filePtr);
+	}
+}
+
+/* See perf.h header for documentation */
+void perf_parse_args(int *argc, const char *argv[])
+{
+	int i, j, memory;
+
+	for (i = 1; i < *argc; i++) {
+		memory = 0;
+
+		if (strcmp(argv[i], "--perf-json") == 0) {
+			report_path = NULL;
+		} else if (strncmp(argv[i], "--perf-json=", 12) == 0) {
+			report_path = argv[i] + 12;
+		} else if (strcmp(argv[i], "--mem-report") == 0) {
+			memory_path = NULL;
+			memory = 1;
+		} else if (strncmp(argv[i], "--mem-report=", 13) == 0) {
+			memory_path = argv[i] + 13;
+			memory = 1;
+		} else {
+			continue;
+		}
+
+		for (j = i; j + 1 < *argc; j++)
+			argv[j] = argv[j + 1];
+
+		argv[--(*argc)] = NULL;
+		--i;
+
+		if (memory) {
+			if (!malloc_accounting_enabled()) {
+				malloc_accounting_enable();
+				atexit(write_memory_report);
+			}
+		} else if (!enabled) {
+			if (pthread_key_create(&thread_key, free) != 0)
+				exit_with_error("Cannot record the performance stages of each thread.");
+
+			enabled = 1;
+			malloc_counting_enable();
+			program_name = argv[0];
+			program_start = timer_now();
+			atexit(write_report);
+		}
+	}
+}
+
+int perf_enabled(void)
+{
+	return enabled;
+}
+
+void perf_begin(const char *stage)
+{
+	struct PerfThread *thread;
+	struct PerfFrame *frame;
+
+	if (!enabled)
+		return;
+
+	thread = this_thread();
+
+	if (thread->depth == PERF_MAX_DEPTH)
+		exit_with_error("Performance stages nested too deeply.");
+
+	frame = &thread->frames[thread->depth++];
+	pthread_mutex_lock(&lock);
+	frame->stage = find_stage(stage);
+	pthread_mutex_unlock(&lock);
+	frame->nested = 0.0;
+	frame->bytes = malloc_thread_allocated_bytes();
+	frame->start = timer_now();
+}
+
+void perf_end(const char *stage)
+{
+	struct PerfThread *thread;
+	struct PerfFrame *frame;
+	struct PerfStage *s;
+	double elapsed;
+
+	if (!enabled)
+		return;
+
+	elapsed = timer_now();
+	thread = this_thread();
+	pthread_mutex_lock(&lock);
+
+	if (thread->depth == 0 || !same_name(stages[thread->frames[thread->depth - 1].stage].name, stage))
+		exit_with_error("perf_end does not match the innermost perf_begin.");
+
+	frame = &thread->frames[--thread->depth];
+	elapsed -= frame->start;
+	s = &stages[frame->stage];
+
+	++s->calls;
+	s->seconds += elapsed;
+	s->self_seconds += elapsed - frame->nested;
+	s->bytes += malloc_thread_allocated_bytes() - frame->bytes;
+	pthread_mutex_unlock(&lock);
+
+	if (thread->depth > 0)
+		thread->frames[thread->depth - 1].nested += elapsed;
+}
+
+void perf_count(const char *counter, double amount)
+{
+	size_t k;
+
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	for (k = 0; k < ncounters; k++) {
+		if (same_name(counters[k].name, counter)) {
+			counters[k].value += amount;
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+	}
+
+	if (ncounters == PERF_MAX_COUNTERS)
+		exit_with_error("Too many performance counters.");
+
+	counters[ncounters].name = counter;
+	counters[ncounters].value = amount;
+	++ncounters;
+	pthread_mutex_unlock(&lock);
+}
+
+/* Names are program identifiers or literals, but escape them anyway. */
+static void write_string(FILE *filePtr, const char *s)
+{
+	fputc('"', filePtr);
+
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', filePtr);
+
+		if ((unsigned char)*s >= 0x20)
+			fputc(*s, filePtr);
+	}
+
+	fputc('"', filePtr);
+}
+
+/* See perf.h header for documentation */
+int perf_write_json(FILE *filePtr)
+{
+	struct MallocStats memory;
+	size_t k;
+
+	pthread_mutex_lock(&lock);
+	fprintf(filePtr, "{\n\t\"program\": ");
+	write_string(filePtr, program_name);
+	fprintf(filePtr, ",\n\t\"wall_seconds\": %.9f,\n", enabled ? timer_now() - program_start : 0.0);
+	fprintf(filePtr, "\t\"bytes_allocated\": %lu,\n", (unsigned long)malloc_allocated_bytes());
+
+	if (malloc_accounting_enabled()) {
+		malloc_accounting_stats(&memory);
+		fprintf(filePtr, "\t\"peak_bytes\": %lu,\n\t\"live_bytes\": %lu,\n",
+				(unsigned long)memory.peak_bytes, (unsigned long)memory.live_bytes);
+	}
+
+	fprintf(filePtr, "\t\"stages\": [");
+
+	for (k = 0; k < nstages; k++) {
+		fprintf(filePtr, "%s\n\t\t{\"name\": ", (k == 0) ? "" : ",");
+		write_string(filePtr, stages[k].name);
+		fprintf(filePtr, ", \"calls\": %lu, \"seconds\": %.9f, \"self_seconds\": %.9f, \"bytes_allocated\": %lu}",
+				stages[k].calls, stages[k].seconds, stages[k].self_seconds, (unsigned long)stages[k].bytes);
+	}
+
+	fprintf(filePtr, "%s],\n\t\"counters\": {", (nstages > 0) ? "\n\t" : "");
+
+	for (k = 0; k < ncounters; k++) {
+		fprintf(filePtr, "%s\n\t\t", (k == 0) ? "" : ",");
+		write_string(filePtr, counters[k].name);
+		fprintf(filePtr, ": %.17g", counters[k].value);
+	}
+
+	fprintf(filePtr, "%s}\n}\n", (ncounters > 0) ? "\n\t" : "");
+	pthread_mutex_unlock(&lock);
+
+	return ferror(filePtr) ? -1 : 0;
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "cholesky.h"
+#include "circuits.h"
+#include "perf.h"
+#include "resistance.h"
+#include "sparse.h"
+#include "utils.h"
+
+/* Forward elimination for up to RESISTANCE_BATCH right-hand sides at once.
+ *
+ * Column c of the right-hand side is e_a[c] - e_b[c] (ground terms dropped),
+ * stored interleaved in y (y[i * count + c]). The elimination starts at the
+ * first row with a nonzero, since everything before it stays zero. On return
+ * sq[c] holds ||L^-1 (e_a[c] - e_b[c])||^2 and dots[c] the dot product of the
+ * first two solution columns when dots is not NULL.
+ */
+static void forward_batch(const struct BandMatrix *L, size_t count, const size_t *a, const size_t *b, double *sq, double *dot)
+{
+	size_t n = L->n;
+	size_t hb = L->hb;
+	size_t start, first, i, k, c;
+	double *y;
+	const double *Li;
+	double l;
+
+	start = n;
+
+	for (c = 0; c < count; c++) {
+		sq[c] = 0.0;
+
+		if (a[c] > 0 && a[c] - 1 < start)
+			start = a[c] - 1;
+
+		if (b[c] > 0 && b[c] - 1 < start)
+			start = b[c] - 1;
+	}
+
+	if (dot != NULL)
+		*dot = 0.0;
+
+	if (start == n)
+		return;
+
+	y = malloc_or_fail((n - start) * count, sizeof *y);
+
+	for (i = 0; i < (n - start) * count; i++)
+		y[i] = 0.0;
+
+	/* y is indexed from row 'start' */
+	for (c = 0; c < count; c++) {
+		if (a[c] > 0)
+			y[(a[c] - 1 - start) * count + c] += 1.0;
+
+		if (b[c] > 0)
+			y[(b[c] - 1 - start) * count + c] -= 1.0;
+	}
+
+	for (i = start; i < n; i++) {
+		first = (i + 1 > hb) ? i + 1 - hb : 0;
+
+		if (first < start)
+			first = start;
+
+		Li = &BAND_ENTRY(L, i, i) - i;
+
+		for (k = first; k < i; k++) {
+			l = Li[k];
+
+			for (c = 0; c < count; c++)
+				y[(i - start) * count + c] -= l * y[(k - start) * count + c];
+		}
+
+		for (c = 0; c < count; c++) {
+			y[(i - start) * count + c] /= Li[i];
+			sq[c] += y[(i - start) * count + c] * y[(i - start) * count + c];
+		}
+
+		if (dot != NULL)
+			*dot += y[(i - start) * count] * y[(i - start) * count + 1];
+	}
+
+	free_tracked(y);
+}
+
+int resistance_solver_create_from_matrix(struct ResistanceSolver *rs, const struct SparseMatrix *G)
+{
+	if (G->m != G->n)
+		exit_with_error("Conductance matrix must be square.");
+
+	rs->L = SparseMatrix_to_band(G, SparseMatrix_half_bandwidth(G));
+	rs->nnodes = G->n;
+
+	if (cholesky_factor_band(rs->L) != 0) {
+		BandMatrix_delete(rs->L);
+		return -1;
+	}
+
+	return 0;
+}
+
+int resistance_solver_create(struct ResistanceSolver *rs, const struct CircuitDescription *circuit)
+{
+	struct SparseMatrix *G;
+	int result;
+
+	if (circuits_build_passive_sparse(circuit, &G) != 0)
+		return -1;
+
+	result = resistance_solver_create_from_matrix(rs, G);
+	SparseMatrix_delete(G);
+
+	return result;
+}
+
+void resistance_solver_destroy(struct ResistanceSolver *rs)
+{
+	BandMatrix_delete(rs->L);
+}
+
+double resistance_between(const struct ResistanceSolver *rs, size_t a, size_t b)
+{
+	double R;
+
+	resistance_between_batch(rs, 1, &a, &b, &R);
+
+	return R;
+}
+
+void resistance_between_batch(const struct ResistanceSolver *rs, size_t count, const size_t *a, const size_t *b, double *R)
+{
+	size_t k, c, batch;
+
+	for (k = 0; k < count; k++) {
+		if (a[k] > rs->nnodes || b[k] > rs->nnodes)
+			exit_with_error("Node index out of range for resistance query.");
+	}
+
+	perf_begin("query");
+
+	for (k = 0; k < count; k += batch) {
+		batch = (count - k < RESISTANCE_BATCH) ? count - k : RESISTANCE_BATCH;
+		forward_batch(rs->L, batch, a + k, b + k, R + k, NULL);
+
+		for (c = 0; c < batch; c++) {
+			if (a[k + c] == b[k + c])
+				R[k + c] = 0.0;
+		}
+	}
+
+	perf_count("queries", count);
+	perf_end("query");
+}
+
+double resistance_inverse_entry(const struct ResistanceSolver *rs, size_t i, size_t j)
+{
+	size_t nodes[2], ground[2];
+	double sq[2];
+	double dot;
+
+	if (i > rs->nnodes || j > rs->nnodes)
+		exit_with_error("Node index out of range for inverse entry.");
+
+	if (i == 0 || j == 0)
+		return 0.0;
+
+	/* (G^-1)_ij = (L^-1 e_i) . (L^-1 e_j) */
+	nodes[0] = i;
+	nodes[1] = j;
+	ground[0] = ground[1] = 0;
+	forward_batch(rs->L, 2, nodes, ground, sq, &dot);
+
+	return dot;
+}
+
+/* See resistance.h header for documentation */
+struct BandMatrix *resistance_selected_inverse(const struct ResistanceSolver *rs)
+{
+	const struct BandMatrix *L = rs->L;
+	struct BandMatrix *Z;
+	size_t n = L->n;
+	size_t hb = L->hb;
+	size_t i, j, k, t, s, last;
+	double sum, Lii;
+
+	Z = BandMatrix_zero(n, hb);
+
+	/* From L^T Z = L^-1, for j >= i:
+	 * Z_ij = (delta_ij / L_ii - sum_{k > i} L_ki Z_kj) / L_ii.
+	 * Rows are done from the last one up, and within a row the
+	 * diagonal last, so every Z_kj needed is already known. */
+	for (t = 0; t < n; t++) {
+		i = n - t - 1;
+		Lii = BAND_ENTRY(L, i, i);
+		last = (i + hb - 1 < n - 1) ? i + hb - 1 : n - 1;
+
+		for (s = 0; s <= last - i; s++) {
+			j = last - s;
+			sum = (j == i) ? 1.0 / Lii : 0.0;
+
+			for (k = i + 1; k <= last; k++) {
+				if (k >= j)
+					sum -= BAND_ENTRY(L, k, i) * BAND_ENTRY(Z, k, j);
+				else
+					sum -= BAND_ENTRY(L, k, i) * BAND_ENTRY(Z, j, k);
+			}
+
+			BAND_ENTRY(Z, j, i) = sum / Lii;
+		}
+	}
+
+	return Z;
+}
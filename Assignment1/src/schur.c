@@ -0,0 +1,607 @@
+/* Threads and sysconf are POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cholesky.h"
+#include "perf.h"
+#include "schur.h"
+#include "sparse.h"
+#include "timer.h"
+#include "utils.h"
+
+#define SCHUR_NONE	((size_t)(-1))
+
+enum SchurPhase {
+	SCHUR_FACTOR = 0,	/* Factor A_i and form Y_i^T Y_i */
+	SCHUR_INTERIOR		/* work = A_i^-1 work */
+};
+
+struct SchurTask {
+	struct SchurSubdomain *subdomain;
+	enum SchurPhase phase;
+};
+
+/* PROTOTYPES */
+static size_t breadth_first(const struct SparseMatrix *A, size_t start, size_t *order, size_t *position, size_t count);
+static void graph_order(const struct SparseMatrix *A, size_t *order);
+static void subdomain_factor(struct SchurSubdomain *sub);
+static void subdomain_interior(struct SchurSubdomain *sub);
+static void *subdomain_thread(void *arg);
+static void run_subdomains(const struct SchurSolver *solver, enum SchurPhase phase);
+static void build_subdomain(struct SchurSubdomain *sub, const struct SparseMatrix *A, const size_t *local, const size_t *iface_index, size_t *iface_local);
+static void subdomain_setup_done(struct SchurSubdomain *sub);
+/* END PROTOTYPES */
+
+void schur_default_options(struct SchurOptions *options)
+{
+	options->subdomains = 0;
+}
+
+/* Breadth first search from start over the nodes not yet in order, which
+ * are appended from order[count]. Returns the new count. */
+static size_t breadth_first(const struct SparseMatrix *A, size_t start, size_t *order, size_t *position, size_t count)
+{
+	size_t head, i, k;
+
+	order[count] = start;
+	position[start] = count++;
+
+	for (head = count - 1; head < count; head++) {
+		i = order[head];
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			if (position[A->col_idx[k]] == SCHUR_NONE) {
+				position[A->col_idx[k]] = count;
+				order[count++] = A->col_idx[k];
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Breadth first order of every component, each started from the last node
+ * reached from its first node, which is at or near the end of the graph. */
+static void graph_order(const struct SparseMatrix *A, size_t *order)
+{
+	size_t *position;
+	size_t i, k, first, count;
+
+	position = malloc_or_fail(A->n, sizeof *position);
+
+	for (i = 0; i < A->n; i++)
+		position[i] = SCHUR_NONE;
+
+	count = 0;
+
+	for (i = 0; i < A->n; i++) {
+		if (position[i] != SCHUR_NONE)
+			continue;
+
+		/* First pass to find a peripheral node, then start again from it */
+		first = count;
+		count = breadth_first(A, i, order, position, first);
+
+		for (k = first; k < count; k++)
+			position[order[k]] = SCHUR_NONE;
+
+		count = breadth_first(A, order[count - 1], order, position, first);
+	}
+
+	free_tracked(position);
+}
+
+/* Factor A_i and form Y_i = L_i^-1 A_iI and Y_i^T Y_i. Runs on a worker thread. */
+static void subdomain_factor(struct SchurSubdomain *sub)
+{
+	const struct SparseMatrix *C = sub->coupling;
+	size_t *start = sub->first;
+	double *y, *z, sum;
+	size_t c, d, k, first;
+
+	sub->status = cholesky_factor_band_rows(sub->rows, 0, sub->L->hb, 0, sub->n);
+
+	if (sub->status != 0 || C == NULL)
+		return;
+
+	for (c = 0; c < sub->ninterface; c++) {
+		y = &sub->Y[c * sub->n];
+
+		for (k = 0; k < sub->n; k++)
+			y[k] = 0.0;
+
+		/* Row c of the coupling is column c of A_iI */
+		for (k = C->row_ptr[c]; k < C->row_ptr[c + 1]; k++)
+			y[C->col_idx[k]] = C->values[k];
+
+		/* Forward elimination can start at the first nonzero */
+		first = (C->row_ptr[c] < C->row_ptr[c + 1]) ? C->col_idx[C->row_ptr[c]] : sub->n;
+		cholesky_forward_band_rows((const double *const *)sub->rows, 0, sub->L->hb, first, sub->n, y);
+		start[c] = first;
+	}
+
+	for (c = 0; c < sub->ninterface; c++) {
+		y = &sub->Y[c * sub->n];
+
+		for (d = 0; d <= c; d++) {
+			z = &sub->Y[d * sub->n];
+			sum = 0.0;
+
+			for (k = (start[c] > start[d]) ? start[c] : start[d]; k < sub->n; k++)
+				sum += y[k] * z[k];
+
+			sub->schur[c * sub->ninterface + d] = sum;
+			sub->schur[d * sub->ninterface + c] = sum;
+		}
+	}
+}
+
+/* work = A_i^-1 work. Runs on a worker thread. */
+static void subdomain_interior(struct SchurSubdomain *sub)
+{
+	cholesky_forward_band_rows((const double *const *)sub->rows, 0, sub->L->hb, 0, sub->n, sub->work);
+	cholesky_backward_band_rows((const double *const *)sub->rows, 0, sub->L->hb, 0, sub->n, sub->work);
+}
+
+static void *subdomain_thread(void *arg)
+{
+	struct SchurTask *task = arg;
+
+	if (task->phase == SCHUR_FACTOR)
+		subdomain_factor(task->subdomain);
+	else
+		subdomain_interior(task->subdomain);
+
+	return NULL;
+}
+
+/* Run a phase on every subdomain, one thread each. A subdomain whose
+ * thread cannot be started is done on the calling thread. */
+static void run_subdomains(const struct SchurSolver *solver, enum SchurPhase phase)
+{
+	struct SchurTask *tasks;
+	pthread_t *threads;
+	int *started;
+	size_t s;
+
+	tasks = malloc_or_fail(solver->nsubdomains, sizeof *tasks);
+	threads = malloc_or_fail(solver->nsubdomains, sizeof *threads);
+	started = malloc_or_fail(solver->nsubdomains, sizeof *started);
+
+	for (s = 0; s < solver->nsubdomains; s++) {
+		tasks[s].subdomain = &solver->subdomains[s];
+		tasks[s].phase = phase;
+		started[s] = (pthread_create(&threads[s], NULL, subdomain_thread, &tasks[s]) == 0);
+	}
+
+	for (s = 0; s < solver->nsubdomains; s++) {
+		if (started[s])
+			pthread_join(threads[s], NULL);
+		else
+			subdomain_thread(&tasks[s]);
+	}
+
+	free_tracked(started);
+	free_tracked(threads);
+	free_tracked(tasks);
+}
+
+/* Build the interior matrix, its band and the coupling of one subdomain.
+ * local[i] is the local index of interior node i, iface_index[i] the
+ * position of interface node i; iface_local is scratch of the interface
+ * size, all SCHUR_NONE on entry and on return. */
+static void build_subdomain(struct SchurSubdomain *sub, const struct SparseMatrix *A, const size_t *local, const size_t *iface_index, size_t *iface_local)
+{
+	struct SparseMatrix *Ai;
+	size_t *rows, *cols;
+	double *values;
+	size_t nnz, ncoupling, r, k, i, j, hb;
+
+	/* Count the entries of A_i and A_iI */
+	nnz = 0;
+	ncoupling = 0;
+	sub->ninterface = 0;
+
+	for (r = 0; r < sub->n; r++) {
+		i = sub->nodes[r];
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			j = A->col_idx[k];
+
+			if (local[j] != SCHUR_NONE) {
+				++nnz;
+			} else {
+				++ncoupling;
+
+				if (iface_local[iface_index[j]] == SCHUR_NONE)
+					iface_local[iface_index[j]] = sub->ninterface++;
+			}
+		}
+	}
+
+	sub->interface = malloc_or_fail(sub->ninterface > 0 ? sub->ninterface : 1, sizeof *(sub->interface));
+	rows = malloc_or_fail(nnz + ncoupling, sizeof *rows);
+	cols = malloc_or_fail(nnz + ncoupling, sizeof *cols);
+	values = malloc_or_fail(nnz + ncoupling, sizeof *values);
+
+	/* A_i in local numbering */
+	nnz = 0;
+
+	for (r = 0; r < sub->n; r++) {
+		i = sub->nodes[r];
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			if (local[A->col_idx[k]] != SCHUR_NONE) {
+				rows[nnz] = r;
+				cols[nnz] = local[A->col_idx[k]];
+				values[nnz++] = A->values[k];
+			}
+		}
+	}
+
+	Ai = SparseMatrix_from_triplets(sub->n, sub->n, nnz, rows, cols, values);
+	hb = SparseMatrix_half_bandwidth(Ai);
+	sub->L = SparseMatrix_to_band(Ai, hb);
+	SparseMatrix_delete(Ai);
+
+	sub->rows = malloc_or_fail(sub->n, sizeof *(sub->rows));
+
+	for (r = 0; r < sub->n; r++)
+		sub->rows[r] = &sub->L->entries[r * sub->L->hb];
+
+	/* A_Ii, the transpose of the coupling, so its rows are the columns of A_iI */
+	ncoupling = 0;
+
+	for (r = 0; r < sub->n; r++) {
+		i = sub->nodes[r];
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			j = A->col_idx[k];
+
+			if (local[j] == SCHUR_NONE) {
+				rows[ncoupling] = iface_local[iface_index[j]];
+				cols[ncoupling] = r;
+				values[ncoupling++] = A->values[k];
+				sub->interface[iface_local[iface_index[j]]] = iface_index[j];
+			}
+		}
+	}
+
+	sub->coupling = NULL;
+	sub->Y = NULL;
+	sub->first = NULL;
+	sub->schur = NULL;
+
+	if (sub->ninterface > 0) {
+		sub->coupling = SparseMatrix_from_triplets(sub->ninterface, sub->n, ncoupling, rows, cols, values);
+		sub->Y = malloc_or_fail(sub->n * sub->ninterface, sizeof *(sub->Y));
+		sub->first = malloc_or_fail(sub->ninterface, sizeof *(sub->first));
+		sub->schur = malloc_or_fail(sub->ninterface * sub->ninterface, sizeof *(sub->schur));
+	}
+
+	for (k = 0; k < sub->ninterface; k++)
+		iface_local[sub->interface[k]] = SCHUR_NONE;
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+
+	sub->work = malloc_or_fail(sub->n, sizeof *(sub->work));
+	sub->status = 0;
+}
+
+/* Release the storage only needed while setting up. */
+static void subdomain_setup_done(struct SchurSubdomain *sub)
+{
+	free_tracked(sub->Y);
+	free_tracked(sub->first);
+	free_tracked(sub->schur);
+	sub->Y = NULL;
+	sub->first = NULL;
+	sub->schur = NULL;
+}
+
+/* See schur.h header for documentation */
+struct SchurSolver *schur_setup(const struct SparseMatrix *A, const struct SchurOptions *options)
+{
+	struct SchurSolver *solver;
+	struct SchurSubdomain *sub;
+	size_t *order, *block, *local, *iface_index, *iface_local, *count;
+	size_t n = A->n;
+	size_t nsub, s, p, i, k, c, d;
+	double flops;
+	long cpus;
+	int result;
+
+	if (A->m != A->n || n == 0)
+		exit_with_error("Matrix must be square for the Schur solver.");
+
+	nsub = options->subdomains;
+
+	if (nsub == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nsub = (cpus > 2) ? (size_t)cpus : 2;
+	}
+
+	if (nsub > n / 2)
+		nsub = (n / 2 > 0) ? n / 2 : 1;
+
+	perf_begin("partition");
+
+	order = malloc_or_fail(n, sizeof *order);
+	block = malloc_or_fail(n, sizeof *block);
+	local = malloc_or_fail(n, sizeof *local);
+	iface_index = malloc_or_fail(n, sizeof *iface_index);
+	graph_order(A, order);
+
+	for (p = 0; p < n; p++)
+		block[order[p]] = p * nsub / n;
+
+	solver = malloc_or_fail(1, sizeof *solver);
+	solver->n = n;
+	solver->ninterface = 0;
+	count = malloc_or_fail(nsub, sizeof *count);
+
+	for (s = 0; s < nsub; s++)
+		count[s] = 0;
+
+	/* Interface: nodes with a neighbour in an earlier block */
+	for (i = 0; i < n; i++) {
+		local[i] = 0;
+
+		for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+			if (block[A->col_idx[k]] < block[i]) {
+				local[i] = SCHUR_NONE;
+				break;
+			}
+		}
+
+		if (local[i] == SCHUR_NONE)
+			iface_index[i] = solver->ninterface++;
+		else
+			++count[block[i]];
+	}
+
+	/* A block thinner than a level of the ordering can be all interface.
+	 * Block 0 never is, so there is at least one subdomain. */
+	solver->nsubdomains = 0;
+
+	for (s = 0; s < nsub; s++) {
+		if (count[s] > 0)
+			++solver->nsubdomains;
+	}
+
+	solver->subdomains = malloc_or_fail(solver->nsubdomains, sizeof *(solver->subdomains));
+	solver->interface = malloc_or_fail(solver->ninterface > 0 ? solver->ninterface : 1, sizeof *(solver->interface));
+	d = 0;
+
+	for (s = 0; s < nsub; s++) {
+		if (count[s] == 0)
+			continue;
+
+		solver->subdomains[d].nodes = malloc_or_fail(count[s], sizeof *(solver->subdomains[d].nodes));
+		solver->subdomains[d].n = 0;
+		count[s] = d++;
+	}
+
+	nsub = solver->nsubdomains;
+
+	/* Interiors keep the breadth first order, which keeps their bands narrow */
+	for (p = 0; p < n; p++) {
+		i = order[p];
+
+		if (local[i] == SCHUR_NONE) {
+			solver->interface[iface_index[i]] = i;
+		} else {
+			sub = &solver->subdomains[count[block[i]]];
+			local[i] = sub->n;
+			sub->nodes[sub->n++] = i;
+		}
+	}
+
+	iface_local = order;
+
+	for (k = 0; k < solver->ninterface; k++)
+		iface_local[k] = SCHUR_NONE;
+
+	/* Interior nodes of other subdomains never meet, so one local map serves all */
+	for (s = 0; s < nsub; s++)
+		build_subdomain(&solver->subdomains[s], A, local, iface_index, iface_local);
+
+	perf_end("partition");
+
+	perf_begin("factor");
+	run_subdomains(solver, SCHUR_FACTOR);
+	result = 0;
+	flops = 0.0;
+
+	for (s = 0; s < nsub; s++) {
+		sub = &solver->subdomains[s];
+
+		if (sub->status != 0)
+			result = -1;
+
+		/* Factor, forward eliminations for Y_i, then Y_i^T Y_i */
+		flops += (double)sub->n * sub->L->hb * (sub->L->hb + 2.0 * sub->ninterface) + (double)sub->n * sub->ninterface * sub->ninterface;
+	}
+
+	perf_count("flops", flops);
+	perf_end("factor");
+
+	/* S = A_II - sum of the Y_i^T Y_i */
+	perf_begin("schur");
+	solver->S = NULL;
+	solver->g = malloc_or_fail(solver->ninterface > 0 ? solver->ninterface : 1, sizeof *(solver->g));
+
+	if (result == 0 && solver->ninterface > 0) {
+		solver->S = Matrix_zero(solver->ninterface, solver->ninterface);
+
+		for (c = 0; c < solver->ninterface; c++) {
+			i = solver->interface[c];
+
+			for (k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+				if (local[A->col_idx[k]] == SCHUR_NONE)
+					solver->S->entries[c][iface_index[A->col_idx[k]]] = A->values[k];
+			}
+		}
+
+		for (s = 0; s < nsub; s++) {
+			sub = &solver->subdomains[s];
+
+			for (c = 0; c < sub->ninterface; c++) {
+				for (d = 0; d < sub->ninterface; d++)
+					solver->S->entries[sub->interface[c]][sub->interface[d]] -= sub->schur[c * sub->ninterface + d];
+			}
+		}
+
+		result = cholesky_factor(solver->S, 0);
+	}
+
+	for (s = 0; s < nsub; s++)
+		subdomain_setup_done(&solver->subdomains[s]);
+
+	perf_end("schur");
+
+	free_tracked(count);
+	free_tracked(iface_index);
+	free_tracked(local);
+	free_tracked(block);
+	free_tracked(order);
+
+	if (result != 0) {
+		schur_delete(solver);
+		return NULL;
+	}
+
+	return solver;
+}
+
+void schur_delete(struct SchurSolver *solver)
+{
+	struct SchurSubdomain *sub;
+	size_t s;
+
+	for (s = 0; s < solver->nsubdomains; s++) {
+		sub = &solver->subdomains[s];
+		free_tracked(sub->nodes);
+		free_tracked(sub->interface);
+		BandMatrix_delete(sub->L);
+		free_tracked(sub->rows);
+
+		if (sub->coupling != NULL)
+			SparseMatrix_delete(sub->coupling);
+
+		free_tracked(sub->work);
+		subdomain_setup_done(sub);
+	}
+
+	if (solver->S != NULL)
+		Matrix_delete(solver->S);
+
+	free_tracked(solver->g);
+	free_tracked(solver->interface);
+	free_tracked(solver->subdomains);
+	free_tracked(solver);
+}
+
+/* See schur.h header for documentation */
+void schur_solve(const struct SchurSolver *solver, const double *b, double *x)
+{
+	const struct SparseMatrix *C;
+	struct SchurSubdomain *sub;
+	double *g = solver->g;
+	size_t s, r, c, k;
+
+	perf_begin("solve");
+
+	/* work = A_i^-1 b_i */
+	for (s = 0; s < solver->nsubdomains; s++) {
+		sub = &solver->subdomains[s];
+
+		for (r = 0; r < sub->n; r++)
+			sub->work[r] = b[sub->nodes[r]];
+	}
+
+	run_subdomains(solver, SCHUR_INTERIOR);
+
+	/* g = b_I - sum of A_Ii A_i^-1 b_i */
+	for (c = 0; c < solver->ninterface; c++)
+		g[c] = b[solver->interface[c]];
+
+	for (s = 0; s < solver->nsubdomains; s++) {
+		sub = &solver->subdomains[s];
+		C = sub->coupling;
+
+		for (c = 0; c < sub->ninterface; c++) {
+			for (k = C->row_ptr[c]; k < C->row_ptr[c + 1]; k++)
+				g[sub->interface[c]] -= C->values[k] * sub->work[C->col_idx[k]];
+		}
+	}
+
+	if (solver->S != NULL)
+		cholesky_solve_factored(solver->S, g);
+
+	/* work = A_i^-1 (b_i - A_iI x_I), with b_i read before x is written */
+	for (s = 0; s < solver->nsubdomains; s++) {
+		sub = &solver->subdomains[s];
+		C = sub->coupling;
+
+		for (r = 0; r < sub->n; r++)
+			sub->work[r] = b[sub->nodes[r]];
+
+		for (c = 0; c < sub->ninterface; c++) {
+			for (k = C->row_ptr[c]; k < C->row_ptr[c + 1]; k++)
+				sub->work[C->col_idx[k]] -= C->values[k] * g[sub->interface[c]];
+		}
+	}
+
+	run_subdomains(solver, SCHUR_INTERIOR);
+
+	for (c = 0; c < solver->ninterface; c++)
+		x[solver->interface[c]] = g[c];
+
+	for (s = 0; s < solver->nsubdomains; s++) {
+		sub = &solver->subdomains[s];
+
+		for (r = 0; r < sub->n; r++)
+			x[sub->nodes[r]] = sub->work[r];
+	}
+
+	perf_end("solve");
+}
+
+/* See schur.h header for documentation */
+int schur_solve_system(struct Vector **xp, const struct SparseMatrix *A, const struct Vector *b, const struct SchurOptions *options, struct SchurStats *stats)
+{
+	struct SchurSolver *solver;
+	struct Vector *x;
+	double start, factored;
+
+	start = timer_now();
+	solver = schur_setup(A, options);
+	factored = timer_now();
+
+	if (solver == NULL)
+		return -1;
+
+	x = Vector_new(A->n);
+	schur_solve(solver, b->entries, x->entries);
+
+	if (stats != NULL) {
+		stats->subdomains = solver->nsubdomains;
+		stats->interface = solver->ninterface;
+		stats->setup_time = factored - start;
+		stats->solve_time = timer_now() - factored;
+	}
+
+	schur_delete(solver);
+	*xp = x;
+
+	return 0;
+}
@@ -1,31 +1,59 @@
 #include <stdio.h>
 
 #include "circuits.h"
+#include "perf.h"
 #include "utils.h"
 
 int main(int argc, const char *argv[])
 {
-	struct CircuitDescription circuit;
+	struct BranchList *branches;
+	struct CircuitSolverOptions options;
+	struct CircuitSolverStats stats;
 	struct Vector *V;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+	perf_parse_args(&argc, argv);
+
+	circuits_default_options(&options);
+	options.method = CIRCUIT_SOLVER_DENSE;
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s <filename> [auto|dense|banded|banded-ooc[=MB]|schur[=k]|mg|pcg-none|pcg-jacobi|pcg-ssor|pcg-ic0|pcg-mg]\n", argv[0]);
 		return 0;
 	}
 
-	if (circuits_parse_file(&circuit, argv[1]) != 0) {
+	if (argc == 3 && circuits_parse_method(&options, argv[2]) != 0) {
+		fprintf(stderr, "Unknown solver method '%s'.\n", argv[2]);
+		return -1;
+	}
+
+	if (circuits_read_branches(argv[1], &branches) != 0) {
 		fprintf(stderr, "Failed to parse circuit file.\n");
 		return -1;
 	}
 
-	V = circuits_solve_voltages(&circuit);
+	V = circuits_solve_branches_with(branches, &options, &stats);
+
+	if (V == NULL) {
+		fprintf(stderr, "Failed to solve the circuit with the %s solver.\n", circuits_method_name(options.method));
+		BranchList_delete(branches);
+		return -1;
+	}
 
 	printf("V = ");
 	Vector_print(V);
 	printf("\n");
 
+	/* The default dense solve prints V alone, as it always has */
+	if (argc == 3) {
+		fprintf(stderr, "Solver: %s, %lu nodes, %u iterations, residual %e\n", circuits_method_name(stats.method),
+				(unsigned long)stats.nnodes, stats.iterations, stats.residual_norm);
+
+		if (stats.method == CIRCUIT_SOLVER_SCHUR)
+			fprintf(stderr, "Schur complement over %lu subdomains\n", (unsigned long)stats.subdomains);
+	}
+
 	Vector_delete(V);
-	circuits_destroy(&circuit);
+	BranchList_delete(branches);
 
 	return 0;
 }
@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "sparse.h"
+#include "utils.h"
+
+/* Sort the entries of one row by column index. Rows of circuit matrices
+ * only hold a handful of entries, so insertion sort is enough. */
+static void sort_row(size_t *cols, double *values, size_t count)
+{
+	size_t i, k;
+	size_t col;
+	double value;
+
+	for (i = 1; i < count; i++) {
+		col = cols[i];
+		value = values[i];
+
+		for (k = i; k > 0 && cols[k - 1] > col; k--) {
+			cols[k] = cols[k - 1];
+			values[k] = values[k - 1];
+		}
+
+		cols[k] = col;
+		values[k] = value;
+	}
+}
+
+/* Allocate an m x n matrix with room for nnz entries. */
+static struct SparseMatrix *sparse_alloc(size_t m, size_t n, size_t nnz)
+{
+	struct SparseMatrix *S;
+
+	if (m == 0 || n == 0)
+		exit_with_error("Sparse matrix must have at least one row and column.");
+
+	S = malloc_or_fail(1, sizeof *S);
+	S->row_ptr = malloc_or_fail(m + 1, sizeof *(S->row_ptr));
+	S->col_idx = malloc_or_fail(nnz > 0 ? nnz : 1, sizeof *(S->col_idx));
+	S->values = malloc_or_fail(nnz > 0 ? nnz : 1, sizeof *(S->values));
+	S->m = m;
+	S->n = n;
+	S->nnz = nnz;
+
+	return S;
+}
+
+struct SparseMatrix *SparseMatrix_from_triplets(size_t m, size_t n, size_t nnz, const size_t *rows, const size_t *cols, const double *values)
+{
+	struct SparseMatrix *S;
+	size_t *fill;
+	size_t i, k, start, end, out;
+
+	S = sparse_alloc(m, n, nnz);
+
+	/* Count the entries of each row, then turn the counts into row offsets. */
+	for (i = 0; i <= m; i++)
+		S->row_ptr[i] = 0;
+
+	for (k = 0; k < nnz; k++) {
+		if (rows[k] >= m || cols[k] >= n)
+			exit_with_error("Triplet index out of range for sparse matrix.");
+
+		++S->row_ptr[rows[k] + 1];
+	}
+
+	for (i = 0; i < m; i++)
+		S->row_ptr[i + 1] += S->row_ptr[i];
+
+	fill = malloc_or_fail(m, sizeof *fill);
+
+	for (i = 0; i < m; i++)
+		fill[i] = S->row_ptr[i];
+
+	for (k = 0; k < nnz; k++) {
+		S->col_idx[fill[rows[k]]] = cols[k];
+		S->values[fill[rows[k]]] = values[k];
+		++fill[rows[k]];
+	}
+
+	free_tracked(fill);
+
+	/* Sort each row and merge duplicates, compacting the arrays in place. */
+	out = 0;
+
+	for (i = 0; i < m; i++) {
+		start = S->row_ptr[i];
+		end = S->row_ptr[i + 1];
+		sort_row(S->col_idx + start, S->values + start, end - start);
+		S->row_ptr[i] = out;
+
+		for (k = start; k < end; k++) {
+			if (out > S->row_ptr[i] && S->col_idx[out - 1] == S->col_idx[k]) {
+				S->values[out - 1] += S->values[k];
+			} else {
+				S->col_idx[out] = S->col_idx[k];
+				S->values[out] = S->values[k];
+				++out;
+			}
+		}
+	}
+
+	S->row_ptr[m] = out;
+	S->nnz = out;
+
+	return S;
+}
+
+struct SparseMatrix *SparseMatrix_from_dense(const struct Matrix *M)
+{
+	struct SparseMatrix *S;
+	size_t n, nnz;
+	size_t i, j;
+
+	if (M->m != M->n)
+		exit_with_error("Matrix must be square to convert to sparse format.");
+
+	n = M->n;
+	nnz = 0;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			if (M->entries[i][j] != 0.0)
+				++nnz;
+		}
+	}
+
+	S = sparse_alloc(n, n, nnz);
+	nnz = 0;
+
+	for (i = 0; i < n; i++) {
+		S->row_ptr[i] = nnz;
+
+		for (j = 0; j < n; j++) {
+			if (M->entries[i][j] != 0.0) {
+				S->col_idx[nnz] = j;
+				S->values[nnz] = M->entries[i][j];
+				++nnz;
+			}
+		}
+	}
+
+	S->row_ptr[n] = nnz;
+
+	return S;
+}
+
+void SparseMatrix_delete(struct SparseMatrix *S)
+{
+	free_tracked(S->values);
+	free_tracked(S->col_idx);
+	free_tracked(S->row_ptr);
+	free_tracked(S);
+}
+
+void SparseMatrix_multiply_vector(const struct SparseMatrix *S, const double *x, double *y)
+{
+	size_t i, k;
+	double sum;
+
+	for (i = 0; i < S->m; i++) {
+		sum = 0.0;
+
+		for (k = S->row_ptr[i]; k < S->row_ptr[i + 1]; k++)
+			sum += S->values[k] * x[S->col_idx[k]];
+
+		y[i] = sum;
+	}
+}
+
+double SparseMatrix_get(const struct SparseMatrix *S, size_t i, size_t j)
+{
+	size_t k;
+
+	for (k = S->row_ptr[i]; k < S->row_ptr[i + 1]; k++) {
+		if (S->col_idx[k] == j)
+			return S->values[k];
+	}
+
+	return 0.0;
+}
+
+size_t SparseMatrix_half_bandwidth(const struct SparseMatrix *S)
+{
+	size_t i, k;
+	size_t distance, hb;
+
+	hb = 1;
+
+	for (i = 0; i < S->m; i++) {
+		for (k = S->row_ptr[i]; k < S->row_ptr[i + 1]; k++) {
+			if (S->col_idx[k] < i)
+				distance = i - S->col_idx[k];
+			else
+				distance = S->col_idx[k] - i;
+
+			if (distance + 1 > hb)
+				hb = distance + 1;
+		}
+	}
+
+	return hb;
+}
+
+struct Matrix *SparseMatrix_to_dense(const struct SparseMatrix *S)
+{
+	struct Matrix *M;
+	size_t i, k;
+
+	M = Matrix_zero(S->m, S->n);
+
+	for (i = 0; i < S->m; i++) {
+		for (k = S->row_ptr[i]; k < S->row_ptr[i + 1]; k++)
+			M->entries[i][S->col_idx[k]] = S->values[k];
+	}
+
+	return M;
+}
+
+struct BandMatrix *SparseMatrix_to_band(const struct SparseMatrix *S, size_t hb)
+{
+	struct BandMatrix *B;
+	size_t i, k;
+
+	if (S->m != S->n)
+		exit_with_error("Matrix must be square to convert to band format.");
+
+	B = BandMatrix_zero(S->n, hb);
+
+	for (i = 0; i < S->m; i++) {
+		for (k = S->row_ptr[i]; k < S->row_ptr[i + 1] && S->col_idx[k] <= i; k++) {
+			if (i - S->col_idx[k] < hb)
+				BAND_ENTRY(B, i, S->col_idx[k]) = S->values[k];
+		}
+	}
+
+	return B;
+}
+
+struct SparseMatrix *SparseMatrix_transpose(const struct SparseMatrix *S)
+{
+	struct SparseMatrix *T;
+	size_t *fill;
+	size_t i, k;
+
+	T = sparse_alloc(S->n, S->m, S->nnz);
+
+	for (i = 0; i <= T->m; i++)
+		T->row_ptr[i] = 0;
+
+	for (k = 0; k < S->nnz; k++)
+		++T->row_ptr[S->col_idx[k] + 1];
+
+	for (i = 0; i < T->m; i++)
+		T->row_ptr[i + 1] += T->row_ptr[i];
+
+	fill = malloc_or_fail(T->m, sizeof *fill);
+
+	for (i = 0; i < T->m; i++)
+		fill[i] = T->row_ptr[i];
+
+	/* Visiting the rows of S in order keeps the columns of T sorted. */
+	for (i = 0; i < S->m; i++) {
+		for (k = S->row_ptr[i]; k < S->row_ptr[i + 1]; k++) {
+			T->col_idx[fill[S->col_idx[k]]] = i;
+			T->values[fill[S->col_idx[k]]] = S->values[k];
+			++fill[S->col_idx[k]];
+		}
+	}
+
+	free_tracked(fill);
+
+	return T;
+}
+
+/* Galerkin product
+ *
+ * Row a of P^T A P is accumulated from the fine rows i that interpolate
+ * from a (row a of P^T), the neighbours k of i in A, and the coarse
+ * nodes b that k interpolates from. A dense accumulator indexed by the
+ * coarse node plus a marker array keeps each row O(work). The pattern
+ * is counted in a first pass and filled in a second.
+ */
+struct SparseMatrix *SparseMatrix_galerkin(const struct SparseMatrix *A, const struct SparseMatrix *P)
+{
+	struct SparseMatrix *PT, *C;
+	double *accumulator;
+	size_t *marker, *pattern;
+	size_t nc, a, b, i, k, pi, pk, ai;
+	size_t count, nnz, pass;
+
+	if (A->m != A->n || P->m != A->n)
+		exit_with_error("Dimensions of matrices incompatible for Galerkin product.");
+
+	nc = P->n;
+	PT = SparseMatrix_transpose(P);
+	accumulator = malloc_or_fail(nc, sizeof *accumulator);
+	marker = malloc_or_fail(nc, sizeof *marker);
+	pattern = malloc_or_fail(nc, sizeof *pattern);
+	C = NULL;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (b = 0; b < nc; b++)
+			marker[b] = nc;
+
+		nnz = 0;
+
+		for (a = 0; a < nc; a++) {
+			count = 0;
+
+			for (pi = PT->row_ptr[a]; pi < PT->row_ptr[a + 1]; pi++) {
+				i = PT->col_idx[pi];
+
+				for (ai = A->row_ptr[i]; ai < A->row_ptr[i + 1]; ai++) {
+					k = A->col_idx[ai];
+
+					for (pk = P->row_ptr[k]; pk < P->row_ptr[k + 1]; pk++) {
+						b = P->col_idx[pk];
+
+						if (marker[b] != a) {
+							marker[b] = a;
+							pattern[count++] = b;
+							accumulator[b] = 0.0;
+						}
+
+						accumulator[b] += PT->values[pi] * A->values[ai] * P->values[pk];
+					}
+				}
+			}
+
+			if (pass == 1) {
+				C->row_ptr[a] = nnz;
+
+				for (k = 0; k < count; k++)
+					C->col_idx[nnz + k] = pattern[k];
+
+				for (k = 0; k < count; k++)
+					C->values[nnz + k] = accumulator[pattern[k]];
+
+				sort_row(C->col_idx + nnz, C->values + nnz, count);
+			}
+
+			nnz += count;
+		}
+
+		if (pass == 0)
+			C = sparse_alloc(nc, nc, nnz);
+	}
+
+	C->row_ptr[nc] = nnz;
+
+	free_tracked(pattern);
+	free_tracked(marker);
+	free_tracked(accumulator);
+	SparseMatrix_delete(PT);
+
+	return C;
+}
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lattice.h"
+#include "operator.h"
+#include "stencil.h"
+#include "utils.h"
+
+#define STENCIL_HORIZONTAL(S, i, j)	((S)->horizontal[(i) * ((S)->cols - 1) + (j)])
+#define STENCIL_VERTICAL(S, i, j)	((S)->vertical[(i) * (S)->cols + (j)])
+
+/* Unknown of a lattice node other than ground */
+static size_t unknown(const struct StencilOperator *S, size_t node)
+{
+	return (node < S->ground) ? node : node - 1;
+}
+
+/* Voltage of a lattice node, 0 at ground */
+static double node_value(const struct StencilOperator *S, const double *x, size_t node)
+{
+	if (node == S->ground)
+		return 0.0;
+
+	return x[unknown(S, node)];
+}
+
+/* Row of Ax for node (i, j), with every neighbour checked. */
+static double stencil_node(const struct StencilOperator *S, const double *x, size_t i, size_t j)
+{
+	size_t node = i * S->cols + j;
+	double sum;
+
+	sum = S->diag[node] * node_value(S, x, node);
+
+	if (j > 0)
+		sum -= STENCIL_HORIZONTAL(S, i, j - 1) * node_value(S, x, node - 1);
+
+	if (j + 1 < S->cols)
+		sum -= STENCIL_HORIZONTAL(S, i, j) * node_value(S, x, node + 1);
+
+	if (i > 0)
+		sum -= STENCIL_VERTICAL(S, i - 1, j) * node_value(S, x, node - S->cols);
+
+	if (i + 1 < S->rows)
+		sum -= STENCIL_VERTICAL(S, i, j) * node_value(S, x, node + S->cols);
+
+	return sum;
+}
+
+/* Row kernel
+ *
+ * Computes y[j] for the interior nodes 1 <= j < n - 1 of a lattice row, where
+ * xc, xu and xd are the voltages of the row and the rows above and below it,
+ * d the diagonal of the row, gh its horizontal conductances (gh[j] joins j
+ * and j + 1) and gu, gd the vertical conductances to the rows above and below.
+ */
+static void stencil_row(double *y, const double *xc, const double *xu, const double *xd,
+		const double *d, const double *gh, const double *gu, const double *gd, size_t n)
+{
+	size_t j = 1;
+
+#ifdef __SSE2__
+	__m128d acc;
+
+	for (; j + 2 < n; j += 2) {
+		acc = _mm_mul_pd(_mm_loadu_pd(d + j), _mm_loadu_pd(xc + j));
+		acc = _mm_sub_pd(acc, _mm_mul_pd(_mm_loadu_pd(gh + j - 1), _mm_loadu_pd(xc + j - 1)));
+		acc = _mm_sub_pd(acc, _mm_mul_pd(_mm_loadu_pd(gh + j), _mm_loadu_pd(xc + j + 1)));
+		acc = _mm_sub_pd(acc, _mm_mul_pd(_mm_loadu_pd(gu + j), _mm_loadu_pd(xu + j)));
+		acc = _mm_sub_pd(acc, _mm_mul_pd(_mm_loadu_pd(gd + j), _mm_loadu_pd(xd + j)));
+		_mm_storeu_pd(y + j, acc);
+	}
+#endif
+
+	/* Same operations in the same order as the vector loop */
+	for (; j + 1 < n; j++)
+		y[j] = d[j] * xc[j] - gh[j - 1] * xc[j - 1] - gh[j] * xc[j + 1] - gu[j] * xu[j] - gd[j] * xd[j];
+}
+
+/* Add conductance g between lattice nodes a and b, if they are neighbours. */
+static int add_branch(struct StencilOperator *S, size_t a, size_t b, double g)
+{
+	size_t lo = (a < b) ? a : b;
+	size_t hi = (a < b) ? b : a;
+
+	if (hi == lo + 1 && lo / S->cols == hi / S->cols)
+		STENCIL_HORIZONTAL(S, lo / S->cols, lo % S->cols) += g;
+	else if (hi == lo + S->cols)
+		STENCIL_VERTICAL(S, lo / S->cols, lo % S->cols) += g;
+	else
+		return -1;
+
+	S->diag[lo] += g;
+	S->diag[hi] += g;
+
+	return 0;
+}
+
+struct StencilOperator *StencilOperator_from_lattice(const struct Lattice *lattice, size_t ground, const struct LatticeBranch *extra, size_t nextra)
+{
+	struct StencilOperator *S;
+	size_t rows, cols, nnodes, i, j, k;
+
+	rows = lattice->rows;
+	cols = lattice->cols;
+	nnodes = rows * cols;
+
+	if (ground >= nnodes)
+		exit_with_error("Ground node outside the lattice.");
+
+	S = malloc_or_fail(1, sizeof *S);
+	S->rows = rows;
+	S->cols = cols;
+	S->ground = ground;
+	S->horizontal = malloc_or_fail(rows * cols, sizeof *(S->horizontal));
+	S->vertical = malloc_or_fail(rows * cols, sizeof *(S->vertical));
+	S->diag = malloc_or_fail(nnodes, sizeof *(S->diag));
+	S->zeros = malloc_or_fail(cols, sizeof *(S->zeros));
+
+	for (k = 0; k < nnodes; k++)
+		S->diag[k] = 0.0;
+
+	for (j = 0; j < cols; j++)
+		S->zeros[j] = 0.0;
+
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j + 1 < cols; j++) {
+			STENCIL_HORIZONTAL(S, i, j) = 0.0;
+			add_branch(S, i * cols + j, i * cols + j + 1, 1.0 / LATTICE_HORIZONTAL(lattice, i, j));
+		}
+	}
+
+	for (i = 0; i + 1 < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			STENCIL_VERTICAL(S, i, j) = 0.0;
+			add_branch(S, i * cols + j, (i + 1) * cols + j, 1.0 / LATTICE_VERTICAL(lattice, i, j));
+		}
+	}
+
+	for (k = 0; k < nextra; k++) {
+		if (extra[k].from >= nnodes || extra[k].to >= nnodes)
+			exit_with_error("Branch node index out of range.");
+
+		if (extra[k].from == extra[k].to)
+			continue;
+
+		/* A branch to ground only adds to the diagonal */
+		if (extra[k].from == ground) {
+			S->diag[extra[k].to] += 1.0 / extra[k].R;
+		} else if (extra[k].to == ground) {
+			S->diag[extra[k].from] += 1.0 / extra[k].R;
+		} else if (add_branch(S, extra[k].from, extra[k].to, 1.0 / extra[k].R) != 0) {
+			StencilOperator_delete(S);
+			return NULL;
+		}
+	}
+
+	return S;
+}
+
+void StencilOperator_delete(struct StencilOperator *S)
+{
+	free_tracked(S->zeros);
+	free_tracked(S->diag);
+	free_tracked(S->vertical);
+	free_tracked(S->horizontal);
+	free_tracked(S);
+}
+
+size_t StencilOperator_size(const struct StencilOperator *S)
+{
+	return S->rows * S->cols - 1;
+}
+
+/* See stencil.h header for documentation */
+void StencilOperator_multiply(const struct StencilOperator *S, const double *x, double *y)
+{
+	size_t rows = S->rows;
+	size_t cols = S->cols;
+	size_t ig = S->ground / cols;
+	size_t i, j, node;
+	const double *xu, *xd, *gu, *gd;
+	size_t shift;
+
+	for (i = 0; i < rows; i++) {
+		/* Rows next to the ground node, and narrow lattices, node by node */
+		if (cols < 3 || (i + 1 >= ig && i <= ig + 1)) {
+			for (j = 0; j < cols; j++) {
+				node = i * cols + j;
+
+				if (node != S->ground)
+					y[unknown(S, node)] = stencil_node(S, x, i, j);
+			}
+
+			continue;
+		}
+
+		/* Every node of rows i - 1, i and i + 1 is on the same side of the
+		 * ground node, so each row is contiguous in x. */
+		shift = (i > ig);
+		xu = (i > 0) ? x + (i - 1) * cols - shift : x;
+		gu = (i > 0) ? &STENCIL_VERTICAL(S, i - 1, 0) : S->zeros;
+		xd = (i + 1 < rows) ? x + (i + 1) * cols - shift : x;
+		gd = (i + 1 < rows) ? &STENCIL_VERTICAL(S, i, 0) : S->zeros;
+
+		stencil_row(y + i * cols - shift, x + i * cols - shift, xu, xd,
+				S->diag + i * cols, &STENCIL_HORIZONTAL(S, i, 0), gu, gd, cols);
+
+		y[i * cols - shift] = stencil_node(S, x, i, 0);
+		y[i * cols + cols - 1 - shift] = stencil_node(S, x, i, cols - 1);
+	}
+}
+
+static void stencil_multiply(const void *data, const double *x, double *y)
+{
+	StencilOperator_multiply(data, x, y);
+}
+
+static void stencil_diagonal(const void *data, double *d)
+{
+	const struct StencilOperator *S = data;
+	size_t node;
+
+	for (node = 0; node < S->rows * S->cols; node++) {
+		if (node != S->ground)
+			d[unknown(S, node)] = S->diag[node];
+	}
+}
+
+void StencilOperator_operator(const struct StencilOperator *S, struct LinearOperator *op)
+{
+	op->n = StencilOperator_size(S);
+	op->multiply = stencil_multiply;
+	op->diagonal = stencil_diagonal;
+	op->data = S;
+	op->matrix = NULL;
+}
+
+/* See stencil.h header for documentation */
+struct Vector *StencilOperator_sources(const struct StencilOperator *S, const struct LatticeBranch *extra, size_t nextra)
+{
+	struct Vector *b;
+	double source;
+	size_t k;
+
+	b = Vector_new(StencilOperator_size(S));
+
+	for (k = 0; k < b->n; k++)
+		b->entries[k] = 0.0;
+
+	/* Same signs as circuits_build_nodal_branches */
+	for (k = 0; k < nextra; k++) {
+		if (extra[k].from == extra[k].to)
+			continue;
+
+		source = extra[k].J - extra[k].E / extra[k].R;
+
+		if (extra[k].from != S->ground)
+			b->entries[unknown(S, extra[k].from)] += source;
+
+		if (extra[k].to != S->ground)
+			b->entries[unknown(S, extra[k].to)] -= source;
+	}
+
+	return b;
+}
@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <math.h>
 #include <time.h>
 
 #include "cholesky.h"
+#include "perf.h"
 #include "utils.h"
 
+/* Largest residual of a solution, relative to max_i sum_j |A_ij x_j| */
 #define PRECISION	0.000000001
 #define RESOLUTION	0.1
 #define RANGE_MAX	100.0
@@ -41,12 +44,31 @@ static struct Matrix *random_nonsingular_lower_triangular(size_t m, size_t n, do
 	return M;
 }
 
+/* Largest sum_j |A_ij x_j|, the scale of the rounding errors in A x */
+static double product_scale(const struct Matrix *A, const struct Vector *x)
+{
+	double scale = 0.0;
+	double row;
+	size_t i, j;
+
+	for (i = 0; i < A->m; i++) {
+		row = 0.0;
+
+		for (j = 0; j < A->n; j++)
+			row += fabs(A->entries[i][j] * x->entries[j]);
+
+		if (row > scale)
+			scale = row;
+	}
+
+	return scale;
+}
 
 static enum TestResult test_solver(void)
 {
 	size_t sizes[] = {2, 3, 4, 5};
 	struct Matrix *L, *Ltranspose, *A;
-	struct Vector *b, *x, *found_x;
+	struct Vector *b, *x, *found_x, *found_b;
 	struct Matrix *found_L;
 	size_t n;
 	enum TestResult result;
@@ -72,7 +94,12 @@ static enum TestResult test_solver(void)
 		goto cleanup_;
 	}
 
-	if (!Vector_equal(found_x, x, PRECISION)) {
+	/* Cholesky is backward stable, but the random L can be so badly
+	 * conditioned that x itself is only good to a few digits, so check
+	 * that found_x solves the system instead */
+	found_b = Vector_matrix_multiply(A, found_x);
+
+	if (!Vector_equal(found_b, b, PRECISION * product_scale(A, found_x))) {
 		/* Debugging information */
 		printf("Wrong solution for system.\n");
 		printf("found_x = \n");
@@ -91,12 +118,13 @@ static enum TestResult test_solver(void)
 		Matrix_print(found_L);
 		printf("\n\n");
 		result = TEST_WRONGSOL;
-		goto cleanup_found_L;
+		goto cleanup_found_b;
 	}
 
 	result = TEST_SUCCESS;
 
-cleanup_found_L:
+cleanup_found_b:
+	Vector_delete(found_b);
 	Matrix_delete(found_L);
 	Vector_delete(found_x);
 cleanup_:
@@ -216,13 +244,14 @@ cleanup:
 	return result;
 }
 
-int main(void)
+int main(int argc, const char *argv[])
 {
 	int success_count = 0;
 	int notspd_count = 0;
 	int wrongsol_count = 0;
 	int i;
 
+	perf_parse_args(&argc, argv);
 	srand(time(NULL));
 
 	if (simple_test() != 0) {
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
+
+#include "fdgrid.h"
+#include "fdmultigrid.h"
+#include "perf.h"
+#include "utils.h"
+
+/* Largest difference of the multigrid and SOR potentials, in volts, once
+ * both are solved down to RESIDUAL */
+#define PRECISION	0.000001
+#define RESIDUAL	1.0e-9
+
+/* Cycles multigrid may take at any spacing, dyadic or not, to reach the
+ * default residual, and then to go on to RESIDUAL */
+#define MAX_CYCLES	5
+#define MAX_MORE_CYCLES	10
+
+/* Spacings are drawn from H_MIN ... H_MAX */
+#define H_MIN		0.0003
+#define H_MAX		0.001
+
+#define NTRIALS		20
+
+/* Solve the coax grid of spacing h with multigrid, check that it takes a
+ * bounded number of cycles and compare against red-black SOR. */
+static int test_multigrid(double h)
+{
+	struct FDGrid *grid, *reference;
+	struct FDMultigridOptions options;
+	struct FDOptions sor_options;
+	unsigned int cycles;
+	size_t i, j;
+	int result = 0;
+
+	grid = FDGrid_coax(h);
+	reference = FDGrid_coax(h);
+
+	fd_multigrid_default_options(&options);
+	cycles = fd_multigrid(grid, &options);
+
+	if (cycles > MAX_CYCLES) {
+		printf("Multigrid took %u cycles at h = %g (N = %lu, inner conductor at %lu, %lu).\n", cycles, h,
+			(unsigned long)grid->N, (unsigned long)grid->inner_x, (unsigned long)grid->inner_y);
+		result = -1;
+	}
+
+	/* Carry on from the solution to the residual of the comparison */
+	options.full = 0;
+	options.r = RESIDUAL;
+	cycles = fd_multigrid(grid, &options);
+
+	if (cycles > MAX_MORE_CYCLES || fd_max_residual(grid) >= RESIDUAL) {
+		printf("Multigrid took %u more cycles to reach %g at h = %g.\n", cycles, RESIDUAL, h);
+		result = -1;
+	}
+
+	fd_default_options(&sor_options);
+	sor_options.w = 0.0;
+	sor_options.r = RESIDUAL;
+	fd_red_black_sor(reference, &sor_options);
+
+	for (i = 1; i < grid->N - 1 && result == 0; i++) {
+		for (j = 1; j < grid->row_end[i]; j++) {
+			if (fabs(FD_NODE(grid, i, j) - FD_NODE(reference, i, j)) > PRECISION) {
+				printf("Multigrid and SOR differ at node (%lu, %lu) at h = %g.\n", (unsigned long)i, (unsigned long)j, h);
+				result = -1;
+				break;
+			}
+		}
+	}
+
+	FDGrid_delete(reference);
+	FDGrid_delete(grid);
+
+	return result;
+}
+
+int main(int argc, const char *argv[])
+{
+	/* Spacings whose grids do not halve evenly, and two that do */
+	static const double spacings[] = {0.000521, 0.000434, 0.000362, 0.000301, 0.000625, 0.0003125};
+	int failures = 0;
+	int i, n;
+
+	perf_parse_args(&argc, argv);
+	srand(time(NULL));
+
+	n = sizeof spacings / sizeof spacings[0];
+
+	for (i = 0; i < n; i++) {
+		if (test_multigrid(spacings[i]) != 0)
+			++failures;
+	}
+
+	for (i = 0; i < NTRIALS; i++) {
+		if (test_multigrid(H_MIN + (H_MAX - H_MIN) * rand() / RAND_MAX) != 0)
+			++failures;
+	}
+
+	printf("Success rate:\t\t\t\t%d/%d\n", n + NTRIALS - failures, n + NTRIALS);
+
+	return (failures == 0) ? 0 : -1;
+}
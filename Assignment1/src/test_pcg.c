@@ -0,0 +1,748 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
+
+#include "circuits.h"
+#include "cholesky.h"
+#include "lattice.h"
+#include "multigrid.h"
+#include "operator.h"
+#include "outofcore.h"
+#include "pcg.h"
+#include "perf.h"
+#include "resistance.h"
+#include "schur.h"
+#include "sparse.h"
+#include "stencil.h"
+#include "utils.h"
+
+#define PRECISION	0.000001
+#define RESOLUTION	0.1
+#define RANGE_MAX	10.0
+
+#define NTRIALS		1000
+
+/* Each out-of-core trial creates a scratch file and an I/O thread */
+#define OUTOFCORE_TRIALS	50
+
+/* Port pairs queried on each factored network */
+#define NPAIRS		20
+
+/* Standalone multigrid on the meshes must not need more cycles as N grows */
+#define MULTIGRID_MESH_MAX_CYCLES	12
+
+static void add_conductance(size_t *rows, size_t *cols, double *values, size_t *nnz, size_t i, size_t j, double g)
+{
+	rows[*nnz] = i;
+	cols[*nnz] = j;
+	values[*nnz] = g;
+	++*nnz;
+}
+
+/* Random conductance network: the nodal matrix of n nodes joined by random
+ * positive conductances, with a few nodes also tied to ground. This is
+ * sparse, symmetric and positive-definite, like the circuits we solve. */
+static struct SparseMatrix *random_nodal_matrix(size_t n)
+{
+	struct SparseMatrix *S;
+	size_t *rows, *cols;
+	double *values;
+	size_t nnz, k, i, j;
+	size_t nbranches;
+	double g;
+
+	nbranches = 3 * n;
+	rows = malloc_or_fail(4 * nbranches + n, sizeof *rows);
+	cols = malloc_or_fail(4 * nbranches + n, sizeof *cols);
+	values = malloc_or_fail(4 * nbranches + n, sizeof *values);
+	nnz = 0;
+
+	/* A chain through every node keeps the network connected */
+	for (k = 0; k < nbranches; k++) {
+		if (k < n - 1) {
+			i = k;
+			j = k + 1;
+		} else {
+			i = rand() % n;
+			j = rand() % n;
+
+			if (i == j)
+				continue;
+		}
+
+		g = RESOLUTION + fabs(random_double_in_range(RANGE_MAX, RESOLUTION));
+		add_conductance(rows, cols, values, &nnz, i, i, g);
+		add_conductance(rows, cols, values, &nnz, j, j, g);
+		add_conductance(rows, cols, values, &nnz, i, j, -g);
+		add_conductance(rows, cols, values, &nnz, j, i, -g);
+	}
+
+	/* Ground node 0 and a few random ones */
+	for (k = 0; k < 1 + n / 4; k++) {
+		i = (k == 0) ? 0 : (size_t)(rand() % n);
+		g = RESOLUTION + fabs(random_double_in_range(RANGE_MAX, RESOLUTION));
+		add_conductance(rows, cols, values, &nnz, i, i, g);
+	}
+
+	S = SparseMatrix_from_triplets(n, n, nnz, rows, cols, values);
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+
+	return S;
+}
+
+/* Solve one random system with every preconditioner and compare against Cholesky. */
+static int test_pcg(void)
+{
+	const enum PCGPreconditioner preconditioners[] = {
+		PCG_PRECONDITIONER_NONE, PCG_PRECONDITIONER_JACOBI, PCG_PRECONDITIONER_SSOR, PCG_PRECONDITIONER_IC0
+	};
+	size_t sizes[] = {2, 5, 10, 50, 100};
+	struct SparseMatrix *S;
+	struct Matrix *A;
+	struct Vector *b, *x, *found_x;
+	struct PCGOptions options;
+	struct PCGStats stats;
+	size_t n, k;
+	int result = 0;
+
+	n = sizes[rand() % (sizeof sizes / sizeof sizes[0])];
+	S = random_nodal_matrix(n);
+	A = SparseMatrix_to_dense(S);
+	b = Vector_random(n, RANGE_MAX, RESOLUTION);
+
+	if (cholesky_solve_system(&x, A, b, NULL) != 0) {
+		printf("Cholesky failed on a random nodal matrix.\n");
+		result = -1;
+		goto cleanup_;
+	}
+
+	for (k = 0; k < sizeof preconditioners / sizeof preconditioners[0]; k++) {
+		pcg_default_options(&options);
+		options.preconditioner = preconditioners[k];
+		options.tolerance = 1.0e-12;
+
+		if (pcg_solve_system(&found_x, S, b, &options, &stats) != 0) {
+			printf("PCG with preconditioner %d did not converge (n = %lu, %u iterations, residual %e).\n",
+					(int)preconditioners[k], (unsigned long)n, stats.iterations, stats.residual_norm);
+			result = -1;
+			continue;
+		}
+
+		if (!Vector_equal(found_x, x, PRECISION)) {
+			printf("Wrong solution with preconditioner %d.\n", (int)preconditioners[k]);
+			printf("found_x = \n");
+			Vector_print(found_x);
+			printf("\n");
+			printf("x = \n");
+			Vector_print(x);
+			printf("\n\n");
+			result = -1;
+		}
+
+		Vector_delete(found_x);
+	}
+
+	Vector_delete(x);
+cleanup_:
+	Vector_delete(b);
+	Matrix_delete(A);
+	SparseMatrix_delete(S);
+
+	return result;
+}
+
+static int test_schur(void)
+{
+	size_t sizes[] = {2, 5, 10, 50, 100};
+	struct SparseMatrix *S;
+	struct Matrix *A;
+	struct Vector *b, *x, *found_x;
+	struct SchurOptions options;
+	size_t n;
+	int result = 0;
+
+	n = sizes[rand() % (sizeof sizes / sizeof sizes[0])];
+	S = random_nodal_matrix(n);
+	A = SparseMatrix_to_dense(S);
+	b = Vector_random(n, RANGE_MAX, RESOLUTION);
+
+	if (cholesky_solve_system(&x, A, b, NULL) != 0) {
+		printf("Cholesky failed on a random nodal matrix.\n");
+		result = -1;
+		goto cleanup_;
+	}
+
+	schur_default_options(&options);
+	options.subdomains = 1 + rand() % 8;
+
+	if (schur_solve_system(&found_x, S, b, &options, NULL) != 0) {
+		printf("Schur solver failed (n = %lu, %lu subdomains).\n", (unsigned long)n, (unsigned long)options.subdomains);
+		result = -1;
+	} else {
+		if (!Vector_equal(found_x, x, PRECISION)) {
+			printf("Wrong solution with %lu subdomains.\n", (unsigned long)options.subdomains);
+			result = -1;
+		}
+
+		Vector_delete(found_x);
+	}
+
+	Vector_delete(x);
+cleanup_:
+	Vector_delete(b);
+	Matrix_delete(A);
+	SparseMatrix_delete(S);
+
+	return result;
+}
+
+/* Random rows x cols lattice grounded at node 0, with random branch
+ * conductances and a shunt on the last node, numbered like meshgen. */
+static struct SparseMatrix *random_lattice_matrix(struct LatticeInfo *lattice)
+{
+	struct SparseMatrix *S;
+	size_t *rows, *cols;
+	double *values;
+	size_t n, nnz, i, j, p, q, d;
+	double g;
+
+	lattice->rows = 2 + rand() % 40;
+	lattice->cols = 2 + rand() % 40;
+	lattice->ground = 0;
+	n = lattice->rows * lattice->cols - 1;
+
+	rows = malloc_or_fail(8 * n + 1, sizeof *rows);
+	cols = malloc_or_fail(8 * n + 1, sizeof *cols);
+	values = malloc_or_fail(8 * n + 1, sizeof *values);
+	nnz = 0;
+
+	for (i = 0; i < lattice->rows; i++) {
+		for (j = 0; j < lattice->cols; j++) {
+			p = i * lattice->cols + j;
+
+			/* East and north neighbours */
+			for (d = 0; d < 2; d++) {
+				if (d == 0 && j + 1 < lattice->cols)
+					q = p + 1;
+				else if (d == 1 && i + 1 < lattice->rows)
+					q = p + lattice->cols;
+				else
+					continue;
+
+				/* Geometric multigrid is meant for smoothly varying branches */
+				g = 1.0 + fabs(random_double_in_range(1.0, RESOLUTION));
+
+				/* Node 0 is ground, so p is unknown p - 1 and q > p is never ground */
+				add_conductance(rows, cols, values, &nnz, q - 1, q - 1, g);
+
+				if (p > 0) {
+					add_conductance(rows, cols, values, &nnz, p - 1, p - 1, g);
+					add_conductance(rows, cols, values, &nnz, p - 1, q - 1, -g);
+					add_conductance(rows, cols, values, &nnz, q - 1, p - 1, -g);
+				}
+			}
+		}
+	}
+
+	add_conductance(rows, cols, values, &nnz, n - 1, n - 1, RESOLUTION);
+	S = SparseMatrix_from_triplets(n, n, nnz, rows, cols, values);
+
+	free_tracked(values);
+	free_tracked(cols);
+	free_tracked(rows);
+
+	return S;
+}
+
+/* Query random port pairs of a random network, each one several times and
+ * in a batch, from a single factorization, and compare every answer against
+ * a fresh dense Cholesky solve of G x = e_a - e_b for that pair. */
+static int test_resistance(void)
+{
+	size_t sizes[] = {2, 5, 10, 50, 100};
+	struct ResistanceSolver rs;
+	struct SparseMatrix *S;
+	struct Matrix *A;
+	struct Vector *e, *x;
+	size_t a[NPAIRS], b[NPAIRS];
+	double batch[NPAIRS];
+	double R, expected;
+	size_t n, k, i;
+	int result = 0;
+
+	n = sizes[rand() % (sizeof sizes / sizeof sizes[0])];
+	S = random_nodal_matrix(n);
+	A = SparseMatrix_to_dense(S);
+
+	if (resistance_solver_create_from_matrix(&rs, S) != 0) {
+		printf("Failed to factor a random network of %lu nodes.\n", (unsigned long)n);
+		result = -1;
+		goto cleanup_;
+	}
+
+	/* Node 0 is ground, node k > 0 is row k - 1 */
+	for (k = 0; k < NPAIRS; k++) {
+		a[k] = rand() % (n + 1);
+		b[k] = rand() % (n + 1);
+	}
+
+	resistance_between_batch(&rs, NPAIRS, a, b, batch);
+
+	for (k = 0; k < NPAIRS && result == 0; k++) {
+		e = Vector_new(n);
+
+		for (i = 0; i < n; i++)
+			e->entries[i] = 0.0;
+
+		if (a[k] > 0)
+			e->entries[a[k] - 1] += 1.0;
+
+		if (b[k] > 0)
+			e->entries[b[k] - 1] -= 1.0;
+
+		if (cholesky_solve_system(&x, A, e, NULL) != 0) {
+			printf("Cholesky failed on a random nodal matrix.\n");
+			Vector_delete(e);
+			result = -1;
+			break;
+		}
+
+		expected = 0.0;
+
+		for (i = 0; i < n; i++)
+			expected += e->entries[i] * x->entries[i];
+
+		/* The same pair again must give the same answer */
+		for (i = 0; i < 3; i++) {
+			R = resistance_between(&rs, a[k], b[k]);
+
+			if (fabs(R - expected) > PRECISION * (1.0 + expected) || fabs(batch[k] - expected) > PRECISION * (1.0 + expected)) {
+				printf("R(%lu, %lu) = %f (batch %f), %f with a fresh solve.\n",
+						(unsigned long)a[k], (unsigned long)b[k], R, batch[k], expected);
+				result = -1;
+				break;
+			}
+		}
+
+		Vector_delete(x);
+		Vector_delete(e);
+	}
+
+	resistance_solver_destroy(&rs);
+cleanup_:
+	Matrix_delete(A);
+	SparseMatrix_delete(S);
+
+	return result;
+}
+
+/* Compare the spectral resistance between nodes a and b of a uniform
+ * rows x cols lattice of branches R with the one from the banded Cholesky
+ * factor of its nodal matrix, grounded at a. */
+static int test_spectral(size_t rows, size_t cols, double R, size_t a, size_t b)
+{
+	struct Lattice *lattice;
+	struct BranchList *branches;
+	struct SparseMatrix *M;
+	struct Vector *sources;
+	struct ResistanceSolver rs;
+	double spectral, banded;
+	int result = 0;
+
+	lattice = Lattice_new(rows, cols, R);
+	branches = lattice_to_branches(lattice, a, NULL, 0);
+	circuits_build_nodal_branches(branches, &M, &sources);
+
+	if (lattice_resistance_spectral(lattice, a, b, &spectral) != 0) {
+		printf("No spectral resistance for a uniform %lu x %lu lattice.\n", (unsigned long)rows, (unsigned long)cols);
+		result = -1;
+		goto cleanup_;
+	}
+
+	if (resistance_solver_create_from_matrix(&rs, M) != 0) {
+		printf("Failed to factor a %lu x %lu lattice.\n", (unsigned long)rows, (unsigned long)cols);
+		result = -1;
+		goto cleanup_;
+	}
+
+	banded = resistance_between(&rs, 0, lattice_circuit_node(b, a));
+	resistance_solver_destroy(&rs);
+
+	if (fabs(spectral - banded) > PRECISION * banded) {
+		printf("R(%lu, %lu) of a %lu x %lu lattice is %f spectral, %f banded.\n", (unsigned long)a, (unsigned long)b,
+				(unsigned long)rows, (unsigned long)cols, spectral, banded);
+		result = -1;
+	}
+
+cleanup_:
+	Vector_delete(sources);
+	SparseMatrix_delete(M);
+	BranchList_delete(branches);
+	Lattice_delete(lattice);
+
+	return result;
+}
+
+/* Solve a random lattice with multigrid and multigrid-preconditioned CG,
+ * and compare against banded Cholesky. */
+static int test_multigrid(void)
+{
+	struct LatticeInfo lattice, detected;
+	struct SparseMatrix *S;
+	struct BandMatrix *L;
+	struct Vector *b, *x, *found_x;
+	struct MultigridOptions mg_options;
+	struct MultigridStats mg_stats;
+	struct PCGOptions options;
+	struct PCGStats stats;
+	size_t i;
+	int result = 0;
+
+	S = random_lattice_matrix(&lattice);
+	b = Vector_random(S->n, RANGE_MAX, RESOLUTION);
+
+	if (multigrid_detect_lattice(S, &detected) != 0 || detected.rows != lattice.rows || detected.cols != lattice.cols) {
+		printf("Failed to detect a %lu x %lu lattice.\n", (unsigned long)lattice.rows, (unsigned long)lattice.cols);
+		result = -1;
+	}
+
+	x = Vector_copy(b);
+	L = SparseMatrix_to_band(S, SparseMatrix_half_bandwidth(S));
+
+	if (cholesky_factor_band(L) != 0) {
+		printf("Banded Cholesky failed on a lattice matrix.\n");
+		result = -1;
+		goto cleanup_;
+	}
+
+	cholesky_solve_band(L, x->entries);
+
+	/* Force several levels even on small lattices */
+	multigrid_default_options(&mg_options);
+	mg_options.lattice = &lattice;
+	mg_options.coarse_max = 4;
+	mg_options.tolerance = 1.0e-12;
+
+	if (multigrid_solve_system(&found_x, S, b, &mg_options, &mg_stats) != 0) {
+		printf("Multigrid did not converge on a %lu x %lu lattice.\n", (unsigned long)lattice.rows, (unsigned long)lattice.cols);
+		result = -1;
+	} else {
+		if (!Vector_equal(found_x, x, PRECISION)) {
+			printf("Wrong solution with multigrid.\n");
+			result = -1;
+		}
+
+		Vector_delete(found_x);
+	}
+
+	pcg_default_options(&options);
+	options.preconditioner = PCG_PRECONDITIONER_MULTIGRID;
+	options.multigrid = &mg_options;
+	options.tolerance = 1.0e-12;
+
+	if (pcg_solve_system(&found_x, S, b, &options, &stats) != 0) {
+		printf("PCG with multigrid did not converge (%u iterations).\n", stats.iterations);
+		result = -1;
+	} else {
+		for (i = 0; i < x->n; i++) {
+			if (fabs(found_x->entries[i] - x->entries[i]) > PRECISION) {
+				printf("Wrong solution with multigrid-preconditioned PCG.\n");
+				result = -1;
+				break;
+			}
+		}
+
+		Vector_delete(found_x);
+	}
+
+cleanup_:
+	BandMatrix_delete(L);
+	Vector_delete(x);
+	Vector_delete(b);
+	SparseMatrix_delete(S);
+
+	return result;
+}
+
+/* Solve the N x 2N meshes of meshgen with standalone multigrid, which must
+ * take a bounded number of cycles and give the resistance of the spectral
+ * solution. */
+static int test_multigrid_mesh(size_t N)
+{
+	struct BranchList *branches;
+	struct SparseMatrix *M;
+	struct Vector *b, *V;
+	struct MultigridStats stats;
+	double v, R, expected;
+	int result = 0;
+
+	branches = lattice_mesh_circuit(N);
+	circuits_build_nodal_branches(branches, &M, &b);
+
+	if (multigrid_solve_system(&V, M, b, NULL, &stats) != 0) {
+		printf("Multigrid did not converge on the mesh of size %lu.\n", (unsigned long)N);
+		result = -1;
+		goto cleanup_;
+	}
+
+	/* The source node is the last one, in series with 1000 ohms */
+	v = V->entries[V->n - 1];
+	R = 1000.0 * v / (1.0 - v);
+	expected = lattice_mesh_resistance(N);
+
+	if (fabs(R - expected) > PRECISION * expected) {
+		printf("Multigrid gives %f ohms for the mesh of size %lu, spectral %f.\n", R, (unsigned long)N, expected);
+		result = -1;
+	}
+
+	if (stats.cycles > MULTIGRID_MESH_MAX_CYCLES) {
+		printf("Multigrid took %u cycles on the mesh of size %lu.\n", stats.cycles, (unsigned long)N);
+		result = -1;
+	}
+
+	Vector_delete(V);
+
+cleanup_:
+	Vector_delete(b);
+	SparseMatrix_delete(M);
+	BranchList_delete(branches);
+
+	return result;
+}
+
+/* Factor a random lattice matrix out of core, with a memory budget of a few
+ * panels that holds only part of the band, and compare the solution with
+ * that of the in-core banded Cholesky. */
+static int test_outofcore(void)
+{
+	struct LatticeInfo lattice;
+	struct SparseMatrix *S;
+	struct BandMatrix *L;
+	struct OutOfCoreBand *B;
+	struct OutOfCoreOptions options;
+	struct Vector *b, *x, *found_x;
+	size_t hb, budget_rows;
+	int result = 0;
+
+	/* The band must not fit in the budget */
+	for (;;) {
+		S = random_lattice_matrix(&lattice);
+		hb = SparseMatrix_half_bandwidth(S);
+		budget_rows = hb + 2 + rand() % hb;
+
+		if (S->n > 2 * budget_rows)
+			break;
+
+		SparseMatrix_delete(S);
+	}
+
+	b = Vector_random(S->n, RANGE_MAX, RESOLUTION);
+	x = Vector_copy(b);
+	found_x = Vector_copy(b);
+
+	L = SparseMatrix_to_band(S, hb);
+
+	if (cholesky_factor_band(L) != 0) {
+		printf("Banded Cholesky failed on a lattice matrix.\n");
+		result = -1;
+		goto cleanup_band;
+	}
+
+	cholesky_solve_band(L, x->entries);
+
+	outofcore_default_options(&options);
+	options.memory_budget = budget_rows * hb * sizeof(double);
+	B = OutOfCoreBand_from_sparse(S, hb, &options);
+
+	if (B == NULL) {
+		printf("Failed to write a %lu x %lu band out of core.\n", (unsigned long)S->n, (unsigned long)hb);
+		result = -1;
+		goto cleanup_band;
+	}
+
+	if (B->npanels <= B->window) {
+		printf("A band of %lu rows fits in a budget of %lu rows.\n", (unsigned long)S->n, (unsigned long)budget_rows);
+		result = -1;
+	} else if (outofcore_cholesky_factor(B) != 0 || outofcore_cholesky_solve(B, found_x->entries) != 0) {
+		printf("Out-of-core Cholesky failed on a %lu x %lu band.\n", (unsigned long)S->n, (unsigned long)hb);
+		result = -1;
+	} else if (!Vector_equal(found_x, x, PRECISION)) {
+		printf("Out-of-core and in-core Cholesky differ on a %lu x %lu band.\n", (unsigned long)S->n, (unsigned long)hb);
+		result = -1;
+	}
+
+	OutOfCoreBand_delete(B);
+cleanup_band:
+	BandMatrix_delete(L);
+	Vector_delete(found_x);
+	Vector_delete(x);
+	Vector_delete(b);
+	SparseMatrix_delete(S);
+
+	return result;
+}
+
+/* Compare the stencil operator of a random lattice, with a random ground
+ * and a source branch, against its assembled nodal matrix. */
+static int test_stencil(void)
+{
+	struct Lattice *lattice;
+	struct LatticeBranch source;
+	struct BranchList *branches;
+	struct StencilOperator *S;
+	struct LinearOperator op;
+	struct SparseMatrix *M;
+	struct Vector *b, *stencil_b, *x;
+	double *y, *stencil_y;
+	size_t rows, cols, ground, k;
+	int result = 0;
+
+	rows = 1 + rand() % 30;
+	cols = 2 + rand() % 30;
+	lattice = Lattice_new(rows, cols, 1.0);
+
+	for (k = 0; k < rows * (cols - 1); k++)
+		lattice->horizontal[k] = 1.0 + fabs(random_double_in_range(RANGE_MAX, RESOLUTION));
+
+	for (k = 0; k + cols < rows * cols; k++)
+		lattice->vertical[k] = 1.0 + fabs(random_double_in_range(RANGE_MAX, RESOLUTION));
+
+	ground = rand() % (rows * cols);
+	source.from = ground;
+	source.to = (ground + 1 + rand() % (rows * cols - 1)) % (rows * cols);
+	source.J = random_double_in_range(RANGE_MAX, RESOLUTION);
+	source.R = 1.0 + fabs(random_double_in_range(RANGE_MAX, RESOLUTION));
+	source.E = random_double_in_range(RANGE_MAX, RESOLUTION);
+
+	branches = lattice_to_branches(lattice, ground, &source, 1);
+	circuits_build_nodal_branches(branches, &M, &b);
+	S = StencilOperator_from_lattice(lattice, ground, &source, 1);
+	StencilOperator_operator(S, &op);
+	stencil_b = StencilOperator_sources(S, &source, 1);
+
+	x = Vector_random(M->n, RANGE_MAX, RESOLUTION);
+	y = malloc_or_fail(M->n, sizeof *y);
+	stencil_y = malloc_or_fail(M->n, sizeof *stencil_y);
+	SparseMatrix_multiply_vector(M, x->entries, y);
+	LinearOperator_multiply(&op, x->entries, stencil_y);
+
+	for (k = 0; k < M->n; k++) {
+		if (fabs(y[k] - stencil_y[k]) > PRECISION || fabs(b->entries[k] - stencil_b->entries[k]) > PRECISION) {
+			printf("Stencil operator differs from the nodal matrix of a %lu x %lu lattice.\n", (unsigned long)rows, (unsigned long)cols);
+			result = -1;
+			break;
+		}
+	}
+
+	free_tracked(stencil_y);
+	free_tracked(y);
+	Vector_delete(x);
+	Vector_delete(stencil_b);
+	StencilOperator_delete(S);
+	Vector_delete(b);
+	SparseMatrix_delete(M);
+	BranchList_delete(branches);
+	Lattice_delete(lattice);
+
+	return result;
+}
+
+int main(int argc, const char *argv[])
+{
+	int pcg_failures = 0;
+	int resistance_failures = 0;
+	int spectral_failures = 0;
+	int spectral_trials = 0;
+	int outofcore_failures = 0;
+	size_t rows, cols, a, b;
+	int multigrid_failures = 0;
+	int mesh_failures = 0;
+	int mesh_trials = 0;
+	size_t N;
+	int stencil_failures = 0;
+	int schur_failures = 0;
+	int i;
+
+	perf_parse_args(&argc, argv);
+	srand(time(NULL));
+
+	for (i = 0; i < NTRIALS; i++) {
+		if (test_pcg() != 0)
+			++pcg_failures;
+	}
+
+	printf("Success rate:\t\t\t\t%d/%d\n", NTRIALS - pcg_failures, NTRIALS);
+
+	for (i = 0; i < NTRIALS; i++) {
+		if (test_resistance() != 0)
+			++resistance_failures;
+	}
+
+	printf("Resistance success rate:\t\t%d/%d\n", NTRIALS - resistance_failures, NTRIALS);
+
+	for (i = 0; i < NTRIALS; i++) {
+		rows = 1 + rand() % 40;
+		cols = 2 + rand() % 40;
+		a = rand() % (rows * cols);
+		b = (a + 1 + rand() % (rows * cols - 1)) % (rows * cols);
+
+		if (test_spectral(rows, cols, RESOLUTION + fabs(random_double_in_range(RANGE_MAX, RESOLUTION)), a, b) != 0)
+			++spectral_failures;
+
+		++spectral_trials;
+	}
+
+	/* The meshes of meshsolve, from ground to the source node */
+	for (N = 10; N <= 40; N += 10) {
+		if (test_spectral(2 * N, N, 1000.0, 0, 2 * N * N - 1) != 0)
+			++spectral_failures;
+
+		++spectral_trials;
+	}
+
+	printf("Spectral success rate:\t\t\t%d/%d\n", spectral_trials - spectral_failures, spectral_trials);
+
+	for (i = 0; i < OUTOFCORE_TRIALS; i++) {
+		if (test_outofcore() != 0)
+			++outofcore_failures;
+	}
+
+	printf("Out-of-core success rate:\t\t%d/%d\n", OUTOFCORE_TRIALS - outofcore_failures, OUTOFCORE_TRIALS);
+
+	for (i = 0; i < NTRIALS; i++) {
+		if (test_multigrid() != 0)
+			++multigrid_failures;
+	}
+
+	printf("Multigrid success rate:\t\t\t%d/%d\n", NTRIALS - multigrid_failures, NTRIALS);
+
+	for (N = 200; N <= 400; N += 100) {
+		if (test_multigrid_mesh(N) != 0)
+			++mesh_failures;
+
+		++mesh_trials;
+	}
+
+	printf("Multigrid mesh success rate:\t\t%d/%d\n", mesh_trials - mesh_failures, mesh_trials);
+
+	for (i = 0; i < NTRIALS; i++) {
+		if (test_stencil() != 0)
+			++stencil_failures;
+	}
+
+	printf("Stencil success rate:\t\t\t%d/%d\n", NTRIALS - stencil_failures, NTRIALS);
+
+	for (i = 0; i < NTRIALS; i++) {
+		if (test_schur() != 0)
+			++schur_failures;
+	}
+
+	printf("Schur success rate:\t\t\t%d/%d\n", NTRIALS - schur_failures, NTRIALS);
+
+	return (pcg_failures == 0 && resistance_failures == 0 && spectral_failures == 0 && outofcore_failures == 0 && multigrid_failures == 0 && mesh_failures == 0 && stencil_failures == 0 && schur_failures == 0) ? 0 : -1;
+}
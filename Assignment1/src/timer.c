@@ -0,0 +1,16 @@
+/* clock_gettime is POSIX, not C89 */
+#define _POSIX_C_SOURCE 199309L
+
+#include <time.h>
+
+#include "timer.h"
+
+/* See timer.h header for documentation */
+double timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + 1.0e-9 * (double)ts.tv_nsec;
+}
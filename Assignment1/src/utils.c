@@ -1,14 +1,64 @@
+/* The allocation lock is POSIX, not C89 */
+#define _XOPEN_SOURCE 500
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#include <math.h>
+
+#include <pthread.h>
 
 #define SIZET_MAX	((size_t)(-1))
 
 #include "utils.h"
 
+/* Room for the call sites; sites beyond MALLOC_MAX_SITES are merged into one. */
+#define MALLOC_SITE_SLOTS	512
+#define MALLOC_MAX_SITES	256
+
+struct MallocSite {
+	const char *file;	/* NULL for an empty slot */
+	int line;
+	unsigned long allocations;
+	size_t bytes;
+	size_t live_bytes;
+	size_t largest;
+	unsigned long classes[MALLOC_SIZE_CLASSES];
+};
+
+/* A live block, in an open addressing table keyed by its address */
+struct MallocBlock {
+	void *ptr;		/* NULL for an empty slot */
+	size_t size;
+	size_t site;		/* Slot in sites[] */
+};
+
+/* Set before any thread starts and only read afterwards, so they need no
+ * lock; the counts and the tables they enable are updated under it. */
+static int counting = 0;
+static int accounting = 0;
+static pthread_mutex_t malloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t allocated_bytes = 0;
+static pthread_key_t thread_bytes_key;	/* size_t of the bytes of each thread, once counting */
+static struct MallocStats totals;
+static unsigned long size_classes[MALLOC_SIZE_CLASSES];
+static struct MallocSite sites[MALLOC_SITE_SLOTS];
+static size_t nsites = 0;
+static struct MallocBlock *blocks = NULL;
+static size_t block_slots = 0;		/* Power of two */
+static size_t nblocks = 0;
+
 /* PROTOTYPES */
 static void print_row(const double *row, size_t n);
+static size_t *thread_bytes(void);
+static size_t block_hash(const void *ptr);
+static void blocks_grow(void);
+static size_t find_site(const char *file, int line);
+static size_t size_class(size_t size);
+static void record_allocation(void *ptr, size_t size, const char *file, int line);
+static int compare_sites(const void *a, const void *b);
 /* END PROTOTYPES */
 
 static void print_row(const double *row, size_t n)
@@ -43,7 +93,7 @@ void exit_with_error(const char *errmsg)
 	exit(EXIT_FAILURE);
 }
 
-void *malloc_or_fail(size_t count, size_t size)
+void *malloc_or_fail_at(size_t count, size_t size, const char *file, int line)
 {
 	void *ptr;
 
@@ -59,9 +109,315 @@ void *malloc_or_fail(size_t count, size_t size)
 		exit(EXIT_FAILURE);
 	}
 
+	if (counting || accounting) {
+		pthread_mutex_lock(&malloc_lock);
+		allocated_bytes += count * size;
+
+		if (accounting)
+			record_allocation(ptr, count * size, file, line);
+
+		pthread_mutex_unlock(&malloc_lock);
+	}
+
+	if (counting)
+		*thread_bytes() += count * size;
+
 	return ptr;
 }
 
+/* Bytes counted for the calling thread, set up on its first allocation.
+ * The count is the thread's own, so it needs no lock. */
+static size_t *thread_bytes(void)
+{
+	size_t *bytes;
+
+	bytes = pthread_getspecific(thread_bytes_key);
+
+	if (bytes == NULL) {
+		bytes = calloc(1, sizeof *bytes);
+
+		if (bytes == NULL || pthread_setspecific(thread_bytes_key, bytes) != 0)
+			exit_with_error("Cannot count the allocations of a thread.");
+	}
+
+	return bytes;
+}
+
+void malloc_counting_enable(void)
+{
+	if (counting)
+		return;
+
+	if (pthread_key_create(&thread_bytes_key, free) != 0)
+		exit_with_error("Cannot count the allocations of each thread.");
+
+	counting = 1;
+}
+
+size_t malloc_allocated_bytes(void)
+{
+	size_t bytes;
+
+	pthread_mutex_lock(&malloc_lock);
+	bytes = allocated_bytes;
+	pthread_mutex_unlock(&malloc_lock);
+
+	return bytes;
+}
+
+size_t malloc_thread_allocated_bytes(void)
+{
+	return counting ? *thread_bytes() : 0;
+}
+
+static size_t block_hash(const void *ptr)
+{
+	/* Blocks are at least 8 byte aligned, so drop the low bits */
+	return (size_t)(((unsigned long)ptr >> 3) * 2654435761UL);
+}
+
+static void blocks_grow(void)
+{
+	struct MallocBlock *old = blocks;
+	size_t old_slots = block_slots;
+	size_t k, slot;
+
+	block_slots = (old_slots == 0) ? 1024 : 2 * old_slots;
+
+	/* The table itself is not accounted for */
+	blocks = calloc(block_slots, sizeof *blocks);
+
+	if (blocks == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (k = 0; k < old_slots; k++) {
+		if (old[k].ptr == NULL)
+			continue;
+
+		slot = block_hash(old[k].ptr) & (block_slots - 1);
+
+		while (blocks[slot].ptr != NULL)
+			slot = (slot + 1) & (block_slots - 1);
+
+		blocks[slot] = old[k];
+	}
+
+	free(old);
+}
+
+static size_t find_site(const char *file, int line)
+{
+	size_t slot;
+
+	slot = ((size_t)line * 31 + strlen(file)) & (MALLOC_SITE_SLOTS - 1);
+
+	while (sites[slot].file != NULL) {
+		if (sites[slot].line == line && (sites[slot].file == file || strcmp(sites[slot].file, file) == 0))
+			return slot;
+
+		slot = (slot + 1) & (MALLOC_SITE_SLOTS - 1);
+	}
+
+	if (nsites >= MALLOC_MAX_SITES && line != 0)
+		return find_site("(other sites)", 0);
+
+	++nsites;
+	sites[slot].file = file;
+	sites[slot].line = line;
+
+	return slot;
+}
+
+static size_t size_class(size_t size)
+{
+	size_t k = 0;
+
+	while (size > 1 && k + 1 < MALLOC_SIZE_CLASSES) {
+		size >>= 1;
+		++k;
+	}
+
+	return k;
+}
+
+static void record_allocation(void *ptr, size_t size, const char *file, int line)
+{
+	struct MallocSite *site;
+	size_t slot, k;
+
+	if (2 * (nblocks + 1) > block_slots)
+		blocks_grow();
+
+	slot = block_hash(ptr) & (block_slots - 1);
+
+	while (blocks[slot].ptr != NULL)
+		slot = (slot + 1) & (block_slots - 1);
+
+	blocks[slot].ptr = ptr;
+	blocks[slot].size = size;
+	blocks[slot].site = find_site(file, line);
+	++nblocks;
+
+	site = &sites[blocks[slot].site];
+	k = size_class(size);
+	++site->allocations;
+	++site->classes[k];
+	site->bytes += size;
+	site->live_bytes += size;
+
+	if (size > site->largest)
+		site->largest = size;
+
+	++size_classes[k];
+	++totals.allocations;
+	totals.total_bytes += size;
+	totals.live_bytes += size;
+
+	if (totals.live_bytes > totals.peak_bytes)
+		totals.peak_bytes = totals.live_bytes;
+}
+
+void free_tracked(void *ptr)
+{
+	size_t mask, slot, next, home;
+
+	if (ptr != NULL && accounting)
+		pthread_mutex_lock(&malloc_lock);
+
+	if (ptr != NULL && accounting && nblocks > 0) {
+		mask = block_slots - 1;
+		slot = block_hash(ptr) & mask;
+
+		while (blocks[slot].ptr != NULL && blocks[slot].ptr != ptr)
+			slot = (slot + 1) & mask;
+
+		/* Blocks from before accounting was enabled are not in the table */
+		if (blocks[slot].ptr == ptr) {
+			sites[blocks[slot].site].live_bytes -= blocks[slot].size;
+			totals.live_bytes -= blocks[slot].size;
+			++totals.frees;
+			--nblocks;
+
+			/* Backward shift deletion keeps every probe sequence unbroken */
+			blocks[slot].ptr = NULL;
+			next = slot;
+
+			for (;;) {
+				next = (next + 1) & mask;
+
+				if (blocks[next].ptr == NULL)
+					break;
+
+				home = block_hash(blocks[next].ptr) & mask;
+
+				/* Leave it if its home lies cyclically in (slot, next] */
+				if ((slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next))
+					continue;
+
+				blocks[slot] = blocks[next];
+				blocks[next].ptr = NULL;
+				slot = next;
+			}
+		}
+	}
+
+	if (ptr != NULL && accounting)
+		pthread_mutex_unlock(&malloc_lock);
+
+	free(ptr);
+}
+
+void malloc_accounting_enable(void)
+{
+	accounting = 1;
+}
+
+int malloc_accounting_enabled(void)
+{
+	return accounting;
+}
+
+void malloc_accounting_stats(struct MallocStats *stats)
+{
+	pthread_mutex_lock(&malloc_lock);
+	*stats = totals;
+	pthread_mutex_unlock(&malloc_lock);
+}
+
+/* Call sites by decreasing bytes allocated */
+static int compare_sites(const void *a, const void *b)
+{
+	const struct MallocSite *sa = *(const struct MallocSite * const *)a;
+	const struct MallocSite *sb = *(const struct MallocSite * const *)b;
+
+	if (sa->bytes != sb->bytes)
+		return (sa->bytes < sb->bytes) ? 1 : -1;
+
+	return (sa->allocations < sb->allocations) ? 1 : (sa->allocations > sb->allocations) ? -1 : 0;
+}
+
+/* See utils.h header for documentation */
+int malloc_accounting_report(FILE *filePtr)
+{
+	const struct MallocSite **sorted;
+	char where[64];
+	size_t k, l, count;
+
+	fprintf(filePtr, "Allocations:\t%lu\n", totals.allocations);
+	fprintf(filePtr, "Frees:\t\t%lu\n", totals.frees);
+	fprintf(filePtr, "Total bytes:\t%lu\n", (unsigned long)totals.total_bytes);
+	fprintf(filePtr, "Peak bytes:\t%lu\n", (unsigned long)totals.peak_bytes);
+	fprintf(filePtr, "Live bytes:\t%lu\n", (unsigned long)totals.live_bytes);
+
+	fprintf(filePtr, "\n%-12s %12s\n", "Block size", "Allocations");
+
+	for (k = 0; k < MALLOC_SIZE_CLASSES; k++) {
+		if (size_classes[k] > 0)
+			fprintf(filePtr, "%s2^%-8lu %12lu\n", (k + 1 == MALLOC_SIZE_CLASSES) ? ">=" : "  ", (unsigned long)k, size_classes[k]);
+	}
+
+	if (nsites == 0)
+		return ferror(filePtr) ? -1 : 0;
+
+	/* The report runs at exit, so do not go through malloc_or_fail */
+	sorted = malloc(nsites * sizeof *sorted);
+
+	if (sorted == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	count = 0;
+
+	for (k = 0; k < MALLOC_SITE_SLOTS; k++) {
+		if (sites[k].file != NULL)
+			sorted[count++] = &sites[k];
+	}
+
+	qsort(sorted, count, sizeof *sorted, compare_sites);
+
+	fprintf(filePtr, "\n%-32s %12s %14s %14s %14s  %s\n", "Call site", "Allocations", "Bytes", "Largest", "Live bytes", "Size classes");
+
+	for (k = 0; k < count; k++) {
+		sprintf(where, "%.48s:%d", sorted[k]->file, sorted[k]->line);
+		fprintf(filePtr, "%-32s %12lu %14lu %14lu %14lu ", where, sorted[k]->allocations,
+				(unsigned long)sorted[k]->bytes, (unsigned long)sorted[k]->largest, (unsigned long)sorted[k]->live_bytes);
+
+		for (l = 0; l < MALLOC_SIZE_CLASSES; l++) {
+			if (sorted[k]->classes[l] > 0)
+				fprintf(filePtr, " 2^%lu:%lu", (unsigned long)l, sorted[k]->classes[l]);
+		}
+
+		fprintf(filePtr, "\n");
+	}
+
+	free(sorted);
+
+	return ferror(filePtr) ? -1 : 0;
+}
+
 struct Vector *Vector_new(size_t n)
 {
 	struct Vector *v;
@@ -75,8 +431,8 @@ struct Vector *Vector_new(size_t n)
 
 void Vector_delete(struct Vector *v)
 {
-	free(v->entries);
-	free(v);
+	free_tracked(v->entries);
+	free_tracked(v);
 }
 
 struct Matrix *Matrix_new(size_t m, size_t n)
@@ -101,10 +457,10 @@ void Matrix_delete(struct Matrix *M)
 	size_t i;
 
 	for (i = 0; i < M->m; i++)
-		free(M->entries[i]);
+		free_tracked(M->entries[i]);
 
-	free(M->entries);
-	free(M);
+	free_tracked(M->entries);
+	free_tracked(M);
 }
 
 void Vector_print(const struct Vector *v)
@@ -323,9 +679,37 @@ int Vector_equal(const struct Vector *u, const struct Vector *v, double precisio
 		return 0;
 
 	for (i = 0; i < u->n; i++) {
-		if (abs(u->entries[i] - v->entries[i]) > precision)
+		if (fabs(u->entries[i] - v->entries[i]) > precision)
 			return 0;
 	}
 
 	return 1;
 }
+
+struct BandMatrix *BandMatrix_zero(size_t n, size_t hb)
+{
+	struct BandMatrix *B;
+	size_t i;
+
+	if (hb == 0 || hb > n)
+		hb = n;
+
+	if (n > SIZET_MAX / hb)
+		exit_with_error("Band matrix too large.");
+
+	B = malloc_or_fail(1, sizeof *B);
+	B->entries = malloc_or_fail(n * hb, sizeof *(B->entries));
+	B->n = n;
+	B->hb = hb;
+
+	for (i = 0; i < n * hb; i++)
+		B->entries[i] = 0.0;
+
+	return B;
+}
+
+void BandMatrix_delete(struct BandMatrix *B)
+{
+	free_tracked(B->entries);
+	free_tracked(B);
+}